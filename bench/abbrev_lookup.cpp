@@ -0,0 +1,180 @@
+// Abbreviated SHA lookup latency at scale: a scratch repository with N loose
+// objects (empty files under objects/xx, which is all the prefix index looks
+// at) and a pack index holding another N IDs. Each lookup resolves a 7-digit
+// prefix of a known object, through:
+//   readdir     scanning objects/xx for a matching name, no index
+//   rebuild     no saved or in-memory list: scan, sort and save objects/xx
+//   saved       the saved list for objects/xx, read back on every lookup
+//   memo        the in-memory list, as repeated lookups in one process see it
+//   pack        fanout + binary search in the pack idx
+//
+// Usage: bench_abbrev_lookup [objects] [lookups]   (defaults: 1000000, 2000)
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "loose_index.h"
+#include "pack.h"
+
+namespace fs = std::filesystem;
+
+static void put_be32(std::string& out, uint32_t v) {
+    for (int shift = 24; shift >= 0; shift -= 8) out += static_cast<char>(v >> shift);
+}
+
+static void write_file(const fs::path& path, const std::string& data) {
+    FILE* f = std::fopen(path.c_str(), "wb");
+    if (!f || std::fwrite(data.data(), 1, data.size(), f) != data.size()) {
+        std::perror(path.c_str());
+        std::exit(1);
+    }
+    std::fclose(f);
+}
+
+// A version 2 idx over `ids` (sorted) and a pack with a matching header.
+// Offsets and CRCs are zero; only the name lookup is exercised.
+static void write_fake_pack(const fs::path& dir, const std::vector<ObjectId>& ids) {
+    std::string idx("\377tOc", 4);
+    put_be32(idx, 2);
+    uint32_t counts[256] = {};
+    for (const ObjectId& id : ids) ++counts[id.bytes[0]];
+    uint32_t total = 0;
+    for (uint32_t c : counts) put_be32(idx, total += c);
+    for (const ObjectId& id : ids) idx.append(reinterpret_cast<const char*>(id.data()), 20);
+    idx.append(8 * ids.size() + 40, '\0');
+    write_file(dir / "pack-bench.idx", idx);
+
+    std::string pack("PACK", 4);
+    put_be32(pack, 2);
+    put_be32(pack, static_cast<uint32_t>(ids.size()));
+    pack.append(20, '\0');
+    write_file(dir / "pack-bench.pack", pack);
+}
+
+static std::string prefix_of(const ObjectId& id) { return id.hex().substr(0, 7); }
+
+static double time_lookups(const char* label, const std::vector<ObjectId>& targets,
+                           const std::function<size_t(const std::string&)>& lookup) {
+    size_t matched = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const ObjectId& id : targets) matched += lookup(prefix_of(id)) > 0;
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double us = secs * 1e6 / targets.size();
+    std::printf("%-10s %12.2f %12.0f   (%zu/%zu found)\n", label, us, targets.size() / secs, matched, targets.size());
+    return us;
+}
+
+int main(int argc, char* argv[]) {
+    size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+    size_t lookups = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 2000;
+
+    char tmpl[] = "/tmp/gitlite-abbrev-XXXXXX";
+    if (!mkdtemp(tmpl)) {
+        std::perror("mkdtemp");
+        return 1;
+    }
+    fs::path root = tmpl;
+    GitRepository repo = GitRepository::create(root);
+    fs::path objects = repo.gitdir / "objects";
+
+    std::mt19937_64 rng(1);
+    auto random_id = [&rng] {
+        ObjectId id;
+        for (auto& b : id.bytes) b = static_cast<unsigned char>(rng());
+        return id;
+    };
+
+    std::printf("creating %zu loose objects and a %zu-entry pack in %s\n", count, count, tmpl);
+    std::vector<ObjectId> loose(count);
+    for (ObjectId& id : loose) id = random_id();
+    for (int i = 0; i < 256; ++i) {
+        char name[3];
+        std::snprintf(name, sizeof(name), "%02x", i);
+        fs::create_directories(objects / name);
+    }
+    for (const ObjectId& id : loose) {
+        std::string hex = id.hex();
+        std::string path = (objects / hex.substr(0, 2) / hex.substr(2)).string();
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0444);
+        if (fd < 0) {
+            std::perror(path.c_str());
+            return 1;
+        }
+        ::close(fd);
+    }
+    // Back-date the fanout directories so their lists count as settled and
+    // get saved, as they would in any repository not being written to
+    struct timespec times[2];
+    clock_gettime(CLOCK_REALTIME, &times[0]);
+    times[0].tv_sec -= 60;
+    times[1] = times[0];
+    for (int i = 0; i < 256; ++i) {
+        char name[3];
+        std::snprintf(name, sizeof(name), "%02x", i);
+        utimensat(AT_FDCWD, (objects / name).c_str(), times, 0);
+    }
+
+    std::vector<ObjectId> packed(count);
+    for (ObjectId& id : packed) id = random_id();
+    std::sort(packed.begin(), packed.end());
+    fs::create_directories(objects / "pack");
+    write_fake_pack(objects / "pack", packed);
+    PackFile pack(objects / "pack" / "pack-bench.idx");
+
+    std::vector<ObjectId> loose_targets, pack_targets;
+    for (size_t i = 0; i < lookups; ++i) {
+        loose_targets.push_back(loose[rng() % count]);
+        pack_targets.push_back(packed[rng() % count]);
+    }
+
+    std::printf("\n%-10s %12s %12s\n", "method", "us/lookup", "lookups/s");
+    time_lookups("readdir", loose_targets, [&](const std::string& prefix) {
+        size_t n = 0;
+        DIR* d = opendir((objects / prefix.substr(0, 2)).c_str());
+        while (struct dirent* e = readdir(d)) n += std::strncmp(e->d_name, prefix.c_str() + 2, prefix.size() - 2) == 0;
+        closedir(d);
+        return n;
+    });
+    std::vector<ObjectId> out;
+    time_lookups("rebuild", loose_targets, [&](const std::string& prefix) {
+        loose_index_forget();
+        char name[3] = {prefix[0], prefix[1], '\0'};
+        ::unlink((objects / "info" / "loose-index" / name).c_str());
+        out.clear();
+        loose_find_prefix(repo, prefix, out, 16);
+        return out.size();
+    });
+    time_lookups("saved", loose_targets, [&](const std::string& prefix) {
+        loose_index_forget();
+        out.clear();
+        loose_find_prefix(repo, prefix, out, 16);
+        return out.size();
+    });
+    auto memo = [&](const std::string& prefix) {
+        out.clear();
+        loose_find_prefix(repo, prefix, out, 16);
+        return out.size();
+    };
+    for (const ObjectId& id : loose_targets) memo(prefix_of(id));  // Warm every fanout list
+    time_lookups("memo", loose_targets, memo);
+    time_lookups("pack", pack_targets, [&](const std::string& prefix) {
+        std::string padded = prefix + std::string(40 - prefix.size(), '0');
+        out.clear();
+        pack.find_prefix(ObjectId::from_hex(padded), prefix, out, 16);
+        return out.size();
+    });
+
+    fs::remove_all(root);
+    return 0;
+}
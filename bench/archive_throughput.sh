@@ -0,0 +1,61 @@
+#!/bin/bash
+# Snapshot export: `archive` as a plain tar and as a tar.gz on one thread and
+# on every core, next to inflating every blob once with `cat-file --batch`
+# (the floor archive should come close to) and the old way of checking out
+# into a scratch folder and running tar over it.
+#
+# Usage: bench/archive_throughput.sh [files] [file_kb]
+#   files    files in the tree, 1000 per directory (default 20000)
+#   file_kb  size of each file in KiB (default 16)
+
+GITLITE="$(pwd)/build/gitlite"
+FILES=${1:-20000}
+FILE_KB=${2:-16}
+
+if [ ! -f "$GITLITE" ]; then
+    echo "Error: gitlite not found in build/. Please build the project first."
+    exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'cd /; rm -rf "$WORK"' EXIT
+cd "$WORK"
+"$GITLITE" init > /dev/null
+
+echo "Generating $FILES files of ${FILE_KB}KiB..."
+for ((i = 0; i < FILES; i++)); do
+    d="d$((i / 1000))"
+    [ -d "$d" ] || mkdir "$d"
+    { echo "file $i"; seq $((i * 7)) $((i * 7 + FILE_KB * 180)); } | head -c $((FILE_KB * 1024)) > "$d/f$i.txt"
+done
+tree=$("$GITLITE" write-tree)
+commit=$("$GITLITE" commit-tree $tree -m "bench")
+"$GITLITE" rev-list --objects $commit | cut -c1-40 > names
+rm -rf d* .git/index
+MB=$(awk "BEGIN { print $FILES * $FILE_KB / 1024 }")
+
+now() { date +%s.%N; }
+time_it() {
+    local start end
+    start=$(now)
+    "$@" > /dev/null 2>&1
+    end=$(now)
+    awk "BEGIN { print $end - $start }"
+}
+report() {
+    printf "%-32s %8.3fs %9.1f MB/s\n" "$1" "$2" "$(awk "BEGIN { print $MB * 1.048576 / $2 }")"
+}
+checkout_and_tar() {
+    mkdir scratch && cd scratch && "$GITLITE" init > /dev/null
+    cp -r ../.git/objects .git/
+    "$GITLITE" checkout $commit > /dev/null 2>&1
+    tar cf - --exclude=.git .
+    cd .. && rm -rf scratch
+}
+
+echo "Exporting $MB MiB in $FILES files"
+report "cat-file --batch (inflate only)" "$(time_it "$GITLITE" cat-file --batch < names)"
+report "archive (tar)" "$(time_it "$GITLITE" archive $commit)"
+report "archive --format=tar.gz -j1" "$(time_it "$GITLITE" archive --format=tar.gz -j1 $commit)"
+report "archive --format=tar.gz" "$(time_it "$GITLITE" archive --format=tar.gz $commit)"
+report "checkout + tar" "$(time_it checkout_and_tar)"
@@ -0,0 +1,158 @@
+// Reachable-object enumeration on a synthetic history: N commits over a
+// 16x16x16 tree of 4096 files, each commit changing one file (a new blob
+// and three new trees), packed and bitmapped, then T more commits in a
+// second pack that has no bitmap, as if they came in after the last repack.
+// Each query counts everything reachable from one commit, through:
+//   walk      every commit and every tree read, as rev-list --objects does
+//   bitmap    bitmaps ORed in, only the commits they don't cover walked
+// Queries are run from the newest commit (T commits past the bitmaps) and
+// from one in the middle of the packed history. Both methods must agree.
+//
+// Usage: bench_bitmap_reach [commits] [tail]   (defaults: 100000, 1000)
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "bitmap.h"
+#include "commit_graph.h"
+#include "pack.h"
+#include "sha1.h"
+
+namespace fs = std::filesystem;
+
+// The files as a three-level tree, rebuilt along one path per commit
+class History {
+public:
+    explicit History(PackWriter& writer) : writer_(writer) {
+        for (int f = 0; f < 4096; ++f) blobs_[f] = add("blob", "initial " + std::to_string(f) + "\n");
+        for (int t = 0; t < 256; ++t) rebuild_leaf(t);
+        for (int t = 0; t < 16; ++t) rebuild_mid(t);
+        rebuild_root();
+    }
+
+    // Changes file f and commits; returns the commit
+    std::string commit(uint64_t n, int f) {
+        blobs_[f] = add("blob", "change " + std::to_string(n) + "\n");
+        rebuild_leaf(f / 16);
+        rebuild_mid(f / 256);
+        rebuild_root();
+        std::string body = "tree " + root_ + "\n";
+        if (!head_.empty()) body += "parent " + head_ + "\n";
+        std::string stamp = std::to_string(1000000000 + n) + " +0000\n";
+        body += "author Bench <bench@example.com> " + stamp + "committer Bench <bench@example.com> " + stamp;
+        body += "\ncommit " + std::to_string(n) + "\n";
+        head_ = add("commit", body);
+        return head_;
+    }
+
+    void set_writer(PackWriter& writer) { writer_ = std::ref(writer); }
+
+private:
+    std::string add(const std::string& fmt, const std::string& data) {
+        std::string object = fmt + " " + std::to_string(data.size()) + '\0' + data;
+        std::string sha = sha1(object.data(), object.size()).hex();
+        writer_.get().add(sha, fmt, data);
+        return sha;
+    }
+
+    static std::string tree(const std::string* shas, const char* prefix, const char* mode) {
+        std::string data;
+        for (int i = 0; i < 16; ++i) {
+            char name[8];
+            std::snprintf(name, sizeof(name), "%s%02d", prefix, i);
+            data += std::string(mode) + " " + name + '\0';
+            unsigned char raw[20];
+            hex_to_sha(shas[i], raw);
+            data.append(reinterpret_cast<const char*>(raw), 20);
+        }
+        return data;
+    }
+
+    void rebuild_leaf(int t) { leaves_[t] = add("tree", tree(&blobs_[t * 16], "f", "100644")); }
+    void rebuild_mid(int t) { mids_[t] = add("tree", tree(&leaves_[t * 16], "d", "40000")); }
+    void rebuild_root() { root_ = add("tree", tree(mids_, "d", "40000")); }
+
+    std::reference_wrapper<PackWriter> writer_;
+    std::string blobs_[4096], leaves_[256], mids_[16], root_, head_;
+};
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    uint64_t commits = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100000;
+    uint64_t tail = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1000;
+    fs::path dir = fs::temp_directory_path() / ("gitlite_bench_bitmap_" + std::to_string(getpid()));
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    GitRepository repo = GitRepository::create(dir);
+
+    auto start = std::chrono::steady_clock::now();
+    std::string middle, packed_head, head;
+    std::shared_ptr<PackFile> base;
+    {
+        PackWriter writer(repo);
+        History history(writer);
+        for (uint64_t n = 0; n < commits; ++n) {
+            packed_head = history.commit(n, static_cast<int>((n * 2654435761u) % 4096));
+            if (n == commits / 2 + 37) middle = packed_head;  // Not on the bitmap interval
+        }
+        fs::path pack_path = writer.finish();
+        base = std::make_shared<PackFile>(pack_path.replace_extension(".idx"));
+
+        PackWriter tail_writer(repo);
+        history.set_writer(tail_writer);
+        head = packed_head;
+        for (uint64_t n = commits; n < commits + tail; ++n) {
+            head = history.commit(n, static_cast<int>((n * 2654435761u) % 4096));
+        }
+        if (tail > 0) tail_writer.finish();
+    }
+    std::ofstream(repo.gitdir / "refs" / "heads" / "master") << head << "\n";
+    pack_list(repo, true);
+    commit_graph_write(repo, {head});
+    std::printf("%llu + %llu commits, %u objects packed: %.1fs\n", static_cast<unsigned long long>(commits),
+                static_cast<unsigned long long>(tail), base->count(), seconds_since(start));
+
+    start = std::chrono::steady_clock::now();
+    uint32_t selected = bitmap_write(repo, base, {packed_head});
+    std::printf("bitmaps for %u commits written: %.1fs, %ju bytes\n\n", selected, seconds_since(start),
+                static_cast<uintmax_t>(fs::file_size(fs::path(base->pack_path()).replace_extension(".bitmap"))));
+
+    std::printf("%-8s %-8s %12s %12s\n", "from", "method", "seconds", "objects");
+    int status = 0;
+    for (const auto& [label, tip] : {std::make_pair("head", head), std::make_pair("middle", middle)}) {
+        start = std::chrono::steady_clock::now();
+        Reachable reachable;
+        if (!bitmap_reachable(repo, {tip}, reachable)) {
+            std::fprintf(stderr, "no bitmap found\n");
+            return 1;
+        }
+        ObjectCounts fast = reachable.counts();
+        double fast_secs = seconds_since(start);
+        std::printf("%-8s %-8s %12.4f %12llu\n", label, "bitmap", fast_secs,
+                    static_cast<unsigned long long>(fast.total()));
+
+        start = std::chrono::steady_clock::now();
+        ObjectCounts slow = walk_objects(repo, {tip}, [](const std::string&, int, const std::string&) {});
+        double slow_secs = seconds_since(start);
+        std::printf("%-8s %-8s %12.4f %12llu   (%.0fx)\n", label, "walk", slow_secs,
+                    static_cast<unsigned long long>(slow.total()), slow_secs / fast_secs);
+        if (slow.commits != fast.commits || slow.trees != fast.trees || slow.blobs != fast.blobs) {
+            std::printf("mismatch from %s\n", label);
+            status = 1;
+        }
+    }
+    std::printf("\n");
+    bitmap_print_stats(std::cout);
+    fs::remove_all(dir);
+    return status;
+}
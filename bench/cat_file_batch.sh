@@ -0,0 +1,50 @@
+#!/bin/bash
+# Bulk object reads: one `cat-file <type> <sha>` process per object against a
+# single `cat-file --batch` / `--batch-check` process fed every name on stdin,
+# with the objects loose and then packed.
+#
+# Usage: bench/cat_file_batch.sh [files] [file_kb]
+#   files    number of blobs (default 2000)
+#   file_kb  size of each blob in KiB (default 16)
+
+GITLITE="$(pwd)/build/gitlite"
+FILES=${1:-2000}
+FILE_KB=${2:-16}
+
+if [ ! -f "$GITLITE" ]; then
+    echo "Error: gitlite not found in build/. Please build the project first."
+    exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK"
+"$GITLITE" init > /dev/null
+
+echo "Generating $FILES files of ${FILE_KB}KiB..."
+for ((i = 0; i < FILES; i++)); do
+    { echo "file $i"; seq $((i * 7)) $((i * 7 + FILE_KB * 180)); } | head -c $((FILE_KB * 1024)) > "f$i.txt"
+done
+"$GITLITE" write-tree > /dev/null
+"$GITLITE" ls-tree "$("$GITLITE" write-tree)" | awk '{ print $3 }' > names
+rm -f f*.txt .git/index
+
+now() { date +%s.%N; }
+time_it() {
+    local start end
+    start=$(now)
+    "$@" > /dev/null
+    end=$(now)
+    awk "BEGIN { print $end - $start }"
+}
+per_object() {
+    while read -r sha; do "$GITLITE" cat-file blob "$sha"; done < names
+}
+
+printf "%-28s %10s\n" "reads ($FILES objects)" "seconds"
+for storage in loose packed; do
+    if [ "$storage" = packed ]; then "$GITLITE" repack -d > /dev/null; fi
+    printf "%-28s %10.3f\n" "one process each ($storage)" "$(time_it per_object)"
+    printf "%-28s %10.3f\n" "--batch ($storage)" "$(time_it "$GITLITE" cat-file --batch < names)"
+    printf "%-28s %10.3f\n" "--batch-check ($storage)" "$(time_it "$GITLITE" cat-file --batch-check < names)"
+done
@@ -0,0 +1,60 @@
+#!/bin/bash
+# Ingest throughput and on-disk size of write-tree under different
+# compression policies, on a mixed corpus: text that compresses well, and
+# random and gzipped files standing in for JPEGs and tarballs.
+#
+# Usage: bench/compression_policy.sh [text_files] [asset_files]
+#   text_files   number of ~32 KiB text files (default 2000)
+#   asset_files  number of ~256 KiB incompressible files (default 200)
+
+GITLITE="$(pwd)/build/gitlite"
+TEXT_FILES=${1:-2000}
+ASSET_FILES=${2:-200}
+
+if [ ! -f "$GITLITE" ]; then
+    echo "Error: gitlite not found in build/. Please build the project first."
+    exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK"
+"$GITLITE" init > /dev/null
+
+echo "Generating $TEXT_FILES text files and $ASSET_FILES assets..."
+mkdir -p text assets
+for ((i = 0; i < TEXT_FILES; i++)); do
+    seq $((i * 1000)) $((i * 1000 + 4000)) | sed 's/^/value = /' > "text/f$i.txt"
+done
+for ((i = 0; i < ASSET_FILES; i++)); do
+    if [ $((i % 2)) -eq 0 ]; then
+        head -c 262144 /dev/urandom > "assets/a$i.jpg"
+    else
+        head -c 196608 /dev/urandom | base64 | gzip -c > "assets/a$i.tar.gz"
+    fi
+done
+corpus_kb=$(du -sk --apparent-size text assets | awk '{ s += $1 } END { print s }')
+
+now() { date +%s.%N; }
+
+printf "%-34s %10s %10s %12s\n" "policy" "seconds" "MB/s" "objects KiB"
+run() {
+    local name="$1"
+    shift
+    rm -rf .git/objects .git/index && mkdir .git/objects
+    sync
+    local start end secs kb
+    start=$(now)
+    "$GITLITE" "$@" write-tree -j 1 > /dev/null
+    end=$(now)
+    secs=$(awk "BEGIN { print $end - $start }")
+    kb=$(du -sk --apparent-size .git/objects | cut -f1)
+    printf "%-34s %10.3f %10.1f %12s\n" "$name" "$secs" "$(awk "BEGIN { print $corpus_kb / 1024 / $secs }")" "$kb"
+}
+echo "corpus: $corpus_kb KiB"
+run "best (default)"
+run "best, no sampling" -c compression.sample=0
+run "default" -c compression.level=default
+run "fast" -c compression.level=fast
+run "none" -c compression.level=none
+run "fast blobs, best trees/commits" -c compression.blob=fast
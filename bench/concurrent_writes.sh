@@ -0,0 +1,57 @@
+#!/bin/bash
+# Concurrent object writers: N worktrees sharing one objects directory run
+# write-tree at the same time over the same files, under each
+# core.fsyncObjects mode. Every writer must produce the same tree, and every
+# stored object must read back intact with no temp files left over.
+#
+# Usage: bench/concurrent_writes.sh [writers] [files]
+#   writers  parallel write-tree processes (default 8)
+#   files    files in each worktree (default 2000)
+
+GITLITE="$(pwd)/build/gitlite"
+WRITERS=${1:-8}
+FILES=${2:-2000}
+
+if [ ! -f "$GITLITE" ]; then
+    echo "Error: gitlite not found in build/. Please build the project first."
+    exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK"
+mkdir shared
+"$GITLITE" init shared > /dev/null 2>&1 || (cd shared && "$GITLITE" init > /dev/null)
+
+echo "Generating $WRITERS worktrees of $FILES files..."
+for ((w = 0; w < WRITERS; w++)); do
+    mkdir -p "wt$w/.git"
+    cp shared/.git/HEAD "wt$w/.git/"
+    ln -s "$WORK/shared/.git/objects" "wt$w/.git/objects"
+    for ((i = 0; i < FILES; i++)); do
+        echo "file $i" > "wt$w/f$i.txt"
+    done
+done
+
+now() { date +%s.%N; }
+printf "%-8s %10s  %s\n" "mode" "seconds" "result"
+for mode in none object batch; do
+    rm -rf shared/.git/objects/??
+    start=$(now)
+    for ((w = 0; w < WRITERS; w++)); do
+        (cd "wt$w" && rm -f .git/index && "$GITLITE" -c core.fsyncObjects=$mode write-tree > tree) &
+    done
+    wait
+    end=$(now)
+    result=ok
+    for ((w = 1; w < WRITERS; w++)); do
+        cmp -s wt0/tree "wt$w/tree" || result="trees differ"
+    done
+    objects=$(find shared/.git/objects -path '*/??/*' -type f | sed 's|.*/\(..\)/|\1|')
+    if echo "$objects" | (cd wt0 && "$GITLITE" cat-file --batch-check) | grep -q missing; then
+        result="unreadable objects"
+    fi
+    if ls shared/.git/objects | grep -q tmp_obj; then result="temp files left"; fi
+    printf "%-8s %10.3f  %s (%d objects)\n" "$mode" "$(awk "BEGIN { print $end - $start }")" "$result" \
+        "$(echo "$objects" | wc -l)"
+done
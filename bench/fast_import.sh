@@ -0,0 +1,88 @@
+#!/bin/bash
+# Bulk ingestion: a generated history imported by one fast-import process,
+# against the per-process path (hash-object for every file, then write-tree
+# and commit-tree for every commit, each writing loose objects). Each commit
+# changes 8 files of one folder in a 16x16 layout, so it makes 8 blobs,
+# 3 trees and the commit.
+#
+# Usage: bench/fast_import.sh [objects] [blob_bytes] [sample_commits]
+#   objects         objects in the fast-import stream, roughly (default 1000000)
+#   blob_bytes      size of each file (default 1024)
+#   sample_commits  commits made the per-process way (default 200)
+
+GITLITE="$(pwd)/build/gitlite"
+OBJECTS=${1:-1000000}
+BLOB_BYTES=${2:-1024}
+SAMPLE=${3:-200}
+
+if [ ! -f "$GITLITE" ]; then
+    echo "Error: gitlite not found in build/. Please build the project first."
+    exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK"
+
+# Commit c writes files d<c%16>/e<c/16%16>/f<0..7>; the contents are slices
+# of one random block, so they don't compress to nothing
+COMMITS=$((OBJECTS / 12))
+head -c 6144 /dev/urandom | base64 -w0 > pad
+echo "Generating a stream of $COMMITS commits ($((COMMITS * 8)) files of $BLOB_BYTES bytes)..."
+LC_ALL=C awk -v commits=$COMMITS -v bytes=$BLOB_BYTES -v pad="$(cat pad)" 'BEGIN {
+    for (c = 0; c < commits; c++) {
+        for (f = 0; f < 8; f++) {
+            head = "commit " c " file " f "\n"
+            body = head substr(pad, 1 + (c * 8 + f) % 4000, bytes - length(head))
+            printf "blob\nmark :%d\ndata %d\n%s\n", c * 8 + f + 1, length(body), body
+        }
+        msg = "commit " c "\n"
+        printf "commit refs/heads/master\ncommitter Bench <bench@example.com> %d +0000\ndata %d\n%s", 1000000000 + c, length(msg), msg
+        dir = "d" (c % 16) "/e" (int(c / 16) % 16)
+        for (f = 0; f < 8; f++) printf "M 100644 :%d %s/f%d\n", c * 8 + f + 1, dir, f
+        printf "\n"
+    }
+}' > stream
+echo "stream: $(du -m stream | cut -f1) MiB"
+
+now() { date +%s.%N; }
+
+printf "\n%-18s %10s %10s %12s %10s\n" "path" "objects" "seconds" "objects/s" "MB/s"
+
+# The repository's compression settings apply (level 9 with sampling unless
+# configured), then the same stream at level 1 without sampling
+for level in "" fast; do
+    rm -rf import && mkdir import && cd import
+    "$GITLITE" init > /dev/null
+    start=$(now)
+    "$GITLITE" ${level:+-c compression.level=$level -c compression.sample=0} fast-import < ../stream 2> ../import.log > /dev/null
+    end=$(now)
+    secs=$(awk "BEGIN { print $end - $start }")
+    objects=$(grep -o "Imported [0-9]*" ../import.log | cut -d' ' -f2)
+    printf "%-18s %10d %10.2f %12.0f %10.1f\n" "fast-import${level:+ ($level)}" "$objects" "$secs" \
+        "$(awk "BEGIN { print $objects / $secs }")" "$(awk "BEGIN { print $(du -b ../stream | cut -f1) / 1e6 / $secs }")"
+    cd ..
+done
+
+mkdir per_process && cd per_process
+"$GITLITE" init > /dev/null
+sample_bytes=0
+start=$(now)
+parent=""
+for ((c = 0; c < SAMPLE; c++)); do
+    dir="d$((c % 16))/e$(((c / 16) % 16))"
+    mkdir -p "$dir"
+    for ((f = 0; f < 8; f++)); do
+        head="commit $c file $f"
+        { echo "$head"; cut -c$((1 + (c * 8 + f) % 4000))-$(((c * 8 + f) % 4000 + BLOB_BYTES - ${#head} - 1)) ../pad | tr -d '\n'; } > "$dir/f$f"
+        "$GITLITE" hash-object "$dir/f$f" > /dev/null
+    done
+    tree=$("$GITLITE" write-tree -j 1)
+    parent=$("$GITLITE" commit-tree "$tree" ${parent:+-p "$parent"} -m "commit $c")
+done
+end=$(now)
+secs=$(awk "BEGIN { print $end - $start }")
+objects=$(find .git/objects -type f -path '*/objects/??/*' | wc -l)
+sample_bytes=$((SAMPLE * 8 * BLOB_BYTES))
+printf "%-18s %10d %10.2f %12.0f %10.1f\n" "per-process" "$objects" "$secs" \
+    "$(awk "BEGIN { print $objects / $secs }")" "$(awk "BEGIN { print $sample_bytes / 1e6 / $secs }")"
@@ -0,0 +1,55 @@
+#!/bin/bash
+# Scaling report for fsck: a repository with loose objects and a pack,
+# checked with 1/2/4/8/16 threads, with and without --connectivity.
+#
+# Usage: bench/fsck_scaling.sh [files] [file_kb]
+#   files    files in each of the two commits (default 20000)
+#   file_kb  size of each file in KiB (default 4)
+
+GITLITE="$(pwd)/build/gitlite"
+FILES=${1:-20000}
+FILE_KB=${2:-4}
+
+if [ ! -f "$GITLITE" ]; then
+    echo "Error: gitlite not found in build/. Please build the project first."
+    exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK"
+"$GITLITE" init > /dev/null
+
+# The first commit goes into a pack, the second stays loose
+make_files() {
+    for ((i = 0; i < FILES; i++)); do
+        dir="d$((i / 100))"
+        [ $((i % 100)) -eq 0 ] && mkdir -p "$dir"
+        head -c $((FILE_KB * 1024)) /dev/urandom | base64 > "$dir/f$i.txt"
+    done
+}
+echo "Generating 2 x $FILES files of $FILE_KB KiB..."
+make_files
+first=$("$GITLITE" commit-tree "$("$GITLITE" write-tree)" -m first)
+"$GITLITE" repack -d > /dev/null
+make_files
+second=$("$GITLITE" commit-tree "$("$GITLITE" write-tree)" -p "$first" -m second)
+echo "$second" > .git/refs/heads/master
+
+now() { date +%s.%N; }
+
+echo "cores: $(nproc)"
+printf "%-16s %-8s %10s %10s %12s\n" "mode" "threads" "seconds" "speedup" "objects/s"
+for mode in "" "--connectivity"; do
+    base=""
+    for j in 1 2 4 8 16; do
+        start=$(now)
+        summary=$("$GITLITE" fsck -j $j $mode 2>&1 >/dev/null | tail -1)
+        end=$(now)
+        secs=$(awk "BEGIN { print $end - $start }")
+        [ -z "$base" ] && base=$secs
+        rate=$(echo "$summary" | awk '{ print $(NF - 1) }')
+        printf "%-16s %-8s %10.3f %9.2fx %12s\n" "${mode:-objects}" "$j" "$secs" \
+            "$(awk "BEGIN { print $base / $secs }")" "$rate"
+    done
+done
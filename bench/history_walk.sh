@@ -0,0 +1,52 @@
+#!/bin/bash
+# History walk timings: rev-list over a long synthetic history with every
+# commit inflated (no commit-graph) and walked from objects/info/commit-graph.
+#
+# Usage: bench/history_walk.sh [commits]
+#   commits  length of the history; every 10th commit is a merge (default 20000)
+
+GITLITE="$(pwd)/build/gitlite"
+COMMITS=${1:-20000}
+
+if [ ! -f "$GITLITE" ]; then
+    echo "Error: gitlite not found in build/. Please build the project first."
+    exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK"
+"$GITLITE" init > /dev/null
+echo "bench" > file.txt
+tree=$("$GITLITE" write-tree)
+
+echo "Generating $COMMITS commits..."
+head=$("$GITLITE" commit-tree $tree -m "c0")
+side=$head
+for ((i = 1; i < COMMITS; i++)); do
+    if [ $((i % 10)) -eq 0 ]; then
+        head=$("$GITLITE" commit-tree $tree -p $head -p $side -m "merge $i")
+    elif [ $((i % 10)) -eq 5 ]; then
+        side=$("$GITLITE" commit-tree $tree -p $side -m "side $i")
+    else
+        head=$("$GITLITE" commit-tree $tree -p $head -m "c$i")
+    fi
+done
+"$GITLITE" repack -d > /dev/null
+
+now() { date +%s.%N; }
+run() {
+    local start end
+    start=$(now)
+    "$GITLITE" "$@" > /dev/null
+    end=$(now)
+    awk "BEGIN { print $end - $start }"
+}
+
+printf "%-32s %10s\n" "walk" "seconds"
+printf "%-32s %10.3f\n" "rev-list (objects)" "$(run rev-list $head)"
+printf "%-32s %10.3f\n" "rev-list --topo-order (objects)" "$(run rev-list --topo-order $head)"
+printf "%-32s %10.3f\n" "commit-graph write" "$(run commit-graph write $head)"
+printf "%-32s %10.3f\n" "rev-list (graph)" "$(run rev-list $head)"
+printf "%-32s %10.3f\n" "rev-list --topo-order (graph)" "$(run rev-list --topo-order $head)"
+printf "%-32s %10.3f\n" "merge-base (graph)" "$(run merge-base $head $side)"
@@ -0,0 +1,130 @@
+// Ignore-rule matching throughput: N generated worktree paths (a tenth of
+// them directories) against a .gitignore of R generated rules: plain names,
+// "*.ext", "name*", bracket globs, anchored paths and dir-only patterns.
+//   linear      fnmatch() on every rule from the last one up, stopping at
+//               the first match, as a straightforward matcher would
+//   compiled    IgnoreRules: hash lookups for names, suffixes and prefixes,
+//               a component trie for patterns with a '/'
+// Both must agree on every path; the run fails if they don't.
+//
+// Usage: bench_ignore_match [paths] [rules]   (defaults: 1000000, 300)
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+#include <fnmatch.h>
+#include "ignore.h"
+
+struct Entry {
+    std::string path;
+    size_t name_at;  // Offset of the last component
+    bool is_dir;
+};
+
+struct LinearRule {
+    std::string pattern;
+    bool negate, dir_only, anchored;
+};
+
+static std::vector<LinearRule> parse_linear(const std::string& text) {
+    std::vector<LinearRule> rules;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t nl = text.find('\n', pos);
+        std::string line = text.substr(pos, nl - pos);
+        pos = nl + 1;
+        LinearRule rule{line, false, false, false};
+        if (rule.pattern[0] == '!') {
+            rule.negate = true;
+            rule.pattern.erase(0, 1);
+        }
+        if (rule.pattern.back() == '/') {
+            rule.dir_only = true;
+            rule.pattern.pop_back();
+        }
+        rule.anchored = rule.pattern.find('/') != std::string::npos;
+        if (rule.pattern[0] == '/') rule.pattern.erase(0, 1);
+        rules.push_back(rule);
+    }
+    return rules;
+}
+
+static int linear_match(const std::vector<LinearRule>& rules, const Entry& e) {
+    const char* name = e.path.c_str() + e.name_at;
+    for (auto it = rules.rbegin(); it != rules.rend(); ++it) {
+        if (it->dir_only && !e.is_dir) continue;
+        bool hit = it->anchored ? fnmatch(it->pattern.c_str(), e.path.c_str(), FNM_PATHNAME) == 0
+                                : fnmatch(it->pattern.c_str(), name, 0) == 0;
+        if (hit) return it->negate ? IgnoreRules::INCLUDED : IgnoreRules::IGNORED;
+    }
+    return IgnoreRules::NONE;
+}
+
+static double time_matches(const char* label, const std::vector<Entry>& entries, std::vector<int>& results,
+                           const std::function<int(const Entry&)>& match) {
+    results.resize(entries.size());
+    size_t ignored = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < entries.size(); ++i) ignored += (results[i] = match(entries[i])) == IgnoreRules::IGNORED;
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("%-10s %12.1f %14.0f   (%zu ignored)\n", label, secs * 1e9 / entries.size(), entries.size() / secs,
+                ignored);
+    return secs;
+}
+
+int main(int argc, char* argv[]) {
+    size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+    size_t rule_count = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 300;
+
+    std::mt19937_64 rng(1);
+    const char* exts[] = {"c", "h", "cpp", "o", "a", "so", "log", "tmp", "txt", "md", "json", "js", "py", "pyc"};
+    auto word = [&rng](size_t i) { return "w" + std::to_string(i % 997) + (rng() % 4 == 0 ? "_gen" : ""); };
+
+    std::string text;
+    for (size_t i = 0; i < rule_count; ++i) {
+        std::string rule;
+        switch (rng() % 6) {
+            case 0: rule = word(rng()); break;
+            case 1: rule = "*." + std::string(exts[rng() % 14]) + (rng() % 2 ? std::to_string(i) : ""); break;
+            case 2: rule = word(rng()) + "*"; break;
+            case 3: rule = "*" + std::to_string(i % 10) + "[0-9]." + exts[rng() % 14]; break;
+            case 4: rule = "/" + word(rng()) + "/" + word(rng()) + "/*." + exts[rng() % 14]; break;
+            case 5: rule = word(rng()) + "/"; break;
+        }
+        if (rng() % 10 == 0) rule = "!" + rule;
+        text += rule + "\n";
+    }
+    IgnoreRules compiled(text, "");
+    std::vector<LinearRule> linear = parse_linear(text);
+
+    std::vector<Entry> entries(count);
+    for (Entry& e : entries) {
+        size_t depth = 1 + rng() % 5;
+        e.path.clear();
+        for (size_t d = 0; d + 1 < depth; ++d) e.path += word(rng() % 64) + "/";
+        e.name_at = e.path.size();
+        e.is_dir = rng() % 10 == 0;
+        e.path += word(rng());
+        if (!e.is_dir) e.path += std::to_string(rng() % 100) + "." + exts[rng() % 14];
+    }
+
+    std::printf("%zu paths, %zu rules\n\n%-10s %12s %14s\n", count, linear.size(), "method", "ns/path", "paths/s");
+    std::vector<int> expect, got;
+    double slow = time_matches("linear", entries, expect,
+                               [&](const Entry& e) { return linear_match(linear, e); });
+    double fast = time_matches("compiled", entries, got, [&](const Entry& e) {
+        return compiled.match(e.path, std::string_view(e.path).substr(e.name_at), e.is_dir);
+    });
+    std::printf("\nspeedup: %.1fx\n", slow / fast);
+    for (size_t i = 0; i < count; ++i) {
+        if (expect[i] != got[i]) {
+            std::printf("mismatch on %s: linear %d, compiled %d\n", entries[i].path.c_str(), expect[i], got[i]);
+            return 1;
+        }
+    }
+    return 0;
+}
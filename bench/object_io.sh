@@ -0,0 +1,49 @@
+#!/bin/bash
+# Object I/O counters: `log` over a long history and `checkout` of a wide
+# tree, all loose objects, with the GITLITE_STATS io line for each (allocations,
+# read/write syscalls, object file opens/preads/writes) and the wall time.
+#
+# Usage: bench/object_io.sh [files] [commits]
+#   files    files in the checked-out tree (default 100000)
+#   commits  length of the history walked by log (default 20000)
+
+GITLITE="$(pwd)/build/gitlite"
+FILES=${1:-100000}
+COMMITS=${2:-20000}
+
+if [ ! -f "$GITLITE" ]; then
+    echo "Error: gitlite not found in build/. Please build the project first."
+    exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK"
+"$GITLITE" init > /dev/null
+
+echo "Generating $FILES files and $COMMITS commits..."
+for ((d = 0; d * 1000 < FILES; d++)); do
+    mkdir "d$d"
+    for ((i = 0; i < 1000 && d * 1000 + i < FILES; i++)); do
+        echo "file $d/$i" > "d$d/f$i.txt"
+    done
+done
+tree=$("$GITLITE" write-tree)
+head=$("$GITLITE" commit-tree $tree -m "c0")
+for ((i = 1; i < COMMITS; i++)); do
+    head=$("$GITLITE" commit-tree $tree -p $head -m "c$i")
+done
+rm -rf d* .git/index
+
+now() { date +%s.%N; }
+run() {
+    local start end stats
+    start=$(now)
+    stats=$(GITLITE_STATS=1 "$GITLITE" "$@" 2>&1 >/dev/null | grep "^io:")
+    end=$(now)
+    printf "%-10s %8.3fs  %s\n" "$1" "$(awk "BEGIN { print $end - $start }")" "$stats"
+}
+
+run log $head
+echo "ref: refs/heads/none" > .git/HEAD
+run checkout -j1 $head
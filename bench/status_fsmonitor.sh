@@ -0,0 +1,60 @@
+#!/bin/bash
+# status and write-tree on a wide worktree: a full stat walk on one thread
+# and on every core, then with the fsmonitor daemon, after a handful of
+# files have changed.
+#
+# Usage: bench/status_fsmonitor.sh [files] [changed]
+#   files    files in the worktree, 100 per directory (default 200000)
+#   changed  files modified before each incremental run (default 10)
+
+GITLITE="$(pwd)/build/gitlite"
+FILES=${1:-200000}
+CHANGED=${2:-10}
+
+if [ ! -f "$GITLITE" ]; then
+    echo "Error: gitlite not found in build/. Please build the project first."
+    exit 1
+fi
+
+WORK=$(mktemp -d)
+trap '"$GITLITE" fsmonitor stop > /dev/null 2>&1; cd /; rm -rf "$WORK"' EXIT
+cd "$WORK"
+"$GITLITE" init > /dev/null
+
+echo "Generating $FILES files..."
+DIRS=$(( (FILES + 99) / 100 ))
+for ((d = 0; d < DIRS; d++)); do
+    dir="t$((d % 20))/s$d"
+    mkdir -p "$dir"
+    (cd "$dir" && seq 1 100 | split -l 1 -a 3 - f)
+done
+"$GITLITE" write-tree > /dev/null
+
+now() { date +%s.%N; }
+run() {
+    local start end
+    start=$(now)
+    "$GITLITE" "$@" > /dev/null
+    end=$(now)
+    awk "BEGIN { print $end - $start }"
+}
+touch_some() {
+    for ((i = 0; i < CHANGED; i++)); do
+        d=$((RANDOM % DIRS))
+        echo "change $RANDOM" >> "t$((d % 20))/s$d/faaa"
+    done
+}
+
+printf "%-40s %10s\n" "run" "seconds"
+printf "%-40s %10.3f\n" "status, no changes (-j1)" "$(run status -j1)"
+printf "%-40s %10.3f\n" "status, no changes" "$(run status)"
+touch_some
+printf "%-40s %10.3f\n" "status, $CHANGED changed" "$(run status)"
+printf "%-40s %10.3f\n" "write-tree, $CHANGED changed" "$(run write-tree)"
+
+"$GITLITE" -c core.fsmonitor=true fsmonitor start > /dev/null
+"$GITLITE" -c core.fsmonitor=true write-tree > /dev/null  # First run with the daemon is a full scan
+touch_some
+printf "%-40s %10.3f\n" "status, $CHANGED changed (fsmonitor)" "$(run -c core.fsmonitor=true status)"
+printf "%-40s %10.3f\n" "write-tree, $CHANGED changed (fsmonitor)" "$(run -c core.fsmonitor=true write-tree)"
+printf "%-40s %10.3f\n" "status, no changes (fsmonitor)" "$(run -c core.fsmonitor=true status)"
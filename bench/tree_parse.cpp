@@ -0,0 +1,89 @@
+// Microbenchmark for tree parsing: the original GitTree::parse (ostringstream
+// per SHA, substr per field) against the current GitTree::parse and a
+// zero-copy TreeView walk, on a synthetic tree.
+//
+// Usage: bench_tree_parse [entries] [rounds]   (defaults: 10000 entries, 200 rounds)
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include "git_objects.h"
+
+// GitTree::parse as it was before TreeView
+static GitTree legacy_parse(const std::string& data) {
+    GitTree tree;
+    size_t pos = 0;
+    while (pos < data.size()) {
+        size_t space_pos = data.find(' ', pos);
+        if (space_pos == std::string::npos) throw std::runtime_error("No space found after mode");
+        std::string mode_str = data.substr(pos, space_pos - pos);
+        if (mode_str.empty() || !std::all_of(mode_str.begin(), mode_str.end(), ::isdigit)) {
+            throw std::runtime_error("Bad mode");
+        }
+        uint32_t mode = std::stoul(mode_str, nullptr, 8);
+        size_t null_pos = data.find('\0', space_pos + 1);
+        if (null_pos == std::string::npos) throw std::runtime_error("No null terminator found after path");
+        std::string path = data.substr(space_pos + 1, null_pos - space_pos - 1);
+        pos = null_pos + 1;
+        if (pos + 20 > data.size()) throw std::runtime_error("Not enough data for SHA");
+        std::ostringstream sha_ss;
+        sha_ss << std::hex << std::setfill('0');
+        for (size_t i = 0; i < 20; ++i) {
+            uint8_t byte = static_cast<uint8_t>(data[pos++]);
+            sha_ss << std::setw(2) << static_cast<unsigned>(byte);
+        }
+        tree.items.push_back({mode, path, sha_ss.str()});
+    }
+    return tree;
+}
+
+template <typename Fn>
+static double time_rounds(int rounds, Fn fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; ++r) fn();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    size_t entries = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000;
+    int rounds = argc > 2 ? std::atoi(argv[2]) : 200;
+
+    std::mt19937_64 rng(42);
+    GitTree tree;
+    for (size_t i = 0; i < entries; ++i) {
+        unsigned char raw[20];
+        for (auto& b : raw) b = static_cast<unsigned char>(rng());
+        uint32_t mode = i % 10 == 0 ? 040000 : 0100644;
+        tree.items.push_back({mode, "file_" + std::to_string(i) + ".txt", sha_to_hex(raw)});
+    }
+    std::sort(tree.items.begin(), tree.items.end(),
+              [](const GitTreeLeaf& a, const GitTreeLeaf& b) { return a.path < b.path; });
+    std::string data = tree.serialize();
+    if (legacy_parse(data).serialize() != data || GitTree::parse(data).serialize() != data) {
+        std::fprintf(stderr, "parsers disagree\n");
+        return 1;
+    }
+
+    size_t sink = 0;
+    double legacy = time_rounds(rounds, [&] { sink += legacy_parse(data).items.size(); });
+    double parsed = time_rounds(rounds, [&] { sink += GitTree::parse(data).items.size(); });
+    double view = time_rounds(rounds, [&] {
+        for (const auto& entry : TreeView(data)) sink += entry.path.size() + entry.raw_sha[0];
+    });
+    double serialize = time_rounds(rounds, [&] { sink += tree.serialize().size(); });
+
+    double per = 1e9 / (double(entries) * rounds);
+    std::printf("%zu entries x %d rounds (checksum %zu)\n", entries, rounds, sink);
+    std::printf("%-24s %10s %9s\n", "parser", "ns/entry", "speedup");
+    std::printf("%-24s %10.1f %8.2fx\n", "legacy GitTree::parse", legacy * per, 1.0);
+    std::printf("%-24s %10.1f %8.2fx\n", "GitTree::parse", parsed * per, legacy / parsed);
+    std::printf("%-24s %10.1f %8.2fx\n", "TreeView", view * per, legacy / view);
+    std::printf("%-24s %10.1f\n", "GitTree::serialize", serialize * per);
+    return 0;
+}
@@ -0,0 +1,79 @@
+#!/bin/bash
+# checkout of a wide tree of small loose files through the synchronous
+# backend and through io_uring, on one thread and on eight: best wall time
+# of a few runs, and syscalls per file written. The syscall count comes from
+# `strace -c -f` when strace is installed; otherwise the GITLITE_STATS io and
+# uring lines are shown (io_uring_enter calls stand in for the opens, reads,
+# writes and closes they replace).
+#
+# Usage: bench/uring_checkout.sh [files] [runs]
+#   files  files in the checked-out tree, 1000 per directory (default 100000)
+#   runs   checkouts per configuration, the fastest is kept (default 3)
+
+GITLITE="$(pwd)/build/gitlite"
+FILES=${1:-100000}
+RUNS=${2:-3}
+
+if [ ! -f "$GITLITE" ]; then
+    echo "Error: gitlite not found in build/. Please build the project first."
+    exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'cd /; rm -rf "$WORK"' EXIT
+cd "$WORK"
+"$GITLITE" init > /dev/null
+
+echo "Generating $FILES files..."
+for ((d = 0; d * 1000 < FILES; d++)); do
+    mkdir "d$d"
+    (cd "d$d" && seq $((d * 1000 + 1)) $((d * 1000 + 1000 < FILES ? d * 1000 + 1000 : FILES)) | split -l 1 -a 3 - f)
+done
+tree=$("$GITLITE" write-tree)
+commit=$("$GITLITE" commit-tree $tree -m "bench")
+
+reset() {
+    rm -rf d* .git/index
+    echo "ref: refs/heads/none" > .git/HEAD
+}
+
+now() { date +%s.%N; }
+best_time() {
+    local best="" start end t
+    for ((r = 0; r < RUNS; r++)); do
+        reset
+        start=$(now)
+        "$GITLITE" checkout "$@" > /dev/null 2>&1
+        end=$(now)
+        t=$(awk "BEGIN { print $end - $start }")
+        best=$(awk -v t="$t" -v b="$best" 'BEGIN { print ((b == "" || t + 0 < b + 0) ? t : b) }')
+    done
+    echo "$best"
+}
+
+syscalls() {
+    reset
+    if command -v strace > /dev/null; then
+        local total
+        total=$(strace -c -f -o "$WORK/strace.out" "$GITLITE" checkout "$@" > /dev/null 2>&1;
+                awk '$NF == "total" { print $(NF-2) }' "$WORK/strace.out")
+        awk "BEGIN { printf \"%.2f syscalls/file\", $total / $FILES }"
+    else
+        GITLITE_STATS=1 "$GITLITE" checkout "$@" 2>&1 > /dev/null | grep -E "^(io|uring):" | tr '\n' ' '
+    fi
+}
+
+for backend in sync uring; do
+    for jobs in 1 8; do
+        t=$(GITLITE_IO=$backend best_time -j$jobs $commit)
+        s=$(GITLITE_IO=$backend syscalls -j$jobs $commit)
+        printf "%-6s -j%-2s %8.3fs  %s\n" "$backend" "$jobs" "$t" "$s"
+    done
+done
+
+reset
+GITLITE_IO=uring "$GITLITE" checkout $commit > /dev/null 2>&1
+if [ "$("$GITLITE" write-tree)" != "$tree" ]; then
+    echo "Error: the io_uring checkout doesn't match the tree"
+    exit 1
+fi
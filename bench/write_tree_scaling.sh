@@ -0,0 +1,45 @@
+#!/bin/bash
+# Scaling report for write-tree: times the serial path (-j 1) against the
+# work-stealing pool at 2/4/8/16 threads on a synthetic worktree.
+#
+# Usage: bench/write_tree_scaling.sh [files] [file_kb]
+#   files    number of files to generate (default 20000)
+#   file_kb  size of each file in KiB (default 16)
+
+GITLITE="$(pwd)/build/gitlite"
+FILES=${1:-20000}
+FILE_KB=${2:-16}
+
+if [ ! -f "$GITLITE" ]; then
+    echo "Error: gitlite not found in build/. Please build the project first."
+    exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK"
+"$GITLITE" init > /dev/null
+
+# 100 files per directory, 100 directories per level
+echo "Generating $FILES files of $FILE_KB KiB..."
+for ((i = 0; i < FILES; i++)); do
+    dir="d$((i / 10000))/d$(((i / 100) % 100))"
+    [ $((i % 100)) -eq 0 ] && mkdir -p "$dir"
+    head -c $((FILE_KB * 1024)) /dev/urandom | base64 > "$dir/f$i.txt"
+done
+
+now() { date +%s.%N; }
+
+echo "cores: $(nproc)"
+printf "%-8s %10s %10s  %s\n" "threads" "seconds" "speedup" "tree"
+base=""
+for j in 1 2 4 8 16; do
+    rm -rf .git/objects .git/index && mkdir .git/objects
+    sync
+    start=$(now)
+    sha=$("$GITLITE" write-tree -j $j)
+    end=$(now)
+    secs=$(awk "BEGIN { print $end - $start }")
+    [ -z "$base" ] && base=$secs
+    printf "%-8s %10.3f %9.2fx  %s\n" "$j" "$secs" "$(awk "BEGIN { print $base / $secs }")" "$sha"
+done
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include "repo.h"
+
+// A tree as a tar stream, written straight from the object store: trees are
+// walked with GitTree::parse and each blob is streamed from its object into
+// its tar record, so no file touches the worktree and no blob is held whole
+// in memory (symlink targets aside).
+//
+// Entries follow Git's archive layout: a directory record before its
+// contents, files 0664 or 0775 and directories 0775 (Git's tar.umask of
+// 002), owner root, every mtime the commit time. Names over ustar's limits
+// and files over 8 GiB get pax extended headers, and a commit's id goes in
+// a pax global header as Git does.
+//
+// For tar.gz the stream is cut into blocks that are deflated on a thread
+// pool, each primed with the 32 KiB before it, the way pigz does, so the
+// result is a single ordinary gzip member.
+enum class ArchiveFormat { TAR, TAR_GZ };
+
+struct ArchiveOptions {
+    ArchiveFormat format = ArchiveFormat::TAR;
+    std::string prefix;          // Put in front of every path, e.g. "project-1.0/"
+    std::string commit;          // For the pax global header; empty for a bare tree
+    uint64_t mtime = 0;
+    int level = -1;              // zlib level for tar.gz, -1 for zlib's default
+    unsigned jobs = 0;           // Compression threads for tar.gz, 0: one per core
+};
+
+struct ArchiveStats {
+    uint64_t files = 0;
+    uint64_t dirs = 0;
+    uint64_t bytes = 0;          // Blob payload bytes
+    uint64_t written = 0;        // Bytes written to `fd`
+    double seconds = 0;
+};
+
+// Writes the archive of `tree_sha` to `fd`
+ArchiveStats archive_tree(const GitRepository& repo, const std::string& tree_sha, const ArchiveOptions& options,
+                          int fd);
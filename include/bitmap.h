@@ -0,0 +1,127 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "object_id.h"
+#include "pack.h"
+#include "repo.h"
+
+// A plain bitmap over object positions in a pack
+class Bitmap {
+public:
+    void set(uint32_t i) {
+        if (i / 64 >= words_.size()) words_.resize(i / 64 + 1);
+        words_[i / 64] |= uint64_t(1) << (i % 64);
+    }
+    bool get(uint32_t i) const { return i / 64 < words_.size() && (words_[i / 64] >> (i % 64)) & 1; }
+    void or_with(const Bitmap& other);
+    void xor_with(const Bitmap& other);
+    uint64_t count() const;
+    uint64_t count_and(const Bitmap& other) const;  // Bits set in both
+    void for_each(const std::function<void(uint32_t)>& fn) const;
+
+    std::vector<uint64_t>& words() { return words_; }
+    const std::vector<uint64_t>& words() const { return words_; }
+
+private:
+    std::vector<uint64_t> words_;
+};
+
+// EWAH, the run-length encoding Git stores bitmaps in: 32-bit bit count,
+// 32-bit word count, the words (big-endian 64-bit), then the position of
+// the last marker word. A marker word holds a run of all-0 or all-1 words
+// (bit 0: which, bits 1-32: how many) and the number of literal words that
+// follow it (bits 33-63).
+std::string ewah_encode(const Bitmap& bits);
+// Decodes the EWAH at `p` and ORs (or XORs) it into `out`. Returns the
+// bytes it took up; throws if it runs past `len`.
+size_t ewah_apply(const unsigned char* p, size_t len, Bitmap& out, bool xor_into);
+
+// The pack-<sha>.bitmap next to a pack, in Git's format (version 1), so
+// Git and gitlite can each use the other's. Bit i stands for the i-th
+// object in pack order (by offset). Four bitmaps give every object's type,
+// then each selected commit has the bitmap of everything reachable from it,
+// possibly stored XORed against one of the entries before it.
+class PackBitmap {
+public:
+    // nullptr if the pack has no .bitmap; throws if it's damaged or was
+    // written for a different pack
+    static std::unique_ptr<PackBitmap> open(std::shared_ptr<PackFile> pack);
+
+    const PackFile& pack() const { return *pack_; }
+    uint32_t entries() const { return static_cast<uint32_t>(entries_.size()); }
+    // Bit position of an object; false if it isn't in the pack
+    bool position(const ObjectId& id, uint32_t& pos) const;
+    ObjectId id_at(uint32_t pos) const { return ObjectId::from_raw(pack_->sha_at(index_of_[pos])); }
+    // PACK_COMMIT .. PACK_TAG
+    const Bitmap& type(int pack_type) const { return types_[pack_type - 1]; }
+    int type_at(uint32_t pos) const;
+    // ORs the stored closure of `commit` into `out`; false if it has none
+    bool or_into(const ObjectId& commit, Bitmap& out) const;
+
+private:
+    struct Entry {
+        size_t at;            // Offset of the EWAH in data_
+        uint32_t xor_offset;  // Entries back to the one this is XORed with, 0 for none
+    };
+
+    std::shared_ptr<PackFile> pack_;
+    std::string data_;
+    std::vector<uint32_t> index_of_;  // Pack order -> idx order
+    std::vector<uint32_t> pos_of_;    // idx order -> pack order
+    Bitmap types_[4];
+    std::vector<Entry> entries_;
+    std::unordered_map<ObjectId, uint32_t> by_commit_;
+};
+
+// Commits that get a bitmap besides the ref tips: one in every this many,
+// walking back from the tips
+constexpr uint32_t BITMAP_INTERVAL = 100;
+
+// Writes the .bitmap for `pack`, which must hold every object reachable
+// from `tips` (throws otherwise; tips that aren't commits are skipped).
+// Returns the number of commits given a bitmap.
+uint32_t bitmap_write(const GitRepository& repo, std::shared_ptr<PackFile> pack, const std::vector<std::string>& tips,
+                      uint32_t interval = BITMAP_INTERVAL);
+
+struct ObjectCounts {
+    uint64_t commits = 0;
+    uint64_t trees = 0;
+    uint64_t blobs = 0;
+    uint64_t tags = 0;
+    uint64_t total() const { return commits + trees + blobs + tags; }
+};
+
+// Everything reachable from some commits: a bitmap over a pack, plus what
+// lies outside it
+class Reachable {
+public:
+    ObjectCounts counts() const;
+    // Pack order, then the objects outside the pack
+    void for_each(const std::function<void(const ObjectId&, int pack_type)>& fn) const;
+
+private:
+    friend bool bitmap_reachable(const GitRepository&, const std::vector<std::string>&, Reachable&);
+    std::shared_ptr<const PackBitmap> bitmap_;
+    Bitmap bits_;
+    std::vector<std::pair<ObjectId, int>> outside_;
+};
+
+// Fills `out` from the bitmaps of the first pack that has them: tips with a
+// bitmap are ORed in, and commits without one are walked only until they
+// reach something already included. False if no pack has a bitmap.
+bool bitmap_reachable(const GitRepository& repo, const std::vector<std::string>& tips, Reachable& out);
+
+// The same objects by walking every commit and tree, in `rev-list --objects`
+// order: the commits newest first, then each commit's tree and everything
+// under it not seen before, with its path ("" for the root tree; commits
+// get no path)
+ObjectCounts walk_objects(const GitRepository& repo, const std::vector<std::string>& tips,
+                          const std::function<void(const std::string& sha, int pack_type, const std::string& path)>& fn);
+
+// "bitmap: B bitmaps used, C commits walked" for GITLITE_STATS
+void bitmap_print_stats(std::ostream& out);
@@ -0,0 +1,83 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+#include <ostream>
+#include "repo.h"
+
+// What history walks need from a commit
+struct CommitNode {
+    std::string sha;
+    std::string tree;
+    std::vector<std::string> parents;
+    uint32_t generation = 0;  // 1 + max(parent generations); roots are 1, 0 = not yet known
+    uint64_t time = 0;        // Committer timestamp
+};
+
+// objects/info/commit-graph in Git's format (version 1): an OID fanout and
+// sorted OID list, then one fixed-width CDAT record per commit holding the
+// tree OID, two parent positions, generation number and commit time, plus an
+// EDGE list for octopus merges. The file is mapped read-only.
+class CommitGraph {
+public:
+    // Null if the repository has no commit-graph file
+    static std::unique_ptr<CommitGraph> open(const GitRepository& repo);
+    ~CommitGraph();
+    CommitGraph(const CommitGraph&) = delete;
+    CommitGraph& operator=(const CommitGraph&) = delete;
+
+    uint32_t count() const { return count_; }
+    bool find(const std::string& sha, uint32_t& pos) const;
+    CommitNode node(uint32_t pos) const;
+
+private:
+    CommitGraph() = default;
+    const unsigned char* sha_at(uint32_t pos) const { return oidl_ + 20 * size_t(pos); }
+
+    const unsigned char* map_ = nullptr;
+    size_t size_ = 0;
+    uint32_t count_ = 0;
+    const unsigned char* oidf_ = nullptr;
+    const unsigned char* oidl_ = nullptr;
+    const unsigned char* cdat_ = nullptr;
+    const unsigned char* edge_ = nullptr;
+    size_t edge_count_ = 0;
+};
+
+// Commit lookups for history walks: answered from the commit-graph when the
+// commit is in it, otherwise by reading the commit object. Results are
+// memoized. A corrupt graph is ignored with a warning.
+class CommitSource {
+public:
+    explicit CommitSource(const GitRepository& repo);
+    const CommitNode& get(const std::string& sha);
+    // Generation numbers of commits outside the graph are derived from their
+    // parents on demand, so ordering stays topological
+    uint32_t generation(const std::string& sha);
+    bool has_graph() const { return graph_ != nullptr; }
+
+private:
+    CommitNode& load(const std::string& sha);
+
+    const GitRepository& repo_;
+    std::unique_ptr<CommitGraph> graph_;
+    std::unordered_map<std::string, CommitNode> nodes_;
+};
+
+// Walk history from `tips`, newest first. By default commits come out in
+// committer-date order; topo_order pops by generation number instead, which
+// guarantees every commit appears before its parents.
+std::vector<std::string> rev_list(CommitSource& source, const std::vector<std::string>& tips, bool topo_order);
+
+// Best common ancestors of a and b, using generation numbers to stop early
+std::vector<std::string> merge_bases(CommitSource& source, const std::string& a, const std::string& b);
+
+// Write objects/info/commit-graph covering `tips` and all their ancestors.
+// Returns the number of commits written.
+uint32_t commit_graph_write(const GitRepository& repo, const std::vector<std::string>& tips);
+
+// "commit graph: G from graph, R object reads" for GITLITE_STATS; silent if
+// no history walk ran
+void commit_graph_print_stats(std::ostream& out);
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include "repo.h"
+
+// zlib levels for new loose objects and pack entries, from .git/config
+// (or `gitlite -c key=value`):
+//   [compression]
+//       level = best     best (9, the default), default (6), fast (1),
+//                        none (0) or a number 0-9
+//       blob = fast      per-type overrides: blob, tree, commit, tag
+//       sample = 16k     leading bytes of each blob trial-compressed; blobs
+//                        that don't shrink (JPEGs, tarballs, ...) are stored
+//                        at level 0. 0 turns sampling off.
+// Without compression.level, Git's core.compression is honoured, and
+// core.looseCompression / pack.compression for loose objects and packs.
+class CompressionPolicy {
+public:
+    enum Target { LOOSE, PACK };
+    static CompressionPolicy from_config(const GitRepository& repo, Target target);
+
+    // Level for an object of this type, before any sampling
+    int level(const std::string& fmt) const;
+    // Level for an object whose payload starts with `sample`; blobs that
+    // fail the compressibility check get level 0
+    int level(const std::string& fmt, const char* sample, size_t len) const;
+    size_t sample_bytes() const { return sample_; }
+
+private:
+    int base_ = 9;
+    int per_type_[4] = {-1, -1, -1, -1};  // blob, tree, commit, tag
+    size_t sample_ = 16 * 1024;
+};
+
+// Process-wide counters for GITLITE_STATS; silent if nothing was compressed
+void compression_record(uint64_t raw_bytes, uint64_t stored_bytes, bool incompressible);
+void compression_print_stats(std::ostream& out);
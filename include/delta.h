@@ -0,0 +1,35 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Git pack delta encoding. A delta is "<source size><target size>" as
+// little-endian base-128 varints followed by copy ops (copy a range of the
+// source) and insert ops (up to 127 literal bytes).
+
+// Rolling-hash index over 16-byte blocks of a delta source. Built once per
+// source and reused for every target it is tried against.
+class DeltaIndex {
+public:
+    // `source` must outlive the index
+    explicit DeltaIndex(const std::string& source);
+
+    // Delta that rebuilds `target` from the source, or empty if it would be
+    // larger than max_size
+    std::string create(const std::string& target, size_t max_size) const;
+
+    const std::string& source() const { return src_; }
+    size_t memory_size() const { return (heads_.size() + next_.size()) * sizeof(uint32_t); }
+
+private:
+    const std::string& src_;
+    std::vector<uint32_t> heads_;  // Bucket -> first block offset + 1 (0 = empty)
+    std::vector<uint32_t> next_;   // Block number -> next block offset + 1 in the same bucket
+    uint32_t mask_ = 0;
+};
+
+// Rebuild the target of `delta` from `base`; throws on malformed deltas
+std::string apply_delta(const std::string& base, const std::string& delta);
+
+// Target size declared in a delta header
+uint64_t delta_target_size(const std::string& delta);
@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include "repo.h"
+
+// Bulk import from a `git fast-import` stream: blob, commit, tag and reset
+// commands with marks, and M / D / C / R / deleteall file changes. Trees
+// are kept in memory per branch and only the changed paths are rewritten
+// on each commit. Every object goes straight into one new pack (no loose
+// files); an object the stream produces twice is only written once.
+// Branch and tag refs are updated at the end.
+struct FastImportOptions {
+    std::string import_marks;  // ":<mark> <sha>" lines to start from
+    std::string export_marks;  // Where to write the marks at the end
+};
+
+struct FastImportStats {
+    uint64_t blobs = 0;
+    uint64_t trees = 0;
+    uint64_t commits = 0;
+    uint64_t tags = 0;
+    uint64_t duplicates = 0;  // Objects already written earlier in the stream
+    uint64_t bytes = 0;       // Uncompressed payload written
+    uint64_t pack_bytes = 0;
+    std::string pack;         // File name of the new pack, "" if nothing was written
+    double seconds = 0;
+    uint64_t objects() const { return blobs + trees + commits + tags; }
+};
+
+// `progress` commands are echoed to `out`. Throws on a malformed stream;
+// nothing is left behind then.
+FastImportStats fast_import(const GitRepository& repo, std::istream& in, std::ostream& out,
+                            const FastImportOptions& options);
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include "repo.h"
+
+// Repository check. Every loose object and every object in every pack is
+// inflated and re-hashed on a thread pool: the SHA-1 must match the name,
+// the header's size the payload, and trees, commits and tags must parse
+// (tree entries in Git order, no duplicates, known modes). Packs also get
+// their trailing checksums checked.
+//
+// With `connectivity`, the links between objects are followed too: a
+// commit's tree and parents, a tree's entries, a tag's target, and HEAD
+// and the refs. Targets that don't exist are reported as missing, and
+// objects nothing points to as dangling (not an error, as in Git).
+struct FsckOptions {
+    bool connectivity = false;
+    unsigned jobs = 0;  // 0: one per core
+};
+
+struct FsckStats {
+    uint64_t loose = 0;
+    uint64_t packed = 0;
+    uint64_t bytes = 0;     // Inflated payload bytes hashed
+    uint64_t errors = 0;    // Damaged objects and packs, bad links
+    uint64_t missing = 0;
+    uint64_t dangling = 0;
+    double seconds = 0;
+};
+
+// Problems go to `out`, one per line, sorted
+FsckStats fsck(const GitRepository& repo, const FsckOptions& options, std::ostream& out);
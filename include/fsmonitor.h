@@ -0,0 +1,45 @@
+#pragma once
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_set>
+#include "repo.h"
+
+// A per-worktree daemon (`gitlite fsmonitor start`) that keeps inotify
+// watches on every directory and remembers which paths changed. Clients
+// hand it the token saved with the index by the last write-tree and get
+// back a new token plus everything that changed since the old one, over
+// the Unix socket .git/fsmonitor.sock. Opt in with core.fsmonitor=true.
+//
+// Protocol: the client sends "Q <token>\n"; the daemon answers with the new
+// token, a NUL, then each changed path followed by a NUL, and closes the
+// connection. A single "/" path means it can't tell (unknown or expired
+// token, event queue overflow) and everything must be looked at.
+// "STOP\n" shuts the daemon down.
+
+struct FsMonitorResult {
+    std::string token;          // To be saved with the index written from this scan
+    bool everything = true;     // No usable history: every path counts as changed
+    std::unordered_set<std::string> paths;  // Changed paths, relative to the worktree
+    std::unordered_set<std::string> dirs;   // Every directory above a changed path, "" for the root
+
+    // `rel` itself, or a directory above it, may have changed
+    bool changed(const std::string& rel) const;
+    // Directory `rel` needs reading: it, or something below it, may have changed
+    bool dir_changed(const std::string& rel) const;
+};
+
+bool fsmonitor_enabled(const GitRepository& repo);  // core.fsmonitor
+// Null unless core.fsmonitor is on and the daemon answered
+std::unique_ptr<FsMonitorResult> fsmonitor_query(const GitRepository& repo, const std::string& since);
+
+// Daemon control. run() stays in the foreground until stopped; start()
+// forks a daemon and returns once it is watching the worktree.
+void fsmonitor_run(const GitRepository& repo);
+void fsmonitor_start(const GitRepository& repo);
+bool fsmonitor_stop(const GitRepository& repo);
+bool fsmonitor_running(const GitRepository& repo);
+
+// Walks that trusted the daemon instead of reading a directory or stat()ing a file
+void fsmonitor_count_skipped(bool dir);
+void fsmonitor_print_stats(std::ostream& out);
@@ -1,8 +1,14 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
 #include <cstdint>  // For uint8_t, etc.
+#include "object_id.h"
+
+// SHA-1 conversions between 40-char hex and 20 raw bytes
+std::string sha_to_hex(const unsigned char* bin);
+void hex_to_sha(const std::string& hex, unsigned char* bin);
 
 // Base Git Object
 class GitObject {
@@ -36,6 +42,58 @@ public:
     static GitTree parse(const std::string& data);  // Added
 };
 
+// One tree entry, pointing into the tree object's buffer
+struct TreeEntryView {
+    uint32_t mode = 0;
+    std::string_view path;
+    const unsigned char* raw_sha = nullptr;  // 20 bytes
+    ObjectId id() const { return ObjectId::from_raw(raw_sha); }
+};
+
+// Zero-copy reader over a tree payload; entries are parsed as the iterator
+// advances, with no allocation. The buffer must outlive the view. Throws
+// std::runtime_error on a malformed entry.
+class TreeView {
+public:
+    explicit TreeView(std::string_view data) : data_(data) {}
+
+    class iterator {
+    public:
+        iterator(std::string_view data, size_t pos) : data_(data), pos_(pos) { parse(); }
+        const TreeEntryView& operator*() const { return entry_; }
+        const TreeEntryView* operator->() const { return &entry_; }
+        iterator& operator++() {
+            pos_ = next_;
+            parse();
+            return *this;
+        }
+        bool operator==(const iterator& o) const { return pos_ == o.pos_; }
+        bool operator!=(const iterator& o) const { return pos_ != o.pos_; }
+
+    private:
+        void parse();
+        std::string_view data_;
+        size_t pos_;
+        size_t next_ = 0;
+        TreeEntryView entry_;
+    };
+
+    iterator begin() const { return iterator(data_, 0); }
+    iterator end() const { return iterator(data_, data_.size()); }
+
+private:
+    std::string_view data_;
+};
+
+// Git's tree order: entries sort by name, with a subtree's name compared as
+// if it ended in '/'. Negative, zero or positive like strcmp. A file and a
+// directory of the same name are different entries in this order.
+int tree_order(std::string_view a_name, uint32_t a_mode, std::string_view b_name, uint32_t b_mode);
+inline int tree_order(const GitTreeLeaf& a, const GitTreeLeaf& b) { return tree_order(a.path, a.mode, b.path, b.mode); }
+inline int tree_order(const TreeEntryView& a, const TreeEntryView& b) {
+    return tree_order(a.path, a.mode, b.path, b.mode);
+}
+
 // Commit
 class GitCommit : public GitObject {
 public:
@@ -43,4 +101,36 @@ public:
     GitCommit() { fmt = "commit"; }
     std::string serialize() const override;
     static GitCommit parse(const std::string& data);  // Added
+};
+
+// Zero-copy reader over a commit payload: header lines in order, then the
+// message. Continuation lines (multi-line values such as signatures) are
+// skipped. The buffer must outlive the view.
+class CommitView {
+public:
+    explicit CommitView(std::string_view data);
+    // First value for `key`, empty if there is none
+    std::string_view header(std::string_view key) const;
+    // Calls fn(key, value) for each header line
+    template <typename Fn>
+    void for_each_header(Fn fn) const {
+        size_t pos = 0;
+        while (pos < headers_end_) {
+            size_t nl = data_.find('\n', pos);
+            if (nl == std::string_view::npos || nl > headers_end_) nl = headers_end_;
+            std::string_view line = data_.substr(pos, nl - pos);
+            pos = nl + 1;
+            size_t space = line.find(' ');
+            if (space == std::string_view::npos || space == 0) continue;
+            fn(line.substr(0, space), line.substr(space + 1));
+        }
+    }
+    std::string_view message() const { return data_.substr(message_start_); }
+    // Committer timestamp, 0 if missing or malformed
+    uint64_t commit_time() const;
+
+private:
+    std::string_view data_;
+    size_t headers_end_ = 0;   // The blank line (or end of data)
+    size_t message_start_ = 0;
 };
\ No newline at end of file
@@ -0,0 +1,118 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "repo.h"
+
+namespace fs = std::filesystem;
+
+// .gitignore patterns from one file, compiled once. Matching an entry
+// doesn't try the patterns in turn: plain names and "*.ext" / "name*"
+// patterns are hash lookups, patterns with a '/' sit in a trie over path
+// components, and the remaining globs are only run when the name has their
+// literal beginning and ending. As in Git, the last pattern in the file
+// that matches decides.
+class IgnoreRules {
+public:
+    enum Result { NONE, IGNORED, INCLUDED };  // INCLUDED: a "!pattern" matched last
+
+    IgnoreRules() = default;
+    IgnoreRules(IgnoreRules&&) = default;
+    IgnoreRules& operator=(IgnoreRules&&) = default;
+    // `text` is a .gitignore file. `base` is the directory it applies to,
+    // relative to the worktree ("" for the root); patterns with a '/' are
+    // anchored there, the others match a name at any depth below it.
+    IgnoreRules(std::string_view text, std::string base);
+
+    // `rel` is relative to the worktree and below base(); `name` is its
+    // last component
+    Result match(std::string_view rel, std::string_view name, bool is_dir) const;
+
+    // Whether a non-negated pattern could match something strictly inside
+    // directory `rel`. Patterns without a '/' match at any depth, so any of
+    // those means yes.
+    bool may_match_below(std::string_view rel) const;
+
+    const std::string& base() const { return base_; }
+    bool empty() const { return rules_.empty(); }
+    size_t size() const { return rules_.size(); }
+
+private:
+    struct Rule {
+        std::string pattern;  // As written, minus "!", a leading and a trailing "/"
+        bool negate = false;
+        bool dir_only = false;
+        // For the globs left to fnmatch(): literal text every match starts
+        // with, checked first
+        std::string_view head;
+    };
+
+    // A trie node over path components. "**" is an edge that loops: it
+    // stays active for any number of components, zero included.
+    struct Node {
+        std::unordered_map<std::string_view, uint32_t> literal;  // Component -> child
+        std::vector<std::pair<std::string, uint32_t>> globs;     // fnmatch() pattern -> child
+        uint32_t any_depth = 0;                                  // "**" child, 0 if none
+        bool loops = false;                                      // This is a "**" child
+        std::vector<uint32_t> rules;                             // Patterns ending here
+    };
+
+    // Keys point into rules_, which isn't touched once the lookups are built
+    using Index = std::unordered_map<std::string_view, std::vector<uint32_t>>;
+
+    void parse(std::string_view line);
+    void compile(uint32_t rule);
+    void add_path(uint32_t rule, std::string_view pattern);
+    uint32_t trie_child(uint32_t node, std::string_view component);
+    // The last rule in `ids` that applies to an entry of this type
+    int64_t last_applying(const std::vector<uint32_t>& ids, bool is_dir) const;
+    // Trie nodes reached by the components of `rel`
+    std::vector<uint32_t> trie_walk(std::string_view rel) const;
+    int64_t match_trie(std::string_view rel, bool is_dir) const;
+
+    std::string base_;
+    std::vector<Rule> rules_;
+    Index names_;                                   // Exact name
+    std::unordered_map<size_t, Index> suffixes_;    // "*.ext": length -> ending
+    std::unordered_map<size_t, Index> prefixes_;    // "name*": length -> beginning
+    std::unordered_map<size_t, Index> glob_tails_;  // Other patterns on the name, by literal ending
+    std::vector<uint32_t> name_globs_;              // Other patterns on the name, no literal ending
+    std::vector<Node> trie_;                        // Patterns with a '/'; [0] is the root
+    bool floating_ = false;                         // A non-negated pattern without a '/'
+};
+
+// The ignore rules in effect inside one directory: its own .gitignore,
+// then its parent's and so on up to the top, then .git/info/exclude, then
+// the built-in ones (dot files and gitlite's own build files, which a
+// "!pattern" can bring back). Walks hand each subdirectory child() of the
+// directory's scope and don't descend into ignored directories at all.
+class IgnoreScope : public std::enable_shared_from_this<IgnoreScope> {
+public:
+    // The scope for the top of a walk of `dir` (the worktree or below it)
+    static std::shared_ptr<const IgnoreScope> root(const GitRepository& repo, const fs::path& dir);
+
+    // The scope inside subdirectory `rel` (relative to the walk's top) at
+    // `path` on disk. Shares this one unless it has a .gitignore.
+    std::shared_ptr<const IgnoreScope> child(const fs::path& path, const std::string& rel) const;
+
+    // ".git" is always ignored
+    bool ignored(std::string_view rel, std::string_view name, bool is_dir) const;
+
+    IgnoreScope(std::shared_ptr<const IgnoreScope> parent, IgnoreRules rules)
+        : parent_(std::move(parent)), rules_(std::move(rules)) {}
+
+private:
+    std::shared_ptr<const IgnoreScope> parent_;
+    IgnoreRules rules_;
+};
+
+// Directories pruned and files left out by walks, for GITLITE_STATS
+void ignore_print_stats(std::ostream& out);
+
+// True if a pattern needs glob matching: it has '*', '?', '[' or an escape
+bool has_glob(std::string_view pattern);
@@ -0,0 +1,56 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+#include <sys/stat.h>
+#include "repo.h"
+
+// One worktree file in the index: stat data plus the blob SHA it hashed to.
+// Layout follows Git's DIRC version 2 entries.
+struct IndexEntry {
+    uint32_t ctime_sec = 0;
+    uint32_t ctime_nsec = 0;
+    uint32_t mtime_sec = 0;
+    uint32_t mtime_nsec = 0;
+    uint32_t dev = 0;
+    uint32_t ino = 0;
+    uint32_t mode = 0;
+    uint32_t uid = 0;
+    uint32_t gid = 0;
+    uint32_t size = 0;   // Truncated to 32 bits, like Git
+    std::string sha;     // SHA-1 hex
+    std::string path;    // Relative to the worktree, '/'-separated
+
+    static IndexEntry from_stat(const std::string& path, const struct stat& st, const std::string& sha);
+    bool stat_matches(const struct stat& st) const;
+};
+
+// Cached tree SHA for one directory (Git's TREE extension)
+struct CacheTreeEntry {
+    int32_t entry_count = -1;    // Files anywhere below this directory, -1 if invalid
+    uint32_t subtree_count = 0;  // Immediate subdirectories
+    std::string sha;             // SHA-1 hex, only meaningful if entry_count >= 0
+};
+
+// The stat cache at .git/index
+class GitIndex {
+public:
+    std::vector<IndexEntry> entries;              // Sorted by path
+    std::map<std::string, CacheTreeEntry> trees;  // Keyed by directory path, "" is the root
+    int64_t timestamp_sec = 0;                    // Index file mtime when read, for racy checks
+    int64_t timestamp_nsec = 0;
+    std::string fsmonitor_token;                  // See fsmonitor.h; "" if not in use
+
+    // Missing index reads as empty; a damaged one throws
+    static GitIndex read(const GitRepository& repo);
+    // Atomically replace the index via index.lock. Returns false if another
+    // process holds the lock.
+    bool write(const GitRepository& repo);
+
+    const IndexEntry* find(const std::string& path) const;
+    // An entry modified in the same instant the index was written may have
+    // changed again without its stat data changing; such entries must be rehashed.
+    bool is_racy(const IndexEntry& entry) const;
+    void sort();
+};
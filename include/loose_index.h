@@ -0,0 +1,20 @@
+#pragma once
+#include <cstddef>
+#include <string_view>
+#include <vector>
+#include "repo.h"
+
+// Sorted ID lists for the loose objects in each objects/xx directory, so an
+// abbreviated SHA resolves with a binary search instead of a directory scan.
+// Each list is saved in objects/info/loose-index/xx along with the mtime of
+// the directory it describes; when that mtime moves (an object was added or
+// removed) only that one directory is re-read. Lists also stay in memory for
+// the rest of the process.
+//
+// Appends up to `limit` loose objects whose hex name starts with `prefix`
+// (lower case, 2-40 digits) to `out`.
+void loose_find_prefix(const GitRepository& repo, std::string_view prefix, std::vector<ObjectId>& out,
+                       size_t limit);
+
+// Forget the in-memory lists; the saved ones stay. For benchmarks.
+void loose_index_forget();
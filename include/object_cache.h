@@ -0,0 +1,36 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <ostream>
+#include "repo.h"
+
+// An inflated object as held by the cache
+struct CachedObject {
+    std::string fmt;
+    std::string data;
+};
+
+// Counters since process start
+struct ObjectCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t bypassed = 0;   // Objects over the big-object threshold, never stored
+    uint64_t bytes = 0;      // Currently held
+    uint64_t limit = 0;
+};
+
+// Process-wide cache of inflated objects keyed by SHA, bounded by a byte
+// budget with least-recently-used eviction. Budget and big-object threshold
+// come from the repository config:
+//   [cache]
+//       limit = 64m       total bytes held (0 disables the cache)
+//       bigObject = 4m    larger objects are returned but never stored
+std::shared_ptr<const CachedObject> object_cache_read(const GitRepository& repo, const std::string& sha);
+// Parsed forms, kept next to the cached object so each is parsed at most
+// once while it stays cached. Throw on type mismatch.
+std::shared_ptr<const GitTree> object_cache_tree(const GitRepository& repo, const std::string& sha);
+std::shared_ptr<const GitCommit> object_cache_commit(const GitRepository& repo, const std::string& sha);
+
+ObjectCacheStats object_cache_stats();
+void object_cache_print_stats(std::ostream& out);
@@ -0,0 +1,45 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+
+// A SHA-1 object name as 20 raw bytes. Cheap to copy, compare and hash;
+// hex only at the edges (command output, loose object paths).
+struct ObjectId {
+    std::array<unsigned char, 20> bytes{};
+
+    static ObjectId from_raw(const unsigned char* raw) {
+        ObjectId id;
+        std::memcpy(id.bytes.data(), raw, 20);
+        return id;
+    }
+    // Throws std::runtime_error unless given exactly 40 hex digits
+    static ObjectId from_hex(std::string_view hex);
+    // Non-throwing form; returns false on malformed input
+    static bool parse_hex(std::string_view hex, ObjectId& out);
+
+    std::string hex() const;
+    void hex(char* out) const;  // Writes 40 chars, no terminator
+    const unsigned char* data() const { return bytes.data(); }
+
+    bool operator==(const ObjectId& o) const { return std::memcmp(bytes.data(), o.bytes.data(), 20) == 0; }
+    bool operator!=(const ObjectId& o) const { return !(*this == o); }
+    bool operator<(const ObjectId& o) const { return std::memcmp(bytes.data(), o.bytes.data(), 20) < 0; }
+};
+
+// SHA-1 output is already uniformly distributed, so the first word will do
+struct ObjectIdHash {
+    size_t operator()(const ObjectId& id) const {
+        size_t h;
+        std::memcpy(&h, id.bytes.data(), sizeof(h));
+        return h;
+    }
+};
+
+namespace std {
+template <>
+struct hash<ObjectId> : ObjectIdHash {};
+}  // namespace std
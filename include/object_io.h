@@ -0,0 +1,132 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <zlib.h>
+#include "repo.h"
+
+// Plumbing shared by the loose object read and write paths: pooled zlib
+// streams, per-operation scratch memory, file reads that skip iostreams,
+// and the counters GITLITE_STATS prints.
+
+// A zlib stream borrowed from the calling thread's pool. Streams are reset
+// when handed back instead of being torn down, so after warm-up an object
+// read or write does no inflateInit/deflateInit and no zlib allocations.
+class InflateLease {
+public:
+    InflateLease();
+    ~InflateLease();
+    InflateLease(const InflateLease&) = delete;
+    InflateLease& operator=(const InflateLease&) = delete;
+    z_stream& operator*() { return *zs_; }
+    z_stream* operator->() { return zs_; }
+
+private:
+    z_stream* zs_;
+};
+
+class DeflateLease {
+public:
+    explicit DeflateLease(int level);
+    ~DeflateLease();
+    DeflateLease(const DeflateLease&) = delete;
+    DeflateLease& operator=(const DeflateLease&) = delete;
+    z_stream& operator*();
+    z_stream* operator->() { return &**this; }
+
+private:
+    struct PooledDeflate* pooled_;
+};
+
+// zlib counts avail_in and avail_out in 32 bits, so a buffer over 4 GiB is
+// handed over in slices: once `avail` has run dry, the next slice of the
+// `left` bytes behind it is added (next_in and next_out move on by themselves)
+inline void zlib_refill(uInt& avail, uint64_t& left) {
+    if (avail != 0 || left == 0) return;
+    avail = static_cast<uInt>(left < UINT32_MAX ? left : UINT32_MAX);
+    left -= avail;
+}
+
+// Per-thread bump allocator for buffers that only live for one operation.
+// An ArenaScope hands back everything allocated inside it when it ends;
+// the blocks stay with the thread for the next operation.
+class ScratchArena {
+public:
+    struct Mark {
+        size_t block = 0;
+        size_t used = 0;
+    };
+    static ScratchArena& local();
+    ~ScratchArena();
+    void* alloc(size_t size);
+    Mark mark() const { return {cur_, used_}; }
+    void release(Mark mark) {
+        cur_ = mark.block;
+        used_ = mark.used;
+    }
+
+private:
+    struct Block {
+        char* data;
+        size_t size;
+    };
+    std::vector<Block> blocks_;
+    size_t cur_ = 0;
+    size_t used_ = 0;
+};
+
+class ArenaScope {
+public:
+    ArenaScope() : arena_(ScratchArena::local()), mark_(arena_.mark()) {}
+    ~ArenaScope() { arena_.release(mark_); }
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+    template <typename T = unsigned char>
+    T* alloc(size_t count) {
+        return static_cast<T*>(arena_.alloc(count * sizeof(T)));
+    }
+
+private:
+    ScratchArena& arena_;
+    ScratchArena::Mark mark_;
+};
+
+// A loose object file: one open() and one fstat(), then pread() or mmap().
+// Construct, check ok() (false if the file doesn't exist), then either take
+// the whole contents or read pieces of it.
+class LooseFile {
+public:
+    explicit LooseFile(const std::string& path);
+    ~LooseFile();
+    LooseFile(const LooseFile&) = delete;
+    LooseFile& operator=(const LooseFile&) = delete;
+    bool ok() const { return fd_ >= 0; }
+    uint64_t size() const { return size_; }
+    // The whole file: read into `scope` when small, mapped when large
+    const unsigned char* contents(ArenaScope& scope);
+    // Up to `len` bytes from `offset`; returns the number read (0 at EOF)
+    size_t read_at(void* buf, size_t len, uint64_t offset);
+
+private:
+    int fd_ = -1;
+    uint64_t size_ = 0;
+    void* map_ = nullptr;
+};
+
+// A whole loose object file, already in memory, inflated to its type and
+// payload. Throws if the header is malformed, the stream is damaged, cut
+// short or followed by anything, or the payload isn't the declared size.
+std::pair<std::string, std::string> inflate_loose(const unsigned char* compressed, uint64_t compressed_size);
+
+// Counted wrappers for the syscalls object I/O makes directly
+void io_count_open();
+void io_count_write();
+// An object write that was skipped because the object was already stored
+void io_count_existing();
+
+// Allocations (operator new) and syscalls since process start; the read and
+// write syscall totals come from /proc/self/io and cover the whole process
+void io_print_stats(std::ostream& out);
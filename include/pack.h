@@ -0,0 +1,176 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include "repo.h"
+#include "compression.h"
+
+// Pack object type codes
+enum PackObjectType : int {
+    PACK_COMMIT = 1,
+    PACK_TREE = 2,
+    PACK_BLOB = 3,
+    PACK_TAG = 4,
+    PACK_OFS_DELTA = 6,
+    PACK_REF_DELTA = 7,
+};
+
+int pack_type_from_fmt(const std::string& fmt);
+std::string pack_fmt_from_type(int type);
+
+// A pack-<sha>.pack file and its version 2 .idx, both mapped read-only.
+// Lookups go through the idx fanout table and a binary search over the
+// sorted SHA list, so no per-object files are opened.
+class PackFile {
+public:
+    explicit PackFile(const fs::path& idx_path);
+    ~PackFile();
+    PackFile(const PackFile&) = delete;
+    PackFile& operator=(const PackFile&) = delete;
+
+    uint32_t count() const { return count_; }
+    // Raw 20-byte SHA and pack offset of the i-th object in idx (SHA) order
+    const unsigned char* sha_at(uint32_t i) const { return names_ + 20 * size_t(i); }
+    uint64_t offset_at(uint32_t i) const;
+    // Returns false if the object is not in this pack
+    bool find(const unsigned char* sha, uint64_t& offset) const;
+    // The same lookup, giving the object's position in idx order
+    bool find_index(const unsigned char* sha, uint32_t& index) const;
+    // Append up to `limit` objects whose hex name starts with `prefix` to
+    // `out`; `lower` is the prefix padded out with zeros
+    void find_prefix(const ObjectId& lower, std::string_view prefix, std::vector<ObjectId>& out,
+                     size_t limit) const;
+    // Inflate the object stored at `offset`, resolving delta chains: {fmt, data}
+    std::pair<std::string, std::string> read(uint64_t offset) const;
+    // Type and size only: follows delta chains through entry headers and
+    // inflates just the start of the outermost delta
+    void read_header(uint64_t offset, std::string& fmt, uint64_t& size) const;
+    // Undeltified entries are inflated straight into `sink`; deltas need
+    // their base in memory, so they're resolved first and then chunked
+    void stream(uint64_t offset, const ObjectHeaderFn& on_header, const ObjectSink& sink) const;
+
+    // SHA-1 trailers of the pack and the idx, and the pack checksum the
+    // idx records; throws on a mismatch. Reads both files end to end.
+    void verify_checksums() const;
+    // The pack's own trailing SHA-1, which names it
+    const unsigned char* checksum() const { return pack_ + pack_size_ - 20; }
+
+    const fs::path& idx_path() const { return idx_path_; }
+    const fs::path& pack_path() const { return pack_path_; }
+
+private:
+    struct EntryHeader {
+        int type;
+        uint64_t size;       // Inflated size (of the delta, for delta entries)
+        size_t data_pos;     // Start of the zlib stream
+        uint64_t base_offset;  // For delta entries
+    };
+    EntryHeader parse_header(uint64_t offset) const;
+    std::string inflate_at(size_t pos, uint64_t size) const;
+    std::string inflate_prefix(size_t pos, size_t max) const;
+
+    // Resolved delta bases, keyed by pack offset, evicted least recently used
+    // first once over the byte budget. Long chains through the same base then
+    // inflate it only once.
+    struct CachedBase {
+        int type;
+        std::shared_ptr<const std::string> data;
+        std::list<uint64_t>::iterator lru;
+    };
+    bool cache_get(uint64_t offset, int& type, std::shared_ptr<const std::string>& data) const;
+    void cache_put(uint64_t offset, int type, std::shared_ptr<const std::string> data) const;
+    mutable std::mutex cache_mu_;
+    mutable std::unordered_map<uint64_t, CachedBase> cache_;
+    mutable std::list<uint64_t> cache_lru_;  // Most recent at the front
+    mutable size_t cache_bytes_ = 0;
+
+    fs::path idx_path_;
+    fs::path pack_path_;
+    const unsigned char* idx_ = nullptr;
+    size_t idx_size_ = 0;
+    const unsigned char* pack_ = nullptr;
+    size_t pack_size_ = 0;
+    uint32_t count_ = 0;
+    const unsigned char* fanout_ = nullptr;
+    const unsigned char* names_ = nullptr;
+    const unsigned char* offsets_ = nullptr;
+    const unsigned char* large_offsets_ = nullptr;
+};
+
+// Packs under objects/pack, mapped once per process. Pass reload after
+// packs were added or removed.
+std::vector<std::shared_ptr<PackFile>> pack_list(const GitRepository& repo, bool reload = false);
+
+// Look an object up in every pack. Returns false if no pack has it.
+bool pack_read_object(const GitRepository& repo, const std::string& sha, std::string& fmt, std::string& data);
+bool pack_has_object(const GitRepository& repo, const std::string& sha);
+bool pack_read_stream(const GitRepository& repo, const std::string& sha, const ObjectHeaderFn& on_header,
+                      const ObjectSink& sink);
+bool pack_read_header(const GitRepository& repo, const std::string& sha, std::string& fmt, uint64_t& size);
+
+// Streams objects into objects/pack/tmp_pack_*, then writes the .idx and
+// moves both to pack-<checksum>.{pack,idx} on finish()
+class PackWriter {
+public:
+    explicit PackWriter(const GitRepository& repo);
+    ~PackWriter();
+    PackWriter(const PackWriter&) = delete;
+    PackWriter& operator=(const PackWriter&) = delete;
+
+    void add(const std::string& sha, const std::string& fmt, const std::string& data);
+    // Store `sha` as a delta against `base_sha`, which must already have been
+    // added. OFS_DELTA points at the base by pack offset, REF_DELTA by SHA.
+    void add_delta(const std::string& sha, const std::string& base_sha, const std::string& delta, bool ofs_delta);
+    uint32_t count() const { return static_cast<uint32_t>(entries_.size()); }
+    uint64_t bytes() const { return offset_; }
+    // Reads back an object add()ed earlier, before the pack is finished.
+    // Returns false if it wasn't written here; throws for deltas.
+    bool read(const std::string& sha, std::string& fmt, std::string& data);
+    // Returns the path of the finished .pack
+    fs::path finish();
+
+private:
+    struct Entry {
+        unsigned char sha[20];
+        uint64_t offset;
+        uint32_t crc;
+    };
+
+    void write_raw(const void* data, size_t len, uint32_t* crc);
+    void flush();
+    void write_fd(const void* data, size_t len);
+    void write_entry(const std::string& sha, int type, const std::string& base, const std::string& payload);
+
+    fs::path pack_dir_;
+    CompressionPolicy policy_;
+    std::string tmp_path_;
+    int fd_ = -1;
+    uint64_t offset_ = 0;  // Including what's still in buffer_
+    std::string buffer_;
+    static constexpr size_t WRITE_BUFFER = 1 << 20;
+    std::vector<Entry> entries_;
+    std::unordered_map<std::string, uint64_t> offsets_;  // SHA -> pack offset, for OFS_DELTA
+};
+
+// Delta search settings for pack_objects
+struct PackOptions {
+    unsigned window = 10;    // Candidate bases tried per object
+    unsigned depth = 50;     // Longest delta chain allowed
+    bool ofs_delta = true;   // OFS_DELTA (default) or REF_DELTA entries
+};
+
+struct PackStats {
+    uint32_t objects = 0;
+    uint32_t deltas = 0;
+};
+
+// Write `shas` into `writer`. Objects are sorted by type, path-name hash
+// and size so similar objects end up close together, then each object is
+// tried as a delta against the previous `window` objects of the same type.
+PackStats pack_objects(const GitRepository& repo, const std::vector<std::string>& shas,
+                       PackWriter& writer, const PackOptions& opts);
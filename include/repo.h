@@ -1,6 +1,14 @@
 #pragma once
 #include <string>
+#include <map>
+#include <cstdint>
+#include <cstddef>
 #include <filesystem>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_set>
+#include <vector>
 #include "git_objects.h"
 
 namespace fs = std::filesystem;
@@ -12,30 +20,135 @@ public:
     GitRepository(const fs::path& path, bool create = false);
     static GitRepository create(const fs::path& path);
     static GitRepository find(const fs::path& path = ".");
+
+    // Settings from .git/config, keyed "section.key" in lower case
+    std::map<std::string, std::string> config;
+    std::string config_get(const std::string& key, const std::string& def = "") const;
+    // Integer setting with optional k/m/g suffix
+    uint64_t config_get_size(const std::string& key, uint64_t def) const;
     // Other members...
 };
 
+// Command-line `-c section.key=value` settings, applied on top of
+// .git/config by every GitRepository constructed afterwards
+void config_override(const std::string& assignment);
+
+// Chunk size used when streaming object payloads through SHA-1 and zlib
+constexpr size_t STREAM_CHUNK = 64 * 1024;
+
+// New loose objects go to a temp file that is linked into place, never
+// over an existing object. How durable that is comes from core.fsyncObjects:
+//   none     (default) leave write-back to the OS
+//   object   fsync each object file, then its objects/xx directory
+//   batch    objects written while an ObjectWriteBatch is open are held
+//            back until commit(): their write-back starts as each one is
+//            closed, commit() fsyncs them all, then links them into place
+//            and fsyncs each directory once.
+//            Outside a batch this behaves like "object".
+// Git's core.fsyncObjectFiles=true is read as "object".
+class ObjectWriteBatch {
+public:
+    explicit ObjectWriteBatch(const GitRepository& repo);
+    // Commits, unless we're unwinding from an exception; then the pending
+    // objects are dropped
+    ~ObjectWriteBatch();
+    ObjectWriteBatch(const ObjectWriteBatch&) = delete;
+    ObjectWriteBatch& operator=(const ObjectWriteBatch&) = delete;
+    void commit();
+
+    // For LooseObjectWriter: the batch open in this process, if any
+    static ObjectWriteBatch* active();
+    bool add(const ObjectId& id, const std::string& tmp_path, const std::string& path);
+    bool contains(const ObjectId& id);
+
+private:
+    struct Pending {
+        std::string tmp_path;
+        std::string path;
+    };
+    bool owner_ = false;
+    std::mutex mutex_;
+    std::vector<Pending> pending_;
+    std::unordered_set<ObjectId> ids_;
+};
+
 // Utility functions
 fs::path repo_path(const GitRepository& repo, const std::vector<std::string>& parts);
 fs::path repo_file(const GitRepository& repo, const std::vector<std::string>& parts, bool mkdir = false);
 fs::path repo_dir(const GitRepository& repo, const std::vector<std::string>& parts, bool mkdir = false);
 
 // Object functions
+std::pair<std::string, std::string> read_object_fmt_and_data(const GitRepository& repo, const std::string& sha);
 std::string object_read(const GitRepository& repo, const std::string& sha);
+// Type and size without the payload; false if there's no such object
+bool object_read_header(const GitRepository& repo, const std::string& sha, std::string& fmt, uint64_t& size);
+// Streaming read: `on_header` runs once with the type and declared size,
+// then `sink` gets the payload in order, STREAM_CHUNK bytes at a time. The
+// size and SHA-1 are checked as the data goes by; a mismatch throws after
+// the last chunk. Loose objects and undeltified pack entries never sit
+// whole in memory.
+using ObjectHeaderFn = std::function<void(const std::string& fmt, uint64_t size)>;
+using ObjectSink = std::function<void(const char* data, size_t len)>;
+void object_read_stream(const GitRepository& repo, const std::string& sha, const ObjectHeaderFn& on_header,
+                        const ObjectSink& sink);
 std::string object_write(GitObject* obj, GitRepository* repo = nullptr);
+// True if the object is in a pack or stored loose (not checked for damage)
+bool object_exists(const GitRepository& repo, const std::string& sha);
 std::string object_find(const GitRepository& repo, const std::string& name, const std::string& fmt = "", bool follow = true);
+// Thrown by object_find for a short SHA that matches more than one object
+class AmbiguousObjectName : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
 std::string object_hash(std::istream& fd, const std::string& fmt, GitRepository* repo = nullptr);
+std::string object_hash_stream(std::istream& fd, uint64_t size, const std::string& fmt, GitRepository* repo = nullptr);
+std::string object_hash_file(const fs::path& path, const std::string& fmt, GitRepository* repo = nullptr);
+std::vector<std::string> loose_objects(const GitRepository& repo);
 
 // Tree and checkout helpers (new)
-std::string write_tree(const GitRepository& repo, const fs::path& dir);
+std::string write_tree(const GitRepository& repo, const fs::path& dir, unsigned jobs = 0);
 void read_tree(const GitRepository& repo, const std::string& tree_sha, const fs::path& base_path);
+struct CheckoutStats {
+    uint64_t written = 0;
+    uint64_t deleted = 0;
+    uint64_t skipped = 0;  // Unchanged entries; an unchanged subtree counts once
+    // Changed entries the new filter left out: subtrees never read, and
+    // files (and their bytes) never written
+    uint64_t trees_pruned = 0;
+    uint64_t files_excluded = 0;
+    uint64_t bytes_excluded = 0;
+};
+class TreeFilter;
+// The worktree holds old_tree as old_filter allowed; afterwards it holds
+// new_tree as new_filter allows (nullptr: everything). Files missing from the
+// worktree or changed in it are written again. If that would lose local
+// changes to a file the two trees differ in (or an untracked file in the
+// way), nothing is touched and it throws, unless `force`.
+CheckoutStats checkout_tree(const GitRepository& repo, const std::string& old_tree, const std::string& new_tree,
+                            const fs::path& base_path, unsigned jobs = 0, const TreeFilter* old_filter = nullptr,
+                            const TreeFilter* new_filter = nullptr, bool force = false);
+std::string head_commit(const GitRepository& repo);
+// HEAD's commit and every ref under refs/ (duplicates included)
+std::vector<std::string> ref_tips(const GitRepository& repo);
+std::string commit_tree_sha(const GitRepository& repo, const std::string& commit_sha);
 
 // Commands (bridges)
 void cmd_init(const std::vector<std::string>& args);
 void cmd_hash_object(const std::vector<std::string>& args);
 void cmd_cat_file(const std::vector<std::string>& args);
 void cmd_write_tree(const std::vector<std::string>& args);
+void cmd_status(const std::vector<std::string>& args);
+void cmd_fsmonitor(const std::vector<std::string>& args);
 void cmd_commit_tree(const std::vector<std::string>& args);
 void cmd_ls_tree(const std::vector<std::string>& args);
+void cmd_diff_tree(const std::vector<std::string>& args);
 void cmd_log(const std::vector<std::string>& args);
-void cmd_checkout(const std::vector<std::string>& args);
\ No newline at end of file
+void cmd_checkout(const std::vector<std::string>& args);
+void cmd_repack(const std::vector<std::string>& args);
+void cmd_commit_graph(const std::vector<std::string>& args);
+void cmd_rev_list(const std::vector<std::string>& args);
+void cmd_count_objects(const std::vector<std::string>& args);
+void cmd_merge_base(const std::vector<std::string>& args);
+void cmd_fast_import(const std::vector<std::string>& args);
+void cmd_fsck(const std::vector<std::string>& args);
+void cmd_archive(const std::vector<std::string>& args);
\ No newline at end of file
@@ -0,0 +1,51 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "object_id.h"
+
+typedef struct evp_md_ctx_st EVP_MD_CTX;
+
+// SHA-1 implementations, picked at runtime from what the CPU supports:
+//   shani    x86 SHA extensions, one message at a time
+//   avx2     8 messages at once in AVX2 lanes (sha1_many); single messages
+//            go through shani if present, otherwise OpenSSL
+//   openssl  EVP, always available
+// GITLITE_SHA1=<name> forces a backend; an unavailable one falls back to
+// openssl with a warning.
+enum class Sha1Backend { OPENSSL, SHANI, AVX2 };
+
+bool sha1_backend_available(Sha1Backend backend);
+const char* sha1_backend_name(Sha1Backend backend);
+// Active backend: GITLITE_SHA1 if set, else the fastest available
+Sha1Backend sha1_backend();
+
+// Incremental SHA-1
+class Sha1 {
+public:
+    explicit Sha1(Sha1Backend backend = sha1_backend());
+    ~Sha1();
+    Sha1(const Sha1&) = delete;
+    Sha1& operator=(const Sha1&) = delete;
+
+    void update(const void* data, size_t len);
+    ObjectId finish();
+
+private:
+    void (*compress_)(uint32_t* state, const unsigned char* blocks, size_t count) = nullptr;
+    EVP_MD_CTX* evp_ = nullptr;  // When there is no native compress function
+    uint32_t state_[5];
+    unsigned char buf_[64];
+    size_t buf_len_ = 0;
+    uint64_t total_ = 0;
+};
+
+ObjectId sha1(const void* data, size_t len, Sha1Backend backend = sha1_backend());
+
+// Hash `count` independent messages into out[0..count). The avx2 backend
+// hashes up to 8 at a time, batching messages of similar length together;
+// the others hash one after another.
+struct Sha1Message {
+    const void* data;
+    size_t len;
+};
+void sha1_many(const Sha1Message* messages, size_t count, ObjectId* out, Sha1Backend backend = sha1_backend());
@@ -0,0 +1,44 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "ignore.h"
+#include "tree_diff.h"
+
+// Which paths a checkout puts in the worktree. Patterns are Git's
+// sparse-checkout file (.gitignore syntax, but a match means "check it
+// out"): a path is in if the last pattern matching it isn't negated, and
+// a path no pattern matches goes with its closest matching parent folder.
+// Pathspecs narrow it further: a path is only in if it is, or is inside,
+// one of them (or matches one with a wildcard, '*' crossing '/' as in Git).
+class SparseFilter : public TreeFilter {
+public:
+    // .git/info/sparse-checkout, or nullptr if there isn't one
+    static std::unique_ptr<SparseFilter> load(const GitRepository& repo);
+    static std::unique_ptr<SparseFilter> from_patterns(std::string text);
+
+    // Everything, narrowed to the pathspecs; copies the patterns of `base`
+    // if there is one
+    static std::unique_ptr<SparseFilter> from_pathspecs(const SparseFilter* base, std::vector<std::string> pathspecs);
+
+    bool includes(const std::string& path, bool is_dir) const override;
+    bool prunes(const std::string& path) const override;
+
+    // The patterns as read, "" with only pathspecs
+    const std::string& text() const { return text_; }
+
+private:
+    SparseFilter() = default;
+    bool pattern_includes(std::string_view path, bool is_dir) const;
+    bool pathspec_includes(const std::string& path) const;
+    bool pathspec_prunes(const std::string& path) const;
+
+    bool has_patterns_ = false;
+    std::string text_;
+    IgnoreRules rules_;
+    std::vector<std::string> pathspecs_;
+};
+
+// Makes `filter` the one later checkouts use, or removes the file for nullptr
+void sparse_save(const GitRepository& repo, const SparseFilter* filter);
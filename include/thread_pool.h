@@ -0,0 +1,55 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool. Each worker owns a deque: it pushes and pops its
+// own tasks at the back (LIFO, cache-warm) and idle workers steal from the
+// front of other deques (FIFO, oldest and usually largest work first).
+// Tasks may submit further tasks. With threads <= 1 no workers are started
+// and tasks run inline on the submitting thread, which is the serial path.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned threads);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task);
+    // Block until every submitted task (including ones they spawned) finished.
+    // Rethrows the first exception raised by a task; later tasks are skipped.
+    void wait();
+    unsigned size() const { return static_cast<unsigned>(workers_.size()); }
+
+    // Number of hardware threads, at least 1
+    static unsigned default_threads();
+
+private:
+    struct Queue {
+        std::mutex mu;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void run(size_t self);
+    bool try_pop(size_t self, std::function<void()>& task);
+    void execute(std::function<void()>& task);
+    void finish_one();
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::mutex mu_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    size_t queued_ = 0;             // Guarded by mu_
+    std::atomic<size_t> pending_{0};  // Queued plus running
+    std::atomic<size_t> next_{0};     // Round-robin target for external submits
+    std::atomic<bool> failed_{false};
+    std::exception_ptr error_;
+    bool stop_ = false;
+};
@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include "repo.h"
+
+// One difference between two trees. A path whose type changed (file <->
+// directory) is reported as a deletion and a separate addition, as Git does;
+// the two aren't necessarily next to each other.
+struct TreeChange {
+    char status;           // 'A' added, 'D' deleted, 'M' modified (content or mode)
+    std::string path;      // Relative to the diffed trees, '/'-separated
+    uint32_t old_mode = 0;  // 0 on the side the entry is missing from
+    uint32_t new_mode = 0;
+    std::string old_sha;   // "" on the side the entry is missing from
+    std::string new_sha;
+    bool is_tree() const { return (status == 'D' ? old_mode : new_mode) == 040000; }
+};
+
+// Called for every changed entry, subtrees included. For a subtree,
+// returning true walks into it: its entries are reported under the
+// subtree's path (all 'A' or all 'D' for an added or deleted one).
+using TreeChangeFn = std::function<bool(const TreeChange&)>;
+
+// Limits a diff to part of the tree, as a sparse checkout does. Paths are
+// '/'-separated and relative to the diffed trees.
+class TreeFilter {
+public:
+    virtual ~TreeFilter() = default;
+    virtual bool includes(const std::string& path, bool is_dir) const = 0;
+    // True if nothing inside directory `path` can be included, so the
+    // subtree doesn't need reading at all
+    virtual bool prunes(const std::string& path) const = 0;
+};
+
+struct TreeDiffStats {
+    uint64_t trees_read = 0;
+    uint64_t unchanged = 0;  // Equal entries; an unchanged subtree counts once and is never read
+    // New-side entries a filter left out (a pruned subtree counts once)
+    uint64_t trees_pruned = 0;
+    uint64_t files_excluded = 0;
+    uint64_t bytes_excluded = 0;
+};
+
+// Merge-walk the two trees' entries in Git's tree order. Entries with the
+// same name, type and SHA are skipped without reading them, so the cost
+// follows the number of changed paths rather than the size of the trees.
+// Either SHA may be "" for an empty tree.
+//
+// With filters, each side only has the entries its filter includes, and
+// pruned subtrees are never read. When the two filters differ, equal
+// subtrees can still differ after filtering, so they're reported as 'M'
+// and walked unless both sides prune them.
+TreeDiffStats tree_diff(const GitRepository& repo, const std::string& old_tree, const std::string& new_tree,
+                        const TreeChangeFn& fn, const TreeFilter* old_filter = nullptr,
+                        const TreeFilter* new_filter = nullptr);
+
+void tree_diff_print_stats(std::ostream& out);
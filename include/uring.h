@@ -0,0 +1,82 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+// How bulk file I/O is done. With io_uring, a whole batch of files is
+// opened, read or written and closed with a single io_uring_enter() instead
+// of three or four syscalls each. Picked once per process: GITLITE_IO=sync
+// or uring forces one, otherwise io_uring is used when the kernel has it.
+enum class IoBackend { SYNC, URING };
+
+IoBackend io_backend();
+const char* io_backend_name(IoBackend backend);
+
+// An io_uring on the raw syscalls (no liburing). Each file goes through a
+// chain of open -> read/write -> close on one of the ring's registered file
+// slots, so a batch is as big as the number of slots. Not thread-safe: one
+// thread submits and waits.
+class IoRing {
+public:
+    // nullptr if this kernel can't do it (too old, io_uring disabled or
+    // blocked by seccomp)
+    static std::unique_ptr<IoRing> create(unsigned slots = 128);
+    ~IoRing();
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    // Files per batch
+    unsigned slots() const { return slots_; }
+
+    struct Read {
+        const char* path;
+        unsigned char* buf;
+        uint32_t cap;
+        int64_t result = 0;  // Bytes read (cap means there may be more), or -errno
+    };
+    // Reads up to `cap` bytes from the start of each file; n <= slots()
+    void read_files(Read* files, size_t n);
+
+    struct Write {
+        const char* path;
+        const char* data;
+        uint32_t len;
+        int64_t result = 0;  // 0 once the file is written and closed, or -errno
+    };
+    // Creates or truncates each file (mode 0666 before umask) and writes
+    // `data` to it; n <= slots()
+    void write_files(Write* files, size_t n);
+
+private:
+    IoRing() = default;
+    // Queues open -> read/write -> close for file `i` in slot `i`
+    void queue_chain(unsigned i, const char* path, int flags, uint8_t op, const void* buf, uint32_t len);
+    // Submits everything queued and reaps one completion per operation
+    // into opened_/transferred_/closed_
+    void run(size_t files);
+
+    int fd_ = -1;
+    unsigned slots_ = 0;
+    unsigned queued_ = 0;
+    bool counted_ = false;  // The self-test in create() stays out of the stats
+    void* sq_map_ = nullptr;
+    size_t sq_map_size_ = 0;
+    void* cq_map_ = nullptr;
+    size_t cq_map_size_ = 0;
+    struct io_uring_sqe* sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_mask_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned* cq_mask_ = nullptr;
+    struct io_uring_cqe* cqes_ = nullptr;
+    // Per-file results of the last batch
+    std::vector<int32_t> opened_, transferred_, closed_;
+};
+
+// Batches, operations and io_uring_enter calls, for GITLITE_STATS
+void uring_print_stats(std::ostream& out);
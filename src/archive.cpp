@@ -0,0 +1,430 @@
+#include "archive.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <zlib.h>
+#include <unistd.h>
+#include "git_objects.h"
+#include "thread_pool.h"
+
+static constexpr size_t TAR_BLOCK = 512;
+// Git pads the archive to a whole tar record of 20 blocks
+static constexpr size_t TAR_RECORD = 20 * TAR_BLOCK;
+static constexpr size_t OUT_BUFFER = 1 << 20;
+// Input per compression job, as in pigz, and the window each job is primed with
+static constexpr size_t GZIP_BLOCK = 128 * 1024;
+static constexpr size_t GZIP_DICT = 32 * 1024;
+
+namespace {
+
+// Where the archive bytes go: straight to the fd, or through gzip first
+class ArchiveSink {
+public:
+    virtual ~ArchiveSink() = default;
+    virtual void write(const char* data, size_t len) = 0;
+    virtual void finish() = 0;
+};
+
+// write(2) in OUT_BUFFER pieces; big writes skip the buffer
+class FdSink : public ArchiveSink {
+public:
+    explicit FdSink(int fd) : fd_(fd) { buf_.reserve(OUT_BUFFER); }
+    void write(const char* data, size_t len) override {
+        if (buf_.size() + len > OUT_BUFFER) flush();
+        if (len >= OUT_BUFFER) {
+            write_all(data, len);
+        } else {
+            buf_.append(data, len);
+        }
+    }
+    void finish() override { flush(); }
+    uint64_t written() const { return written_; }
+
+private:
+    void flush() {
+        write_all(buf_.data(), buf_.size());
+        buf_.clear();
+    }
+    void write_all(const char* data, size_t len) {
+        written_ += len;
+        while (len > 0) {
+            ssize_t n = ::write(fd_, data, len);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) throw std::runtime_error(std::string("Failed to write archive: ") + std::strerror(errno));
+            data += n;
+            len -= static_cast<size_t>(n);
+        }
+    }
+
+    int fd_;
+    std::string buf_;
+    uint64_t written_ = 0;
+};
+
+// One GZIP_BLOCK of input on its way through the pool
+struct GzipBlock {
+    std::string in;
+    std::string dict;   // The GZIP_DICT bytes of input before this block
+    std::string out;
+    uLong crc = 0;
+    bool last = false;
+    std::mutex mu;
+    std::condition_variable cv;
+    bool done = false;
+    std::exception_ptr error;
+};
+
+// Raw deflate stream per worker thread, reset between blocks
+struct RawDeflate {
+    z_stream zs{};
+    int level = 0;
+    bool ready = false;
+    ~RawDeflate() {
+        if (ready) deflateEnd(&zs);
+    }
+};
+
+static void gzip_compress(GzipBlock& block, int level) {
+    static thread_local RawDeflate raw;
+    if (raw.ready && raw.level != level) {
+        deflateEnd(&raw.zs);
+        raw.ready = false;
+    }
+    if (!raw.ready) {
+        raw.zs = z_stream{};
+        if (deflateInit2(&raw.zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            throw std::runtime_error("zlib deflateInit error");
+        }
+        raw.level = level;
+        raw.ready = true;
+    } else {
+        deflateReset(&raw.zs);
+    }
+    z_stream& zs = raw.zs;
+    if (!block.dict.empty()) {
+        deflateSetDictionary(&zs, reinterpret_cast<const Bytef*>(block.dict.data()),
+                             static_cast<uInt>(block.dict.size()));
+    }
+    block.crc = crc32(0, reinterpret_cast<const Bytef*>(block.in.data()), static_cast<uInt>(block.in.size()));
+
+    // Every block but the last ends on a byte boundary with a sync flush,
+    // so the pieces join into one deflate stream
+    int flush = block.last ? Z_FINISH : Z_SYNC_FLUSH;
+    block.out.resize(deflateBound(&zs, block.in.size()) + 64);
+    zs.next_in = reinterpret_cast<Bytef*>(block.in.data());
+    zs.avail_in = static_cast<uInt>(block.in.size());
+    size_t have = 0;
+    for (;;) {
+        zs.next_out = reinterpret_cast<Bytef*>(block.out.data() + have);
+        zs.avail_out = static_cast<uInt>(block.out.size() - have);
+        int ret = deflate(&zs, flush);
+        if (ret == Z_STREAM_ERROR) throw std::runtime_error("zlib deflate error");
+        have = block.out.size() - zs.avail_out;
+        if (ret == Z_STREAM_END || (!block.last && zs.avail_out > 0 && zs.avail_in == 0)) break;
+        block.out.resize(block.out.size() * 2);
+    }
+    block.out.resize(have);
+}
+
+// gzip with the deflating spread over a thread pool. Blocks are handed out
+// as they fill and written back in order; at most a few per thread are in
+// flight, which bounds the memory used.
+class GzipSink : public ArchiveSink {
+public:
+    GzipSink(FdSink& out, int level, unsigned jobs, uint64_t mtime)
+        : out_(out), level_(level), pool_(jobs), max_in_flight_(std::max(2u, pool_.size() * 4)) {
+        unsigned char header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};  // deflate, no flags, Unix
+        for (int i = 0; i < 4; ++i) header[4 + i] = static_cast<unsigned char>(mtime >> (8 * i));
+        if (level == 9) header[8] = 2;
+        if (level == 1) header[8] = 4;
+        out_.write(reinterpret_cast<const char*>(header), sizeof(header));
+        cur_.reserve(GZIP_BLOCK);
+    }
+    ~GzipSink() override {
+        // On an error, let the jobs still running finish with their blocks
+        try {
+            pool_.wait();
+        } catch (...) {
+        }
+    }
+
+    void write(const char* data, size_t len) override {
+        while (len > 0) {
+            size_t n = std::min(len, GZIP_BLOCK - cur_.size());
+            cur_.append(data, n);
+            data += n;
+            len -= n;
+            if (cur_.size() == GZIP_BLOCK) submit(false);
+        }
+    }
+
+    void finish() override {
+        submit(true);
+        drain(true);
+        unsigned char trailer[8];
+        for (int i = 0; i < 4; ++i) {
+            trailer[i] = static_cast<unsigned char>(crc_ >> (8 * i));
+            trailer[4 + i] = static_cast<unsigned char>(total_ >> (8 * i));
+        }
+        out_.write(reinterpret_cast<const char*>(trailer), sizeof(trailer));
+        out_.finish();
+    }
+
+private:
+    void submit(bool last) {
+        auto block = std::make_shared<GzipBlock>();
+        block->dict = std::move(dict_);
+        block->last = last;
+        if (!last) dict_.assign(cur_, cur_.size() - std::min(cur_.size(), GZIP_DICT), std::string::npos);
+        block->in = std::move(cur_);
+        cur_.clear();
+        cur_.reserve(GZIP_BLOCK);
+        in_flight_.push_back(block);
+        pool_.submit([block, level = level_] {
+            try {
+                gzip_compress(*block, level);
+            } catch (...) {
+                block->error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(block->mu);
+            block->done = true;
+            block->cv.notify_one();
+        });
+        drain(false);
+    }
+
+    // Writes finished blocks from the front; waits for them once too many
+    // are in flight, or for all of them at the end
+    void drain(bool all) {
+        while (!in_flight_.empty()) {
+            GzipBlock& block = *in_flight_.front();
+            {
+                std::unique_lock<std::mutex> lock(block.mu);
+                if (!block.done && !all && in_flight_.size() <= max_in_flight_) return;
+                block.cv.wait(lock, [&] { return block.done; });
+            }
+            if (block.error) std::rethrow_exception(block.error);
+            crc_ = crc32_combine(crc_, block.crc, static_cast<z_off_t>(block.in.size()));
+            total_ += block.in.size();
+            out_.write(block.out.data(), block.out.size());
+            in_flight_.pop_front();
+        }
+    }
+
+    FdSink& out_;
+    int level_;
+    ThreadPool pool_;
+    size_t max_in_flight_;
+    std::deque<std::shared_ptr<GzipBlock>> in_flight_;
+    std::string cur_;
+    std::string dict_;
+    uLong crc_ = crc32(0, nullptr, 0);
+    uint64_t total_ = 0;
+};
+
+// Whether `value` fits in a `width`-byte octal field (digits and a NUL)
+static bool tar_octal_fits(size_t width, uint64_t value) {
+    return (value >> (3 * (width - 1))) == 0;
+}
+
+// Octal, zero-padded to fill `width` - 1 digits and a NUL. Callers move
+// values that don't fit into pax records first; anything else is a bug
+static void tar_octal(char* field, size_t width, uint64_t value) {
+    if (!tar_octal_fits(width, value)) throw std::runtime_error("Value too large for a tar header field");
+    field[width - 1] = '\0';
+    for (size_t i = width - 1; i-- > 0; value >>= 3) field[i] = static_cast<char>('0' + (value & 7));
+}
+
+// One "<len> <key>=<value>\n" pax record; the length counts itself
+static void pax_record(std::string& out, const std::string& key, const std::string& value) {
+    size_t len = key.size() + value.size() + 3;
+    size_t digits = std::to_string(len).size();
+    while (std::to_string(len + digits).size() != digits) ++digits;
+    out += std::to_string(len + digits) + ' ' + key + '=' + value + '\n';
+}
+
+class TarWriter {
+public:
+    TarWriter(ArchiveSink& sink, uint64_t mtime) : sink_(sink), mtime_(mtime) {}
+
+    // A pax global header, as Git writes for a commit
+    void global_comment(const std::string& comment) {
+        std::string records;
+        pax_record(records, "comment", comment);
+        pax_header("pax_global_header", 'g', records);
+    }
+
+    // Header for `path`; a regular file's `size` bytes follow through data()
+    void entry(const std::string& path, char type, uint32_t mode, uint64_t size, const std::string& link = "") {
+        char header[TAR_BLOCK] = {};
+        std::string records;
+        // ustar holds 100 bytes of name, with up to 155 more in front of a '/'
+        bool fits = path.size() <= 100;
+        if (!fits && path.size() <= 256) {
+            size_t split = path.rfind('/', std::min<size_t>(path.size() - 1, 155));
+            if (split != std::string::npos && split > 0 && path.size() - split - 1 <= 100) {
+                std::memcpy(header + 345, path.data(), split);
+                std::memcpy(header, path.data() + split + 1, path.size() - split - 1);
+                fits = true;
+            }
+        }
+        if (!fits) {
+            pax_record(records, "path", path);
+            std::memcpy(header, path.data(), 100);
+        } else if (path.size() <= 100) {
+            std::memcpy(header, path.data(), path.size());
+        }
+        if (link.size() > 100) pax_record(records, "linkpath", link);
+        std::memcpy(header + 157, link.data(), std::min<size_t>(link.size(), 100));
+        // 11 octal digits stop just short of 8 GiB, or the year 2242
+        bool big = !tar_octal_fits(12, size);
+        if (big) pax_record(records, "size", std::to_string(size));
+        if (!tar_octal_fits(12, mtime_)) pax_record(records, "mtime", std::to_string(mtime_));
+        if (!records.empty()) pax_header("././@PaxHeader", 'x', records);
+
+        tar_octal(header + 100, 8, mode);
+        tar_octal(header + 108, 8, 0);
+        tar_octal(header + 116, 8, 0);
+        tar_octal(header + 124, 12, big ? 0 : size);
+        tar_octal(header + 136, 12, ustar_mtime());
+        header[156] = type;
+        finish_header(header);
+        pending_ = size;
+    }
+
+    void data(const char* data, size_t len) {
+        if (len > pending_) throw std::runtime_error("Blob is longer than its header says");
+        pending_ -= len;
+        written_ += len;
+        sink_.write(data, len);
+    }
+
+    // Pads the last entry's data out to a whole block
+    void end_entry() {
+        if (pending_ != 0) throw std::runtime_error("Blob is shorter than its header says");
+        static const char zeros[TAR_BLOCK] = {};
+        size_t pad = (TAR_BLOCK - written_ % TAR_BLOCK) % TAR_BLOCK;
+        sink_.write(zeros, pad);
+        written_ += pad;
+    }
+
+    // Two empty blocks, then padding to a whole record
+    void finish() {
+        static const char zeros[TAR_RECORD] = {};
+        size_t end = written_ + 2 * TAR_BLOCK;
+        end += (TAR_RECORD - end % TAR_RECORD) % TAR_RECORD;
+        sink_.write(zeros, end - written_);
+        written_ = end;
+        sink_.finish();
+    }
+
+private:
+    // An mtime past the ustar field goes in a pax record; the field gets 0
+    uint64_t ustar_mtime() const { return tar_octal_fits(12, mtime_) ? mtime_ : 0; }
+
+    void pax_header(const char* name, char type, const std::string& records) {
+        char header[TAR_BLOCK] = {};
+        std::memcpy(header, name, std::strlen(name));
+        tar_octal(header + 100, 8, 0666);
+        tar_octal(header + 108, 8, 0);
+        tar_octal(header + 116, 8, 0);
+        tar_octal(header + 124, 12, records.size());
+        tar_octal(header + 136, 12, ustar_mtime());
+        header[156] = type;
+        finish_header(header);
+        pending_ = records.size();
+        data(records.data(), records.size());
+        end_entry();
+    }
+
+    void finish_header(char* header) {
+        std::memcpy(header + 257, "ustar", 6);
+        std::memcpy(header + 263, "00", 2);
+        std::memcpy(header + 265, "root", 4);
+        std::memcpy(header + 297, "root", 4);
+        // The checksum is taken with its own field as spaces
+        std::memset(header + 148, ' ', 8);
+        unsigned sum = 0;
+        for (size_t i = 0; i < TAR_BLOCK; ++i) sum += static_cast<unsigned char>(header[i]);
+        std::snprintf(header + 148, 8, "%06o", sum);
+        header[155] = ' ';
+        sink_.write(header, TAR_BLOCK);
+        written_ += TAR_BLOCK;
+    }
+
+    ArchiveSink& sink_;
+    uint64_t mtime_;
+    uint64_t pending_ = 0;
+    uint64_t written_ = 0;
+};
+
+struct ArchiveWalk {
+    const GitRepository& repo;
+    TarWriter& tar;
+    ArchiveStats& stats;
+
+    void tree(const std::string& sha, const std::string& base) {
+        auto [fmt, data] = read_object_fmt_and_data(repo, sha);
+        if (fmt != "tree") throw std::runtime_error("Not a tree object: " + sha);
+        for (const auto& item : GitTree::parse(data).items) {
+            std::string path = base + item.path;
+            if (item.mode == 040000 || item.mode == 0160000) {
+                // A submodule comes out as an empty folder, as in Git
+                tar.entry(path + '/', '5', 0775, 0);
+                ++stats.dirs;
+                if (item.mode == 040000) tree(item.sha, path + '/');
+            } else if (item.mode == 0120000) {
+                std::string target = object_read(repo, item.sha);
+                tar.entry(path, '2', 0777, 0, target);
+                ++stats.files;
+            } else {
+                uint32_t mode = item.mode & 0111 ? 0775 : 0664;
+                object_read_stream(
+                    repo, item.sha,
+                    [&](const std::string& blob_fmt, uint64_t size) {
+                        if (blob_fmt != "blob") throw std::runtime_error("Not a blob object: " + item.sha);
+                        tar.entry(path, '0', mode, size);
+                        stats.bytes += size;
+                    },
+                    [&](const char* chunk, size_t len) { tar.data(chunk, len); });
+                tar.end_entry();
+                ++stats.files;
+            }
+        }
+    }
+};
+
+}  // namespace
+
+ArchiveStats archive_tree(const GitRepository& repo, const std::string& tree_sha, const ArchiveOptions& options,
+                          int fd) {
+    auto start = std::chrono::steady_clock::now();
+    ArchiveStats stats;
+    FdSink out(fd);
+    std::unique_ptr<GzipSink> gzip;
+    if (options.format == ArchiveFormat::TAR_GZ) {
+        unsigned jobs = options.jobs ? options.jobs : ThreadPool::default_threads();
+        gzip = std::make_unique<GzipSink>(out, options.level, jobs, options.mtime);
+    }
+    ArchiveSink& sink = gzip ? static_cast<ArchiveSink&>(*gzip) : out;
+    TarWriter tar(sink, options.mtime);
+    if (!options.commit.empty()) tar.global_comment(options.commit);
+    if (!options.prefix.empty() && options.prefix.back() == '/') {
+        tar.entry(options.prefix, '5', 0775, 0);
+        ++stats.dirs;
+    }
+    ArchiveWalk walk{repo, tar, stats};
+    walk.tree(tree_sha, options.prefix);
+    tar.finish();
+    stats.written = out.written();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
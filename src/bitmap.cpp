@@ -0,0 +1,525 @@
+#include "bitmap.h"
+#include "commit_graph.h"
+#include "object_cache.h"
+#include "sha1.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <unordered_set>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const uint16_t BITMAP_VERSION = 1;
+static const uint16_t BITMAP_OPT_FULL_DAG = 0x1;  // Every bitmap is a full closure; Git requires it
+static const uint32_t MAX_XOR_OFFSET = 160;       // How far back Git lets an entry point
+static const uint32_t XOR_WINDOW = 10;            // Earlier entries tried as XOR bases when writing
+static const uint32_t MAX_XOR_DEPTH = 16;         // Longest chain of XORs a reader resolves
+static const uint64_t RUN_MAX = 0xffffffffull;
+static const uint64_t LITERALS_MAX = 0x7fffffffull;
+static const uint32_t TREE_MODE = 040000;
+static const uint32_t GITLINK_MODE = 0160000;
+
+// Bitmaps ORed in vs. commits walked by bitmap_reachable, process-wide
+static uint64_t bitmaps_used = 0;
+static uint64_t commits_walked = 0;
+
+static uint32_t be32(const unsigned char* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+static uint64_t be64(const unsigned char* p) {
+    return (uint64_t(be32(p)) << 32) | be32(p + 4);
+}
+
+static void put_be16(std::string& out, uint16_t v) {
+    out += static_cast<char>(v >> 8);
+    out += static_cast<char>(v);
+}
+
+static void put_be32(std::string& out, uint32_t v) {
+    char b[4] = {char(v >> 24), char(v >> 16), char(v >> 8), char(v)};
+    out.append(b, 4);
+}
+
+static void put_be64(std::string& out, uint64_t v) {
+    put_be32(out, static_cast<uint32_t>(v >> 32));
+    put_be32(out, static_cast<uint32_t>(v));
+}
+
+void Bitmap::or_with(const Bitmap& other) {
+    if (other.words_.size() > words_.size()) words_.resize(other.words_.size());
+    for (size_t i = 0; i < other.words_.size(); ++i) words_[i] |= other.words_[i];
+}
+
+void Bitmap::xor_with(const Bitmap& other) {
+    if (other.words_.size() > words_.size()) words_.resize(other.words_.size());
+    for (size_t i = 0; i < other.words_.size(); ++i) words_[i] ^= other.words_[i];
+}
+
+uint64_t Bitmap::count() const {
+    uint64_t n = 0;
+    for (uint64_t w : words_) n += __builtin_popcountll(w);
+    return n;
+}
+
+uint64_t Bitmap::count_and(const Bitmap& other) const {
+    uint64_t n = 0;
+    size_t len = std::min(words_.size(), other.words_.size());
+    for (size_t i = 0; i < len; ++i) n += __builtin_popcountll(words_[i] & other.words_[i]);
+    return n;
+}
+
+void Bitmap::for_each(const std::function<void(uint32_t)>& fn) const {
+    for (size_t i = 0; i < words_.size(); ++i) {
+        for (uint64_t w = words_[i]; w; w &= w - 1) fn(static_cast<uint32_t>(i * 64 + __builtin_ctzll(w)));
+    }
+}
+
+std::string ewah_encode(const Bitmap& bits) {
+    const std::vector<uint64_t>& w = bits.words();
+    size_t n = w.size();
+    while (n > 0 && w[n - 1] == 0) --n;
+
+    std::vector<uint64_t> buffer(1, 0);
+    size_t marker = 0;
+    size_t i = 0;
+    while (i < n) {
+        uint64_t run = 0, literals = 0;
+        bool ones = w[i] == ~uint64_t(0);
+        if (w[i] == 0 || ones) {
+            uint64_t fill = w[i];
+            while (i < n && w[i] == fill && run < RUN_MAX) {
+                ++run;
+                ++i;
+            }
+        }
+        while (i < n && w[i] != 0 && w[i] != ~uint64_t(0) && literals < LITERALS_MAX) {
+            buffer.push_back(w[i++]);
+            ++literals;
+        }
+        buffer[marker] = uint64_t(ones) | (run << 1) | (literals << 33);
+        if (i < n) {
+            marker = buffer.size();
+            buffer.push_back(0);
+        }
+    }
+
+    std::string out;
+    out.reserve(12 + 8 * buffer.size());
+    put_be32(out, n == 0 ? 0 : static_cast<uint32_t>((n - 1) * 64 + 64 - __builtin_clzll(w[n - 1])));
+    put_be32(out, static_cast<uint32_t>(buffer.size()));
+    for (uint64_t word : buffer) put_be64(out, word);
+    put_be32(out, static_cast<uint32_t>(marker));
+    return out;
+}
+
+// Bytes taken by the EWAH at `p`
+static size_t ewah_size(const unsigned char* p, size_t len) {
+    if (len < 8) throw std::runtime_error("Corrupt bitmap: truncated EWAH");
+    size_t size = 8 + 8 * size_t(be32(p + 4)) + 4;
+    if (size > len) throw std::runtime_error("Corrupt bitmap: truncated EWAH");
+    return size;
+}
+
+size_t ewah_apply(const unsigned char* p, size_t len, Bitmap& out, bool xor_into) {
+    size_t size = ewah_size(p, len);
+    size_t count = be32(p + 4);
+    const unsigned char* words = p + 8;
+    std::vector<uint64_t>& o = out.words();
+    size_t pos = 0;
+    for (size_t i = 0; i < count;) {
+        uint64_t marker = be64(words + 8 * i++);
+        uint64_t run = (marker >> 1) & RUN_MAX;
+        uint64_t literals = marker >> 33;
+        if (literals > count - i || pos + run + literals > (size_t(1) << 26)) {
+            throw std::runtime_error("Corrupt bitmap: bad EWAH marker");
+        }
+        if (marker & 1) {
+            if (o.size() < pos + run) o.resize(pos + run);
+            for (uint64_t k = 0; k < run; ++k) o[pos + k] = xor_into ? ~o[pos + k] : ~uint64_t(0);
+        }
+        pos += run;
+        if (literals > 0 && o.size() < pos + literals) o.resize(pos + literals);
+        for (uint64_t k = 0; k < literals; ++k, ++pos, ++i) {
+            uint64_t v = be64(words + 8 * i);
+            o[pos] = xor_into ? o[pos] ^ v : o[pos] | v;
+        }
+    }
+    return size;
+}
+
+// Pack order is offset order; the idx lists objects by SHA
+static void pack_order(const PackFile& pack, std::vector<uint32_t>& index_of, std::vector<uint32_t>& pos_of) {
+    uint32_t n = pack.count();
+    std::vector<std::pair<uint64_t, uint32_t>> by_offset(n);
+    for (uint32_t i = 0; i < n; ++i) by_offset[i] = {pack.offset_at(i), i};
+    std::sort(by_offset.begin(), by_offset.end());
+    index_of.resize(n);
+    pos_of.resize(n);
+    for (uint32_t pos = 0; pos < n; ++pos) {
+        index_of[pos] = by_offset[pos].second;
+        pos_of[by_offset[pos].second] = pos;
+    }
+}
+
+static fs::path bitmap_path(const PackFile& pack) {
+    fs::path path = pack.pack_path();
+    return path.replace_extension(".bitmap");
+}
+
+std::unique_ptr<PackBitmap> PackBitmap::open(std::shared_ptr<PackFile> pack) {
+    fs::path path = bitmap_path(*pack);
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) return nullptr;
+        throw std::runtime_error("Failed to open " + path.string());
+    }
+    std::unique_ptr<PackBitmap> bitmap(new PackBitmap());
+    std::string& data = bitmap->data_;
+    struct stat st;
+    if (fstat(fd, &st) == 0) data.resize(static_cast<size_t>(st.st_size));
+    size_t got = 0;
+    while (got < data.size()) {
+        ssize_t n = ::read(fd, &data[got], data.size() - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += static_cast<size_t>(n);
+    }
+    ::close(fd);
+    if (got != data.size()) throw std::runtime_error("Failed to read " + path.string());
+
+    const auto* d = reinterpret_cast<const unsigned char*>(data.data());
+    if (data.size() < 12 + 20 + 20) throw std::runtime_error("Corrupt bitmap: too short");
+    if (std::memcmp(d, "BITM", 4) != 0 || (d[4] << 8 | d[5]) != BITMAP_VERSION) {
+        throw std::runtime_error("Corrupt bitmap: bad header");
+    }
+    if (!((d[6] << 8 | d[7]) & BITMAP_OPT_FULL_DAG)) throw std::runtime_error("Unsupported bitmap: not a full DAG");
+    if (std::memcmp(d + 12, pack->checksum(), 20) != 0) {
+        throw std::runtime_error("Stale bitmap: " + path.string() + " was written for a different pack");
+    }
+    uint32_t count = be32(d + 8);
+    size_t end = data.size() - 20;  // Trailing checksum
+    size_t at = 32;
+
+    bitmap->pack_ = std::move(pack);
+    const PackFile& p = *bitmap->pack_;
+    pack_order(p, bitmap->index_of_, bitmap->pos_of_);
+    for (Bitmap& type : bitmap->types_) at += ewah_apply(d + at, end - at, type, false);
+    bitmap->entries_.reserve(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        if (end - at < 6) throw std::runtime_error("Corrupt bitmap: truncated entry");
+        uint32_t index = be32(d + at);
+        uint32_t xor_offset = d[at + 4];
+        at += 6;  // Then a flags byte, unused here
+        if (index >= p.count() || xor_offset > i || xor_offset > MAX_XOR_OFFSET) {
+            throw std::runtime_error("Corrupt bitmap: bad entry");
+        }
+        bitmap->by_commit_[ObjectId::from_raw(p.sha_at(index))] = i;
+        bitmap->entries_.push_back({at, xor_offset});
+        at += ewah_size(d + at, end - at);
+    }
+    // Git may add a name-hash cache and a lookup table here; neither is needed
+    return bitmap;
+}
+
+bool PackBitmap::position(const ObjectId& id, uint32_t& pos) const {
+    uint32_t index;
+    if (!pack_->find_index(id.data(), index)) return false;
+    pos = pos_of_[index];
+    return true;
+}
+
+int PackBitmap::type_at(uint32_t pos) const {
+    for (int t = 0; t < 4; ++t) {
+        if (types_[t].get(pos)) return t + 1;
+    }
+    return 0;
+}
+
+bool PackBitmap::or_into(const ObjectId& commit, Bitmap& out) const {
+    auto it = by_commit_.find(commit);
+    if (it == by_commit_.end()) return false;
+    // Back along the XOR chain to a plain bitmap, then forward again
+    std::vector<uint32_t> chain;
+    for (uint32_t i = it->second;; i -= entries_[i].xor_offset) {
+        chain.push_back(i);
+        if (entries_[i].xor_offset == 0) break;
+    }
+    const auto* d = reinterpret_cast<const unsigned char*>(data_.data());
+    size_t end = data_.size() - 20;
+    Bitmap bits;
+    for (auto i = chain.rbegin(); i != chain.rend(); ++i) {
+        size_t at = entries_[*i].at;
+        ewah_apply(d + at, end - at, bits, i != chain.rbegin());
+    }
+    out.or_with(bits);
+    return true;
+}
+
+// Adds a tree and everything under it to `bits`, skipping subtrees already
+// there. Objects outside the pack go to `outside` if given, or throw.
+using PositionFn = std::function<bool(const ObjectId&, uint32_t&)>;
+static void mark_tree(const GitRepository& repo, const PositionFn& position, const ObjectId& tree, Bitmap& bits,
+                      std::unordered_set<ObjectId>* seen_outside, std::vector<std::pair<ObjectId, int>>* outside) {
+    auto mark = [&](const ObjectId& id, int type) {
+        uint32_t pos;
+        if (position(id, pos)) {
+            if (bits.get(pos)) return false;
+            bits.set(pos);
+            return true;
+        }
+        if (!outside) throw std::runtime_error("Can't write bitmap: " + id.hex() + " is not in the pack");
+        if (!seen_outside->insert(id).second) return false;
+        outside->push_back({id, type});
+        return true;
+    };
+    std::vector<ObjectId> pending;
+    if (mark(tree, PACK_TREE)) pending.push_back(tree);
+    while (!pending.empty()) {
+        ObjectId id = pending.back();
+        pending.pop_back();
+        auto obj = object_cache_read(repo, id.hex());
+        if (obj->fmt != "tree") throw std::runtime_error("Expected tree " + id.hex() + ", got " + obj->fmt);
+        for (const TreeEntryView& entry : TreeView(obj->data)) {
+            if (entry.mode == GITLINK_MODE) continue;
+            bool is_tree = entry.mode == TREE_MODE;
+            if (mark(entry.id(), is_tree ? PACK_TREE : PACK_BLOB) && is_tree) pending.push_back(entry.id());
+        }
+    }
+}
+
+uint32_t bitmap_write(const GitRepository& repo, std::shared_ptr<PackFile> pack, const std::vector<std::string>& tips,
+                      uint32_t interval) {
+    const PackFile& p = *pack;
+    std::vector<uint32_t> index_of, pos_of;
+    pack_order(p, index_of, pos_of);
+    Bitmap types[4];
+    for (uint32_t pos = 0; pos < p.count(); ++pos) {
+        std::string fmt;
+        uint64_t size;
+        p.read_header(p.offset_at(index_of[pos]), fmt, size);
+        types[pack_type_from_fmt(fmt) - 1].set(pos);
+    }
+    PositionFn find = [&](const ObjectId& id, uint32_t& pos) {
+        uint32_t index;
+        if (!p.find_index(id.data(), index)) return false;
+        pos = pos_of[index];
+        return true;
+    };
+    auto position = [&](const std::string& sha) {
+        uint32_t pos;
+        if (!find(ObjectId::from_hex(sha), pos)) {
+            throw std::runtime_error("Can't write bitmap: " + sha + " is not in the pack");
+        }
+        return pos;
+    };
+
+    std::vector<std::string> commits;
+    for (const auto& tip : tips) {
+        if (types[PACK_COMMIT - 1].get(position(tip))) commits.push_back(tip);
+    }
+    CommitSource source(repo);
+    std::vector<std::string> order = rev_list(source, commits, true);
+    std::unordered_set<std::string> selected(commits.begin(), commits.end());
+    for (size_t i = 0; i < order.size(); i += std::max<uint32_t>(interval, 1)) selected.insert(order[i]);
+
+    // Oldest first, so each bitmap can OR in those of its selected ancestors
+    std::unordered_map<std::string, std::string> plain;  // Commit -> its EWAH, not XORed
+    std::deque<Bitmap> recent;                            // The last XOR_WINDOW bitmaps written
+    std::vector<uint32_t> depth;
+    std::string entries;
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+        if (!selected.count(*it)) continue;
+        Bitmap bits;
+        std::vector<std::string> stack{*it}, walked;
+        while (!stack.empty()) {
+            std::string sha = std::move(stack.back());
+            stack.pop_back();
+            uint32_t pos = position(sha);
+            if (bits.get(pos)) continue;
+            auto done = plain.find(sha);
+            if (done != plain.end()) {
+                const auto* d = reinterpret_cast<const unsigned char*>(done->second.data());
+                ewah_apply(d, done->second.size(), bits, false);
+                continue;
+            }
+            bits.set(pos);
+            walked.push_back(sha);
+            for (const auto& parent : source.get(sha).parents) stack.push_back(parent);
+        }
+        for (const auto& sha : walked) {
+            mark_tree(repo, find, ObjectId::from_hex(source.get(sha).tree), bits, nullptr, nullptr);
+        }
+
+        std::string best = ewah_encode(bits);
+        plain[*it] = best;
+        uint32_t xor_offset = 0;
+        uint32_t k = static_cast<uint32_t>(depth.size());
+        for (uint32_t back = 1; back <= recent.size(); ++back) {
+            if (depth[k - back] >= MAX_XOR_DEPTH) continue;
+            Bitmap x = bits;
+            x.xor_with(recent[recent.size() - back]);
+            std::string encoded = ewah_encode(x);
+            if (encoded.size() < best.size()) {
+                best = std::move(encoded);
+                xor_offset = back;
+            }
+        }
+        depth.push_back(xor_offset ? depth[k - xor_offset] + 1 : 0);
+        recent.push_back(std::move(bits));
+        if (recent.size() > XOR_WINDOW) recent.pop_front();
+
+        put_be32(entries, index_of[position(*it)]);
+        entries += static_cast<char>(xor_offset);
+        entries += '\0';  // Flags
+        entries += best;
+    }
+
+    std::string out = "BITM";
+    put_be16(out, BITMAP_VERSION);
+    put_be16(out, BITMAP_OPT_FULL_DAG);
+    put_be32(out, static_cast<uint32_t>(depth.size()));
+    out.append(reinterpret_cast<const char*>(p.checksum()), 20);
+    for (const Bitmap& type : types) out += ewah_encode(type);
+    out += entries;
+    ObjectId checksum = sha1(out.data(), out.size());
+    out.append(reinterpret_cast<const char*>(checksum.data()), 20);
+
+    // Temp file and rename, as for the commit-graph
+    fs::path path = bitmap_path(p);
+    std::string tmp = (path.parent_path() / "tmp_bitmap_XXXXXX").string();
+    int fd = mkstemp(tmp.data());
+    if (fd < 0) throw std::runtime_error("Failed to create temp bitmap");
+    const char* data = out.data();
+    size_t left = out.size();
+    while (left > 0) {
+        ssize_t n = ::write(fd, data, left);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ::close(fd);
+            unlink(tmp.c_str());
+            throw std::runtime_error("Failed to write bitmap");
+        }
+        data += n;
+        left -= static_cast<size_t>(n);
+    }
+    fchmod(fd, 0444);
+    ::close(fd);
+    fs::rename(tmp, path);
+    return static_cast<uint32_t>(depth.size());
+}
+
+ObjectCounts Reachable::counts() const {
+    ObjectCounts c;
+    if (bitmap_) {
+        c.commits = bits_.count_and(bitmap_->type(PACK_COMMIT));
+        c.trees = bits_.count_and(bitmap_->type(PACK_TREE));
+        c.blobs = bits_.count_and(bitmap_->type(PACK_BLOB));
+        c.tags = bits_.count_and(bitmap_->type(PACK_TAG));
+    }
+    for (const auto& [id, type] : outside_) {
+        switch (type) {
+            case PACK_COMMIT: ++c.commits; break;
+            case PACK_TREE: ++c.trees; break;
+            case PACK_BLOB: ++c.blobs; break;
+            case PACK_TAG: ++c.tags; break;
+        }
+    }
+    return c;
+}
+
+void Reachable::for_each(const std::function<void(const ObjectId&, int)>& fn) const {
+    if (bitmap_) bits_.for_each([&](uint32_t pos) { fn(bitmap_->id_at(pos), bitmap_->type_at(pos)); });
+    for (const auto& [id, type] : outside_) fn(id, type);
+}
+
+bool bitmap_reachable(const GitRepository& repo, const std::vector<std::string>& tips, Reachable& out) {
+    std::shared_ptr<const PackBitmap> bitmap;
+    for (const auto& pack : pack_list(repo)) {
+        if ((bitmap = PackBitmap::open(pack))) break;
+    }
+    if (!bitmap) return false;
+    out = Reachable();
+    out.bitmap_ = bitmap;
+    Bitmap& bits = out.bits_;
+    std::unordered_set<ObjectId> seen_outside;
+
+    // Commits first: every one reached either has a bitmap, is already
+    // covered by one ORed in, or is walked. Trees wait until the bitmaps are
+    // in, so the walk stops at whatever they already hold.
+    CommitSource source(repo);
+    std::vector<std::string> stack(tips.rbegin(), tips.rend()), walked;
+    while (!stack.empty()) {
+        std::string sha = std::move(stack.back());
+        stack.pop_back();
+        ObjectId id = ObjectId::from_hex(sha);
+        uint32_t pos;
+        if (bitmap->position(id, pos)) {
+            if (bits.get(pos)) continue;
+            if (bitmap->or_into(id, bits)) {
+                ++bitmaps_used;
+                continue;
+            }
+            bits.set(pos);
+        } else {
+            if (!seen_outside.insert(id).second) continue;
+            out.outside_.push_back({id, PACK_COMMIT});
+        }
+        ++commits_walked;
+        walked.push_back(sha);
+        const auto& parents = source.get(sha).parents;
+        stack.insert(stack.end(), parents.rbegin(), parents.rend());
+    }
+    PositionFn find = [&](const ObjectId& id, uint32_t& pos) { return bitmap->position(id, pos); };
+    for (const auto& sha : walked) {
+        mark_tree(repo, find, ObjectId::from_hex(source.get(sha).tree), bits, &seen_outside, &out.outside_);
+    }
+    return true;
+}
+
+ObjectCounts walk_objects(const GitRepository& repo, const std::vector<std::string>& tips,
+                          const std::function<void(const std::string&, int, const std::string&)>& fn) {
+    CommitSource source(repo);
+    std::vector<std::string> commits = rev_list(source, tips, false);
+    ObjectCounts counts;
+    const std::string no_path;
+    for (const auto& sha : commits) {
+        fn(sha, PACK_COMMIT, no_path);
+        ++counts.commits;
+    }
+    std::unordered_set<ObjectId> seen;
+    std::function<void(const std::string&, const std::string&)> walk = [&](const std::string& sha,
+                                                                          const std::string& path) {
+        auto obj = object_cache_read(repo, sha);
+        if (obj->fmt != "tree") throw std::runtime_error("Expected tree " + sha + ", got " + obj->fmt);
+        for (const TreeEntryView& entry : TreeView(obj->data)) {
+            if (entry.mode == GITLINK_MODE || !seen.insert(entry.id()).second) continue;
+            std::string child = path.empty() ? std::string(entry.path) : path + "/" + std::string(entry.path);
+            std::string child_sha = sha_to_hex(entry.raw_sha);
+            if (entry.mode == TREE_MODE) {
+                fn(child_sha, PACK_TREE, child);
+                ++counts.trees;
+                walk(child_sha, child);
+            } else {
+                fn(child_sha, PACK_BLOB, child);
+                ++counts.blobs;
+            }
+        }
+    };
+    for (const auto& sha : commits) {
+        std::string tree = source.get(sha).tree;
+        if (!seen.insert(ObjectId::from_hex(tree)).second) continue;
+        fn(tree, PACK_TREE, no_path);
+        ++counts.trees;
+        walk(tree, no_path);
+    }
+    return counts;
+}
+
+void bitmap_print_stats(std::ostream& out) {
+    if (bitmaps_used == 0 && commits_walked == 0) return;
+    out << "bitmap: " << bitmaps_used << " bitmaps used, " << commits_walked << " commits walked" << std::endl;
+}
@@ -0,0 +1,501 @@
+#include "commit_graph.h"
+#include "object_cache.h"
+#include "sha1.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <queue>
+#include <stdexcept>
+#include <tuple>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <openssl/sha.h>
+
+// Commit-graph layout (Git's format, version 1, SHA-1):
+//   "CGPH" <version=1> <hash version=1> <chunk count> <base graphs=0>
+//   chunk table: (id, 64-bit offset) per chunk plus a terminating entry
+//   OIDF: fanout[256] cumulative commit counts by first SHA byte
+//   OIDL: sorted commit SHAs
+//   CDAT: per commit: tree SHA, parent 1, parent 2 (graph positions), then
+//         generation (top 30 bits) and commit time (low 34 bits)
+//   EDGE: extra parents of octopus merges; the last one has the MSB set
+//   SHA-1 of everything above
+
+static const uint32_t CHUNK_OIDF = 0x4f494446;
+static const uint32_t CHUNK_OIDL = 0x4f49444c;
+static const uint32_t CHUNK_CDAT = 0x43444154;
+static const uint32_t CHUNK_EDGE = 0x45444745;
+static const uint32_t PARENT_NONE = 0x70000000;
+static const uint32_t PARENT_OCTOPUS = 0x80000000;
+static const uint32_t GENERATION_MAX = 0x3fffffff;
+static const size_t CDAT_WIDTH = 20 + 4 + 4 + 8;
+
+static uint32_t be32(const unsigned char* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+static uint64_t be64(const unsigned char* p) {
+    return (uint64_t(be32(p)) << 32) | be32(p + 4);
+}
+
+static void put_be32(std::string& out, uint32_t v) {
+    char b[4] = {char(v >> 24), char(v >> 16), char(v >> 8), char(v)};
+    out.append(b, 4);
+}
+
+static void put_be64(std::string& out, uint64_t v) {
+    put_be32(out, static_cast<uint32_t>(v >> 32));
+    put_be32(out, static_cast<uint32_t>(v));
+}
+
+// Lookups answered from the graph vs. by reading commit objects, process-wide
+static uint64_t graph_hits = 0;
+static uint64_t object_reads = 0;
+
+static fs::path graph_path(const GitRepository& repo) {
+    return repo.gitdir / "objects" / "info" / "commit-graph";
+}
+
+std::unique_ptr<CommitGraph> CommitGraph::open(const GitRepository& repo) {
+    fs::path path = graph_path(repo);
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) return nullptr;
+        throw std::runtime_error("Failed to open " + path.string());
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Failed to stat " + path.string());
+    }
+    std::unique_ptr<CommitGraph> graph(new CommitGraph());
+    graph->size_ = static_cast<size_t>(st.st_size);
+    if (graph->size_ < 8 + 12 + SHA_DIGEST_LENGTH) {
+        ::close(fd);
+        throw std::runtime_error("Corrupt commit-graph: too short");
+    }
+    void* p = mmap(nullptr, graph->size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) throw std::runtime_error("Failed to mmap " + path.string());
+    graph->map_ = static_cast<const unsigned char*>(p);
+
+    const unsigned char* m = graph->map_;
+    if (std::memcmp(m, "CGPH", 4) != 0 || m[4] != 1 || m[5] != 1) {
+        throw std::runtime_error("Corrupt commit-graph: bad header");
+    }
+    size_t chunks = m[6];
+    size_t end = graph->size_ - SHA_DIGEST_LENGTH;
+    if (8 + 12 * (chunks + 1) > end) throw std::runtime_error("Corrupt commit-graph: bad chunk table");
+    for (size_t i = 0; i < chunks; ++i) {
+        const unsigned char* entry = m + 8 + 12 * i;
+        uint64_t start = be64(entry + 4);
+        uint64_t next = be64(entry + 16);
+        if (start > next || next > end) throw std::runtime_error("Corrupt commit-graph: bad chunk offset");
+        const unsigned char* chunk = m + start;
+        size_t len = static_cast<size_t>(next - start);
+        switch (be32(entry)) {
+            case CHUNK_OIDF:
+                if (len != 256 * 4) throw std::runtime_error("Corrupt commit-graph: bad fanout");
+                graph->oidf_ = chunk;
+                break;
+            case CHUNK_OIDL: graph->oidl_ = chunk; break;
+            case CHUNK_CDAT: graph->cdat_ = chunk; break;
+            case CHUNK_EDGE:
+                graph->edge_ = chunk;
+                graph->edge_count_ = len / 4;
+                break;
+        }
+    }
+    if (!graph->oidf_ || !graph->oidl_ || !graph->cdat_) throw std::runtime_error("Corrupt commit-graph: missing chunk");
+    graph->count_ = be32(graph->oidf_ + 255 * 4);
+    if (graph->oidl_ + 20 * size_t(graph->count_) > m + end || graph->cdat_ + CDAT_WIDTH * graph->count_ > m + end) {
+        throw std::runtime_error("Corrupt commit-graph: truncated chunk");
+    }
+    return graph;
+}
+
+CommitGraph::~CommitGraph() {
+    if (map_) munmap(const_cast<unsigned char*>(map_), size_);
+}
+
+bool CommitGraph::find(const std::string& sha, uint32_t& pos) const {
+    unsigned char raw[20];
+    try {
+        hex_to_sha(sha, raw);
+    } catch (const std::exception&) {
+        return false;
+    }
+    uint32_t lo = raw[0] == 0 ? 0 : be32(oidf_ + 4 * size_t(raw[0] - 1));
+    uint32_t hi = be32(oidf_ + 4 * size_t(raw[0]));
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = std::memcmp(sha_at(mid), raw, 20);
+        if (cmp == 0) {
+            pos = mid;
+            return true;
+        }
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return false;
+}
+
+CommitNode CommitGraph::node(uint32_t pos) const {
+    const unsigned char* rec = cdat_ + CDAT_WIDTH * size_t(pos);
+    CommitNode n;
+    n.sha = sha_to_hex(sha_at(pos));
+    n.tree = sha_to_hex(rec);
+    auto parent = [&](uint32_t p) {
+        if (p >= count_) throw std::runtime_error("Corrupt commit-graph: bad parent position");
+        n.parents.push_back(sha_to_hex(sha_at(p)));
+    };
+    uint32_t p1 = be32(rec + 20);
+    uint32_t p2 = be32(rec + 24);
+    if (p1 != PARENT_NONE) parent(p1);
+    if (p2 & PARENT_OCTOPUS) {
+        for (size_t e = p2 & ~PARENT_OCTOPUS; ; ++e) {
+            if (e >= edge_count_) throw std::runtime_error("Corrupt commit-graph: bad edge list");
+            uint32_t v = be32(edge_ + 4 * e);
+            parent(v & ~PARENT_OCTOPUS);
+            if (v & PARENT_OCTOPUS) break;
+        }
+    } else if (p2 != PARENT_NONE) {
+        parent(p2);
+    }
+    uint32_t hi = be32(rec + 28);
+    n.generation = hi >> 2;
+    n.time = (uint64_t(hi & 3) << 32) | be32(rec + 32);
+    return n;
+}
+
+// Parents, tree and committer time straight from the commit object
+static CommitNode read_commit_node(const GitRepository& repo, const std::string& sha) {
+    auto object = object_cache_read(repo, sha);
+    if (object->fmt != "commit") throw std::runtime_error("Not a commit object");
+    CommitView view(object->data);
+    CommitNode n;
+    n.sha = sha;
+    view.for_each_header([&](std::string_view key, std::string_view value) {
+        if (key == "tree") n.tree = std::string(value);
+        else if (key == "parent") n.parents.emplace_back(value);
+    });
+    n.time = view.commit_time();
+    return n;
+}
+
+CommitSource::CommitSource(const GitRepository& repo) : repo_(repo) {
+    try {
+        graph_ = CommitGraph::open(repo);
+    } catch (const std::exception& e) {
+        // The graph is only an accelerator; walk the objects instead
+        std::cerr << "warning: ignoring commit-graph: " << e.what() << std::endl;
+        graph_.reset();
+    }
+}
+
+CommitNode& CommitSource::load(const std::string& sha) {
+    auto it = nodes_.find(sha);
+    if (it != nodes_.end()) return it->second;
+    uint32_t pos;
+    CommitNode n;
+    if (graph_ && graph_->find(sha, pos)) {
+        n = graph_->node(pos);
+        ++graph_hits;
+    } else {
+        n = read_commit_node(repo_, sha);
+        ++object_reads;
+    }
+    return nodes_.emplace(sha, std::move(n)).first->second;
+}
+
+const CommitNode& CommitSource::get(const std::string& sha) {
+    return load(sha);
+}
+
+uint32_t CommitSource::generation(const std::string& sha) {
+    CommitNode& start = load(sha);
+    if (start.generation) return start.generation;
+    // Commits outside the graph: 1 + max over parents, without recursion so
+    // long histories can't overflow the stack
+    std::vector<std::string> stack{sha};
+    while (!stack.empty()) {
+        CommitNode& n = load(stack.back());
+        if (n.generation) {
+            stack.pop_back();
+            continue;
+        }
+        bool ready = true;
+        uint32_t gen = 0;
+        for (const auto& p : n.parents) {
+            CommitNode& parent = load(p);
+            if (!parent.generation) {
+                stack.push_back(p);
+                ready = false;
+            } else {
+                gen = std::max(gen, parent.generation);
+            }
+        }
+        if (ready) {
+            n.generation = std::min(gen + 1, GENERATION_MAX);
+            stack.pop_back();
+        }
+    }
+    return start.generation;
+}
+
+std::vector<std::string> rev_list(CommitSource& source, const std::vector<std::string>& tips, bool topo_order) {
+    // Max-heap on (generation, time); generation stays 0 in date order
+    using Item = std::tuple<uint32_t, uint64_t, std::string>;
+    std::priority_queue<Item> queue;
+    std::unordered_map<std::string, bool> seen;
+    auto push = [&](const std::string& sha) {
+        if (!seen.emplace(sha, true).second) return;
+        uint64_t time = source.get(sha).time;
+        queue.emplace(topo_order ? source.generation(sha) : 0, time, sha);
+    };
+    for (const auto& tip : tips) push(tip);
+
+    std::vector<std::string> out;
+    while (!queue.empty()) {
+        std::string sha = std::get<2>(queue.top());
+        queue.pop();
+        out.push_back(sha);
+        std::vector<std::string> parents = source.get(sha).parents;
+        for (const auto& p : parents) push(p);
+    }
+    return out;
+}
+
+// Is `ancestor` reachable from `from`? Walks no lower than ancestor's generation.
+static bool reachable(CommitSource& source, const std::string& from, const std::string& ancestor) {
+    uint32_t floor = source.generation(ancestor);
+    std::vector<std::string> stack{from};
+    std::unordered_map<std::string, bool> seen;
+    while (!stack.empty()) {
+        std::string sha = stack.back();
+        stack.pop_back();
+        if (sha == ancestor) return true;
+        if (!seen.emplace(sha, true).second || source.generation(sha) <= floor) continue;
+        std::vector<std::string> parents = source.get(sha).parents;
+        for (const auto& p : parents) stack.push_back(p);
+    }
+    return false;
+}
+
+std::vector<std::string> merge_bases(CommitSource& source, const std::string& a, const std::string& b) {
+    if (a == b) return {a};
+    enum { PARENT1 = 1, PARENT2 = 2, STALE = 4, RESULT = 8 };
+
+    // Paint ancestors of a and b, highest generation first: by the time a
+    // commit is popped every descendant in the walk has been, so its paint
+    // is final. Anything below a common commit is marked stale, and the walk
+    // stops once only stale commits are left.
+    using Item = std::tuple<uint32_t, uint64_t, std::string>;
+    std::vector<Item> heap;
+    std::unordered_map<std::string, int> flags;
+    auto push = [&](const std::string& sha) {
+        heap.emplace_back(source.generation(sha), source.get(sha).time, sha);
+        std::push_heap(heap.begin(), heap.end());
+    };
+    flags[a] |= PARENT1;
+    flags[b] |= PARENT2;
+    push(a);
+    push(b);
+
+    std::vector<std::string> results;
+    auto has_nonstale = [&] {
+        return std::any_of(heap.begin(), heap.end(), [&](const Item& it) {
+            return !(flags[std::get<2>(it)] & STALE);
+        });
+    };
+    while (!heap.empty() && has_nonstale()) {
+        std::pop_heap(heap.begin(), heap.end());
+        std::string sha = std::get<2>(heap.back());
+        heap.pop_back();
+        int f = flags[sha] & (PARENT1 | PARENT2 | STALE);
+        if ((f & (PARENT1 | PARENT2)) == (PARENT1 | PARENT2)) {
+            if (!(flags[sha] & RESULT)) {
+                flags[sha] |= RESULT;
+                results.push_back(sha);
+            }
+            f |= STALE;
+        }
+        std::vector<std::string> parents = source.get(sha).parents;
+        for (const auto& p : parents) {
+            if ((flags[p] & f) == f) continue;
+            flags[p] |= f;
+            push(p);
+        }
+    }
+
+    // Drop candidates that turned out to be ancestors of other candidates
+    std::vector<std::string> best;
+    for (const auto& r : results) {
+        if (flags[r] & STALE) continue;
+        bool redundant = false;
+        for (const auto& other : results) {
+            if (other != r && !(flags[other] & STALE) && reachable(source, other, r)) {
+                redundant = true;
+                break;
+            }
+        }
+        if (!redundant) best.push_back(r);
+    }
+    std::stable_sort(best.begin(), best.end(), [&](const std::string& x, const std::string& y) {
+        return source.get(x).time > source.get(y).time;
+    });
+    return best;
+}
+
+// The commit an annotated tag (or chain of tags) points at; "" when the
+// tip ends at a tree or blob, or at nothing
+static std::string peel_to_commit(const GitRepository& repo, std::string sha) {
+    for (;;) {
+        std::string fmt;
+        uint64_t size;
+        if (!object_read_header(repo, sha, fmt, size)) return "";
+        if (fmt == "commit") return sha;
+        if (fmt != "tag") return "";
+        auto tag = object_cache_read(repo, sha);
+        sha = std::string(CommitView(tag->data).header("object"));
+    }
+}
+
+uint32_t commit_graph_write(const GitRepository& repo, const std::vector<std::string>& tips) {
+    // Collect every commit reachable from the tips. This is the one place
+    // commit objects are still inflated. Tags are peeled; refs to trees and
+    // blobs have no commits to add.
+    std::unordered_map<std::string, CommitNode> commits;
+    std::vector<std::string> stack;
+    for (const auto& tip : tips) {
+        std::string commit = peel_to_commit(repo, tip);
+        if (!commit.empty()) stack.push_back(std::move(commit));
+    }
+    while (!stack.empty()) {
+        std::string sha = stack.back();
+        stack.pop_back();
+        if (commits.count(sha)) continue;
+        CommitNode n = read_commit_node(repo, sha);
+        for (const auto& p : n.parents) {
+            if (!commits.count(p)) stack.push_back(p);
+        }
+        commits.emplace(sha, std::move(n));
+    }
+
+    std::vector<std::string> order;
+    order.reserve(commits.size());
+    for (const auto& kv : commits) order.push_back(kv.first);
+    std::sort(order.begin(), order.end());  // Hex order is byte order
+    std::unordered_map<std::string, uint32_t> position;
+    for (uint32_t i = 0; i < order.size(); ++i) position[order[i]] = i;
+
+    // Generation numbers, parents before children
+    for (const auto& tip : order) {
+        if (commits[tip].generation) continue;
+        std::vector<std::string> work{tip};
+        while (!work.empty()) {
+            CommitNode& n = commits[work.back()];
+            if (n.generation) {
+                work.pop_back();
+                continue;
+            }
+            bool ready = true;
+            uint32_t gen = 0;
+            for (const auto& p : n.parents) {
+                uint32_t pg = commits[p].generation;
+                if (!pg) {
+                    work.push_back(p);
+                    ready = false;
+                }
+                gen = std::max(gen, pg);
+            }
+            if (ready) {
+                n.generation = std::min(gen + 1, GENERATION_MAX);
+                work.pop_back();
+            }
+        }
+    }
+
+    std::string oidf, oidl, cdat, edge;
+    uint32_t fanout[256] = {};
+    for (const auto& sha : order) {
+        unsigned char raw[20];
+        hex_to_sha(sha, raw);
+        ++fanout[raw[0]];
+        oidl.append(reinterpret_cast<const char*>(raw), 20);
+
+        const CommitNode& n = commits[sha];
+        unsigned char tree[20];
+        hex_to_sha(n.tree, tree);
+        cdat.append(reinterpret_cast<const char*>(tree), 20);
+        put_be32(cdat, n.parents.size() > 0 ? position[n.parents[0]] : PARENT_NONE);
+        if (n.parents.size() > 2) {
+            put_be32(cdat, PARENT_OCTOPUS | static_cast<uint32_t>(edge.size() / 4));
+            for (size_t i = 1; i < n.parents.size(); ++i) {
+                uint32_t v = position[n.parents[i]];
+                if (i + 1 == n.parents.size()) v |= PARENT_OCTOPUS;
+                put_be32(edge, v);
+            }
+        } else {
+            put_be32(cdat, n.parents.size() == 2 ? position[n.parents[1]] : PARENT_NONE);
+        }
+        uint64_t time = std::min<uint64_t>(n.time, (1ull << 34) - 1);
+        put_be64(cdat, (uint64_t(n.generation) << 34) | time);
+    }
+    for (int i = 1; i < 256; ++i) fanout[i] += fanout[i - 1];
+    for (uint32_t f : fanout) put_be32(oidf, f);
+
+    std::vector<std::pair<uint32_t, const std::string*>> chunks = {
+        {CHUNK_OIDF, &oidf}, {CHUNK_OIDL, &oidl}, {CHUNK_CDAT, &cdat}};
+    if (!edge.empty()) chunks.push_back({CHUNK_EDGE, &edge});
+
+    std::string out = "CGPH";
+    out.push_back(1);  // Version
+    out.push_back(1);  // SHA-1
+    out.push_back(static_cast<char>(chunks.size()));
+    out.push_back(0);  // No base graphs
+    uint64_t offset = 8 + 12 * (chunks.size() + 1);
+    for (const auto& c : chunks) {
+        put_be32(out, c.first);
+        put_be64(out, offset);
+        offset += c.second->size();
+    }
+    put_be32(out, 0);
+    put_be64(out, offset);
+    for (const auto& c : chunks) out += *c.second;
+    ObjectId checksum = sha1(out.data(), out.size());
+    out.append(reinterpret_cast<const char*>(checksum.data()), SHA_DIGEST_LENGTH);
+
+    // Write to a temp file and rename, so readers see the old graph or the new one
+    fs::path path = graph_path(repo);
+    fs::create_directories(path.parent_path());
+    std::string tmp = (path.parent_path() / "tmp_graph_XXXXXX").string();
+    int fd = mkstemp(tmp.data());
+    if (fd < 0) throw std::runtime_error("Failed to create temp commit-graph");
+    const char* p = out.data();
+    size_t left = out.size();
+    while (left > 0) {
+        ssize_t n = ::write(fd, p, left);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ::close(fd);
+            unlink(tmp.c_str());
+            throw std::runtime_error("Failed to write commit-graph");
+        }
+        p += n;
+        left -= static_cast<size_t>(n);
+    }
+    fchmod(fd, 0444);
+    ::close(fd);
+    fs::rename(tmp, path);
+    return static_cast<uint32_t>(order.size());
+}
+
+void commit_graph_print_stats(std::ostream& out) {
+    if (graph_hits == 0 && object_reads == 0) return;
+    out << "commit graph: " << graph_hits << " from graph, " << object_reads << " object reads" << std::endl;
+}
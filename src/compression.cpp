@@ -0,0 +1,101 @@
+#include "compression.h"
+#include "object_io.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <stdexcept>
+#include <zlib.h>
+
+// A sample that deflates to more than this fraction of its size is not
+// worth compressing
+static constexpr double INCOMPRESSIBLE_RATIO = 0.97;
+// Blobs shorter than this are compressed without sampling
+static constexpr size_t MIN_SAMPLE = 512;
+
+static int type_slot(const std::string& fmt) {
+    if (fmt == "blob") return 0;
+    if (fmt == "tree") return 1;
+    if (fmt == "commit") return 2;
+    if (fmt == "tag") return 3;
+    return -1;
+}
+
+// "best", "default", "fast", "none" or 0-9; -1 (Git's "zlib default") maps to 6
+static int parse_level(const std::string& key, const std::string& value) {
+    std::string v = value;
+    std::transform(v.begin(), v.end(), v.begin(), [](unsigned char c) { return std::tolower(c); });
+    if (v == "best") return Z_BEST_COMPRESSION;
+    if (v == "default") return 6;
+    if (v == "fast") return Z_BEST_SPEED;
+    if (v == "none") return Z_NO_COMPRESSION;
+    try {
+        size_t pos = 0;
+        int n = std::stoi(v, &pos);
+        if (pos == v.size() && n >= -1 && n <= 9) return n == -1 ? 6 : n;
+    } catch (const std::exception&) {
+    }
+    throw std::runtime_error("Bad compression level for " + key + ": " + value);
+}
+
+CompressionPolicy CompressionPolicy::from_config(const GitRepository& repo, Target target) {
+    CompressionPolicy policy;
+    const char* specific = target == LOOSE ? "core.loosecompression" : "pack.compression";
+    for (const char* key : {"core.compression", specific, "compression.level"}) {
+        std::string value = repo.config_get(key);
+        if (!value.empty()) policy.base_ = parse_level(key, value);
+    }
+    const char* types[4] = {"blob", "tree", "commit", "tag"};
+    for (int i = 0; i < 4; ++i) {
+        std::string key = std::string("compression.") + types[i];
+        std::string value = repo.config_get(key);
+        if (!value.empty()) policy.per_type_[i] = parse_level(key, value);
+    }
+    policy.sample_ = static_cast<size_t>(repo.config_get_size("compression.sample", policy.sample_));
+    return policy;
+}
+
+int CompressionPolicy::level(const std::string& fmt) const {
+    int slot = type_slot(fmt);
+    return slot >= 0 && per_type_[slot] >= 0 ? per_type_[slot] : base_;
+}
+
+int CompressionPolicy::level(const std::string& fmt, const char* sample, size_t len) const {
+    int lvl = level(fmt);
+    if (fmt != "blob" || lvl == Z_NO_COMPRESSION || sample_ == 0) return lvl;
+    len = std::min(len, sample_);
+    if (len < MIN_SAMPLE) return lvl;
+
+    // Trial deflate at the fastest level: if even that can't shrink the
+    // sample, the real level won't do much better
+    DeflateLease lease(Z_BEST_SPEED);
+    z_stream& zs = *lease;
+    ArenaScope scratch;
+    size_t bound = deflateBound(&zs, static_cast<uLong>(len));
+    unsigned char* out = scratch.alloc(bound);
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(sample));
+    zs.avail_in = static_cast<uInt>(len);
+    zs.next_out = out;
+    zs.avail_out = static_cast<uInt>(bound);
+    int ret = deflate(&zs, Z_FINISH);
+    size_t compressed = bound - zs.avail_out;
+    if (ret != Z_STREAM_END) return lvl;
+    return compressed > len * INCOMPRESSIBLE_RATIO ? Z_NO_COMPRESSION : lvl;
+}
+
+static std::atomic<uint64_t> stat_objects{0};
+static std::atomic<uint64_t> stat_incompressible{0};
+static std::atomic<uint64_t> stat_raw{0};
+static std::atomic<uint64_t> stat_stored{0};
+
+void compression_record(uint64_t raw_bytes, uint64_t stored_bytes, bool incompressible) {
+    ++stat_objects;
+    if (incompressible) ++stat_incompressible;
+    stat_raw += raw_bytes;
+    stat_stored += stored_bytes;
+}
+
+void compression_print_stats(std::ostream& out) {
+    if (stat_objects == 0) return;
+    out << "compression: " << stat_objects << " objects, " << stat_incompressible << " stored uncompressed, "
+        << stat_raw << " -> " << stat_stored << " bytes" << std::endl;
+}
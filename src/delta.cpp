@@ -0,0 +1,201 @@
+#include "delta.h"
+#include <cstring>
+#include <stdexcept>
+
+static constexpr size_t BLOCK = 16;           // Bytes per indexed source block
+static constexpr uint32_t HASH_BASE = 0x01000193;
+static constexpr size_t MAX_CHAIN = 64;       // Candidates checked per lookup
+static constexpr size_t MAX_COPY = 0x10000;   // Largest copy op every Git reader accepts
+
+// HASH_BASE^(BLOCK-1), the weight of the byte leaving the window
+static uint32_t out_weight() {
+    uint32_t w = 1;
+    for (size_t i = 1; i < BLOCK; ++i) w *= HASH_BASE;
+    return w;
+}
+
+static uint32_t block_hash(const unsigned char* p) {
+    uint32_t h = 0;
+    for (size_t i = 0; i < BLOCK; ++i) h = h * HASH_BASE + p[i];
+    return h;
+}
+
+// Mix the polynomial hash before masking so low bits depend on every byte
+static uint32_t bucket_of(uint32_t h, uint32_t mask) {
+    h ^= h >> 15;
+    h *= 0x2c1b3c6d;
+    h ^= h >> 12;
+    return h & mask;
+}
+
+static void put_varint(std::string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out += static_cast<char>((v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+    out += static_cast<char>(v);
+}
+
+static uint64_t get_varint(const std::string& in, size_t& pos) {
+    uint64_t v = 0;
+    int shift = 0;
+    unsigned char c;
+    do {
+        if (pos >= in.size()) throw std::runtime_error("Truncated delta header");
+        c = static_cast<unsigned char>(in[pos++]);
+        if (shift >= 64 || (shift > 57 && uint64_t(c & 0x7f) >> (64 - shift) != 0)) throw std::runtime_error("Delta header size too large");
+        v |= uint64_t(c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    return v;
+}
+
+DeltaIndex::DeltaIndex(const std::string& source) : src_(source) {
+    size_t blocks = src_.size() / BLOCK;
+    if (blocks == 0) return;
+    size_t buckets = 1;
+    while (buckets < blocks) buckets <<= 1;
+    mask_ = static_cast<uint32_t>(buckets - 1);
+    heads_.assign(buckets, 0);
+    next_.assign(blocks, 0);
+    const auto* p = reinterpret_cast<const unsigned char*>(src_.data());
+    // Insert back to front so chains list earlier offsets first
+    for (size_t b = blocks; b-- > 0;) {
+        uint32_t bucket = bucket_of(block_hash(p + b * BLOCK), mask_);
+        next_[b] = heads_[bucket];
+        heads_[bucket] = static_cast<uint32_t>(b * BLOCK + 1);
+    }
+}
+
+static void flush_insert(std::string& out, const std::string& target, size_t from, size_t to) {
+    while (from < to) {
+        size_t n = std::min<size_t>(to - from, 127);
+        out += static_cast<char>(n);
+        out.append(target, from, n);
+        from += n;
+    }
+}
+
+static void emit_copy(std::string& out, uint64_t offset, size_t len) {
+    while (len > 0) {
+        size_t n = std::min(len, MAX_COPY);
+        std::string op(1, '\0');
+        unsigned char cmd = 0x80;
+        for (int i = 0; i < 4; ++i) {
+            unsigned char byte = (offset >> (8 * i)) & 0xff;
+            if (byte) {
+                cmd |= 1 << i;
+                op += static_cast<char>(byte);
+            }
+        }
+        size_t encoded = n == MAX_COPY ? 0 : n;  // Size 0 means 0x10000
+        for (int i = 0; i < 3; ++i) {
+            unsigned char byte = (encoded >> (8 * i)) & 0xff;
+            if (byte) {
+                cmd |= 0x10 << i;
+                op += static_cast<char>(byte);
+            }
+        }
+        op[0] = static_cast<char>(cmd);
+        out += op;
+        offset += n;
+        len -= n;
+    }
+}
+
+std::string DeltaIndex::create(const std::string& target, size_t max_size) const {
+    std::string out;
+    put_varint(out, src_.size());
+    put_varint(out, target.size());
+    const auto* s = reinterpret_cast<const unsigned char*>(src_.data());
+    const auto* t = reinterpret_cast<const unsigned char*>(target.data());
+    const size_t tsize = target.size();
+    const uint32_t weight = out_weight();
+
+    size_t i = 0;
+    size_t literal_start = 0;
+    uint32_t h = (heads_.empty() || tsize < BLOCK) ? 0 : block_hash(t);
+    while (!heads_.empty() && i + BLOCK <= tsize) {
+        size_t best_len = 0;
+        size_t best_off = 0;
+        size_t checked = 0;
+        for (uint32_t c = heads_[bucket_of(h, mask_)]; c && checked < MAX_CHAIN; c = next_[(c - 1) / BLOCK], ++checked) {
+            size_t off = c - 1;
+            if (std::memcmp(s + off, t + i, BLOCK) != 0) continue;
+            size_t len = BLOCK;
+            while (off + len < src_.size() && i + len < tsize && s[off + len] == t[i + len]) ++len;
+            if (len > best_len) {
+                best_len = len;
+                best_off = off;
+            }
+        }
+
+        if (best_len == 0) {
+            if (i + BLOCK < tsize) h = (h - t[i] * weight) * HASH_BASE + t[i + BLOCK];
+            ++i;
+            continue;
+        }
+
+        // Grow the match backwards over bytes we were about to insert literally
+        while (best_off > 0 && i > literal_start && s[best_off - 1] == t[i - 1]) {
+            --best_off;
+            --i;
+            ++best_len;
+        }
+        flush_insert(out, target, literal_start, i);
+        emit_copy(out, best_off, best_len);
+        i += best_len;
+        literal_start = i;
+        if (out.size() > max_size) return "";
+        if (i + BLOCK <= tsize) h = block_hash(t + i);
+    }
+    flush_insert(out, target, literal_start, tsize);
+    if (out.size() > max_size) return "";
+    return out;
+}
+
+uint64_t delta_target_size(const std::string& delta) {
+    size_t pos = 0;
+    get_varint(delta, pos);
+    return get_varint(delta, pos);
+}
+
+std::string apply_delta(const std::string& base, const std::string& delta) {
+    size_t pos = 0;
+    uint64_t base_size = get_varint(delta, pos);
+    uint64_t result_size = get_varint(delta, pos);
+    if (base_size != base.size()) throw std::runtime_error("Delta base size mismatch");
+
+    std::string out;
+    out.reserve(result_size);
+    while (pos < delta.size()) {
+        unsigned char cmd = static_cast<unsigned char>(delta[pos++]);
+        if (cmd & 0x80) {
+            uint64_t offset = 0;
+            size_t size = 0;
+            for (int i = 0; i < 4; ++i) {
+                if (cmd & (1 << i)) {
+                    if (pos >= delta.size()) throw std::runtime_error("Truncated delta copy op");
+                    offset |= uint64_t(static_cast<unsigned char>(delta[pos++])) << (8 * i);
+                }
+            }
+            for (int i = 0; i < 3; ++i) {
+                if (cmd & (0x10 << i)) {
+                    if (pos >= delta.size()) throw std::runtime_error("Truncated delta copy op");
+                    size |= size_t(static_cast<unsigned char>(delta[pos++])) << (8 * i);
+                }
+            }
+            if (size == 0) size = MAX_COPY;
+            if (offset + size > base.size()) throw std::runtime_error("Delta copy out of range");
+            out.append(base, static_cast<size_t>(offset), size);
+        } else if (cmd) {
+            if (pos + cmd > delta.size()) throw std::runtime_error("Truncated delta insert op");
+            out.append(delta, pos, cmd);
+            pos += cmd;
+        } else {
+            throw std::runtime_error("Invalid delta opcode 0");
+        }
+    }
+    if (out.size() != result_size) throw std::runtime_error("Delta result size mismatch");
+    return out;
+}
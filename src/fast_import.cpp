@@ -0,0 +1,558 @@
+#include "fast_import.h"
+#include "object_cache.h"
+#include "object_id.h"
+#include "pack.h"
+#include "sha1.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+static const uint32_t TREE_MODE = 040000;
+
+namespace {
+
+struct TreeNode;
+
+// A tree entry. Directories get their contents loaded on first use; a
+// node shared with another branch is copied before it's changed.
+struct TreeEntry {
+    uint32_t mode = 0;
+    ObjectId id;
+    bool has_id = false;              // False for directories made in this stream and not written yet
+    std::shared_ptr<TreeNode> tree;   // Loaded or changed directory contents
+};
+
+struct TreeNode {
+    std::map<std::string, TreeEntry> entries;
+    bool dirty = false;  // Changed since its id was computed
+    ObjectId id;         // The tree's id while not dirty; `C` can leave several entries sharing the node
+};
+
+struct Branch {
+    ObjectId head;
+    bool has_head = false;
+    TreeEntry root{TREE_MODE, {}, false, std::make_shared<TreeNode>()};
+};
+
+class Importer {
+public:
+    Importer(const GitRepository& repo, std::istream& in, std::ostream& out)
+        : repo_(repo), in_(in), out_(out), writer_(repo) {}
+
+    void import_marks(const std::string& path);
+    void run();
+    FastImportStats finish(const std::string& export_marks);
+
+private:
+    bool next_line(std::string& line);
+    void unread(std::string line) {
+        pending_ = std::move(line);
+        has_pending_ = true;
+    }
+    std::string read_data(const std::string& line);
+    // Optional "mark :<n>" and "original-oid <oid>" lines
+    uint64_t read_mark();
+
+    ObjectId store(const char* fmt, const std::string& data);
+    void set_mark(uint64_t mark, const ObjectId& id) {
+        if (mark) marks_[mark] = id;
+    }
+    ObjectId resolve(const std::string& ref);
+    std::string object_type(const ObjectId& id);
+    Branch& branch(const std::string& ref);
+    ObjectId commit_tree(const ObjectId& commit);
+
+    TreeNode& load(TreeEntry& entry);
+    TreeNode& writable(TreeEntry& entry);
+    bool lookup(TreeEntry& root, const std::string& path, TreeEntry& out);
+    void set(TreeEntry& root, const std::string& path, TreeEntry entry);
+    void remove(TreeEntry& root, const std::string& path);
+    ObjectId write_tree(TreeEntry& entry);
+
+    void parse_blob();
+    void parse_commit(const std::string& ref);
+    void parse_reset(const std::string& ref);
+    void parse_tag(const std::string& name);
+    void parse_file_change(Branch& b, const std::string& line);
+
+    const GitRepository& repo_;
+    std::istream& in_;
+    std::ostream& out_;
+    PackWriter writer_;
+    std::string pending_;
+    bool has_pending_ = false;
+
+    std::unordered_map<ObjectId, const char*> written_;  // Objects stored here -> their type
+    std::unordered_map<uint64_t, ObjectId> marks_;
+    std::unordered_map<ObjectId, ObjectId> commit_trees_;  // Commits made here -> their trees
+    std::map<std::string, Branch> branches_;
+    std::map<std::string, ObjectId> tags_;
+    FastImportStats stats_;
+};
+
+bool Importer::next_line(std::string& line) {
+    if (has_pending_) {
+        line = std::move(pending_);
+        has_pending_ = false;
+        return true;
+    }
+    while (std::getline(in_, line)) {
+        if (line.empty() || line[0] != '#') return true;
+    }
+    return false;
+}
+
+// "data <count>" followed by exactly that many bytes, or "data <<END"
+// followed by lines up to END
+std::string Importer::read_data(const std::string& line) {
+    if (line.rfind("data ", 0) != 0) throw std::runtime_error("fast-import: expected data, got: " + line);
+    std::string data;
+    if (line.compare(5, 2, "<<") == 0) {
+        std::string delim = line.substr(7), text;
+        while (std::getline(in_, text) && text != delim) data += text + "\n";
+        if (text != delim) throw std::runtime_error("fast-import: unterminated data <<" + delim);
+        return data;
+    }
+    size_t count = std::stoull(line.substr(5));
+    data.resize(count);
+    if (!in_.read(data.data(), static_cast<std::streamsize>(count))) {
+        throw std::runtime_error("fast-import: stream ends inside a data block");
+    }
+    if (in_.peek() == '\n') in_.get();  // Optional LF
+    return data;
+}
+
+uint64_t Importer::read_mark() {
+    uint64_t mark = 0;
+    std::string line;
+    while (next_line(line)) {
+        if (line.rfind("mark :", 0) == 0) {
+            mark = std::stoull(line.substr(6));
+        } else if (line.rfind("original-oid ", 0) != 0) {
+            unread(std::move(line));
+            break;
+        }
+    }
+    return mark;
+}
+
+ObjectId Importer::store(const char* fmt, const std::string& data) {
+    std::string header = std::string(fmt) + " " + std::to_string(data.size());
+    Sha1 ctx;
+    ctx.update(header.data(), header.size() + 1);  // With the NUL
+    ctx.update(data.data(), data.size());
+    ObjectId id = ctx.finish();
+    if (!written_.emplace(id, fmt).second) {
+        ++stats_.duplicates;
+        return id;
+    }
+    writer_.add(id.hex(), fmt, data);
+    stats_.bytes += data.size();
+    switch (fmt[0]) {
+        case 'b': ++stats_.blobs; break;
+        case 't': (fmt[1] == 'r' ? stats_.trees : stats_.tags)++; break;
+        case 'c': ++stats_.commits; break;
+    }
+    return id;
+}
+
+// Type of an object from this stream or already in the repository
+std::string Importer::object_type(const ObjectId& id) {
+    auto it = written_.find(id);
+    if (it != written_.end()) return it->second;
+    std::string fmt;
+    uint64_t size;
+    if (!object_read_header(repo_, id.hex(), fmt, size)) {
+        throw std::runtime_error("fast-import: no object " + id.hex());
+    }
+    return fmt;
+}
+
+// ":<mark>", a full SHA, a branch from this stream, or anything object_find takes
+ObjectId Importer::resolve(const std::string& ref) {
+    if (ref[0] == ':') {
+        auto it = marks_.find(std::stoull(ref.substr(1)));
+        if (it == marks_.end()) throw std::runtime_error("fast-import: unknown mark " + ref);
+        return it->second;
+    }
+    ObjectId id;
+    if (ref.size() == 40 && ObjectId::parse_hex(ref, id)) return id;
+    auto it = branches_.find(ref);
+    if (it == branches_.end()) it = branches_.find("refs/heads/" + ref);
+    if (it != branches_.end() && it->second.has_head) return it->second.head;
+    return ObjectId::from_hex(object_find(repo_, ref, "commit", true));
+}
+
+// A branch seen for the first time carries on from the ref on disk, if any
+Branch& Importer::branch(const std::string& ref) {
+    auto [it, added] = branches_.try_emplace(ref);
+    if (added) {
+        std::ifstream file(repo_.gitdir / ref);
+        std::string sha;
+        if (file && std::getline(file, sha) && ObjectId::parse_hex(sha, it->second.head)) {
+            it->second.has_head = true;
+            it->second.root = {TREE_MODE, commit_tree(it->second.head), true, nullptr};
+        }
+    }
+    return it->second;
+}
+
+ObjectId Importer::commit_tree(const ObjectId& commit) {
+    auto it = commit_trees_.find(commit);
+    if (it != commit_trees_.end()) return it->second;
+    return ObjectId::from_hex(commit_tree_sha(repo_, commit.hex()));
+}
+
+TreeNode& Importer::load(TreeEntry& entry) {
+    if (entry.tree) return *entry.tree;
+    entry.tree = std::make_shared<TreeNode>();
+    if (!entry.has_id) return *entry.tree;
+    entry.tree->id = entry.id;
+    // Trees from this stream are read back from the pack being written
+    std::string hex = entry.id.hex(), fmt, data;
+    std::shared_ptr<const CachedObject> cached;
+    if (!writer_.read(hex, fmt, data)) {
+        cached = object_cache_read(repo_, hex);
+        fmt = cached->fmt;
+    }
+    if (fmt != "tree") throw std::runtime_error("fast-import: " + hex + " is not a tree");
+    for (const TreeEntryView& e : TreeView(cached ? cached->data : data)) {
+        entry.tree->entries[std::string(e.path)] = {e.mode, e.id(), true, nullptr};
+    }
+    return *entry.tree;
+}
+
+TreeNode& Importer::writable(TreeEntry& entry) {
+    load(entry);
+    if (entry.tree.use_count() > 1) entry.tree = std::make_shared<TreeNode>(*entry.tree);
+    entry.tree->dirty = true;
+    return *entry.tree;
+}
+
+bool Importer::lookup(TreeEntry& root, const std::string& path, TreeEntry& out) {
+    TreeEntry* e = &root;
+    size_t pos = 0;
+    while (pos <= path.size()) {
+        size_t slash = std::min(path.find('/', pos), path.size());
+        if (e->mode != TREE_MODE) return false;
+        TreeNode& node = load(*e);
+        auto it = node.entries.find(path.substr(pos, slash - pos));
+        if (it == node.entries.end()) return false;
+        e = &it->second;
+        pos = slash + 1;
+    }
+    out = *e;
+    return true;
+}
+
+void Importer::set(TreeEntry& root, const std::string& path, TreeEntry entry) {
+    TreeEntry* e = &root;
+    size_t pos = 0;
+    for (size_t slash; (slash = path.find('/', pos)) != std::string::npos; pos = slash + 1) {
+        TreeEntry& child = writable(*e).entries[path.substr(pos, slash - pos)];
+        if (child.mode != TREE_MODE) child = {TREE_MODE, {}, false, std::make_shared<TreeNode>()};
+        e = &child;
+    }
+    writable(*e).entries[path.substr(pos)] = std::move(entry);
+}
+
+void Importer::remove(TreeEntry& root, const std::string& path) {
+    TreeEntry found;
+    if (!lookup(root, path, found)) return;
+    // Directories left empty go too, as Git has no empty trees
+    std::vector<std::pair<TreeEntry*, std::string>> trail;
+    TreeEntry* e = &root;
+    size_t pos = 0;
+    for (size_t slash; (slash = path.find('/', pos)) != std::string::npos; pos = slash + 1) {
+        std::string name = path.substr(pos, slash - pos);
+        trail.push_back({e, name});
+        e = &writable(*e).entries[name];
+    }
+    writable(*e).entries.erase(path.substr(pos));
+    for (auto it = trail.rbegin(); it != trail.rend() && e->tree->entries.empty(); ++it) {
+        it->first->tree->entries.erase(it->second);
+        e = it->first;
+    }
+}
+
+ObjectId Importer::write_tree(TreeEntry& entry) {
+    if (!entry.tree) return entry.id;
+    if (!entry.tree->dirty) {
+        entry.id = entry.tree->id;
+        entry.has_id = true;
+        return entry.id;
+    }
+    // Git order: directories sort as if their name ended in '/'
+    std::vector<std::pair<std::string, TreeEntry*>> sorted;
+    sorted.reserve(entry.tree->entries.size());
+    for (auto& [name, child] : entry.tree->entries) {
+        sorted.push_back({child.mode == TREE_MODE ? name + "/" : name, &child});
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    std::string data;
+    for (auto& [key, child] : sorted) {
+        if (child->mode == TREE_MODE) {
+            child->id = write_tree(*child);
+            child->has_id = true;
+        }
+        char mode[12];
+        int n = std::snprintf(mode, sizeof(mode), "%o ", child->mode);
+        data.append(mode, n);
+        data.append(key, 0, child->mode == TREE_MODE ? key.size() - 1 : key.size());
+        data += '\0';
+        data.append(reinterpret_cast<const char*>(child->id.data()), 20);
+    }
+    entry.id = store("tree", data);
+    entry.has_id = true;
+    entry.tree->id = entry.id;
+    entry.tree->dirty = false;
+    return entry.id;
+}
+
+void Importer::parse_blob() {
+    uint64_t mark = read_mark();
+    std::string line;
+    if (!next_line(line)) throw std::runtime_error("fast-import: stream ends inside a blob");
+    set_mark(mark, store("blob", read_data(line)));
+}
+
+// A path, C-style quoted or up to the next space (or the end with `last`)
+static std::string parse_path(std::string_view& rest, bool last) {
+    std::string path;
+    if (rest.empty() || rest[0] != '"') {
+        size_t end = last ? rest.size() : rest.find(' ');
+        if (end == std::string_view::npos) throw std::runtime_error("fast-import: missing path");
+        path = std::string(rest.substr(0, end));
+        rest.remove_prefix(std::min(rest.size(), end + 1));
+        return path;
+    }
+    size_t i = 1;
+    for (; i < rest.size() && rest[i] != '"'; ++i) {
+        if (rest[i] != '\\' || i + 1 >= rest.size()) {
+            path += rest[i];
+            continue;
+        }
+        char c = rest[++i];
+        switch (c) {
+            case 'n': path += '\n'; break;
+            case 't': path += '\t'; break;
+            case 'a': path += '\a'; break;
+            case 'b': path += '\b'; break;
+            case 'f': path += '\f'; break;
+            case 'r': path += '\r'; break;
+            case 'v': path += '\v'; break;
+            default:
+                if (c >= '0' && c <= '3' && i + 2 < rest.size()) {
+                    path += static_cast<char>(((c - '0') << 6) | ((rest[i + 1] - '0') << 3) | (rest[i + 2] - '0'));
+                    i += 2;
+                } else {
+                    path += c;
+                }
+        }
+    }
+    if (i >= rest.size()) throw std::runtime_error("fast-import: unterminated quoted path");
+    rest.remove_prefix(std::min(rest.size(), i + 2));  // Closing quote and the space after it
+    return path;
+}
+
+void Importer::parse_file_change(Branch& b, const std::string& line) {
+    std::string_view rest(line);
+    char op = line[0];
+    rest.remove_prefix(2);
+    if (op == 'M') {
+        size_t sp = rest.find(' ');
+        uint32_t mode = static_cast<uint32_t>(std::stoul(std::string(rest.substr(0, sp)), nullptr, 8));
+        if (mode == 0644) mode = 0100644;
+        if (mode == 0755) mode = 0100755;
+        if (mode != 0100644 && mode != 0100755 && mode != 0120000 && mode != 0160000 && mode != TREE_MODE) {
+            throw std::runtime_error("fast-import: bad mode in: " + line);
+        }
+        rest.remove_prefix(sp + 1);
+        sp = rest.find(' ');
+        std::string ref(rest.substr(0, sp));
+        rest.remove_prefix(sp + 1);
+        std::string path = parse_path(rest, true);
+        ObjectId id;
+        if (ref == "inline") {
+            std::string data_line;
+            if (!next_line(data_line)) throw std::runtime_error("fast-import: stream ends inside a commit");
+            id = store("blob", read_data(data_line));
+        } else {
+            id = resolve(ref);
+        }
+        if (path.empty()) {
+            if (mode != TREE_MODE) throw std::runtime_error("fast-import: empty path in: " + line);
+            b.root = {TREE_MODE, id, true, nullptr};
+        } else {
+            set(b.root, path, {mode, id, true, nullptr});
+        }
+    } else if (op == 'D') {
+        remove(b.root, parse_path(rest, true));
+    } else {  // C or R
+        std::string from = parse_path(rest, false);
+        std::string to = parse_path(rest, true);
+        TreeEntry entry;
+        if (!lookup(b.root, from, entry)) throw std::runtime_error("fast-import: path not in branch: " + from);
+        if (op == 'R') remove(b.root, from);
+        set(b.root, to, std::move(entry));
+    }
+}
+
+void Importer::parse_commit(const std::string& ref) {
+    Branch& b = branch(ref);
+    uint64_t mark = read_mark();
+    std::string line, author, committer, encoding;
+    while (next_line(line)) {
+        if (line.rfind("author ", 0) == 0) author = line.substr(7);
+        else if (line.rfind("committer ", 0) == 0) committer = line.substr(10);
+        else if (line.rfind("encoding ", 0) == 0) encoding = line.substr(9);
+        else break;
+    }
+    if (committer.empty()) throw std::runtime_error("fast-import: commit without a committer");
+    std::string message = read_data(line);
+
+    std::vector<ObjectId> parents;
+    if (b.has_head) parents.push_back(b.head);
+    while (next_line(line)) {
+        if (line.empty()) break;
+        if (line.rfind("from ", 0) == 0) {
+            ObjectId from = resolve(line.substr(5));
+            if (!b.has_head || from != b.head) {
+                b.root = {TREE_MODE, commit_tree(from), true, nullptr};
+            }
+            parents.assign(1, from);
+        } else if (line.rfind("merge ", 0) == 0) {
+            parents.push_back(resolve(line.substr(6)));
+        } else if (line == "deleteall") {
+            b.root = {TREE_MODE, {}, false, std::make_shared<TreeNode>()};
+            b.root.tree->dirty = true;
+        } else if (line.size() > 2 && line[1] == ' ' && std::strchr("MDCR", line[0])) {
+            parse_file_change(b, line);
+        } else {
+            unread(std::move(line));
+            break;
+        }
+    }
+
+    if (!b.root.has_id && !b.root.tree->dirty) b.root.tree->dirty = true;  // New branch, nothing added
+    ObjectId tree = write_tree(b.root);
+    std::string data = "tree " + tree.hex() + "\n";
+    for (const ObjectId& parent : parents) data += "parent " + parent.hex() + "\n";
+    data += "author " + (author.empty() ? committer : author) + "\n";
+    data += "committer " + committer + "\n";
+    if (!encoding.empty()) data += "encoding " + encoding + "\n";
+    data += "\n" + message;
+    b.head = store("commit", data);
+    b.has_head = true;
+    commit_trees_[b.head] = tree;
+    set_mark(mark, b.head);
+}
+
+void Importer::parse_reset(const std::string& ref) {
+    Branch& b = branches_[ref];
+    b = Branch();
+    std::string line;
+    if (!next_line(line)) return;
+    if (line.rfind("from ", 0) == 0) {
+        b.head = resolve(line.substr(5));
+        b.has_head = true;
+        b.root = {TREE_MODE, commit_tree(b.head), true, nullptr};
+    } else if (!line.empty()) {
+        unread(std::move(line));
+    }
+}
+
+void Importer::parse_tag(const std::string& name) {
+    uint64_t mark = read_mark();
+    std::string line, tagger;
+    if (!next_line(line) || line.rfind("from ", 0) != 0) throw std::runtime_error("fast-import: tag without from");
+    ObjectId target = resolve(line.substr(5));
+    std::string type = object_type(target);
+    mark = std::max(mark, read_mark());
+    if (!next_line(line)) throw std::runtime_error("fast-import: stream ends inside a tag");
+    if (line.rfind("tagger ", 0) == 0) {
+        tagger = line.substr(7);
+        if (!next_line(line)) throw std::runtime_error("fast-import: stream ends inside a tag");
+    }
+    std::string message = read_data(line);
+    std::string data = "object " + target.hex() + "\ntype " + type + "\ntag " + name + "\n";
+    if (!tagger.empty()) data += "tagger " + tagger + "\n";
+    data += "\n" + message;
+    ObjectId id = store("tag", data);
+    tags_[name] = id;
+    set_mark(mark, id);
+}
+
+void Importer::import_marks(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) throw std::runtime_error("fast-import: can't read marks from " + path);
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t sp = line.find(' ');
+        if (line.empty() || line[0] != ':' || sp == std::string::npos) continue;
+        marks_[std::stoull(line.substr(1, sp - 1))] = ObjectId::from_hex(line.substr(sp + 1));
+    }
+}
+
+void Importer::run() {
+    std::string line;
+    while (next_line(line)) {
+        if (line.empty()) continue;
+        if (line == "blob") parse_blob();
+        else if (line.rfind("commit ", 0) == 0) parse_commit(line.substr(7));
+        else if (line.rfind("reset ", 0) == 0) parse_reset(line.substr(6));
+        else if (line.rfind("tag ", 0) == 0) parse_tag(line.substr(4));
+        else if (line.rfind("progress ", 0) == 0) out_ << line << std::endl;
+        else if (line == "done") break;
+        else if (line == "checkpoint" || line.rfind("feature ", 0) == 0 || line.rfind("option ", 0) == 0) continue;
+        else throw std::runtime_error("fast-import: unsupported command: " + line);
+    }
+}
+
+static void write_ref(const GitRepository& repo, const std::string& ref, const ObjectId& id) {
+    fs::path path = repo.gitdir / ref;
+    fs::create_directories(path.parent_path());
+    std::ofstream file(path, std::ios::trunc);
+    file << id.hex() << "\n";
+    if (!file) throw std::runtime_error("fast-import: failed to update " + ref);
+}
+
+FastImportStats Importer::finish(const std::string& export_marks) {
+    // The refs only change once every object they reach is in place
+    if (writer_.count() > 0) {
+        stats_.pack_bytes = writer_.bytes();
+        stats_.pack = writer_.finish().filename().string();
+        pack_list(repo_, true);
+    }
+    for (const auto& [ref, b] : branches_) {
+        if (b.has_head) write_ref(repo_, ref, b.head);
+    }
+    for (const auto& [name, id] : tags_) write_ref(repo_, "refs/tags/" + name, id);
+    if (!export_marks.empty()) {
+        std::vector<std::pair<uint64_t, ObjectId>> sorted(marks_.begin(), marks_.end());
+        std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+        std::ofstream file(export_marks, std::ios::trunc);
+        for (const auto& [mark, id] : sorted) file << ':' << mark << ' ' << id.hex() << '\n';
+        if (!file) throw std::runtime_error("fast-import: failed to write marks to " + export_marks);
+    }
+    return stats_;
+}
+
+}  // namespace
+
+FastImportStats fast_import(const GitRepository& repo, std::istream& in, std::ostream& out,
+                            const FastImportOptions& options) {
+    auto start = std::chrono::steady_clock::now();
+    Importer importer(repo, in, out);
+    if (!options.import_marks.empty()) importer.import_marks(options.import_marks);
+    importer.run();
+    FastImportStats stats = importer.finish(options.export_marks);
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
@@ -0,0 +1,297 @@
+#include "fsck.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "object_io.h"
+#include "pack.h"
+#include "sha1.h"
+#include "thread_pool.h"
+
+// Objects handed to one pool task
+static constexpr size_t FSCK_CHUNK = 64;
+
+namespace {
+
+enum ObjectType : uint8_t { NONE, BLOB, TREE, COMMIT, TAG };
+
+const char* type_name(uint8_t type) {
+    switch (type) {
+        case BLOB: return "blob";
+        case TREE: return "tree";
+        case COMMIT: return "commit";
+        case TAG: return "tag";
+        default: return "object";
+    }
+}
+
+uint8_t type_of(std::string_view fmt) {
+    if (fmt == "blob") return BLOB;
+    if (fmt == "tree") return TREE;
+    if (fmt == "commit") return COMMIT;
+    if (fmt == "tag") return TAG;
+    return NONE;
+}
+
+struct Link {
+    ObjectId from;
+    ObjectId to;
+    uint8_t from_type;
+    uint8_t to_type;  // What `from` says it is
+};
+
+// What one task found; merged into the context once per task
+struct FsckLocal {
+    std::vector<std::string> errors;
+    std::vector<std::pair<ObjectId, uint8_t>> objects;
+    std::vector<Link> links;
+    uint64_t bytes = 0;
+};
+
+struct FsckContext {
+    const GitRepository& repo;
+    bool connectivity;
+    std::atomic<uint64_t> loose{0};
+    std::atomic<uint64_t> packed{0};
+    std::mutex mu;
+    FsckLocal all;  // Guarded by mu
+
+    FsckContext(const GitRepository& repo, bool connectivity) : repo(repo), connectivity(connectivity) {}
+
+    void merge(FsckLocal& local) {
+        std::lock_guard<std::mutex> lk(mu);
+        all.bytes += local.bytes;
+        std::move(local.errors.begin(), local.errors.end(), std::back_inserter(all.errors));
+        all.objects.insert(all.objects.end(), local.objects.begin(), local.objects.end());
+        all.links.insert(all.links.end(), local.links.begin(), local.links.end());
+    }
+};
+
+bool is_hex_sha(std::string_view s) {
+    return s.size() == 40 && std::all_of(s.begin(), s.end(), [](char c) {
+        return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+    });
+}
+
+// Empty if the tree is fine
+std::string check_tree(const ObjectId& id, std::string_view data, FsckLocal& local, bool links) {
+    TreeEntryView prev;
+    bool first = true;
+    for (const auto& entry : TreeView(data)) {
+        switch (entry.mode) {
+            case 0100644: case 0100755: case 0100664: case 0120000: case 040000: case 0160000: break;
+            default: {
+                char mode[16];
+                std::snprintf(mode, sizeof(mode), "%06o", entry.mode);
+                return "bad mode " + std::string(mode) + " for '" + std::string(entry.path) + "'";
+            }
+        }
+        if (entry.path.empty() || entry.path == "." || entry.path == ".." || entry.path == ".git" ||
+            entry.path.find('/') != std::string_view::npos) {
+            return "bad entry name '" + std::string(entry.path) + "'";
+        }
+        if (!first) {
+            if (prev.path == entry.path) return "duplicate entry '" + std::string(entry.path) + "'";
+            if (tree_order(prev, entry) > 0) return "entries not sorted ('" + std::string(entry.path) + "')";
+        }
+        prev = entry;
+        first = false;
+        // Submodule commits live in another repository
+        if (links && entry.mode != 0160000) {
+            local.links.push_back({id, entry.id(), TREE, uint8_t(entry.mode == 040000 ? TREE : BLOB)});
+        }
+    }
+    return "";
+}
+
+std::string check_commit(const ObjectId& id, std::string_view data, FsckLocal& local, bool links) {
+    CommitView commit(data);
+    size_t index = 0;
+    bool author = false, committer = false;
+    std::string problem;
+    commit.for_each_header([&](std::string_view key, std::string_view value) {
+        if (!problem.empty()) return;
+        if (index++ == 0 && key != "tree") problem = "first header is not 'tree'";
+        else if (key == "tree" || key == "parent") {
+            if (!is_hex_sha(value)) problem = "bad " + std::string(key) + " '" + std::string(value) + "'";
+            else if (links) local.links.push_back({id, ObjectId::from_hex(value), COMMIT, key == "tree" ? TREE : COMMIT});
+        }
+        author |= key == "author";
+        committer |= key == "committer";
+    });
+    if (problem.empty() && index == 0) problem = "no headers";
+    if (problem.empty() && !author) problem = "no author";
+    if (problem.empty() && !committer) problem = "no committer";
+    return problem;
+}
+
+std::string check_tag(const ObjectId& id, std::string_view data, FsckLocal& local, bool links) {
+    CommitView tag(data);  // Same header layout as a commit
+    std::string_view object = tag.header("object");
+    uint8_t type = type_of(tag.header("type"));
+    if (!is_hex_sha(object)) return "bad object '" + std::string(object) + "'";
+    if (type == NONE) return "bad type '" + std::string(tag.header("type")) + "'";
+    if (tag.header("tag").empty()) return "no tag name";
+    if (links) local.links.push_back({id, ObjectId::from_hex(object), TAG, type});
+    return "";
+}
+
+// Hash and parse one object whose header and payload are in hand
+void check_object(FsckContext& ctx, FsckLocal& local, const ObjectId& id, const char* where, std::string_view fmt,
+                  std::string_view payload, const ObjectId& actual) {
+    local.bytes += payload.size();
+    if (actual != id) {
+        local.errors.push_back("error in object " + id.hex() + " (" + where + "): contents hash to " + actual.hex());
+        return;
+    }
+    uint8_t type = type_of(fmt);
+    std::string problem;
+    try {
+        switch (type) {
+            case TREE: problem = check_tree(id, payload, local, ctx.connectivity); break;
+            case COMMIT: problem = check_commit(id, payload, local, ctx.connectivity); break;
+            case TAG: problem = check_tag(id, payload, local, ctx.connectivity); break;
+            case BLOB: break;
+            default: problem = "unknown type '" + std::string(fmt) + "'";
+        }
+    } catch (const std::exception& e) {
+        problem = e.what();  // Malformed tree entry
+    }
+    if (!problem.empty()) {
+        local.errors.push_back("error in " + std::string(type_name(type)) + " " + id.hex() + ": " + problem);
+        return;
+    }
+    if (ctx.connectivity) local.objects.push_back({id, type});
+}
+
+void check_loose(FsckContext& ctx, const std::vector<std::string>& shas, size_t first, size_t last) {
+    FsckLocal local;
+    std::string objects = (ctx.repo.gitdir / "objects").string() + "/";
+    for (size_t i = first; i < last; ++i) {
+        const std::string& sha = shas[i];
+        ObjectId id = ObjectId::from_hex(sha);
+        try {
+            std::string path = objects + sha.substr(0, 2) + "/" + sha.substr(2);
+            LooseFile file(path);
+            if (!file.ok()) throw std::runtime_error("cannot open " + path);
+            ArenaScope scratch;
+            auto [fmt, data] = inflate_loose(file.contents(scratch), file.size());
+            std::string header = fmt + ' ' + std::to_string(data.size()) + '\0';
+            Sha1 hash;
+            hash.update(header.data(), header.size());
+            hash.update(data.data(), data.size());
+            check_object(ctx, local, id, "loose", fmt, data, hash.finish());
+        } catch (const std::exception& e) {
+            local.errors.push_back("error in object " + sha + " (loose): " + e.what());
+        }
+    }
+    ctx.loose += last - first;
+    ctx.merge(local);
+}
+
+void check_packed(FsckContext& ctx, const PackFile& pack, uint32_t first, uint32_t last) {
+    FsckLocal local;
+    std::string where = pack.pack_path().filename().string();
+    for (uint32_t i = first; i < last; ++i) {
+        ObjectId id = ObjectId::from_raw(pack.sha_at(i));
+        try {
+            auto [fmt, data] = pack.read(pack.offset_at(i));
+            std::string header = fmt + ' ' + std::to_string(data.size()) + '\0';
+            Sha1 hash;
+            hash.update(header.data(), header.size());
+            hash.update(data.data(), data.size());
+            check_object(ctx, local, id, where.c_str(), fmt, data, hash.finish());
+        } catch (const std::exception& e) {
+            local.errors.push_back("error in object " + id.hex() + " (" + where + "): " + e.what());
+        }
+    }
+    ctx.packed += last - first;
+    ctx.merge(local);
+}
+
+}  // namespace
+
+FsckStats fsck(const GitRepository& repo, const FsckOptions& options, std::ostream& out) {
+    auto start = std::chrono::steady_clock::now();
+    FsckContext ctx(repo, options.connectivity);
+    std::vector<std::string> loose = loose_objects(repo);
+    std::vector<std::shared_ptr<PackFile>> packs = pack_list(repo, true);
+    {
+        ThreadPool pool(options.jobs ? options.jobs : ThreadPool::default_threads());
+        for (size_t i = 0; i < loose.size(); i += FSCK_CHUNK) {
+            pool.submit([&ctx, &loose, i] { check_loose(ctx, loose, i, std::min(loose.size(), i + FSCK_CHUNK)); });
+        }
+        for (const auto& pack : packs) {
+            const PackFile* p = pack.get();
+            pool.submit([&ctx, p] {
+                try {
+                    p->verify_checksums();
+                } catch (const std::exception& e) {
+                    std::lock_guard<std::mutex> lk(ctx.mu);
+                    ctx.all.errors.push_back(std::string("error: ") + e.what());
+                }
+            });
+            for (uint32_t i = 0; i < p->count(); i += FSCK_CHUNK) {
+                pool.submit([&ctx, p, i] {
+                    check_packed(ctx, *p, i, static_cast<uint32_t>(std::min<uint64_t>(p->count(), i + FSCK_CHUNK)));
+                });
+            }
+        }
+        pool.wait();
+    }
+
+    FsckStats stats;
+    stats.loose = ctx.loose;
+    stats.packed = ctx.packed;
+    stats.bytes = ctx.all.bytes;
+    std::vector<std::string>& errors = ctx.all.errors;
+    std::vector<std::string> broken, missing, dangling;
+    if (options.connectivity) {
+        // An object in a pack and loose too is checked twice but counts once
+        std::unordered_map<ObjectId, uint8_t> types(ctx.all.objects.begin(), ctx.all.objects.end());
+        std::unordered_set<ObjectId> referenced;
+        std::unordered_set<ObjectId> missing_ids;
+        auto report_missing = [&](const ObjectId& id, uint8_t type) {
+            if (missing_ids.insert(id).second) missing.push_back("missing " + std::string(type_name(type)) + " " + id.hex());
+        };
+        for (const Link& link : ctx.all.links) {
+            referenced.insert(link.to);
+            auto it = types.find(link.to);
+            if (it == types.end()) {
+                broken.push_back("broken link from " + std::string(type_name(link.from_type)) + " " + link.from.hex() +
+                                 " to " + type_name(link.to_type) + " " + link.to.hex());
+                report_missing(link.to, link.to_type);
+            } else if (it->second != link.to_type) {
+                errors.push_back("error in " + std::string(type_name(link.from_type)) + " " + link.from.hex() + ": " +
+                                 link.to.hex() + " is a " + type_name(it->second) + ", not a " + type_name(link.to_type));
+            }
+        }
+        for (const std::string& tip : ref_tips(repo)) {
+            if (!is_hex_sha(tip)) continue;
+            ObjectId id = ObjectId::from_hex(tip);
+            referenced.insert(id);
+            if (!types.count(id)) report_missing(id, COMMIT);
+        }
+        for (const auto& [id, type] : types) {
+            if (!referenced.count(id)) dangling.push_back("dangling " + std::string(type_name(type)) + " " + id.hex());
+        }
+    }
+    for (auto* lines : {&errors, &broken, &missing, &dangling}) {
+        std::sort(lines->begin(), lines->end());
+        for (const std::string& line : *lines) out << line << "\n";
+    }
+    out << std::flush;
+    stats.errors = errors.size();
+    stats.missing = missing.size();
+    stats.dangling = dangling.size();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
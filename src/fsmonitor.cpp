@@ -0,0 +1,457 @@
+#include "fsmonitor.h"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static constexpr uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO |
+                                       IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+// Past this many remembered paths the history is dropped and older tokens
+// get a "/" answer
+static constexpr size_t HISTORY_MAX = 1000000;
+
+static std::atomic<uint64_t> stat_dirs_skipped{0};
+static std::atomic<uint64_t> stat_files_skipped{0};
+static std::string stat_summary;
+
+void fsmonitor_count_skipped(bool dir) {
+    (dir ? stat_dirs_skipped : stat_files_skipped).fetch_add(1, std::memory_order_relaxed);
+}
+
+void fsmonitor_print_stats(std::ostream& out) {
+    if (stat_summary.empty()) return;
+    out << "fsmonitor: " << stat_summary << ", " << stat_dirs_skipped << " directories and " << stat_files_skipped
+        << " files not visited" << std::endl;
+}
+
+bool FsMonitorResult::changed(const std::string& rel) const {
+    if (everything || paths.count(rel)) return true;
+    for (size_t slash = rel.find('/'); slash != std::string::npos; slash = rel.find('/', slash + 1)) {
+        if (paths.count(rel.substr(0, slash))) return true;
+    }
+    return false;
+}
+
+bool FsMonitorResult::dir_changed(const std::string& rel) const {
+    return everything || dirs.count(rel) || changed(rel);
+}
+
+static std::string join(const std::string& dir, const char* name) {
+    return dir.empty() ? std::string(name) : dir + "/" + name;
+}
+
+static sockaddr_un socket_address(const GitRepository& repo) {
+    std::string path = (repo.gitdir / "fsmonitor.sock").string();
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) throw std::runtime_error("Socket path too long: " + path);
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return addr;
+}
+
+// -1 if nothing is listening
+static int connect_daemon(const GitRepository& repo) {
+    sockaddr_un addr = socket_address(repo);
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool send_all(int fd, const std::string& data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = ::send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Send a request and read the whole answer; false if the daemon is gone
+static bool request(const GitRepository& repo, const std::string& req, std::string& reply) {
+    int fd = connect_daemon(repo);
+    if (fd < 0) return false;
+    bool ok = send_all(fd, req);
+    char buf[64 * 1024];
+    while (ok) {
+        ssize_t n = ::read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) ok = false;
+        if (n <= 0) break;
+        reply.append(buf, static_cast<size_t>(n));
+    }
+    ::close(fd);
+    return ok;
+}
+
+bool fsmonitor_enabled(const GitRepository& repo) {
+    std::string setting = repo.config_get("core.fsmonitor");
+    return setting == "true" || setting == "1" || setting == "yes";
+}
+
+std::unique_ptr<FsMonitorResult> fsmonitor_query(const GitRepository& repo, const std::string& since) {
+    if (!fsmonitor_enabled(repo)) return nullptr;
+    std::string reply;
+    if (!request(repo, "Q " + since + "\n", reply) || reply.find('\0') == std::string::npos) {
+        stat_summary = "daemon not running, full scan";
+        return nullptr;
+    }
+    auto result = std::make_unique<FsMonitorResult>();
+    size_t pos = reply.find('\0');
+    result->token = reply.substr(0, pos);
+    result->everything = false;
+    for (++pos; pos < reply.size();) {
+        size_t end = reply.find('\0', pos);
+        if (end == std::string::npos) end = reply.size();
+        std::string path = reply.substr(pos, end - pos);
+        pos = end + 1;
+        if (path == "/") {
+            result->everything = true;
+            continue;
+        }
+        result->dirs.insert("");
+        for (size_t slash = path.find('/'); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+            result->dirs.insert(path.substr(0, slash));
+        }
+        result->paths.insert(std::move(path));
+    }
+    if (result->everything) {
+        result->paths.clear();
+        result->dirs.clear();
+        stat_summary = since.empty() ? "no token yet, full scan" : "token expired, full scan";
+    } else {
+        stat_summary = std::to_string(result->paths.size()) + " changed paths";
+    }
+    return result;
+}
+
+// Daemon
+
+namespace {
+
+class Daemon {
+public:
+    explicit Daemon(const GitRepository& repo) : repo_(repo), root_(repo.worktree.string()) {
+        auto now = std::chrono::system_clock::now().time_since_epoch();
+        instance_ = std::to_string(::getpid()) + "." +
+                    std::to_string(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+    }
+
+    ~Daemon() {
+        if (listen_fd_ >= 0) {
+            ::close(listen_fd_);
+            ::unlink(socket_address(repo_).sun_path);
+        }
+        if (inotify_fd_ >= 0) ::close(inotify_fd_);
+    }
+
+    // Watch the whole worktree, then start listening. Changes made while
+    // the watches go in are covered: the first answer to any client is "/".
+    void setup() {
+        sockaddr_un addr = socket_address(repo_);
+        int probe = connect_daemon(repo_);
+        if (probe >= 0) {
+            ::close(probe);
+            throw std::runtime_error("fsmonitor is already running for " + root_);
+        }
+        inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fd_ < 0) throw std::runtime_error("inotify_init failed: " + std::string(std::strerror(errno)));
+        watch_tree("", false);
+        // .git/info/exclude changes what walks leave out
+        std::error_code ec;
+        fs::create_directories(repo_.gitdir / "info", ec);
+        exclude_wd_ = inotify_add_watch(inotify_fd_, (repo_.gitdir / "info").c_str(), WATCH_MASK);
+
+        ::unlink(addr.sun_path);  // Left behind by a daemon that was killed
+        listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listen_fd_ < 0 || ::bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+            ::listen(listen_fd_, 64) != 0) {
+            throw std::runtime_error("Failed to listen on " + std::string(addr.sun_path) + ": " +
+                                     std::strerror(errno));
+        }
+    }
+
+    void serve() {
+        while (!stop_) {
+            pollfd fds[2] = {{inotify_fd_, POLLIN, 0}, {listen_fd_, POLLIN, 0}};
+            if (::poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error("poll failed");
+            }
+            if (fds[0].revents & POLLIN) drain();
+            if (fds[1].revents & POLLIN) answer();
+        }
+    }
+
+private:
+    // Ignore rules can bring back any name but .git, so only that is skipped
+    static bool skip_name(const char* name) {
+        return std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0 || std::strcmp(name, ".git") == 0;
+    }
+
+    void note(const std::string& rel) {
+        changed_[rel] = ++seq_;
+        if (changed_.size() > HISTORY_MAX) forget();
+    }
+
+    void forget() {
+        changed_.clear();
+        history_start_ = ++seq_;
+    }
+
+    // Watch `rel` and every directory below it. For a directory that just
+    // appeared, everything inside is new, so `mark` records it all.
+    void watch_tree(const std::string& rel, bool mark) {
+        std::string path = rel.empty() ? root_ : root_ + "/" + rel;
+        int wd = inotify_add_watch(inotify_fd_, path.c_str(), WATCH_MASK);
+        if (wd < 0) {
+            if (errno == ENOSPC || errno == ENOMEM) {
+                throw std::runtime_error("Out of inotify watches (raise fs.inotify.max_user_watches)");
+            }
+            return;  // Gone again, or not a directory
+        }
+        wd_paths_[wd] = rel;
+        dir_wds_[rel] = wd;
+        DIR* d = opendir(path.c_str());
+        if (!d) return;
+        std::vector<std::string> subdirs;
+        while (struct dirent* e = readdir(d)) {
+            if (skip_name(e->d_name)) continue;
+            std::string child = join(rel, e->d_name);
+            if (mark) note(child);
+            bool is_dir = e->d_type == DT_DIR;
+            if (e->d_type == DT_UNKNOWN) {
+                struct stat st;
+                is_dir = ::lstat((root_ + "/" + child).c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+            }
+            if (is_dir) subdirs.push_back(std::move(child));
+        }
+        closedir(d);
+        for (const auto& sub : subdirs) watch_tree(sub, mark);
+    }
+
+    // A directory moved away: its watches now describe some other path
+    void unwatch_tree(const std::string& rel) {
+        std::string prefix = rel + "/";
+        for (auto it = dir_wds_.begin(); it != dir_wds_.end();) {
+            if (it->first == rel || it->first.compare(0, prefix.size(), prefix) == 0) {
+                inotify_rm_watch(inotify_fd_, it->second);
+                wd_paths_.erase(it->second);
+                it = dir_wds_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // Read every queued event. A change that finished before a client
+    // connected is already queued, so draining before each answer keeps
+    // answers up to date.
+    void drain() {
+        alignas(struct inotify_event) char buf[64 * 1024];
+        for (;;) {
+            ssize_t n = ::read(inotify_fd_, buf, sizeof(buf));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            for (char* p = buf; p < buf + n;) {
+                auto* ev = reinterpret_cast<struct inotify_event*>(p);
+                p += sizeof(struct inotify_event) + ev->len;
+                handle(*ev);
+            }
+        }
+    }
+
+    void handle(const struct inotify_event& ev) {
+        if (ev.mask & IN_Q_OVERFLOW) {
+            // Events were lost: nobody can be told what changed, and new
+            // directories may be missing watches
+            forget();
+            watch_tree("", false);
+            return;
+        }
+        if (ev.wd == exclude_wd_) {
+            if (ev.len > 0 && std::strcmp(ev.name, "exclude") == 0) forget();
+            return;
+        }
+        auto it = wd_paths_.find(ev.wd);
+        if (it == wd_paths_.end()) return;
+        std::string dir = it->second;
+        if (ev.mask & IN_IGNORED) {
+            dir_wds_.erase(dir);
+            wd_paths_.erase(it);
+            return;
+        }
+        if (ev.len == 0 || ev.name[0] == '\0') {
+            // The watched directory itself
+            if (dir.empty() && (ev.mask & (IN_DELETE_SELF | IN_MOVE_SELF))) {
+                stop_ = true;  // The worktree is gone
+            } else if (!dir.empty()) {
+                note(dir);
+            }
+            return;
+        }
+        if (skip_name(ev.name)) return;
+        std::string rel = join(dir, ev.name);
+        if (std::strcmp(ev.name, ".gitignore") == 0) {
+            // What walks look at changed, possibly everywhere below
+            forget();
+            return;
+        }
+        note(rel);
+        if (ev.mask & IN_ISDIR) {
+            if (ev.mask & IN_MOVED_FROM) unwatch_tree(rel);
+            if (ev.mask & (IN_CREATE | IN_MOVED_TO)) watch_tree(rel, true);
+        }
+    }
+
+    void answer() {
+        int fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) return;
+        struct timeval timeout{1, 0};  // Don't let a stuck client hold up the daemon
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        std::string req;
+        char c;
+        while (req.size() < 4096 && ::read(fd, &c, 1) == 1 && c != '\n') req += c;
+
+        std::string reply;
+        if (req == "STOP") {
+            reply = "OK";
+            stop_ = true;
+        } else if (req.compare(0, 2, "Q ") == 0) {
+            drain();
+            reply = instance_ + ":" + std::to_string(seq_);
+            reply += '\0';
+            uint64_t since = 0;
+            if (!token_seq(req.substr(2), since) || since < history_start_) {
+                reply += "/";
+                reply += '\0';
+            } else {
+                for (const auto& [path, seq] : changed_) {
+                    if (seq <= since) continue;
+                    reply += path;
+                    reply += '\0';
+                }
+            }
+        }
+        send_all(fd, reply);
+        ::close(fd);
+    }
+
+    // Tokens are "<instance>:<sequence number>"; ones from another daemon
+    // instance mean nothing here
+    bool token_seq(const std::string& token, uint64_t& seq) const {
+        size_t colon = token.rfind(':');
+        if (colon == std::string::npos || token.compare(0, colon, instance_) != 0) return false;
+        try {
+            seq = std::stoull(token.substr(colon + 1));
+        } catch (const std::exception&) {
+            return false;
+        }
+        return seq <= seq_;
+    }
+
+    const GitRepository& repo_;
+    std::string root_;
+    std::string instance_;
+    int inotify_fd_ = -1;
+    int listen_fd_ = -1;
+    int exclude_wd_ = -1;
+    bool stop_ = false;
+    uint64_t seq_ = 0;
+    uint64_t history_start_ = 0;
+    std::unordered_map<int, std::string> wd_paths_;
+    std::unordered_map<std::string, int> dir_wds_;
+    std::unordered_map<std::string, uint64_t> changed_;  // Path -> sequence number of its last change
+};
+
+}  // namespace
+
+void fsmonitor_run(const GitRepository& repo) {
+    Daemon daemon(repo);
+    daemon.setup();
+    daemon.serve();
+}
+
+void fsmonitor_start(const GitRepository& repo) {
+    if (fsmonitor_running(repo)) throw std::runtime_error("fsmonitor is already running");
+    int ready[2];
+    if (::pipe2(ready, O_CLOEXEC) != 0) throw std::runtime_error("pipe failed");
+    pid_t pid = ::fork();
+    if (pid < 0) throw std::runtime_error("fork failed");
+    if (pid == 0) {
+        // Detach: new session, second fork so the daemon is reparented,
+        // stdio to /dev/null. Setup errors go back through the pipe.
+        ::close(ready[0]);
+        ::setsid();
+        if (::fork() != 0) ::_exit(0);
+        std::signal(SIGHUP, SIG_IGN);
+        int null_fd = ::open("/dev/null", O_RDWR);
+        if (null_fd >= 0) {
+            ::dup2(null_fd, 0);
+            ::dup2(null_fd, 1);
+            ::dup2(null_fd, 2);
+            if (null_fd > 2) ::close(null_fd);
+        }
+        int status = 0;
+        try {
+            Daemon daemon(repo);
+            daemon.setup();
+            (void)!::write(ready[1], "1", 1);
+            ::close(ready[1]);
+            daemon.serve();
+        } catch (const std::exception& e) {
+            std::string msg = std::string("0") + e.what();
+            (void)!::write(ready[1], msg.data(), msg.size());
+            status = 1;
+        }
+        ::_exit(status);
+    }
+    ::close(ready[1]);
+    std::string msg;
+    char buf[512];
+    ssize_t n;
+    while ((n = ::read(ready[0], buf, sizeof(buf))) != 0) {
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) break;
+        msg.append(buf, static_cast<size_t>(n));
+        if (msg[0] == '1') break;
+    }
+    ::close(ready[0]);
+    int status;
+    ::waitpid(pid, &status, 0);
+    if (msg.empty() || msg[0] != '1') {
+        throw std::runtime_error("fsmonitor failed to start" + (msg.size() > 1 ? ": " + msg.substr(1) : ""));
+    }
+}
+
+bool fsmonitor_stop(const GitRepository& repo) {
+    std::string reply;
+    return request(repo, "STOP\n", reply) && reply == "OK";
+}
+
+bool fsmonitor_running(const GitRepository& repo) {
+    int fd = connect_daemon(repo);
+    if (fd < 0) return false;
+    ::close(fd);
+    return true;
+}
@@ -1,57 +1,137 @@
 #include "git_objects.h"
-#include <sstream>
-#include <iomanip>  // For std::hex in parse
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+// Nibble value of each byte, 0xff for non-hex characters
+struct HexTable {
+    unsigned char value[256];
+    constexpr HexTable() : value() {
+        for (int i = 0; i < 256; ++i) value[i] = 0xff;
+        for (int i = 0; i < 10; ++i) value['0' + i] = static_cast<unsigned char>(i);
+        for (int i = 0; i < 6; ++i) {
+            value['a' + i] = static_cast<unsigned char>(10 + i);
+            value['A' + i] = static_cast<unsigned char>(10 + i);
+        }
+    }
+};
+static constexpr HexTable HEX_VALUES;
+
+bool ObjectId::parse_hex(std::string_view hex, ObjectId& out) {
+    if (hex.size() != 40) return false;
+    unsigned bad = 0;
+    for (size_t i = 0; i < 20; ++i) {
+        unsigned hi = HEX_VALUES.value[static_cast<unsigned char>(hex[2 * i])];
+        unsigned lo = HEX_VALUES.value[static_cast<unsigned char>(hex[2 * i + 1])];
+        bad |= hi | lo;
+        out.bytes[i] = static_cast<unsigned char>((hi << 4) | lo);
+    }
+    return !(bad & 0xf0);
+}
+
+ObjectId ObjectId::from_hex(std::string_view hex) {
+    ObjectId id;
+    if (!parse_hex(hex, id)) throw std::runtime_error("Invalid SHA-1: " + std::string(hex));
+    return id;
+}
+
+void ObjectId::hex(char* out) const {
+    for (size_t i = 0; i < 20; ++i) {
+        out[2 * i] = HEX_DIGITS[bytes[i] >> 4];
+        out[2 * i + 1] = HEX_DIGITS[bytes[i] & 0xf];
+    }
+}
+
+std::string ObjectId::hex() const {
+    std::string out(40, '0');
+    hex(out.data());
+    return out;
+}
+
+std::string sha_to_hex(const unsigned char* bin) {
+    return ObjectId::from_raw(bin).hex();
+}
+
+void hex_to_sha(const std::string& hex, unsigned char* bin) {
+    ObjectId id = ObjectId::from_hex(hex);
+    std::memcpy(bin, id.data(), 20);
+}
 
 // Tree serialize: mode<SP>path<NULL>sha (binary SHA)
 std::string GitTree::serialize() const {
     std::string ret;
+    size_t total = 0;
+    for (const auto& leaf : items) total += 6 + 1 + leaf.path.size() + 1 + 20;
+    ret.reserve(total);
     for (const auto& leaf : items) {
-        std::ostringstream mode_ss;
-        mode_ss << std::oct << leaf.mode;  // Octal mode
-        ret += mode_ss.str() + " " + leaf.path;
+        char mode[12];
+        char* end = mode + sizeof(mode);
+        char* p = end;
+        uint32_t m = leaf.mode;
+        do {
+            *--p = static_cast<char>('0' + (m & 7));  // Octal mode
+            m >>= 3;
+        } while (m);
+        ret.append(p, end);
+        ret += ' ';
+        ret += leaf.path;
         ret += '\0';  // Explicitly append null char
-        // Convert hex SHA to binary
-        for (size_t i = 0; i < leaf.sha.length(); i += 2) {
-            uint8_t byte = static_cast<uint8_t>(std::stoi(leaf.sha.substr(i, 2), nullptr, 16));
-            ret += static_cast<char>(byte);
-        }
+        ObjectId id = ObjectId::from_hex(leaf.sha);
+        ret.append(reinterpret_cast<const char*>(id.data()), 20);
     }
     return ret;
 }
 
+void TreeView::iterator::parse() {
+    if (pos_ >= data_.size()) {
+        pos_ = data_.size();
+        return;
+    }
+    uint32_t mode = 0;
+    size_t p = pos_;
+    while (p < data_.size() && data_[p] != ' ') {
+        char c = data_[p];
+        if (c < '0' || c > '7') {
+            throw std::runtime_error("Mode string contains non-octal characters at position " + std::to_string(pos_));
+        }
+        mode = (mode << 3) | static_cast<uint32_t>(c - '0');
+        ++p;
+    }
+    if (p >= data_.size()) {
+        throw std::runtime_error("No space found after mode at position " + std::to_string(pos_));
+    }
+    if (p == pos_) {
+        throw std::runtime_error("Empty mode string at position " + std::to_string(pos_));
+    }
+    const char* nul = static_cast<const char*>(std::memchr(data_.data() + p + 1, '\0', data_.size() - p - 1));
+    if (!nul) {
+        throw std::runtime_error("No null terminator found after path");
+    }
+    size_t null_pos = static_cast<size_t>(nul - data_.data());
+    if (null_pos + 1 + 20 > data_.size()) {
+        throw std::runtime_error("Not enough data for SHA at position " + std::to_string(null_pos + 1));
+    }
+    entry_.mode = mode;
+    entry_.path = data_.substr(p + 1, null_pos - p - 1);
+    entry_.raw_sha = reinterpret_cast<const unsigned char*>(data_.data() + null_pos + 1);
+    next_ = null_pos + 1 + 20;
+}
+
+int tree_order(std::string_view a_name, uint32_t a_mode, std::string_view b_name, uint32_t b_mode) {
+    size_t n = std::min(a_name.size(), b_name.size());
+    int cmp = a_name.substr(0, n).compare(b_name.substr(0, n));
+    if (cmp != 0) return cmp;
+    unsigned char ca = a_name.size() > n ? a_name[n] : (a_mode == 040000 ? '/' : '\0');
+    unsigned char cb = b_name.size() > n ? b_name[n] : (b_mode == 040000 ? '/' : '\0');
+    return int(ca) - int(cb);
+}
+
 GitTree GitTree::parse(const std::string& data) {
     GitTree tree;
-    size_t pos = 0;
-    while (pos < data.size()) {
-        size_t space_pos = data.find(' ', pos);
-        if (space_pos == std::string::npos) {
-            throw std::runtime_error("No space found after mode at position " + std::to_string(pos));
-        }
-        std::string mode_str = data.substr(pos, space_pos - pos);
-        if (mode_str.empty()) {
-            throw std::runtime_error("Empty mode string at position " + std::to_string(pos));
-        }
-        if (!std::all_of(mode_str.begin(), mode_str.end(), ::isdigit)) {
-            throw std::runtime_error("Mode string contains non-digit characters: '" + mode_str + "'");
-        }
-        uint32_t mode = std::stoul(mode_str, nullptr, 8);  // Octal
-        size_t null_pos = data.find('\0', space_pos + 1);
-        if (null_pos == std::string::npos) {
-            throw std::runtime_error("No null terminator found after path");
-        }
-        std::string path = data.substr(space_pos + 1, null_pos - space_pos - 1);
-        pos = null_pos + 1;
-        if (pos + 20 > data.size()) {
-            throw std::runtime_error("Not enough data for SHA at position " + std::to_string(pos));
-        }
-        std::ostringstream sha_ss;
-        sha_ss << std::hex << std::setfill('0');
-        for (size_t i = 0; i < 20; ++i) {
-            uint8_t byte = static_cast<uint8_t>(data[pos++]);
-            sha_ss << std::setw(2) << static_cast<unsigned>(byte);
-        }
-        std::string sha = sha_ss.str();
-        tree.items.push_back({mode, path, sha});
+    for (const auto& entry : TreeView(data)) {
+        tree.items.push_back({entry.mode, std::string(entry.path), entry.id().hex()});
     }
     return tree;
 }
@@ -71,27 +151,55 @@ std::string GitCommit::serialize() const {
 
 GitCommit GitCommit::parse(const std::string& data) {
     GitCommit commit;
+    CommitView view(data);
+    view.for_each_header([&](std::string_view key, std::string_view value) {
+        commit.kvlm.push_back({std::string(key), std::string(value)});
+    });
+    commit.kvlm.push_back({"", std::string(view.message())});  // Message
+    return commit;
+}
+
+CommitView::CommitView(std::string_view data) : data_(data) {
+    // Headers run up to the first blank line
     size_t pos = 0;
-    std::string key;
-    while (pos < data.size()) {
-        size_t nl_pos = data.find('\n', pos);
-        if (nl_pos == pos) {  // Blank line separates headers from message
-            pos = nl_pos + 1;
-            break;
+    while (pos < data_.size()) {
+        size_t nl = data_.find('\n', pos);
+        if (nl == pos) {
+            headers_end_ = pos;
+            message_start_ = pos + 1;
+            return;
         }
-        std::string line = data.substr(pos, nl_pos - pos);
-        pos = nl_pos + 1;
+        if (nl == std::string_view::npos) break;
+        pos = nl + 1;
+    }
+    headers_end_ = data_.size();
+    message_start_ = data_.size();
+}
 
-        size_t space_pos = line.find(' ');
-        if (space_pos == std::string::npos) {
-            // Continuation line (multi-line value), but for simplicity, assume single-line headers
-            continue;
-        } else {
-            key = line.substr(0, space_pos);
-            std::string value = line.substr(space_pos + 1);
-            commit.kvlm.push_back({key, value});
+std::string_view CommitView::header(std::string_view key) const {
+    std::string_view found;
+    bool done = false;
+    for_each_header([&](std::string_view k, std::string_view v) {
+        if (!done && k == key) {
+            found = v;
+            done = true;
         }
+    });
+    return found;
+}
+
+uint64_t CommitView::commit_time() const {
+    // "Name <email> <timestamp> <tz>"
+    std::string_view committer = header("committer");
+    size_t tz = committer.rfind(' ');
+    if (tz == std::string_view::npos || tz == 0) return 0;
+    size_t ts = committer.rfind(' ', tz - 1);
+    if (ts == std::string_view::npos) return 0;
+    uint64_t time = 0;
+    for (size_t i = ts + 1; i < tz; ++i) {
+        char c = committer[i];
+        if (c < '0' || c > '9') return 0;
+        time = time * 10 + static_cast<uint64_t>(c - '0');
     }
-    commit.kvlm.push_back({"", data.substr(pos)});  // Message
-    return commit;
-}
\ No newline at end of file
+    return time;
+}
@@ -0,0 +1,289 @@
+#include "ignore.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <functional>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+
+// What write-tree and status always left out, now as rules of lowest
+// precedence
+static const char* const BUILTIN_RULES =
+    ".*\n"
+    "gitlite\n"
+    "test.sh\n"
+    "CMakeLists.txt\n"
+    "Makefile\n"
+    "cmake_install.cmake\n"
+    "CMakeCache.txt\n"
+    "compile_commands.json\n"
+    "include\n"
+    "src\n"
+    "CMakeFiles\n"
+    "repomix-output.xml\n";
+
+static std::atomic<uint64_t> stat_dirs_pruned{0};
+static std::atomic<uint64_t> stat_files_ignored{0};
+
+void ignore_print_stats(std::ostream& out) {
+    if (stat_dirs_pruned == 0 && stat_files_ignored == 0) return;
+    out << "ignore: " << stat_dirs_pruned << " directories pruned, " << stat_files_ignored << " files ignored"
+        << std::endl;
+}
+
+bool has_glob(std::string_view pattern) {
+    return pattern.find_first_of("*?[\\") != std::string_view::npos;
+}
+
+IgnoreRules::IgnoreRules(std::string_view text, std::string base) : base_(std::move(base)) {
+    while (!text.empty()) {
+        size_t nl = text.find('\n');
+        parse(text.substr(0, nl));
+        text.remove_prefix(nl == std::string_view::npos ? text.size() : nl + 1);
+    }
+    // Lookups hold views into the patterns, so they're built once rules_ is final
+    trie_.emplace_back();
+    for (uint32_t i = 0; i < rules_.size(); ++i) compile(i);
+}
+
+void IgnoreRules::parse(std::string_view line) {
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+    if (line.empty() || line[0] == '#') return;
+    // Trailing spaces go unless escaped
+    size_t end = line.size();
+    while (end > 0 && line[end - 1] == ' ' && !(end > 1 && line[end - 2] == '\\')) --end;
+    line = line.substr(0, end);
+    if (line.empty()) return;  // Nothing but spaces
+
+    Rule rule;
+    if (line[0] == '!') {
+        rule.negate = true;
+        line.remove_prefix(1);
+    } else if (line.size() > 1 && (line[0] == '\\') && (line[1] == '!' || line[1] == '#')) {
+        line.remove_prefix(1);
+    }
+    if (!line.empty() && line.back() == '/') {
+        rule.dir_only = true;
+        line.remove_suffix(1);
+    }
+    if (line.empty()) return;
+    rule.pattern = std::string(line);
+    rules_.push_back(std::move(rule));
+}
+
+void IgnoreRules::compile(uint32_t id) {
+    std::string_view p = rules_[id].pattern;
+    if (p.find('/') != std::string_view::npos) {
+        if (p[0] == '/') p.remove_prefix(1);
+        add_path(id, p);
+        return;
+    }
+    if (!rules_[id].negate) floating_ = true;
+    if (!has_glob(p)) {
+        names_[p].push_back(id);
+    } else if (p[0] == '*' && !has_glob(p.substr(1))) {
+        suffixes_[p.size() - 1][p.substr(1)].push_back(id);
+    } else if (p.back() == '*' && !has_glob(p.substr(0, p.size() - 1))) {
+        prefixes_[p.size() - 1][p.substr(0, p.size() - 1)].push_back(id);
+    } else {
+        size_t first = p.find_first_of("*?[\\");
+        size_t last = p.find_last_of("*?[]\\");
+        rules_[id].head = p.substr(0, first);
+        // Past the last '*', '?' or bracket expression it's all literal;
+        // a stray ']' or '[', or an escape, gets no tail
+        bool closes = p[last] == ']' && p[last - 1] != '\\' && p.rfind('[', last) != std::string_view::npos;
+        if (p[last] == '*' || p[last] == '?' || closes) {
+            glob_tails_[p.size() - last - 1][p.substr(last + 1)].push_back(id);
+        } else {
+            name_globs_.push_back(id);
+        }
+    }
+}
+
+uint32_t IgnoreRules::trie_child(uint32_t node, std::string_view component) {
+    uint32_t next = static_cast<uint32_t>(trie_.size());
+    if (component == "**") {
+        if (trie_[node].any_depth) return trie_[node].any_depth;
+        trie_.emplace_back().loops = true;
+        trie_[node].any_depth = next;
+    } else if (!has_glob(component)) {
+        auto [it, added] = trie_[node].literal.emplace(component, next);
+        if (!added) return it->second;
+        trie_.emplace_back();
+    } else {
+        auto& globs = trie_[node].globs;
+        for (const auto& [glob, child] : globs) {
+            if (glob == component) return child;
+        }
+        globs.emplace_back(std::string(component), next);
+        trie_.emplace_back();
+    }
+    return next;
+}
+
+void IgnoreRules::add_path(uint32_t id, std::string_view pattern) {
+    uint32_t node = 0;
+    while (!pattern.empty()) {
+        size_t slash = pattern.find('/');
+        std::string_view component = pattern.substr(0, slash);
+        pattern.remove_prefix(slash == std::string_view::npos ? pattern.size() : slash + 1);
+        if (component.empty()) continue;  // "a//b"
+        // A trailing "**" matches everything inside, but not the directory
+        // itself: one component, then any number
+        if (component == "**" && pattern.empty()) node = trie_child(node, "*");
+        node = trie_child(node, component);
+    }
+    trie_[node].rules.push_back(id);
+}
+
+int64_t IgnoreRules::last_applying(const std::vector<uint32_t>& ids, bool is_dir) const {
+    for (auto it = ids.rbegin(); it != ids.rend(); ++it) {
+        if (is_dir || !rules_[*it].dir_only) return *it;
+    }
+    return -1;
+}
+
+std::vector<uint32_t> IgnoreRules::trie_walk(std::string_view rel) const {
+    std::vector<uint32_t> active, next;
+    const Node& root = trie_[0];
+    if (!root.any_depth && root.globs.empty() && !root.literal.count(rel.substr(0, rel.find('/')))) {
+        return active;  // Nothing starts with this path's first component
+    }
+    // Walk every matching branch at once; "**" nodes stay in the set
+    auto enter = [this](std::vector<uint32_t>& set, uint32_t node) {
+        for (;;) {
+            if (std::find(set.begin(), set.end(), node) != set.end()) return;
+            set.push_back(node);
+            if (!trie_[node].any_depth) return;
+            node = trie_[node].any_depth;  // "**" may match nothing
+        }
+    };
+    enter(active, 0);
+    std::string component;
+    while (!rel.empty() && !active.empty()) {
+        size_t slash = rel.find('/');
+        component.assign(rel.substr(0, slash));
+        rel.remove_prefix(slash == std::string_view::npos ? rel.size() : slash + 1);
+        next.clear();
+        for (uint32_t id : active) {
+            const Node& node = trie_[id];
+            if (node.loops) enter(next, id);
+            auto it = node.literal.find(component);
+            if (it != node.literal.end()) enter(next, it->second);
+            for (const auto& [glob, child] : node.globs) {
+                if (fnmatch(glob.c_str(), component.c_str(), 0) == 0) enter(next, child);
+            }
+        }
+        active.swap(next);
+    }
+    return active;
+}
+
+int64_t IgnoreRules::match_trie(std::string_view rel, bool is_dir) const {
+    int64_t best = -1;
+    for (uint32_t id : trie_walk(rel)) best = std::max(best, last_applying(trie_[id].rules, is_dir));
+    return best;
+}
+
+bool IgnoreRules::may_match_below(std::string_view rel) const {
+    if (floating_) return true;
+    if (trie_.size() <= 1) return false;
+    std::string_view below = base_.empty() ? rel : rel.substr(std::min(rel.size(), base_.size() + 1));
+    // Anything still active with deeper branches could match inside
+    for (uint32_t id : trie_walk(below)) {
+        const Node& node = trie_[id];
+        if (node.loops || node.any_depth || !node.literal.empty() || !node.globs.empty()) return true;
+    }
+    return false;
+}
+
+IgnoreRules::Result IgnoreRules::match(std::string_view rel, std::string_view name, bool is_dir) const {
+    if (rules_.empty()) return NONE;
+    int64_t best = -1;
+    auto lookup = [&](const Index& index, std::string_view key) {
+        auto it = index.find(key);
+        if (it != index.end()) best = std::max(best, last_applying(it->second, is_dir));
+    };
+    lookup(names_, name);
+    for (const auto& [len, index] : suffixes_) {
+        if (len <= name.size()) lookup(index, name.substr(name.size() - len));
+    }
+    for (const auto& [len, index] : prefixes_) {
+        if (len <= name.size()) lookup(index, name.substr(0, len));
+    }
+    if (!glob_tails_.empty() || !name_globs_.empty()) {
+        // Candidates whose ending fits, latest first; anything at or below
+        // an earlier lookup's match can't change the answer
+        std::vector<uint32_t> globs;
+        globs.reserve(name_globs_.size() + 4);
+        for (const auto& [len, index] : glob_tails_) {
+            if (len > name.size()) continue;
+            auto it = index.find(name.substr(name.size() - len));
+            if (it != index.end()) globs.insert(globs.end(), it->second.begin(), it->second.end());
+        }
+        globs.insert(globs.end(), name_globs_.begin(), name_globs_.end());
+        std::sort(globs.begin(), globs.end(), std::greater<>());
+        std::string name_z(name);
+        for (uint32_t id : globs) {
+            if (int64_t(id) <= best) break;
+            const Rule& rule = rules_[id];
+            if ((is_dir || !rule.dir_only) && name.compare(0, rule.head.size(), rule.head) == 0 &&
+                fnmatch(rule.pattern.c_str(), name_z.c_str(), 0) == 0) {
+                best = id;
+                break;
+            }
+        }
+    }
+    if (trie_.size() > 1) {
+        std::string_view below = base_.empty() ? rel : rel.substr(std::min(rel.size(), base_.size() + 1));
+        best = std::max(best, match_trie(below, is_dir));
+    }
+    if (best < 0) return NONE;
+    return rules_[best].negate ? INCLUDED : IGNORED;
+}
+
+// "" if missing. Called for every directory a walk enters, so plain open()
+// rather than a stream.
+static std::string read_file(const fs::path& path) {
+    std::string text;
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return text;
+    char buf[16 * 1024];
+    ssize_t n;
+    while ((n = ::read(fd, buf, sizeof(buf))) != 0) {
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) break;
+        text.append(buf, static_cast<size_t>(n));
+    }
+    ::close(fd);
+    return text;
+}
+
+std::shared_ptr<const IgnoreScope> IgnoreScope::root(const GitRepository& repo, const fs::path& dir) {
+    auto builtin = std::make_shared<const IgnoreScope>(nullptr, IgnoreRules(BUILTIN_RULES, ""));
+    auto exclude =
+        std::make_shared<const IgnoreScope>(builtin, IgnoreRules(read_file(repo.gitdir / "info" / "exclude"), ""));
+    return std::make_shared<const IgnoreScope>(exclude, IgnoreRules(read_file(dir / ".gitignore"), ""));
+}
+
+std::shared_ptr<const IgnoreScope> IgnoreScope::child(const fs::path& path, const std::string& rel) const {
+    std::string text = read_file(path / ".gitignore");  // One failed open() for most directories
+    IgnoreRules rules(text, rel);
+    if (rules.empty()) return shared_from_this();
+    return std::make_shared<const IgnoreScope>(shared_from_this(), std::move(rules));
+}
+
+bool IgnoreScope::ignored(std::string_view rel, std::string_view name, bool is_dir) const {
+    if (name == ".git") return true;
+    bool result = false;
+    // The innermost .gitignore with an opinion wins
+    for (const IgnoreScope* scope = this; scope; scope = scope->parent_.get()) {
+        IgnoreRules::Result r = scope->rules_.match(rel, name, is_dir);
+        if (r == IgnoreRules::NONE) continue;
+        result = r == IgnoreRules::IGNORED;
+        break;
+    }
+    if (result) (is_dir ? stat_dirs_pruned : stat_files_ignored).fetch_add(1, std::memory_order_relaxed);
+    return result;
+}
@@ -0,0 +1,270 @@
+#include "index.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <openssl/sha.h>
+#include "sha1.h"
+
+// Index file layout (all integers big-endian):
+//   "DIRC" <version=2> <entry count>
+//   entries: ctime mtime (sec, nsec) dev ino mode uid gid size <20-byte sha> <flags> <path>
+//            padded with 1-8 NULs to a multiple of 8 bytes
+//   "TREE" <size> extension: per directory "<name>\0<entry_count> <subtree_count>\n<sha>",
+//            children follow their parent, depth first
+//   "GLFM" <size> extension: the fsmonitor token the entries are current as of.
+//            Git skips extensions it doesn't know that start with a capital.
+//   <20-byte SHA-1 of everything above>
+
+static void put32(std::string& out, uint32_t v) {
+    char b[4] = {char(v >> 24), char(v >> 16), char(v >> 8), char(v)};
+    out.append(b, 4);
+}
+
+static uint32_t get32(const std::string& in, size_t pos) {
+    const auto* p = reinterpret_cast<const unsigned char*>(in.data() + pos);
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+static void put_sha(std::string& out, const std::string& hex) {
+    unsigned char bin[20];
+    hex_to_sha(hex, bin);
+    out.append(reinterpret_cast<char*>(bin), 20);
+}
+
+static std::string get_sha(const std::string& in, size_t pos) {
+    return sha_to_hex(reinterpret_cast<const unsigned char*>(in.data() + pos));
+}
+
+IndexEntry IndexEntry::from_stat(const std::string& path, const struct stat& st, const std::string& sha) {
+    IndexEntry e;
+    e.ctime_sec = static_cast<uint32_t>(st.st_ctim.tv_sec);
+    e.ctime_nsec = static_cast<uint32_t>(st.st_ctim.tv_nsec);
+    e.mtime_sec = static_cast<uint32_t>(st.st_mtim.tv_sec);
+    e.mtime_nsec = static_cast<uint32_t>(st.st_mtim.tv_nsec);
+    e.dev = static_cast<uint32_t>(st.st_dev);
+    e.ino = static_cast<uint32_t>(st.st_ino);
+    e.mode = 0100644;  // Trees only record regular files for now
+    e.uid = static_cast<uint32_t>(st.st_uid);
+    e.gid = static_cast<uint32_t>(st.st_gid);
+    e.size = static_cast<uint32_t>(st.st_size);
+    e.sha = sha;
+    e.path = path;
+    return e;
+}
+
+bool IndexEntry::stat_matches(const struct stat& st) const {
+    return mtime_sec == static_cast<uint32_t>(st.st_mtim.tv_sec) &&
+           mtime_nsec == static_cast<uint32_t>(st.st_mtim.tv_nsec) &&
+           ctime_sec == static_cast<uint32_t>(st.st_ctim.tv_sec) &&
+           ctime_nsec == static_cast<uint32_t>(st.st_ctim.tv_nsec) &&
+           size == static_cast<uint32_t>(st.st_size) &&
+           ino == static_cast<uint32_t>(st.st_ino) &&
+           dev == static_cast<uint32_t>(st.st_dev);
+}
+
+bool GitIndex::is_racy(const IndexEntry& entry) const {
+    if (timestamp_sec == 0) return false;  // No index on disk yet
+    if (entry.mtime_sec != timestamp_sec) return entry.mtime_sec > timestamp_sec;
+    return entry.mtime_nsec >= timestamp_nsec;
+}
+
+const IndexEntry* GitIndex::find(const std::string& path) const {
+    auto it = std::lower_bound(entries.begin(), entries.end(), path,
+                               [](const IndexEntry& e, const std::string& p) { return e.path < p; });
+    if (it == entries.end() || it->path != path) return nullptr;
+    return &*it;
+}
+
+void GitIndex::sort() {
+    std::sort(entries.begin(), entries.end(), [](const IndexEntry& a, const IndexEntry& b) {
+        return a.path < b.path;
+    });
+}
+
+// Parse one cache tree node and its children, returns position after them
+static size_t read_cache_tree(const std::string& data, size_t pos, size_t end, const std::string& prefix,
+                              std::map<std::string, CacheTreeEntry>& trees) {
+    size_t nul = data.find('\0', pos);
+    size_t sp = data.find(' ', nul);
+    size_t nl = data.find('\n', sp);
+    if (nul == std::string::npos || sp == std::string::npos || nl == std::string::npos || nl >= end) {
+        throw std::runtime_error("Index file corrupt: bad TREE extension");
+    }
+    std::string name = data.substr(pos, nul - pos);
+    std::string path = prefix.empty() ? name : prefix + "/" + name;
+    CacheTreeEntry node;
+    node.entry_count = std::stoi(data.substr(nul + 1, sp - nul - 1));
+    node.subtree_count = static_cast<uint32_t>(std::stoul(data.substr(sp + 1, nl - sp - 1)));
+    pos = nl + 1;
+    if (node.entry_count >= 0) {
+        if (pos + 20 > end) throw std::runtime_error("Index file corrupt: bad TREE extension");
+        node.sha = get_sha(data, pos);
+        pos += 20;
+    }
+    uint32_t children = node.subtree_count;
+    trees[path] = node;
+    for (uint32_t i = 0; i < children; ++i) {
+        pos = read_cache_tree(data, pos, end, path, trees);
+    }
+    return pos;
+}
+
+GitIndex GitIndex::read(const GitRepository& repo) {
+    GitIndex index;
+    fs::path path = repo.gitdir / "index";
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) return index;
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file) throw std::runtime_error("Failed to open index");
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (data.size() < 12 + SHA_DIGEST_LENGTH || data.compare(0, 4, "DIRC") != 0) {
+        throw std::runtime_error("Index file corrupt: bad signature");
+    }
+    size_t body = data.size() - SHA_DIGEST_LENGTH;
+    ObjectId hash = sha1(data.data(), body);
+    if (std::memcmp(hash.data(), data.data() + body, SHA_DIGEST_LENGTH) != 0) {
+        throw std::runtime_error("Index file corrupt: checksum mismatch");
+    }
+    if (get32(data, 4) != 2) throw std::runtime_error("Unsupported index version");
+
+    uint32_t count = get32(data, 8);
+    size_t pos = 12;
+    index.entries.reserve(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        if (pos + 62 > body) throw std::runtime_error("Index file corrupt: truncated entry");
+        IndexEntry e;
+        e.ctime_sec = get32(data, pos);
+        e.ctime_nsec = get32(data, pos + 4);
+        e.mtime_sec = get32(data, pos + 8);
+        e.mtime_nsec = get32(data, pos + 12);
+        e.dev = get32(data, pos + 16);
+        e.ino = get32(data, pos + 20);
+        e.mode = get32(data, pos + 24);
+        e.uid = get32(data, pos + 28);
+        e.gid = get32(data, pos + 32);
+        e.size = get32(data, pos + 36);
+        e.sha = get_sha(data, pos + 40);
+        size_t name_start = pos + 62;
+        size_t nul = data.find('\0', name_start);
+        if (nul == std::string::npos || nul >= body) throw std::runtime_error("Index file corrupt: bad path");
+        e.path = data.substr(name_start, nul - name_start);
+        size_t entry_len = 62 + e.path.size();
+        pos += (entry_len + 8) & ~size_t(7);
+        index.entries.push_back(std::move(e));
+    }
+
+    // Extensions; unknown ones are skipped
+    while (pos + 8 <= body) {
+        std::string sig = data.substr(pos, 4);
+        size_t len = get32(data, pos + 4);
+        size_t start = pos + 8;
+        if (start + len > body) throw std::runtime_error("Index file corrupt: truncated extension");
+        if (sig == "TREE" && len > 0) {
+            read_cache_tree(data, start, start + len, "", index.trees);
+        } else if (sig == "GLFM") {
+            index.fsmonitor_token = data.substr(start, len);
+        }
+        pos = start + len;
+    }
+
+    index.timestamp_sec = st.st_mtim.tv_sec;
+    index.timestamp_nsec = st.st_mtim.tv_nsec;
+    return index;
+}
+
+static void write_cache_tree(std::string& out, const std::string& path,
+                             const std::map<std::string, CacheTreeEntry>& trees,
+                             const std::map<std::string, std::vector<std::string>>& children) {
+    const CacheTreeEntry& node = trees.at(path);
+    auto kids = children.find(path);
+    size_t nkids = kids == children.end() ? 0 : kids->second.size();
+    std::string name = path.substr(path.rfind('/') == std::string::npos ? 0 : path.rfind('/') + 1);
+    out += name;
+    out += '\0';
+    out += std::to_string(node.entry_count) + " " + std::to_string(nkids) + "\n";
+    if (node.entry_count >= 0) put_sha(out, node.sha);
+    if (kids != children.end()) {
+        for (const auto& kid : kids->second) write_cache_tree(out, kid, trees, children);
+    }
+}
+
+bool GitIndex::write(const GitRepository& repo) {
+    std::string out = "DIRC";
+    put32(out, 2);
+    put32(out, static_cast<uint32_t>(entries.size()));
+    for (const auto& e : entries) {
+        size_t start = out.size();
+        put32(out, e.ctime_sec);
+        put32(out, e.ctime_nsec);
+        put32(out, e.mtime_sec);
+        put32(out, e.mtime_nsec);
+        put32(out, e.dev);
+        put32(out, e.ino);
+        put32(out, e.mode);
+        put32(out, e.uid);
+        put32(out, e.gid);
+        put32(out, e.size);
+        put_sha(out, e.sha);
+        uint16_t flags = static_cast<uint16_t>(std::min<size_t>(e.path.size(), 0xfff));
+        out += static_cast<char>(flags >> 8);
+        out += static_cast<char>(flags);
+        out += e.path;
+        size_t entry_len = out.size() - start;
+        out.append(((entry_len + 8) & ~size_t(7)) - entry_len, '\0');
+    }
+
+    // Only nodes reachable from the root can be encoded
+    if (trees.count("")) {
+        std::map<std::string, std::vector<std::string>> children;
+        for (const auto& [path, node] : trees) {
+            if (path.empty()) continue;
+            size_t slash = path.rfind('/');
+            std::string parent = slash == std::string::npos ? "" : path.substr(0, slash);
+            if (trees.count(parent)) children[parent].push_back(path);
+        }
+        std::string ext;
+        write_cache_tree(ext, "", trees, children);
+        out += "TREE";
+        put32(out, static_cast<uint32_t>(ext.size()));
+        out += ext;
+    }
+    if (!fsmonitor_token.empty()) {
+        out += "GLFM";
+        put32(out, static_cast<uint32_t>(fsmonitor_token.size()));
+        out += fsmonitor_token;
+    }
+
+    ObjectId hash = sha1(out.data(), out.size());
+    out.append(reinterpret_cast<const char*>(hash.data()), SHA_DIGEST_LENGTH);
+
+    fs::path lock_path = repo.gitdir / "index.lock";
+    int fd = ::open(lock_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        if (errno == EEXIST) return false;
+        throw std::runtime_error("Failed to create " + lock_path.string());
+    }
+    const char* p = out.data();
+    size_t left = out.size();
+    while (left > 0) {
+        ssize_t n = ::write(fd, p, left);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ::close(fd);
+            ::unlink(lock_path.c_str());
+            throw std::runtime_error("Failed to write " + lock_path.string());
+        }
+        p += n;
+        left -= static_cast<size_t>(n);
+    }
+    ::close(fd);
+    if (::rename(lock_path.c_str(), (repo.gitdir / "index").c_str()) != 0) {
+        ::unlink(lock_path.c_str());
+        throw std::runtime_error("Failed to update index");
+    }
+    return true;
+}
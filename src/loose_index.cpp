@@ -0,0 +1,170 @@
+#include "loose_index.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "object_io.h"
+
+// objects/info/loose-index/xx: magic, mtime of objects/xx (seconds and
+// nanoseconds, little-endian), entry count, then the sorted 20-byte IDs
+static const char INDEX_MAGIC[8] = {'G', 'L', 'L', 'X', 0, 0, 0, 1};
+static constexpr size_t INDEX_HEADER = 8 + 8 + 8 + 4;
+static_assert(sizeof(ObjectId) == 20, "IDs are read and written as packed 20-byte records");
+
+namespace {
+
+struct FanoutList {
+    struct timespec mtime {};
+    std::vector<ObjectId> ids;
+};
+
+std::mutex memo_mutex;
+// (objects dir, fanout byte) -> list
+std::map<std::pair<std::string, int>, FanoutList> memo;
+
+}  // namespace
+
+static bool same_time(const struct timespec& a, const struct timespec& b) {
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+static void put64(unsigned char* p, uint64_t v) {
+    for (int i = 0; i < 8; ++i) p[i] = static_cast<unsigned char>(v >> (8 * i));
+}
+
+static uint64_t get64(const unsigned char* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) v |= uint64_t(p[i]) << (8 * i);
+    return v;
+}
+
+static bool load_list(const std::string& path, const struct timespec& mtime, std::vector<ObjectId>& ids) {
+    LooseFile file(path);
+    if (!file.ok() || file.size() < INDEX_HEADER) return false;
+    unsigned char header[INDEX_HEADER];
+    if (file.read_at(header, INDEX_HEADER, 0) != INDEX_HEADER || std::memcmp(header, INDEX_MAGIC, 8) != 0) {
+        return false;
+    }
+    struct timespec saved {};
+    saved.tv_sec = static_cast<time_t>(get64(header + 8));
+    saved.tv_nsec = static_cast<long>(get64(header + 16));
+    uint32_t count = uint32_t(header[24]) | uint32_t(header[25]) << 8 | uint32_t(header[26]) << 16 |
+                     uint32_t(header[27]) << 24;
+    if (!same_time(saved, mtime) || file.size() != INDEX_HEADER + 20 * uint64_t(count)) return false;
+    ids.resize(count);
+    size_t want = 20 * size_t(count);
+    size_t got = 0;
+    while (got < want) {
+        size_t n = file.read_at(reinterpret_cast<unsigned char*>(ids.data()) + got, want - got, INDEX_HEADER + got);
+        if (n == 0) return false;
+        got += n;
+    }
+    return true;
+}
+
+// Best effort: a read-only repository just rescans next time
+static void save_list(const std::string& dir, const std::string& path, const struct timespec& mtime,
+                      const std::vector<ObjectId>& ids) {
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    std::string tmp = path + ".XXXXXX";
+    int fd = mkstemp(tmp.data());
+    if (fd < 0) return;
+    std::string data(INDEX_HEADER + 20 * ids.size(), '\0');
+    unsigned char* p = reinterpret_cast<unsigned char*>(data.data());
+    std::memcpy(p, INDEX_MAGIC, 8);
+    put64(p + 8, static_cast<uint64_t>(mtime.tv_sec));
+    put64(p + 16, static_cast<uint64_t>(mtime.tv_nsec));
+    for (int i = 0; i < 4; ++i) p[24 + i] = static_cast<unsigned char>(ids.size() >> (8 * i));
+    if (!ids.empty()) std::memcpy(p + INDEX_HEADER, ids.data(), 20 * ids.size());
+    bool ok = ::write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size());
+    ok = ::close(fd) == 0 && ok;
+    if (!ok || ::rename(tmp.c_str(), path.c_str()) != 0) ::unlink(tmp.c_str());
+}
+
+static void scan_dir(const std::string& dir, int fanout, std::vector<ObjectId>& ids) {
+    DIR* d = opendir(dir.c_str());
+    if (!d) return;
+    char hex[41];
+    std::snprintf(hex, 3, "%02x", fanout);
+    while (struct dirent* e = readdir(d)) {
+        if (std::strlen(e->d_name) != 38) continue;
+        std::memcpy(hex + 2, e->d_name, 39);
+        ObjectId id;
+        if (ObjectId::parse_hex(std::string_view(hex, 40), id)) ids.push_back(id);
+    }
+    closedir(d);
+    std::sort(ids.begin(), ids.end());
+}
+
+// The list for one fanout directory, from memory, the saved copy, or a
+// scan. Called with memo_mutex held.
+static const FanoutList& fanout_list(const GitRepository& repo, int fanout) {
+    std::string objects = (repo.gitdir / "objects").string();
+    char name[3];
+    std::snprintf(name, sizeof(name), "%02x", fanout);
+    std::string dir = objects + "/" + name;
+
+    struct stat st;
+    struct timespec mtime {};
+    bool exists = ::stat(dir.c_str(), &st) == 0;
+    if (exists) mtime = st.st_mtim;
+
+    FanoutList& list = memo[{objects, fanout}];
+    if (!exists) {
+        list = FanoutList{};
+        return list;
+    }
+    if (same_time(list.mtime, mtime) && (mtime.tv_sec != 0 || mtime.tv_nsec != 0)) return list;
+
+    list.mtime = mtime;
+    list.ids.clear();
+    std::string index_dir = objects + "/info/loose-index";
+    std::string index_path = index_dir + "/" + name;
+    if (load_list(index_path, mtime, list.ids)) return list;
+
+    scan_dir(dir, fanout, list.ids);
+    // A directory changed within the last couple of seconds might change
+    // again without its mtime moving (coarse timestamps), so its list isn't
+    // saved until it has settled
+    struct stat after;
+    if (::stat(dir.c_str(), &after) == 0 && same_time(after.st_mtim, mtime) &&
+        std::time(nullptr) > mtime.tv_sec + 2) {
+        save_list(index_dir, index_path, mtime, list.ids);
+    }
+    return list;
+}
+
+void loose_find_prefix(const GitRepository& repo, std::string_view prefix, std::vector<ObjectId>& out,
+                       size_t limit) {
+    if (prefix.size() < 2 || prefix.size() > 40) return;
+    // Lowest ID the prefix can match: the prefix padded with zeros
+    char padded[41];
+    std::memset(padded, '0', 40);
+    std::memcpy(padded, prefix.data(), prefix.size());
+    ObjectId lower;
+    if (!ObjectId::parse_hex(std::string_view(padded, 40), lower)) return;
+
+    std::lock_guard<std::mutex> lock(memo_mutex);
+    const FanoutList& list = fanout_list(repo, lower.bytes[0]);
+    char hex[41];
+    for (auto it = std::lower_bound(list.ids.begin(), list.ids.end(), lower); it != list.ids.end(); ++it) {
+        it->hex(hex);
+        if (std::memcmp(hex, prefix.data(), prefix.size()) != 0 || out.size() >= limit) break;
+        out.push_back(*it);
+    }
+}
+
+void loose_index_forget() {
+    std::lock_guard<std::mutex> lock(memo_mutex);
+    memo.clear();
+}
@@ -1,6 +1,7 @@
 // src/main.cpp
 #include <iostream>
 #include <string>
+#include <cstdlib>
 #include <vector>
 #include <map>
 #include <filesystem>
@@ -8,19 +9,38 @@
 #include <zlib.h>
 #include "git_objects.h"
 #include "repo.h"
+#include "object_cache.h"
+#include "commit_graph.h"
+#include "compression.h"
+#include "object_io.h"
+#include "tree_diff.h"
+#include "fsmonitor.h"
+#include "ignore.h"
+#include "bitmap.h"
+#include "uring.h"
 
 namespace fs = std::filesystem;
 
 int main(int argc, char* argv[]) {
     if (argc < 2) {
-        std::cerr << "Usage: gitlite <command> [<args>]" << std::endl;
+        std::cerr << "Usage: gitlite [-c <name>=<value>]... <command> [<args>]" << std::endl;
         return 1;
     }
 
-    std::string command = argv[1];
-    std::vector<std::string> args(argv + 2, argv + argc);
-
     try {
+        // Global options before the command
+        int first = 1;
+        while (first + 1 < argc && std::string(argv[first]) == "-c") {
+            config_override(argv[first + 1]);
+            first += 2;
+        }
+        if (first >= argc) {
+            std::cerr << "Usage: gitlite [-c <name>=<value>]... <command> [<args>]" << std::endl;
+            return 1;
+        }
+        std::string command = argv[first];
+        std::vector<std::string> args(argv + first + 1, argv + argc);
+
         if (command == "init") {
             cmd_init(args);
         } else if (command == "hash-object") {
@@ -29,18 +49,51 @@ int main(int argc, char* argv[]) {
             cmd_cat_file(args);
         } else if (command == "write-tree") {
             cmd_write_tree(args);
+        } else if (command == "status") {
+            cmd_status(args);
+        } else if (command == "fsmonitor") {
+            cmd_fsmonitor(args);
         } else if (command == "commit-tree") {
             cmd_commit_tree(args);
         } else if (command == "ls-tree") {
             cmd_ls_tree(args);
+        } else if (command == "diff-tree") {
+            cmd_diff_tree(args);
         } else if (command == "log") {
             cmd_log(args);
         } else if (command == "checkout") {
             cmd_checkout(args);
+        } else if (command == "repack") {
+            cmd_repack(args);
+        } else if (command == "commit-graph") {
+            cmd_commit_graph(args);
+        } else if (command == "rev-list") {
+            cmd_rev_list(args);
+        } else if (command == "count-objects") {
+            cmd_count_objects(args);
+        } else if (command == "merge-base") {
+            cmd_merge_base(args);
+        } else if (command == "fast-import") {
+            cmd_fast_import(args);
+        } else if (command == "fsck") {
+            cmd_fsck(args);
+        } else if (command == "archive") {
+            cmd_archive(args);
         } else {
             std::cerr << "Unknown command: " << command << std::endl;
             return 1;
         }
+        if (std::getenv("GITLITE_STATS")) {
+            object_cache_print_stats(std::cerr);
+            commit_graph_print_stats(std::cerr);
+            bitmap_print_stats(std::cerr);
+            tree_diff_print_stats(std::cerr);
+            fsmonitor_print_stats(std::cerr);
+            ignore_print_stats(std::cerr);
+            compression_print_stats(std::cerr);
+            io_print_stats(std::cerr);
+            uring_print_stats(std::cerr);
+        }
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
         return 1;
@@ -0,0 +1,151 @@
+#include "object_cache.h"
+#include <list>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+
+struct CacheEntry {
+    std::shared_ptr<const CachedObject> object;
+    std::shared_ptr<const GitTree> tree;
+    std::shared_ptr<const GitCommit> commit;
+    size_t cost = 0;
+    std::list<std::string>::iterator lru;
+};
+
+class ObjectCache {
+public:
+    void configure(const GitRepository& repo) {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (configured_) return;
+        configured_ = true;
+        stats_.limit = repo.config_get_size("cache.limit", 64ull << 20);
+        big_object_ = repo.config_get_size("cache.bigobject", 4ull << 20);
+    }
+
+    // Look up an entry, counting a hit and refreshing its position
+    bool get(const std::string& sha, CacheEntry& out) {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto it = entries_.find(sha);
+        if (it == entries_.end()) {
+            ++stats_.misses;
+            return false;
+        }
+        ++stats_.hits;
+        lru_.splice(lru_.begin(), lru_, it->second.lru);
+        out = it->second;
+        return true;
+    }
+
+    void put(const std::string& sha, std::shared_ptr<const CachedObject> object) {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (object->data.size() > big_object_ || object->data.size() > stats_.limit) {
+            ++stats_.bypassed;
+            return;
+        }
+        if (entries_.count(sha)) return;  // Another thread loaded it meanwhile
+        lru_.push_front(sha);
+        CacheEntry entry;
+        entry.object = std::move(object);
+        entry.cost = entry.object->data.size() + sha.size() + sizeof(CacheEntry);
+        entry.lru = lru_.begin();
+        stats_.bytes += entry.cost;
+        entries_.emplace(sha, std::move(entry));
+        evict();
+    }
+
+    // Attach a parsed form to a cached entry; `extra` is its approximate size
+    template <typename T>
+    void attach(const std::string& sha, std::shared_ptr<const T> parsed, size_t extra,
+                std::shared_ptr<const T> CacheEntry::*slot) {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto it = entries_.find(sha);
+        if (it == entries_.end() || it->second.*slot) return;
+        it->second.*slot = std::move(parsed);
+        it->second.cost += extra;
+        stats_.bytes += extra;
+        evict();
+    }
+
+    ObjectCacheStats stats() {
+        std::lock_guard<std::mutex> lk(mu_);
+        return stats_;
+    }
+
+private:
+    void evict() {
+        while (stats_.bytes > stats_.limit && !lru_.empty()) {
+            auto victim = entries_.find(lru_.back());
+            stats_.bytes -= victim->second.cost;
+            entries_.erase(victim);
+            lru_.pop_back();
+            ++stats_.evictions;
+        }
+    }
+
+    std::mutex mu_;
+    bool configured_ = false;
+    uint64_t big_object_ = 0;
+    std::unordered_map<std::string, CacheEntry> entries_;
+    std::list<std::string> lru_;  // Most recently used at the front
+    ObjectCacheStats stats_;
+};
+
+ObjectCache& cache() {
+    static ObjectCache instance;
+    return instance;
+}
+
+}  // namespace
+
+// Inflate an object that missed the cache and offer it to the cache
+static std::shared_ptr<const CachedObject> load(const GitRepository& repo, const std::string& sha) {
+    auto [fmt, data] = read_object_fmt_and_data(repo, sha);
+    auto object = std::make_shared<const CachedObject>(CachedObject{std::move(fmt), std::move(data)});
+    cache().put(sha, object);
+    return object;
+}
+
+std::shared_ptr<const CachedObject> object_cache_read(const GitRepository& repo, const std::string& sha) {
+    cache().configure(repo);
+    CacheEntry entry;
+    if (cache().get(sha, entry)) return entry.object;
+    return load(repo, sha);
+}
+
+std::shared_ptr<const GitTree> object_cache_tree(const GitRepository& repo, const std::string& sha) {
+    cache().configure(repo);
+    CacheEntry entry;
+    bool hit = cache().get(sha, entry);
+    if (hit && entry.tree) return entry.tree;
+    auto object = hit ? entry.object : load(repo, sha);
+    if (object->fmt != "tree") throw std::runtime_error("Not a tree object");
+    auto tree = std::make_shared<const GitTree>(GitTree::parse(object->data));
+    size_t extra = tree->items.size() * (sizeof(GitTreeLeaf) + 48);
+    cache().attach(sha, tree, extra, &CacheEntry::tree);
+    return tree;
+}
+
+std::shared_ptr<const GitCommit> object_cache_commit(const GitRepository& repo, const std::string& sha) {
+    cache().configure(repo);
+    CacheEntry entry;
+    bool hit = cache().get(sha, entry);
+    if (hit && entry.commit) return entry.commit;
+    auto object = hit ? entry.object : load(repo, sha);
+    if (object->fmt != "commit") throw std::runtime_error("Not a commit object");
+    auto commit = std::make_shared<const GitCommit>(GitCommit::parse(object->data));
+    size_t extra = object->data.size() + commit->kvlm.size() * 64;
+    cache().attach(sha, commit, extra, &CacheEntry::commit);
+    return commit;
+}
+
+ObjectCacheStats object_cache_stats() {
+    return cache().stats();
+}
+
+void object_cache_print_stats(std::ostream& out) {
+    ObjectCacheStats s = object_cache_stats();
+    out << "object cache: " << s.hits << " hits, " << s.misses << " misses, " << s.evictions
+        << " evictions, " << s.bypassed << " bypassed, " << s.bytes << "/" << s.limit << " bytes" << std::endl;
+}
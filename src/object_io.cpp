@@ -0,0 +1,307 @@
+#include "object_io.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Files at least this big are mapped rather than read
+static constexpr uint64_t MMAP_MIN = 256 * 1024;
+// Arena blocks are at least this big
+static constexpr size_t ARENA_BLOCK = 256 * 1024;
+
+static std::atomic<uint64_t> stat_allocs{0};
+static std::atomic<uint64_t> stat_alloc_bytes{0};
+static std::atomic<uint64_t> stat_opens{0};
+static std::atomic<uint64_t> stat_preads{0};
+static std::atomic<uint64_t> stat_mmaps{0};
+static std::atomic<uint64_t> stat_writes{0};
+static std::atomic<uint64_t> stat_zlib_inits{0};
+static std::atomic<uint64_t> stat_existing{0};
+
+void io_count_open() { stat_opens.fetch_add(1, std::memory_order_relaxed); }
+void io_count_write() { stat_writes.fetch_add(1, std::memory_order_relaxed); }
+void io_count_existing() { stat_existing.fetch_add(1, std::memory_order_relaxed); }
+
+// Global allocation counting for GITLITE_STATS, only when it's set. Counts
+// are kept per thread so an allocation touches no shared cache line; a
+// thread's counts go into the totals when it exits. Sized and unsized forms
+// go through malloc/free; the aligned and nothrow forms fall back to these.
+static const bool count_allocs = std::getenv("GITLITE_STATS") != nullptr;
+
+namespace {
+
+struct AllocCounter {
+    uint64_t allocs = 0;
+    uint64_t bytes = 0;
+    ~AllocCounter() {
+        stat_allocs.fetch_add(allocs, std::memory_order_relaxed);
+        stat_alloc_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+};
+thread_local AllocCounter alloc_counter;
+
+}  // namespace
+
+void* operator new(size_t size) {
+    if (count_allocs) {
+        ++alloc_counter.allocs;
+        alloc_counter.bytes += size;
+    }
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+
+// zlib stream pools, one per thread
+
+namespace {
+
+struct InflatePool {
+    std::vector<z_stream*> free;
+    ~InflatePool() {
+        for (z_stream* zs : free) {
+            inflateEnd(zs);
+            delete zs;
+        }
+    }
+};
+
+thread_local InflatePool inflate_pool;
+
+}  // namespace
+
+struct PooledDeflate {
+    z_stream zs{};
+    int level = 0;
+};
+
+namespace {
+
+struct DeflatePool {
+    std::vector<PooledDeflate*> free;
+    ~DeflatePool() {
+        for (PooledDeflate* d : free) {
+            deflateEnd(&d->zs);
+            delete d;
+        }
+    }
+};
+
+thread_local DeflatePool deflate_pool;
+
+}  // namespace
+
+InflateLease::InflateLease() {
+    if (!inflate_pool.free.empty()) {
+        zs_ = inflate_pool.free.back();
+        inflate_pool.free.pop_back();
+        return;
+    }
+    zs_ = new z_stream{};
+    if (inflateInit(zs_) != Z_OK) {
+        delete zs_;
+        throw std::runtime_error("zlib inflateInit error");
+    }
+    stat_zlib_inits.fetch_add(1, std::memory_order_relaxed);
+}
+
+InflateLease::~InflateLease() {
+    inflateReset(zs_);
+    zs_->next_in = nullptr;
+    zs_->avail_in = 0;
+    inflate_pool.free.push_back(zs_);
+}
+
+DeflateLease::DeflateLease(int level) {
+    if (!deflate_pool.free.empty()) {
+        pooled_ = deflate_pool.free.back();
+        deflate_pool.free.pop_back();
+        // Fresh after deflateReset, so no data needs flushing here
+        if (pooled_->level != level && deflateParams(&pooled_->zs, level, Z_DEFAULT_STRATEGY) == Z_OK) {
+            pooled_->level = level;
+        }
+        if (pooled_->level == level) return;
+        deflateEnd(&pooled_->zs);
+        delete pooled_;
+    }
+    pooled_ = new PooledDeflate;
+    if (deflateInit(&pooled_->zs, level) != Z_OK) {
+        delete pooled_;
+        throw std::runtime_error("zlib deflateInit error");
+    }
+    pooled_->level = level;
+    stat_zlib_inits.fetch_add(1, std::memory_order_relaxed);
+}
+
+DeflateLease::~DeflateLease() {
+    deflateReset(&pooled_->zs);
+    deflate_pool.free.push_back(pooled_);
+}
+
+z_stream& DeflateLease::operator*() { return pooled_->zs; }
+
+// Scratch arena
+
+ScratchArena& ScratchArena::local() {
+    thread_local ScratchArena arena;
+    return arena;
+}
+
+ScratchArena::~ScratchArena() {
+    for (Block& b : blocks_) delete[] b.data;
+}
+
+void* ScratchArena::alloc(size_t size) {
+    size = (size + 15) & ~size_t(15);
+    while (cur_ < blocks_.size()) {
+        if (blocks_[cur_].size - used_ >= size) {
+            void* p = blocks_[cur_].data + used_;
+            used_ += size;
+            return p;
+        }
+        // Skip to the next block; the tail of this one is wasted until release
+        ++cur_;
+        used_ = 0;
+    }
+    blocks_.push_back({new char[std::max(size, ARENA_BLOCK)], std::max(size, ARENA_BLOCK)});
+    cur_ = blocks_.size() - 1;
+    used_ = size;
+    return blocks_.back().data;
+}
+
+// Loose files
+
+LooseFile::LooseFile(const std::string& path) {
+    fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    io_count_open();
+    if (fd_ < 0) return;
+    struct stat st;
+    if (fstat(fd_, &st) != 0) {
+        ::close(fd_);
+        fd_ = -1;
+        return;
+    }
+    size_ = static_cast<uint64_t>(st.st_size);
+}
+
+LooseFile::~LooseFile() {
+    if (map_) munmap(map_, size_);
+    if (fd_ >= 0) ::close(fd_);
+}
+
+const unsigned char* LooseFile::contents(ArenaScope& scope) {
+    if (size_ >= MMAP_MIN) {
+        if (!map_) {
+            void* p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+            stat_mmaps.fetch_add(1, std::memory_order_relaxed);
+            if (p == MAP_FAILED) throw std::runtime_error("Failed to map object file");
+            map_ = p;
+        }
+        return static_cast<const unsigned char*>(map_);
+    }
+    unsigned char* buf = scope.alloc(size_ ? size_ : 1);
+    size_t got = 0;
+    while (got < size_) {
+        size_t n = read_at(buf + got, size_ - got, got);
+        if (n == 0) throw std::runtime_error("Object file shrank while reading");
+        got += n;
+    }
+    return buf;
+}
+
+size_t LooseFile::read_at(void* buf, size_t len, uint64_t offset) {
+    for (;;) {
+        ssize_t n = ::pread(fd_, buf, len, static_cast<off_t>(offset));
+        stat_preads.fetch_add(1, std::memory_order_relaxed);
+        if (n >= 0) return static_cast<size_t>(n);
+        if (errno != EINTR) throw std::runtime_error("Failed to read object file");
+    }
+}
+
+// Loose objects
+
+// Just the header is inflated first, then the payload goes straight into a
+// buffer of exactly the declared size
+std::pair<std::string, std::string> inflate_loose(const unsigned char* compressed, uint64_t compressed_size) {
+    InflateLease zs;
+    zs->next_in = const_cast<Bytef*>(compressed);
+    uint64_t in_left = compressed_size;
+    zlib_refill(zs->avail_in, in_left);
+    char head[64];
+    zs->next_out = reinterpret_cast<Bytef*>(head);
+    zs->avail_out = sizeof(head);
+    int ret = inflate(&*zs, Z_SYNC_FLUSH);
+    if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) throw std::runtime_error("zlib inflate error");
+    std::string_view text(head, sizeof(head) - zs->avail_out);
+    size_t space_pos = text.find(' ');
+    size_t null_pos = space_pos == std::string_view::npos ? space_pos : text.find('\0', space_pos);
+    if (null_pos == std::string_view::npos) throw std::runtime_error("Malformed object header");
+    std::string_view size_text = text.substr(space_pos + 1, null_pos - space_pos - 1);
+    if (size_text.empty() || size_text.size() > 20 ||
+        !std::all_of(size_text.begin(), size_text.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+        throw std::runtime_error("Malformed object header");
+    }
+    std::string fmt(text.substr(0, space_pos));
+    uint64_t size = std::stoull(std::string(size_text));
+    // zlib can't expand more than ~1032:1, which bounds a lying header
+    if (size > compressed_size * 1032ull + 64) throw std::runtime_error("Size mismatch");
+
+    std::string data(size, '\0');
+    size_t have = text.size() - null_pos - 1;
+    if (have > size) throw std::runtime_error("Size mismatch");
+    std::memcpy(data.data(), head + null_pos + 1, have);
+    // One spare byte of room so trailing garbage shows up as a size mismatch
+    char spare;
+    while (ret == Z_OK) {
+        if (have < size) {
+            zs->next_out = reinterpret_cast<Bytef*>(data.data() + have);
+            zs->avail_out = static_cast<uInt>(std::min<uint64_t>(size - have, UINT32_MAX));
+        } else {
+            zs->next_out = reinterpret_cast<Bytef*>(&spare);
+            zs->avail_out = 1;
+        }
+        uInt before = zs->avail_out;
+        zlib_refill(zs->avail_in, in_left);
+        ret = inflate(&*zs, Z_NO_FLUSH);
+        if (ret < 0) throw std::runtime_error(ret == Z_BUF_ERROR ? "truncated zlib stream" : "zlib inflate error");
+        if (have >= size && zs->avail_out == 0) throw std::runtime_error("Size mismatch");
+        if (have < size) have += before - zs->avail_out;
+    }
+    if (ret != Z_STREAM_END) throw std::runtime_error("truncated zlib stream");
+    if (zs->avail_in != 0 || in_left != 0) throw std::runtime_error("garbage after the zlib stream");
+    if (have != size) throw std::runtime_error("Size mismatch");
+
+    return {fmt, std::move(data)};
+}
+
+// Stats
+
+void io_print_stats(std::ostream& out) {
+    uint64_t syscr = 0, syscw = 0;
+    std::ifstream proc("/proc/self/io");
+    std::string key;
+    uint64_t value;
+    while (proc >> key >> value) {
+        if (key == "syscr:") syscr = value;
+        if (key == "syscw:") syscw = value;
+    }
+    // Threads that are still running (this one) haven't handed theirs in yet
+    out << "io: " << stat_allocs + alloc_counter.allocs << " allocations ("
+        << stat_alloc_bytes + alloc_counter.bytes << " bytes), " << syscr << " read / "
+        << syscw << " write syscalls, object files: " << stat_opens << " opens, " << stat_preads << " preads, "
+        << stat_mmaps << " mmaps, " << stat_writes << " writes, " << stat_zlib_inits << " zlib inits, " << stat_existing << " existing objects not rewritten" << std::endl;
+}
@@ -0,0 +1,805 @@
+#include "pack.h"
+#include "delta.h"
+#include "sha1.h"
+#include "object_io.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <openssl/sha.h>
+#include <zlib.h>
+
+// Pack layout: "PACK" <version=2> <count>, then per object a type/size
+// varint header followed by the zlib-deflated payload, then a SHA-1 of
+// everything before it.
+//
+// Idx v2 layout: "\377tOc" <version=2>, fanout[256] (cumulative counts by
+// first SHA byte), sorted SHAs, CRC32s, 31-bit offsets (MSB set = index into
+// the 64-bit table), 64-bit offsets, pack checksum, idx checksum.
+
+static const unsigned char IDX_MAGIC[4] = {0xff, 't', 'O', 'c'};
+
+static uint32_t be32(const unsigned char* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+static void put_be32(std::string& out, uint32_t v) {
+    char b[4] = {char(v >> 24), char(v >> 16), char(v >> 8), char(v)};
+    out.append(b, 4);
+}
+
+int pack_type_from_fmt(const std::string& fmt) {
+    if (fmt == "commit") return PACK_COMMIT;
+    if (fmt == "tree") return PACK_TREE;
+    if (fmt == "blob") return PACK_BLOB;
+    if (fmt == "tag") return PACK_TAG;
+    throw std::runtime_error("Unknown object type: " + fmt);
+}
+
+std::string pack_fmt_from_type(int type) {
+    switch (type) {
+        case PACK_COMMIT: return "commit";
+        case PACK_TREE: return "tree";
+        case PACK_BLOB: return "blob";
+        case PACK_TAG: return "tag";
+    }
+    throw std::runtime_error("Unknown pack object type " + std::to_string(type));
+}
+
+// Map a whole file read-only
+// A zlib stream can't inflate to more than about 1032 times its length
+// (plus a few bytes of header), so a claimed size past that is corrupt and
+// is rejected before it decides how much gets allocated
+static uint64_t max_inflated_size(uint64_t compressed) {
+    return compressed * 1032 + 64;
+}
+
+// True if a 7-bit size group at `shift` doesn't fit in 64 bits
+static bool size_overflows(unsigned char c, int shift) {
+    return shift >= 64 || (shift > 57 && uint64_t(c & 0x7f) >> (64 - shift) != 0);
+}
+
+static const unsigned char* map_file(const fs::path& path, size_t& size) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Failed to open " + path.string());
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        throw std::runtime_error("Failed to stat " + path.string());
+    }
+    size = static_cast<size_t>(st.st_size);
+    void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) throw std::runtime_error("Failed to mmap " + path.string());
+    return static_cast<const unsigned char*>(p);
+}
+
+PackFile::PackFile(const fs::path& idx_path) : idx_path_(idx_path) {
+    pack_path_ = idx_path;
+    pack_path_.replace_extension(".pack");
+    idx_ = map_file(idx_path_, idx_size_);
+    try {
+        if (idx_size_ < 8 + 256 * 4 + 40 || std::memcmp(idx_, IDX_MAGIC, 4) != 0 || be32(idx_ + 4) != 2) {
+            throw std::runtime_error("Unsupported pack index: " + idx_path_.string());
+        }
+        fanout_ = idx_ + 8;
+        count_ = be32(fanout_ + 255 * 4);
+        names_ = fanout_ + 256 * 4;
+        const unsigned char* crcs = names_ + 20 * size_t(count_);
+        offsets_ = crcs + 4 * size_t(count_);
+        large_offsets_ = offsets_ + 4 * size_t(count_);
+        if (large_offsets_ + 40 > idx_ + idx_size_) {
+            throw std::runtime_error("Truncated pack index: " + idx_path_.string());
+        }
+        pack_ = map_file(pack_path_, pack_size_);
+        if (pack_size_ < 32 || std::memcmp(pack_, "PACK", 4) != 0 || be32(pack_ + 8) != count_) {
+            throw std::runtime_error("Pack does not match its index: " + pack_path_.string());
+        }
+    } catch (...) {
+        munmap(const_cast<unsigned char*>(idx_), idx_size_);
+        if (pack_) munmap(const_cast<unsigned char*>(pack_), pack_size_);
+        throw;
+    }
+}
+
+PackFile::~PackFile() {
+    munmap(const_cast<unsigned char*>(idx_), idx_size_);
+    munmap(const_cast<unsigned char*>(pack_), pack_size_);
+}
+
+void PackFile::verify_checksums() const {
+    const unsigned char* pack_trailer = pack_ + pack_size_ - 20;
+    if (sha1(pack_, pack_size_ - 20) != ObjectId::from_raw(pack_trailer)) {
+        throw std::runtime_error("Pack checksum mismatch: " + pack_path_.string());
+    }
+    if (std::memcmp(idx_ + idx_size_ - 40, pack_trailer, 20) != 0) {
+        throw std::runtime_error("Pack index is for a different pack: " + idx_path_.string());
+    }
+    if (sha1(idx_, idx_size_ - 20) != ObjectId::from_raw(idx_ + idx_size_ - 20)) {
+        throw std::runtime_error("Pack index checksum mismatch: " + idx_path_.string());
+    }
+}
+
+uint64_t PackFile::offset_at(uint32_t i) const {
+    uint32_t off = be32(offsets_ + 4 * size_t(i));
+    if (!(off & 0x80000000u)) return off;
+    const unsigned char* p = large_offsets_ + 8 * size_t(off & 0x7fffffffu);
+    return (uint64_t(be32(p)) << 32) | be32(p + 4);
+}
+
+bool PackFile::find(const unsigned char* sha, uint64_t& offset) const {
+    uint32_t i;
+    if (!find_index(sha, i)) return false;
+    offset = offset_at(i);
+    return true;
+}
+
+bool PackFile::find_index(const unsigned char* sha, uint32_t& index) const {
+    uint32_t lo = sha[0] == 0 ? 0 : be32(fanout_ + 4 * size_t(sha[0] - 1));
+    uint32_t hi = be32(fanout_ + 4 * size_t(sha[0]));
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = std::memcmp(sha_at(mid), sha, 20);
+        if (cmp == 0) {
+            index = mid;
+            return true;
+        }
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return false;
+}
+
+void PackFile::find_prefix(const ObjectId& lower, std::string_view prefix, std::vector<ObjectId>& out,
+                           size_t limit) const {
+    uint32_t lo = lower.bytes[0] == 0 ? 0 : be32(fanout_ + 4 * size_t(lower.bytes[0] - 1));
+    uint32_t hi = be32(fanout_ + 4 * size_t(lower.bytes[0]));
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (std::memcmp(sha_at(mid), lower.data(), 20) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    char hex[40];
+    for (uint32_t end = count_; lo < end && out.size() < limit; ++lo) {
+        ObjectId id = ObjectId::from_raw(sha_at(lo));
+        id.hex(hex);
+        if (std::memcmp(hex, prefix.data(), prefix.size()) != 0) break;
+        out.push_back(id);
+    }
+}
+
+PackFile::EntryHeader PackFile::parse_header(uint64_t offset) const {
+    size_t end = pack_size_ - SHA_DIGEST_LENGTH;
+    if (offset < 12 || offset >= end) throw std::runtime_error("Pack offset out of range");
+    size_t pos = static_cast<size_t>(offset);
+
+    // Type and size header: 3 type bits and 4 size bits, then 7 bits per byte
+    unsigned char c = pack_[pos++];
+    EntryHeader h{(c >> 4) & 7, uint64_t(c & 15), 0, 0};
+    int shift = 4;
+    while (c & 0x80) {
+        if (pos >= end) throw std::runtime_error("Truncated pack entry header");
+        c = pack_[pos++];
+        if (size_overflows(c, shift)) throw std::runtime_error("Pack entry size too large");
+        h.size |= uint64_t(c & 0x7f) << shift;
+        shift += 7;
+    }
+
+    if (h.type == PACK_OFS_DELTA) {
+        // Big-endian base-128 distance back to the base, with an offset of one per extra byte
+        if (pos >= end) throw std::runtime_error("Truncated OFS_DELTA header");
+        c = pack_[pos++];
+        uint64_t dist = c & 0x7f;
+        while (c & 0x80) {
+            if (pos >= end) throw std::runtime_error("Truncated OFS_DELTA header");
+            c = pack_[pos++];
+            if (dist + 1 > (UINT64_MAX >> 7)) throw std::runtime_error("Bad OFS_DELTA base offset");
+            dist = ((dist + 1) << 7) | (c & 0x7f);
+        }
+        if (dist == 0 || dist > offset) throw std::runtime_error("Bad OFS_DELTA base offset");
+        h.base_offset = offset - dist;
+    } else if (h.type == PACK_REF_DELTA) {
+        if (pos + 20 > end) throw std::runtime_error("Truncated REF_DELTA header");
+        if (!find(pack_ + pos, h.base_offset)) {
+            throw std::runtime_error("REF_DELTA base " + sha_to_hex(pack_ + pos) + " is not in " + pack_path_.string());
+        }
+        pos += 20;
+    } else {
+        pack_fmt_from_type(h.type);  // Validates the type
+    }
+    h.data_pos = pos;
+    return h;
+}
+
+std::string PackFile::inflate_at(size_t pos, uint64_t size) const {
+    size_t end = pack_size_ - SHA_DIGEST_LENGTH;
+    if (size > max_inflated_size(end - pos)) throw std::runtime_error("Corrupt packed object");
+    // One spare byte so an empty or oversized stream can't stall inflate
+    std::string data(size + 1, '\0');
+    InflateLease zs;
+    zs->next_in = const_cast<Bytef*>(pack_ + pos);
+    zs->next_out = reinterpret_cast<Bytef*>(data.data());
+    uint64_t in_left = end - pos, out_left = size + 1;
+    int ret = Z_OK;
+    while (ret == Z_OK) {
+        zlib_refill(zs->avail_in, in_left);
+        zlib_refill(zs->avail_out, out_left);
+        ret = inflate(&*zs, Z_NO_FLUSH);
+    }
+    if (ret != Z_STREAM_END || zs->total_out != size) throw std::runtime_error("Corrupt packed object");
+    data.resize(size);
+    return data;
+}
+
+// Up to `max` bytes from the start of the zlib stream at `pos`
+std::string PackFile::inflate_prefix(size_t pos, size_t max) const {
+    size_t end = pack_size_ - SHA_DIGEST_LENGTH;
+    std::string data(max, '\0');
+    InflateLease zs;
+    zs->next_in = const_cast<Bytef*>(pack_ + pos);
+    zs->avail_in = static_cast<uInt>(std::min<size_t>(end - pos, UINT32_MAX));
+    zs->next_out = reinterpret_cast<Bytef*>(data.data());
+    zs->avail_out = static_cast<uInt>(max);
+    int ret = inflate(&*zs, Z_SYNC_FLUSH);
+    if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) throw std::runtime_error("Corrupt packed object");
+    data.resize(zs->total_out);
+    return data;
+}
+
+void PackFile::read_header(uint64_t offset, std::string& fmt, uint64_t& size) const {
+    EntryHeader h = parse_header(offset);
+    if (h.type != PACK_OFS_DELTA && h.type != PACK_REF_DELTA) {
+        fmt = pack_fmt_from_type(h.type);
+        size = h.size;
+        return;
+    }
+    // Two varints of at most 10 bytes each: source size, then target size
+    size = delta_target_size(inflate_prefix(h.data_pos, 20));
+    for (size_t depth = 0; h.type == PACK_OFS_DELTA || h.type == PACK_REF_DELTA; ++depth) {
+        if (depth > 10000) throw std::runtime_error("Delta chain too long (cycle?)");
+        h = parse_header(h.base_offset);
+    }
+    fmt = pack_fmt_from_type(h.type);
+}
+
+void PackFile::stream(uint64_t offset, const ObjectHeaderFn& on_header, const ObjectSink& sink) const {
+    EntryHeader h = parse_header(offset);
+    if (h.type == PACK_OFS_DELTA || h.type == PACK_REF_DELTA) {
+        auto [fmt, data] = read(offset);
+        on_header(fmt, data.size());
+        for (size_t pos = 0; pos < data.size(); pos += STREAM_CHUNK) {
+            sink(data.data() + pos, std::min(STREAM_CHUNK, data.size() - pos));
+        }
+        return;
+    }
+
+    on_header(pack_fmt_from_type(h.type), h.size);
+    size_t end = pack_size_ - SHA_DIGEST_LENGTH;
+    ArenaScope scratch;
+    char* out = scratch.alloc<char>(STREAM_CHUNK);
+    InflateLease lease;
+    z_stream& zs = *lease;
+    zs.next_in = const_cast<Bytef*>(pack_ + h.data_pos);
+    uint64_t in_left = end - h.data_pos;
+    const size_t PAGE = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t released = (h.data_pos + PAGE - 1) & ~(PAGE - 1);
+    int ret = Z_OK;
+    while (ret == Z_OK) {
+        zs.next_out = reinterpret_cast<Bytef*>(out);
+        zs.avail_out = static_cast<uInt>(STREAM_CHUNK);
+        zlib_refill(zs.avail_in, in_left);
+        ret = inflate(&zs, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END) break;
+        if (zs.avail_out < STREAM_CHUNK) sink(out, STREAM_CHUNK - zs.avail_out);
+        // Hand back the mapped pages we've read past so a huge blob
+        // doesn't end up resident (they stay in the page cache)
+        size_t consumed = (reinterpret_cast<const unsigned char*>(zs.next_in) - pack_) & ~(PAGE - 1);
+        if (consumed >= released + STREAM_CHUNK * 16) {
+            madvise(const_cast<unsigned char*>(pack_) + released, consumed - released, MADV_DONTNEED);
+            released = consumed;
+        }
+    }
+    if (ret != Z_STREAM_END || zs.total_out != h.size) throw std::runtime_error("Corrupt packed object");
+}
+
+// Budget for resolved delta bases kept per pack
+static constexpr size_t DELTA_BASE_CACHE_LIMIT = 96 * 1024 * 1024;
+
+bool PackFile::cache_get(uint64_t offset, int& type, std::shared_ptr<const std::string>& data) const {
+    std::lock_guard<std::mutex> lk(cache_mu_);
+    auto it = cache_.find(offset);
+    if (it == cache_.end()) return false;
+    cache_lru_.splice(cache_lru_.begin(), cache_lru_, it->second.lru);
+    type = it->second.type;
+    data = it->second.data;
+    return true;
+}
+
+void PackFile::cache_put(uint64_t offset, int type, std::shared_ptr<const std::string> data) const {
+    if (data->size() > DELTA_BASE_CACHE_LIMIT / 4) return;  // Would flush everything else
+    std::lock_guard<std::mutex> lk(cache_mu_);
+    if (cache_.count(offset)) return;
+    cache_lru_.push_front(offset);
+    cache_bytes_ += data->size();
+    cache_[offset] = {type, std::move(data), cache_lru_.begin()};
+    while (cache_bytes_ > DELTA_BASE_CACHE_LIMIT && !cache_lru_.empty()) {
+        auto victim = cache_.find(cache_lru_.back());
+        cache_bytes_ -= victim->second.data->size();
+        cache_.erase(victim);
+        cache_lru_.pop_back();
+    }
+}
+
+std::pair<std::string, std::string> PackFile::read(uint64_t offset) const {
+    // Walk down the chain until a cached base or a full object
+    std::vector<EntryHeader> chain;
+    int type = 0;
+    std::shared_ptr<const std::string> base;
+    uint64_t cur = offset;
+    for (;;) {
+        if (!chain.empty() && cache_get(cur, type, base)) break;
+        EntryHeader h = parse_header(cur);
+        if (h.type == PACK_OFS_DELTA || h.type == PACK_REF_DELTA) {
+            if (chain.size() > 10000) throw std::runtime_error("Delta chain too long (cycle?)");
+            chain.push_back(h);
+            cur = h.base_offset;
+            continue;
+        }
+        type = h.type;
+        base = std::make_shared<const std::string>(inflate_at(h.data_pos, h.size));
+        if (!chain.empty()) cache_put(cur, type, base);
+        break;
+    }
+    if (chain.empty()) return {pack_fmt_from_type(type), *base};
+
+    // Apply deltas from the innermost outwards, remembering each base on the way
+    std::string data;
+    for (size_t i = chain.size(); i-- > 0;) {
+        std::string delta = inflate_at(chain[i].data_pos, chain[i].size);
+        data = apply_delta(*base, delta);
+        if (i > 0) {
+            base = std::make_shared<const std::string>(std::move(data));
+            cache_put(chain[i - 1].base_offset, type, base);
+        }
+    }
+    return {pack_fmt_from_type(type), data};
+}
+
+// Process-wide pack registry, keyed by gitdir
+static std::mutex packs_mu;
+static std::map<std::string, std::vector<std::shared_ptr<PackFile>>> packs_by_repo;
+
+std::vector<std::shared_ptr<PackFile>> pack_list(const GitRepository& repo, bool reload) {
+    std::lock_guard<std::mutex> lk(packs_mu);
+    std::string key = repo.gitdir.string();
+    auto it = packs_by_repo.find(key);
+    if (it != packs_by_repo.end() && !reload) return it->second;
+
+    std::vector<std::shared_ptr<PackFile>> packs;
+    fs::path dir = repo.gitdir / "objects" / "pack";
+    std::error_code ec;
+    if (fs::is_directory(dir, ec)) {
+        std::vector<fs::path> idx_files;
+        for (const auto& entry : fs::directory_iterator(dir)) {
+            std::string name = entry.path().filename().string();
+            if (name.rfind("pack-", 0) == 0 && entry.path().extension() == ".idx") {
+                idx_files.push_back(entry.path());
+            }
+        }
+        std::sort(idx_files.begin(), idx_files.end());
+        for (const auto& idx : idx_files) {
+            packs.push_back(std::make_shared<PackFile>(idx));
+        }
+    }
+    packs_by_repo[key] = packs;
+    return packs;
+}
+
+bool pack_read_object(const GitRepository& repo, const std::string& sha, std::string& fmt, std::string& data) {
+    unsigned char bin[20];
+    hex_to_sha(sha, bin);
+    for (const auto& pack : pack_list(repo)) {
+        uint64_t offset;
+        if (pack->find(bin, offset)) {
+            auto [f, d] = pack->read(offset);
+            fmt = std::move(f);
+            data = std::move(d);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool pack_read_stream(const GitRepository& repo, const std::string& sha, const ObjectHeaderFn& on_header,
+                      const ObjectSink& sink) {
+    unsigned char bin[20];
+    hex_to_sha(sha, bin);
+    uint64_t offset;
+    for (const auto& pack : pack_list(repo)) {
+        if (pack->find(bin, offset)) {
+            pack->stream(offset, on_header, sink);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool pack_read_header(const GitRepository& repo, const std::string& sha, std::string& fmt, uint64_t& size) {
+    unsigned char bin[20];
+    hex_to_sha(sha, bin);
+    uint64_t offset;
+    for (const auto& pack : pack_list(repo)) {
+        if (pack->find(bin, offset)) {
+            pack->read_header(offset, fmt, size);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool pack_has_object(const GitRepository& repo, const std::string& sha) {
+    unsigned char bin[20];
+    hex_to_sha(sha, bin);
+    uint64_t offset;
+    for (const auto& pack : pack_list(repo)) {
+        if (pack->find(bin, offset)) return true;
+    }
+    return false;
+}
+
+PackWriter::PackWriter(const GitRepository& repo)
+    : pack_dir_(repo.gitdir / "objects" / "pack"),
+      policy_(CompressionPolicy::from_config(repo, CompressionPolicy::PACK)) {
+    fs::create_directories(pack_dir_);
+    tmp_path_ = (pack_dir_ / "tmp_pack_XXXXXX").string();
+    fd_ = mkstemp(tmp_path_.data());
+    if (fd_ < 0) throw std::runtime_error("Failed to create temp pack in " + pack_dir_.string());
+    std::string header = "PACK";
+    put_be32(header, 2);
+    put_be32(header, 0);  // Count is fixed up in finish()
+    write_raw(header.data(), header.size(), nullptr);
+}
+
+PackWriter::~PackWriter() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        unlink(tmp_path_.c_str());
+    }
+}
+
+void PackWriter::write_raw(const void* data, size_t len, uint32_t* crc) {
+    if (crc) *crc = crc32(*crc, static_cast<const Bytef*>(data), static_cast<uInt>(len));
+    offset_ += len;
+    // Small objects would otherwise cost a write() or two each
+    if (buffer_.size() + len > WRITE_BUFFER) flush();
+    if (len >= WRITE_BUFFER) write_fd(data, len);
+    else buffer_.append(static_cast<const char*>(data), len);
+}
+
+void PackWriter::flush() {
+    write_fd(buffer_.data(), buffer_.size());
+    buffer_.clear();
+}
+
+void PackWriter::write_fd(const void* data, size_t len) {
+    const char* p = static_cast<const char*>(data);
+    while (len > 0) {
+        ssize_t n = ::write(fd_, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("Failed to write pack");
+        }
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+}
+
+bool PackWriter::read(const std::string& sha, std::string& fmt, std::string& data) {
+    auto it = offsets_.find(sha);
+    if (it == offsets_.end()) return false;
+    flush();
+    uint64_t pos = it->second;
+    unsigned char header[16];
+    ssize_t got = pread(fd_, header, std::min<uint64_t>(sizeof(header), offset_ - pos), static_cast<off_t>(pos));
+    if (got <= 0) throw std::runtime_error("Failed to read back pack");
+    int type = (header[0] >> 4) & 7;
+    uint64_t size = header[0] & 15;
+    size_t n = 0;
+    for (int shift = 4; header[n] & 0x80 && n + 1 < size_t(got); shift += 7) {
+        if (size_overflows(header[n + 1], shift)) throw std::runtime_error("Corrupt object " + sha + " in pack");
+        size |= uint64_t(header[++n] & 0x7f) << shift;
+    }
+    if (type == PACK_OFS_DELTA || type == PACK_REF_DELTA) {
+        throw std::runtime_error("Can't read delta " + sha + " back from an unfinished pack");
+    }
+    pos += n + 1;
+
+    fmt = pack_fmt_from_type(type);
+    if (size > max_inflated_size(offset_ - pos)) throw std::runtime_error("Corrupt object " + sha + " in pack");
+    data.assign(size + 1, '\0');  // One spare byte, as in inflate_at
+    InflateLease zs;
+    zs->next_out = reinterpret_cast<Bytef*>(data.data());
+    uint64_t out_left = size + 1;
+    std::vector<unsigned char> in(STREAM_CHUNK);
+    int ret = Z_OK;
+    while (ret == Z_OK && pos < offset_) {
+        ssize_t r = pread(fd_, in.data(), std::min<uint64_t>(in.size(), offset_ - pos), static_cast<off_t>(pos));
+        if (r <= 0) throw std::runtime_error("Failed to read back pack");
+        pos += static_cast<uint64_t>(r);
+        zs->next_in = in.data();
+        zs->avail_in = static_cast<uInt>(r);
+        while (ret == Z_OK && zs->avail_in > 0) {
+            zlib_refill(zs->avail_out, out_left);
+            ret = inflate(&*zs, Z_NO_FLUSH);
+        }
+    }
+    if (ret != Z_STREAM_END || zs->total_out != size) throw std::runtime_error("Corrupt object " + sha + " in pack");
+    data.resize(size);
+    return true;
+}
+
+void PackWriter::write_entry(const std::string& sha, int type, const std::string& base, const std::string& payload) {
+    Entry entry;
+    hex_to_sha(sha, entry.sha);
+    entry.offset = offset_;
+    entry.crc = crc32(0, nullptr, 0);
+
+    unsigned char header[16];
+    size_t n = 0;
+    uint64_t size = payload.size();
+    unsigned char c = static_cast<unsigned char>((type << 4) | (size & 15));
+    size >>= 4;
+    while (size) {
+        header[n++] = c | 0x80;
+        c = size & 0x7f;
+        size >>= 7;
+    }
+    header[n++] = c;
+    write_raw(header, n, &entry.crc);
+    if (!base.empty()) write_raw(base.data(), base.size(), &entry.crc);
+
+    // Deltas get the base level; whole objects their type's, after sampling
+    std::string fmt = base.empty() ? pack_fmt_from_type(type) : "";
+    int level = policy_.level(fmt, payload.data(), payload.size());
+    bool incompressible = level == Z_NO_COMPRESSION && policy_.level(fmt) != Z_NO_COMPRESSION;
+    uint64_t start = offset_;
+    DeflateLease lease(level);
+    z_stream& zs = *lease;
+    ArenaScope scratch;
+    unsigned char* out = scratch.alloc(STREAM_CHUNK);
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(payload.data()));
+    uint64_t in_left = payload.size();
+    int ret;
+    do {
+        zs.next_out = out;
+        zs.avail_out = static_cast<uInt>(STREAM_CHUNK);
+        zlib_refill(zs.avail_in, in_left);
+        ret = deflate(&zs, in_left ? Z_NO_FLUSH : Z_FINISH);
+        if (ret == Z_STREAM_ERROR) throw std::runtime_error("zlib deflate error");
+        write_raw(out, STREAM_CHUNK - zs.avail_out, &entry.crc);
+    } while (ret != Z_STREAM_END);
+    compression_record(payload.size(), offset_ - start, incompressible);
+    entries_.push_back(entry);
+    offsets_[sha] = entry.offset;
+}
+
+void PackWriter::add(const std::string& sha, const std::string& fmt, const std::string& data) {
+    write_entry(sha, pack_type_from_fmt(fmt), "", data);
+}
+
+void PackWriter::add_delta(const std::string& sha, const std::string& base_sha, const std::string& delta, bool ofs_delta) {
+    auto it = offsets_.find(base_sha);
+    if (it == offsets_.end()) throw std::runtime_error("Delta base " + base_sha + " not written yet");
+    std::string base;
+    if (ofs_delta) {
+        // Inverse of the decoding in PackFile::parse_header
+        uint64_t dist = offset_ - it->second;
+        unsigned char buf[16];
+        size_t pos = sizeof(buf) - 1;
+        buf[pos] = dist & 0x7f;
+        while (dist >>= 7) buf[--pos] = 0x80 | (--dist & 0x7f);
+        base.assign(reinterpret_cast<char*>(buf + pos), sizeof(buf) - pos);
+        write_entry(sha, PACK_OFS_DELTA, base, delta);
+    } else {
+        base.resize(20);
+        hex_to_sha(base_sha, reinterpret_cast<unsigned char*>(base.data()));
+        write_entry(sha, PACK_REF_DELTA, base, delta);
+    }
+}
+
+fs::path PackWriter::finish() {
+    // Fix up the object count, then checksum the whole file
+    flush();
+    std::string count;
+    put_be32(count, static_cast<uint32_t>(entries_.size()));
+    if (pwrite(fd_, count.data(), 4, 8) != 4) throw std::runtime_error("Failed to write pack header");
+
+    Sha1 ctx;
+    std::vector<char> buf(64 * 1024);
+    uint64_t pos = 0;
+    while (pos < offset_) {
+        ssize_t n = pread(fd_, buf.data(), std::min<uint64_t>(buf.size(), offset_ - pos), static_cast<off_t>(pos));
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            throw std::runtime_error("Failed to read back pack");
+        }
+        ctx.update(buf.data(), static_cast<size_t>(n));
+        pos += static_cast<uint64_t>(n);
+    }
+    ObjectId pack_id = ctx.finish();
+    const unsigned char* pack_sha = pack_id.data();
+    write_raw(pack_sha, SHA_DIGEST_LENGTH, nullptr);
+    flush();
+    fchmod(fd_, 0444);
+    if (::close(fd_) != 0) {
+        fd_ = -1;
+        unlink(tmp_path_.c_str());
+        throw std::runtime_error("Failed to close pack");
+    }
+    fd_ = -1;
+
+    std::sort(entries_.begin(), entries_.end(), [](const Entry& a, const Entry& b) {
+        return std::memcmp(a.sha, b.sha, 20) < 0;
+    });
+    std::string idx(reinterpret_cast<const char*>(IDX_MAGIC), 4);
+    put_be32(idx, 2);
+    uint32_t fanout[256] = {};
+    for (const auto& e : entries_) ++fanout[e.sha[0]];
+    for (int i = 1; i < 256; ++i) fanout[i] += fanout[i - 1];
+    for (uint32_t f : fanout) put_be32(idx, f);
+    for (const auto& e : entries_) idx.append(reinterpret_cast<const char*>(e.sha), 20);
+    for (const auto& e : entries_) put_be32(idx, e.crc);
+    std::string large;
+    uint32_t nlarge = 0;
+    for (const auto& e : entries_) {
+        if (e.offset < 0x80000000ull) {
+            put_be32(idx, static_cast<uint32_t>(e.offset));
+        } else {
+            put_be32(idx, 0x80000000u | nlarge++);
+            put_be32(large, static_cast<uint32_t>(e.offset >> 32));
+            put_be32(large, static_cast<uint32_t>(e.offset));
+        }
+    }
+    idx += large;
+    idx.append(reinterpret_cast<const char*>(pack_sha), SHA_DIGEST_LENGTH);
+    ObjectId idx_sha = sha1(idx.data(), idx.size());
+    idx.append(reinterpret_cast<const char*>(idx_sha.data()), SHA_DIGEST_LENGTH);
+
+    std::string name = "pack-" + sha_to_hex(pack_sha);
+    fs::path pack_path = pack_dir_ / (name + ".pack");
+    fs::path idx_path = pack_dir_ / (name + ".idx");
+    fs::rename(tmp_path_, pack_path);
+
+    // The idx is what makes a pack visible to readers, so it goes last
+    std::string idx_tmp = (pack_dir_ / "tmp_idx_XXXXXX").string();
+    int fd = mkstemp(idx_tmp.data());
+    if (fd < 0) throw std::runtime_error("Failed to create temp pack index");
+    const char* p = idx.data();
+    size_t left = idx.size();
+    while (left > 0) {
+        ssize_t n = ::write(fd, p, left);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ::close(fd);
+            unlink(idx_tmp.c_str());
+            throw std::runtime_error("Failed to write pack index");
+        }
+        p += n;
+        left -= static_cast<size_t>(n);
+    }
+    fchmod(fd, 0444);
+    ::close(fd);
+    fs::rename(idx_tmp, idx_path);
+    return pack_path;
+}
+
+// Git's pack name hash: weighted towards the last characters of the file
+// name, so "foo.c" versions cluster and files with the same suffix sort near.
+static uint32_t pack_name_hash(std::string_view name) {
+    uint32_t hash = 0;
+    for (unsigned char c : name) {
+        if (std::isspace(c)) continue;
+        hash = (hash >> 2) + (uint32_t(c) << 24);
+    }
+    return hash;
+}
+
+// Objects this large are stored whole and never used as delta bases
+static constexpr uint64_t BIG_FILE_THRESHOLD = 512ull * 1024 * 1024;
+
+PackStats pack_objects(const GitRepository& repo, const std::vector<std::string>& shas,
+                       PackWriter& writer, const PackOptions& opts) {
+    struct Candidate {
+        std::string sha;
+        int type;
+        uint64_t size;
+        uint32_t name_hash;
+    };
+
+    // Pass 1: types and sizes, plus a name for every tree entry. Only trees
+    // are inflated; everything else is sized from its header.
+    std::vector<Candidate> objects;
+    std::unordered_map<ObjectId, uint32_t> names;
+    objects.reserve(shas.size());
+    for (const auto& sha : shas) {
+        std::string fmt;
+        uint64_t size = 0;
+        if (!object_read_header(repo, sha, fmt, size)) throw std::runtime_error("Failed to open object " + sha);
+        objects.push_back({sha, pack_type_from_fmt(fmt), size, 0});
+        if (fmt == "tree") {
+            std::string data = read_object_fmt_and_data(repo, sha).second;
+            for (const auto& entry : TreeView(data)) {
+                names.emplace(entry.id(), pack_name_hash(entry.path));
+            }
+        }
+    }
+    for (auto& obj : objects) {
+        auto it = names.find(ObjectId::from_hex(obj.sha));
+        if (it != names.end()) obj.name_hash = it->second;
+    }
+    std::sort(objects.begin(), objects.end(), [](const Candidate& a, const Candidate& b) {
+        if (a.type != b.type) return a.type < b.type;
+        if (a.name_hash != b.name_hash) return a.name_hash < b.name_hash;
+        if (a.size != b.size) return a.size > b.size;  // Bigger first: deltas that delete are smaller
+        return a.sha < b.sha;
+    });
+
+    // Pass 2: slide a window over the sorted list and keep the smallest delta
+    struct WindowEntry {
+        std::string sha;
+        int type;
+        unsigned depth;
+        std::string data;
+        std::unique_ptr<DeltaIndex> index;
+    };
+    std::deque<std::unique_ptr<WindowEntry>> window;
+    PackStats stats;
+    for (const auto& obj : objects) {
+        auto [fmt, data] = read_object_fmt_and_data(repo, obj.sha);
+        const WindowEntry* best_base = nullptr;
+        std::string best;
+        bool deltifiable = opts.window > 0 && data.size() > 64 && data.size() < BIG_FILE_THRESHOLD;
+        if (deltifiable) {
+            size_t max_size = data.size() / 2 - 20;
+            for (auto it = window.rbegin(); it != window.rend(); ++it) {
+                const WindowEntry& base = **it;
+                if (base.type != obj.type || base.depth >= opts.depth) continue;
+                if (data.size() < base.data.size() / 32) continue;
+                // Deeper bases must earn their place with a smaller delta
+                size_t limit = best.empty() ? max_size : best.size() - 1;
+                limit = limit * (opts.depth - base.depth) / opts.depth;
+                std::string delta = base.index->create(data, limit);
+                if (!delta.empty() && (best.empty() || delta.size() < best.size())) {
+                    best = std::move(delta);
+                    best_base = &base;
+                }
+            }
+        }
+
+        unsigned depth = 0;
+        if (best_base) {
+            writer.add_delta(obj.sha, best_base->sha, best, opts.ofs_delta);
+            depth = best_base->depth + 1;
+            ++stats.deltas;
+        } else {
+            writer.add(obj.sha, fmt, data);
+        }
+        ++stats.objects;
+
+        if (!deltifiable) continue;
+        if (!window.empty() && window.back()->type != obj.type) window.clear();
+        auto entry = std::make_unique<WindowEntry>(WindowEntry{obj.sha, obj.type, depth, std::move(data), nullptr});
+        entry->index = std::make_unique<DeltaIndex>(entry->data);
+        window.push_back(std::move(entry));
+        if (window.size() > opts.window) window.pop_front();
+    }
+    return stats;
+}
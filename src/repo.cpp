@@ -5,22 +5,117 @@
 #include <array>
 #include <stdexcept>
 #include <vector>
-#include <openssl/sha.h>
 #include <zlib.h>
 #include <iostream>
 #include <filesystem>
 #include <algorithm>  // Added
 #include <ctime>  // Added
-#include <set>  // Added for ignore set
+#include <set>
+#include <cerrno>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+#include <cstdlib>  // mkstemp
+#include <unistd.h>  // write, close, unlink
+#include <sys/stat.h>  // fchmod
+#include <fcntl.h>
+#include <dirent.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include "thread_pool.h"
+#include "index.h"
+#include "pack.h"
+#include "object_cache.h"
+#include "commit_graph.h"
+#include "sha1.h"
+#include "compression.h"
+#include "object_io.h"
+#include "loose_index.h"
+#include "tree_diff.h"
+#include "fsmonitor.h"
+#include "ignore.h"
+#include "bitmap.h"
+#include "fsck.h"
+#include "fast_import.h"
+#include "sparse.h"
+#include "uring.h"
+#include "archive.h"
 
 namespace fs = std::filesystem;
 
+// `gitlite -c key=value` settings, lowercased "section.key" to value; they
+// win over .git/config in every repository opened afterwards
+static std::map<std::string, std::string>& config_overrides() {
+    static std::map<std::string, std::string> overrides;
+    return overrides;
+}
+
+void config_override(const std::string& assignment) {
+    size_t eq = assignment.find('=');
+    size_t dot = assignment.find('.');
+    if (dot == 0 || dot == std::string::npos || (eq != std::string::npos && dot > eq)) {
+        throw std::runtime_error("Bad -c setting (want section.key=value): " + assignment);
+    }
+    std::string key = assignment.substr(0, eq);
+    std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return std::tolower(c); });
+    config_overrides()[key] = eq == std::string::npos ? "true" : assignment.substr(eq + 1);
+}
+
 // Constructor
 GitRepository::GitRepository(const fs::path& path, bool create) : worktree(path), gitdir(path / ".git") {
     if (!create && !fs::exists(gitdir)) {
         throw std::runtime_error("Not a Git repository: " + path.string());
     }
-    // Load config here if needed
+    // Load config: "[section]" headers and "key = value" lines
+    std::ifstream file(gitdir / "config");
+    std::string line, section;
+    auto trim = [](std::string str) {
+        size_t a = str.find_first_not_of(" \t\r");
+        size_t b = str.find_last_not_of(" \t\r");
+        return a == std::string::npos ? std::string() : str.substr(a, b - a + 1);
+    };
+    auto lower = [](std::string str) {
+        std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c) { return std::tolower(c); });
+        return str;
+    };
+    while (std::getline(file, line)) {
+        line = trim(line);
+        if (line.empty() || line[0] == '#' || line[0] == ';') continue;
+        if (line.front() == '[' && line.back() == ']') {
+            section = lower(trim(line.substr(1, line.size() - 2)));
+            continue;
+        }
+        size_t eq = line.find('=');
+        std::string key = lower(trim(line.substr(0, eq)));
+        std::string value = eq == std::string::npos ? "true" : trim(line.substr(eq + 1));
+        config[section + "." + key] = value;
+    }
+    for (const auto& kv : config_overrides()) config[kv.first] = kv.second;
+}
+
+std::string GitRepository::config_get(const std::string& key, const std::string& def) const {
+    auto it = config.find(key);
+    return it == config.end() ? def : it->second;
+}
+
+uint64_t GitRepository::config_get_size(const std::string& key, uint64_t def) const {
+    std::string value = config_get(key);
+    if (value.empty()) return def;
+    size_t pos = 0;
+    uint64_t n = std::stoull(value, &pos);
+    if (pos < value.size()) {
+        switch (std::tolower(static_cast<unsigned char>(value[pos]))) {
+            case 'k': n <<= 10; break;
+            case 'm': n <<= 20; break;
+            case 'g': n <<= 30; break;
+            default: throw std::runtime_error("Bad size for " + key + ": " + value);
+        }
+    }
+    return n;
 }
 
 // Create repo
@@ -96,51 +191,149 @@ fs::path repo_dir(const GitRepository& repo, const std::vector<std::string>& par
     return "";
 }
 
+// objects/xx/yyyy... built in one string rather than a chain of fs::path joins
+static std::string loose_object_path(const GitRepository& repo, const std::string& sha) {
+    const std::string& gitdir = repo.gitdir.native();
+    std::string path;
+    path.reserve(gitdir.size() + 10 + sha.size());
+    path.append(gitdir).append("/objects/").append(sha, 0, 2).append(1, '/').append(sha, 2, std::string::npos);
+    return path;
+}
+
 // Helper: Read full decompressed object and parse fmt and data
+// Packs are searched first (one mmap'd idx lookup each), then loose objects.
 std::pair<std::string, std::string> read_object_fmt_and_data(const GitRepository& repo, const std::string& sha) {
-    std::string sha_prefix = sha.substr(0, 2);
-    std::string sha_rest = sha.substr(2);
-    fs::path path = repo.gitdir / "objects" / sha_prefix / sha_rest;
-
-    std::ifstream file(path, std::ios::binary);
-    if (!file) throw std::runtime_error("Failed to open object");
+    std::string packed_fmt, packed_data;
+    if (pack_read_object(repo, sha, packed_fmt, packed_data)) return {std::move(packed_fmt), std::move(packed_data)};
 
-    std::vector<uint8_t> compressed((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-    file.close();
+    LooseFile file(loose_object_path(repo, sha));
+    if (!file.ok()) {
+        // A concurrent repack may have moved it into a pack we haven't mapped yet
+        pack_list(repo, true);
+        if (pack_read_object(repo, sha, packed_fmt, packed_data)) {
+            return {std::move(packed_fmt), std::move(packed_data)};
+        }
+        throw std::runtime_error("Failed to open object");
+    }
+    ArenaScope scratch;
+    return inflate_loose(file.contents(scratch), file.size());
+}
 
-    // Decompress with zlib
-    z_stream zs{};
-    zs.next_in = compressed.data();
-    zs.avail_in = compressed.size();
+bool object_read_header(const GitRepository& repo, const std::string& sha, std::string& fmt, uint64_t& size) {
+    if (pack_read_header(repo, sha, fmt, size)) return true;
 
-    std::vector<uint8_t> raw(4096);
-    std::string decompressed;
-    int ret = inflateInit(&zs);
-    if (ret != Z_OK) throw std::runtime_error("zlib inflateInit error");
+    if (sha.size() < 3) return false;
+    LooseFile file(loose_object_path(repo, sha));
+    if (!file.ok()) {
+        pack_list(repo, true);
+        return pack_read_header(repo, sha, fmt, size);
+    }
 
-    ret = Z_OK;
-    while (ret == Z_OK) {
-        zs.next_out = raw.data();
-        zs.avail_out = raw.size();
-        ret = inflate(&zs, Z_NO_FLUSH);
-        if (ret < 0) throw std::runtime_error("zlib inflate error");
-        decompressed.append(reinterpret_cast<char*>(raw.data()), raw.size() - zs.avail_out);
+    // "<type> <size>\0" is at most a few dozen bytes: inflate only until
+    // the NUL shows up, whatever the size of the object
+    InflateLease zs;
+    unsigned char in[512];
+    char head[64];
+    zs->next_out = reinterpret_cast<Bytef*>(head);
+    zs->avail_out = sizeof(head);
+    uint64_t offset = 0;
+    int ret = Z_OK;
+    while (ret == Z_OK && !std::memchr(head, '\0', sizeof(head) - zs->avail_out) && zs->avail_out > 0) {
+        if (zs->avail_in == 0) {
+            size_t n = file.read_at(in, sizeof(in), offset);
+            if (n == 0) break;
+            offset += n;
+            zs->next_in = in;
+            zs->avail_in = static_cast<uInt>(n);
+        }
+        ret = inflate(&*zs, Z_SYNC_FLUSH);
     }
-    inflateEnd(&zs);
-    if (ret != Z_STREAM_END) throw std::runtime_error("Decompression did not reach the end of stream");
+    std::string_view text(head, sizeof(head) - zs->avail_out);
+    size_t space_pos = text.find(' ');
+    size_t null_pos = text.find('\0');
+    if (space_pos == std::string_view::npos || null_pos == std::string_view::npos || null_pos < space_pos) {
+        throw std::runtime_error("Malformed object header");
+    }
+    fmt = std::string(text.substr(0, space_pos));
+    size = std::stoull(std::string(text.substr(space_pos + 1, null_pos - space_pos - 1)));
+    return true;
+}
 
-    // Parse header
-    size_t space_pos = decompressed.find(' ');
-    if (space_pos == std::string::npos) throw std::runtime_error("Malformed object header");
-    size_t null_pos = decompressed.find('\0', space_pos + 1);
-    if (null_pos == std::string::npos) throw std::runtime_error("Malformed object header");
-    std::string fmt = decompressed.substr(0, space_pos);
-    size_t size = std::stoi(decompressed.substr(space_pos + 1, null_pos - space_pos - 1));
-    std::string data = decompressed.substr(null_pos + 1);
+// Loose half of object_read_stream: inflate STREAM_CHUNK at a time, split
+// the header off the first output and pass everything after it on
+static bool loose_read_stream(const GitRepository& repo, const std::string& sha, const ObjectHeaderFn& on_header,
+                              const ObjectSink& sink) {
+    LooseFile file(loose_object_path(repo, sha));
+    if (!file.ok()) return false;
 
-    if (data.length() != size) throw std::runtime_error("Size mismatch");
+    ArenaScope scratch;
+    InflateLease zs;
+    // Small files come in with one pread; bigger ones STREAM_CHUNK at a time
+    size_t in_size = static_cast<size_t>(std::min<uint64_t>(file.size(), STREAM_CHUNK));
+    unsigned char* in = scratch.alloc(in_size ? in_size : 1);
+    char* out = scratch.alloc<char>(STREAM_CHUNK);
+    uint64_t offset = 0;
+    std::string header;
+    bool in_header = true;
+    int ret = Z_OK;
+    while (ret == Z_OK) {
+        if (zs->avail_in == 0) {
+            size_t got = file.read_at(in, in_size, offset);
+            if (got == 0) break;
+            offset += got;
+            zs->next_in = in;
+            zs->avail_in = static_cast<uInt>(got);
+        }
+        zs->next_out = reinterpret_cast<Bytef*>(out);
+        zs->avail_out = static_cast<uInt>(STREAM_CHUNK);
+        ret = inflate(&*zs, Z_NO_FLUSH);
+        if (ret < 0 && ret != Z_BUF_ERROR) throw std::runtime_error("zlib inflate error");
+        if (ret == Z_BUF_ERROR) ret = Z_OK;
+        const char* p = out;
+        size_t n = STREAM_CHUNK - zs->avail_out;
+        if (in_header) {
+            const char* nul = static_cast<const char*>(std::memchr(p, '\0', n));
+            header.append(p, nul ? nul - p : n);
+            if (!nul) {
+                if (header.size() > 64) throw std::runtime_error("Malformed object header");
+                continue;
+            }
+            size_t space_pos = header.find(' ');
+            if (space_pos == std::string::npos) throw std::runtime_error("Malformed object header");
+            on_header(header.substr(0, space_pos), std::stoull(header.substr(space_pos + 1)));
+            in_header = false;
+            n -= nul + 1 - p;
+            p = nul + 1;
+        }
+        if (n > 0) sink(p, n);
+    }
+    if (ret != Z_STREAM_END || in_header) throw std::runtime_error("Decompression did not reach the end of stream");
+    return true;
+}
 
-    return {fmt, data};
+void object_read_stream(const GitRepository& repo, const std::string& sha, const ObjectHeaderFn& on_header,
+                        const ObjectSink& sink) {
+    ObjectId expected = ObjectId::from_hex(sha);
+    Sha1 hash;
+    uint64_t declared = 0, seen = 0;
+    ObjectHeaderFn header = [&](const std::string& fmt, uint64_t size) {
+        std::string h = fmt + ' ' + std::to_string(size) + '\0';
+        hash.update(h.data(), h.size());
+        declared = size;
+        on_header(fmt, size);
+    };
+    ObjectSink payload = [&](const char* data, size_t len) {
+        seen += len;
+        if (seen > declared) throw std::runtime_error("Object " + sha + " is longer than its header says");
+        hash.update(data, len);
+        sink(data, len);
+    };
+    if (!pack_read_stream(repo, sha, header, payload) && !loose_read_stream(repo, sha, header, payload)) {
+        pack_list(repo, true);
+        if (!pack_read_stream(repo, sha, header, payload)) throw std::runtime_error("Failed to open object");
+    }
+    if (seen != declared) throw std::runtime_error("Size mismatch");
+    if (hash.finish() != expected) throw std::runtime_error("Object " + sha + " does not match its SHA-1");
 }
 
 // Object read: Return data without header
@@ -149,57 +342,383 @@ std::string object_read(const GitRepository& repo, const std::string& sha) {
     return data;
 }
 
+// List every loose object SHA under objects/xx/
+std::vector<std::string> loose_objects(const GitRepository& repo) {
+    std::vector<std::string> shas;
+    fs::path objects = repo.gitdir / "objects";
+    if (!fs::is_directory(objects)) return shas;
+    for (const auto& dir : fs::directory_iterator(objects)) {
+        std::string prefix = dir.path().filename().string();
+        if (prefix.size() != 2 || !std::isxdigit(static_cast<unsigned char>(prefix[0])) ||
+            !std::isxdigit(static_cast<unsigned char>(prefix[1])) || !dir.is_directory()) {
+            continue;
+        }
+        for (const auto& file : fs::directory_iterator(dir.path())) {
+            std::string rest = file.path().filename().string();
+            if (rest.size() == 38 && std::all_of(rest.begin(), rest.end(), ::isxdigit)) {
+                shas.push_back(prefix + rest);
+            }
+        }
+    }
+    std::sort(shas.begin(), shas.end());
+    return shas;
+}
+
+// core.fsyncObjects, read per writer like the compression policy
+enum class FsyncMode { NONE, OBJECT, BATCH };
+
+static FsyncMode fsync_mode(const GitRepository& repo) {
+    std::string value = repo.config_get("core.fsyncobjects");
+    std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return std::tolower(c); });
+    if (value == "object") return FsyncMode::OBJECT;
+    if (value == "batch") return FsyncMode::BATCH;
+    if (!value.empty() && value != "none") throw std::runtime_error("Bad core.fsyncObjects: " + value);
+    std::string legacy = repo.config_get("core.fsyncobjectfiles");
+    return legacy == "true" || legacy == "1" || legacy == "yes" ? FsyncMode::OBJECT : FsyncMode::NONE;
+}
+
+static void fsync_dir(const std::string& dir) {
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) throw std::runtime_error("Failed to open object directory for fsync: " + dir);
+    int rc = fsync(fd);
+    ::close(fd);
+    if (rc != 0) throw std::runtime_error("Failed to fsync object directory: " + dir);
+}
+
+bool object_exists(const GitRepository& repo, const std::string& sha) {
+    return pack_has_object(repo, sha) || ::access(loose_object_path(repo, sha).c_str(), F_OK) == 0;
+}
+
+// Move a finished temp object to its final name without ever replacing
+// what's there: link() fails with EEXIST if another writer got there
+// first, and since names are content hashes that's as good as success.
+// Filesystems without hard links fall back to rename(), which is atomic
+// and would only swap in identical content.
+static void publish_object(const std::string& tmp_path, const std::string& path) {
+    int rc = ::link(tmp_path.c_str(), path.c_str());
+    if (rc != 0 && errno == ENOENT) {
+        ::mkdir(path.substr(0, path.rfind('/')).c_str(), 0777);
+        rc = ::link(tmp_path.c_str(), path.c_str());
+    }
+    if (rc == 0 || errno == EEXIST) {
+        ::unlink(tmp_path.c_str());
+        return;
+    }
+    if (::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        ::unlink(tmp_path.c_str());
+        throw std::runtime_error("Failed to move object into place: " + path);
+    }
+}
+
+static std::atomic<ObjectWriteBatch*> active_batch{nullptr};
+
+ObjectWriteBatch::ObjectWriteBatch(const GitRepository& /*repo*/) {
+    ObjectWriteBatch* expected = nullptr;
+    // Nested batches just join the outer one
+    owner_ = active_batch.compare_exchange_strong(expected, this);
+}
+
+ObjectWriteBatch::~ObjectWriteBatch() {
+    if (!owner_) return;
+    active_batch = nullptr;
+    if (std::uncaught_exceptions() > 0) {
+        // Failed operation: nothing it wrote gets published
+        for (const auto& p : pending_) ::unlink(p.tmp_path.c_str());
+        return;
+    }
+    try {
+        commit();
+    } catch (const std::exception& e) {
+        std::cerr << "warning: " << e.what() << std::endl;
+    }
+}
+
+bool ObjectWriteBatch::add(const ObjectId& id, const std::string& tmp_path, const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!ids_.insert(id).second) return false;
+    pending_.push_back({tmp_path, path});
+    return true;
+}
+
+bool ObjectWriteBatch::contains(const ObjectId& id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ids_.count(id) > 0;
+}
+
+// Each temp file already had its write-back started when it was closed, so
+// fsyncing them here mostly waits on I/O that's in flight. Nothing is
+// linked into place unless every one of them made it to disk; after the
+// links, each objects/xx directory that gained an entry is fsynced once
+void ObjectWriteBatch::commit() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pending_.empty()) return;
+    for (const auto& p : pending_) {
+        int fd = ::open(p.tmp_path.c_str(), O_RDONLY | O_CLOEXEC);
+        bool ok = fd >= 0 && fsync(fd) == 0;
+        if (fd >= 0) ::close(fd);
+        if (!ok) {
+            for (const auto& q : pending_) ::unlink(q.tmp_path.c_str());
+            pending_.clear();
+            ids_.clear();
+            throw std::runtime_error("Failed to fsync temp object file: " + p.tmp_path);
+        }
+    }
+    std::set<std::string> dirs;
+    for (const auto& p : pending_) {
+        publish_object(p.tmp_path, p.path);
+        dirs.insert(p.path.substr(0, p.path.rfind('/')));
+    }
+    for (const auto& dir : dirs) fsync_dir(dir);
+    pending_.clear();
+    ids_.clear();
+}
+
+ObjectWriteBatch* ObjectWriteBatch::active() { return active_batch.load(); }
+
+// Incremental loose object writer: hashes and deflates "<fmt> <size>\0<payload>"
+// as the payload arrives, so callers never need the whole object in memory.
+// When the caller already knows the object's ID (batch-hashed blobs) it can
+// pass it in and hashing is skipped; an object that already exists is then
+// not compressed or written at all. The zlib level comes from the repo's
+// compression policy and is chosen once the first payload bytes are in.
+class LooseObjectWriter {
+public:
+    LooseObjectWriter(const std::string& fmt, uint64_t size, GitRepository* repo, const ObjectId* known = nullptr)
+        : repo_(repo), fmt_(fmt), expected_(size) {
+        if (known) {
+            known_ = *known;
+            have_known_ = true;
+        } else {
+            hash_ = std::make_unique<Sha1>();
+        }
+        header_ = fmt + " " + std::to_string(size) + '\0';
+        if (hash_) hash_->update(header_.data(), header_.size());
+        if (!repo_) return;
+        if (have_known_ && already_stored(known_)) {
+            skip_ = true;
+            return;
+        }
+        fsync_ = fsync_mode(*repo_);
+        fs::path objects = repo_->gitdir / "objects";
+        fs::create_directories(objects);
+        tmp_path_ = (objects / "tmp_obj_XXXXXX").string();
+        fd_ = mkstemp(tmp_path_.data());
+        io_count_open();
+        if (fd_ < 0) throw std::runtime_error("Failed to create temp object file in " + objects.string());
+        out_ = scratch_.alloc(STREAM_CHUNK);
+    }
+
+    ~LooseObjectWriter() {
+        if (fd_ >= 0) {
+            close(fd_);
+            unlink(tmp_path_.c_str());
+        }
+    }
+
+    LooseObjectWriter(const LooseObjectWriter&) = delete;
+    LooseObjectWriter& operator=(const LooseObjectWriter&) = delete;
+
+    void update(const char* data, size_t len) {
+        if (written_ + len > expected_) throw std::runtime_error("Object payload larger than declared size");
+        feed(data, len);
+    }
+
+    // Finalize hash and, if a repo was given, move the object into place. Returns hex SHA.
+    std::string finish() {
+        if (written_ != expected_) throw std::runtime_error("Object payload shorter than declared size");
+        ObjectId id = have_known_ ? known_ : hash_->finish();
+        std::string sha = id.hex();
+        if (!repo_ || skip_) return sha;
+
+        if (!zs_) start_deflate(nullptr, 0);
+        deflate_chunk(nullptr, 0, Z_FINISH);
+        compression_record(header_.size() + expected_, stored_, incompressible_);
+        fchmod(fd_, 0444);  // Objects are immutable
+        ObjectWriteBatch* batch = fsync_ == FsyncMode::BATCH ? ObjectWriteBatch::active() : nullptr;
+        if (batch) {
+            // Start writeback now; the batch waits for all of it at once
+            sync_file_range(fd_, 0, 0, SYNC_FILE_RANGE_WRITE);
+        } else if (fsync_ != FsyncMode::NONE && fsync(fd_) != 0) {
+            throw std::runtime_error("Failed to fsync temp object file");
+        }
+        if (close(fd_) != 0) {
+            fd_ = -1;
+            unlink(tmp_path_.c_str());
+            throw std::runtime_error("Failed to close temp object file");
+        }
+        fd_ = -1;
+
+        // Someone else may have stored it while we were compressing
+        std::string path = loose_object_path(*repo_, sha);
+        if (already_stored(id)) {
+            unlink(tmp_path_.c_str());
+            return sha;
+        }
+        if (batch) {
+            // Published when the batch commits; a racing thread may have
+            // queued the same object a moment ago
+            if (!batch->add(id, tmp_path_, path)) unlink(tmp_path_.c_str());
+            return sha;
+        }
+        publish_object(tmp_path_, path);
+        if (fsync_ != FsyncMode::NONE) fsync_dir(path.substr(0, path.rfind('/')));
+        return sha;
+    }
+
+private:
+    bool already_stored(const ObjectId& id) {
+        ObjectWriteBatch* batch = ObjectWriteBatch::active();
+        if ((batch && batch->contains(id)) || object_exists(*repo_, id.hex())) {
+            io_count_existing();
+            return true;
+        }
+        return false;
+    }
+
+    void feed(const char* data, size_t len) {
+        if (hash_) hash_->update(data, len);
+        if (repo_ && !skip_) {
+            if (!zs_) start_deflate(data, len);
+            deflate_chunk(data, len, Z_NO_FLUSH);
+        }
+        written_ += len;
+    }
+
+    // Pick the level from the start of the payload, then emit the header
+    void start_deflate(const char* sample, size_t len) {
+        CompressionPolicy policy = CompressionPolicy::from_config(*repo_, CompressionPolicy::LOOSE);
+        int level = policy.level(fmt_, sample, len);
+        incompressible_ = level == Z_NO_COMPRESSION && policy.level(fmt_) != Z_NO_COMPRESSION;
+        zs_.emplace(level);
+        deflate_chunk(header_.data(), header_.size(), Z_NO_FLUSH);
+    }
+
+    // Compressed output collects in out_ and is written once it's full or
+    // the object is finished, so a small object costs one write()
+    void deflate_chunk(const char* data, size_t len, int flush) {
+        z_stream& zs = **zs_;
+        zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        zs.avail_in = static_cast<uInt>(len);
+        int ret;
+        do {
+            zs.next_out = out_ + out_used_;
+            zs.avail_out = static_cast<uInt>(STREAM_CHUNK - out_used_);
+            ret = deflate(&zs, flush);
+            if (ret == Z_STREAM_ERROR) throw std::runtime_error("zlib deflate error");
+            out_used_ = STREAM_CHUNK - zs.avail_out;
+            if (out_used_ == STREAM_CHUNK || flush == Z_FINISH) {
+                write_all(out_, out_used_);
+                stored_ += out_used_;
+                out_used_ = 0;
+            }
+        } while (zs.avail_out == 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+    }
+
+    void write_all(const uint8_t* data, size_t len) {
+        while (len > 0) {
+            ssize_t n = ::write(fd_, data, len);
+            io_count_write();
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error("Failed to write temp object file");
+            }
+            data += n;
+            len -= static_cast<size_t>(n);
+        }
+    }
+
+    GitRepository* repo_;
+    std::string fmt_;
+    std::string header_;
+    uint64_t expected_;
+    uint64_t written_ = 0;
+    uint64_t stored_ = 0;
+    bool incompressible_ = false;
+    std::unique_ptr<Sha1> hash_;
+    ObjectId known_;
+    bool have_known_ = false;
+    std::optional<DeflateLease> zs_;
+    bool skip_ = false;
+    FsyncMode fsync_ = FsyncMode::NONE;
+    int fd_ = -1;
+    std::string tmp_path_;
+    ArenaScope scratch_;
+    uint8_t* out_ = nullptr;
+    size_t out_used_ = 0;
+};
+
 // Object write: Serialize, compress, hash, store
+// The ID is computed up front so an object that's already stored costs
+// one hash and one lookup, with no compression or file writes.
 std::string object_write(GitObject* obj, GitRepository* repo) {
     std::string data = obj->serialize();
-    std::string result = obj->fmt + " " + std::to_string(data.length()) + '\0' + data;
-    // SHA1 hash
-    unsigned char hash[SHA_DIGEST_LENGTH];
-    SHA1(reinterpret_cast<const unsigned char*>(result.c_str()), result.length(), hash);
-    std::ostringstream sha_ss;
-    sha_ss << std::hex << std::setfill('0');
-    for (int i = 0; i < SHA_DIGEST_LENGTH; ++i) {
-        sha_ss << std::setw(2) << static_cast<unsigned>(hash[i]);
+    std::string header = obj->fmt + " " + std::to_string(data.size()) + '\0';
+    Sha1 hash;
+    hash.update(header.data(), header.size());
+    hash.update(data.data(), data.size());
+    ObjectId id = hash.finish();
+    LooseObjectWriter writer(obj->fmt, data.length(), repo, &id);
+    writer.update(data.data(), data.length());
+    return writer.finish();
+}
+
+// Object hash: From a stream of known size, in fixed-size chunks
+std::string object_hash_stream(std::istream& fd, uint64_t size, const std::string& fmt, GitRepository* repo) {
+    LooseObjectWriter writer(fmt, size, repo);
+    std::vector<char> buf(STREAM_CHUNK);
+    uint64_t remaining = size;
+    while (remaining > 0) {
+        size_t want = static_cast<size_t>(std::min<uint64_t>(remaining, buf.size()));
+        fd.read(buf.data(), want);
+        size_t got = static_cast<size_t>(fd.gcount());
+        if (got == 0) throw std::runtime_error("Input ended before declared size (file changed while hashing?)");
+        writer.update(buf.data(), got);
+        remaining -= got;
     }
-    std::string sha = sha_ss.str();
+    if (fd.peek() != std::char_traits<char>::eof()) {
+        throw std::runtime_error("Input longer than declared size (file changed while hashing?)");
+    }
+    return writer.finish();
+}
 
+// Object hash: From file, streamed with constant memory
+// Seekable input of known size. When writing, it's hashed first and only
+// compressed if the object is new; the second pass hashes again, so input
+// that changed in between is still stored under its real ID.
+static std::string object_hash_seekable(std::istream& fd, uint64_t size, const std::string& fmt,
+                                        GitRepository* repo) {
     if (repo) {
-        // Compress
-        z_stream zs{};
-        zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(result.c_str()));
-        zs.avail_in = result.length();
-
-        std::vector<uint8_t> compressed(4096);
-        std::string out_str;
-        int ret = deflateInit(&zs, Z_BEST_COMPRESSION);
-        if (ret != Z_OK) throw std::runtime_error("zlib deflateInit error");
-
-        ret = Z_OK;
-        while (ret == Z_OK) {
-            zs.next_out = compressed.data();
-            zs.avail_out = compressed.size();
-            ret = deflate(&zs, Z_FINISH);
-            if (ret < 0) throw std::runtime_error("zlib deflate error");
-            out_str.append(reinterpret_cast<char*>(compressed.data()), compressed.size() - zs.avail_out);
-        }
-        deflateEnd(&zs);
-        if (ret != Z_STREAM_END) throw std::runtime_error("Compression did not reach the end of stream");
-
-        // Write to objects/<prefix>/<rest>
-        std::string prefix = sha.substr(0, 2);
-        std::string rest = sha.substr(2);
-        fs::path path = repo->gitdir / "objects" / prefix / rest;
-        fs::create_directories(path.parent_path());
-        std::ofstream file(path, std::ios::binary);
-        file.write(out_str.c_str(), out_str.length());
-        file.close();
+        std::streampos start = fd.tellg();
+        std::string sha = object_hash_stream(fd, size, fmt, nullptr);
+        if (object_exists(*repo, sha)) {
+            io_count_existing();
+            return sha;
+        }
+        fd.clear();
+        fd.seekg(start);
     }
+    return object_hash_stream(fd, size, fmt, repo);
+}
 
-    return sha;
+// Object hash: From file, streamed with constant memory
+std::string object_hash_file(const fs::path& path, const std::string& fmt, GitRepository* repo) {
+    std::ifstream fd(path, std::ios::binary);
+    if (!fd) throw std::runtime_error("Failed to open file: " + path.string());
+    return object_hash_seekable(fd, fs::file_size(path), fmt, repo);
 }
 
-// Object hash: From stream
+// Object hash: From stream. Seekable streams are measured and streamed;
+// anything else (pipes) has to be buffered to learn the size for the header.
 std::string object_hash(std::istream& fd, const std::string& fmt, GitRepository* repo) {
+    std::streampos start = fd.tellg();
+    if (start != std::streampos(-1) && fd.seekg(0, std::ios::end)) {
+        std::streampos end = fd.tellg();
+        fd.seekg(start);
+        if (end != std::streampos(-1) && fd) {
+            return object_hash_seekable(fd, static_cast<uint64_t>(end - start), fmt, repo);
+        }
+    }
+    fd.clear();
     std::string data((std::istreambuf_iterator<char>(fd)), std::istreambuf_iterator<char>());
     GitBlob obj;  // Assuming blob for now
     obj.fmt = fmt;
@@ -207,8 +726,49 @@ std::string object_hash(std::istream& fd, const std::string& fmt, GitRepository*
     return object_write(&obj, repo);
 }
 
+// Shortest hex name taken as an abbreviated SHA
+static constexpr size_t MIN_ABBREV = 4;
+
+// Abbreviated names: the sorted pack idx files and the loose object prefix
+// index (loose_index.h) each give every candidate with a binary search.
+// When several objects share the prefix and the caller wants a particular
+// type, only objects of that type count.
+static std::string object_resolve_abbrev(const GitRepository& repo, const std::string& name, const std::string& fmt) {
+    std::string prefix = name;
+    for (char& c : prefix) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    std::string padded = prefix + std::string(40 - prefix.size(), '0');
+    ObjectId lower = ObjectId::from_hex(padded);
+
+    // A handful of candidates is enough to report an ambiguous name
+    constexpr size_t LIMIT = 16;
+    std::vector<ObjectId> found;
+    for (const auto& pack : pack_list(repo)) pack->find_prefix(lower, prefix, found, LIMIT);
+    loose_find_prefix(repo, prefix, found, LIMIT);
+    std::sort(found.begin(), found.end());
+    found.erase(std::unique(found.begin(), found.end()), found.end());
+
+    if (found.size() > 1 && !fmt.empty()) {
+        std::vector<ObjectId> typed;
+        for (const ObjectId& id : found) {
+            std::string obj_fmt;
+            uint64_t size;
+            if (object_read_header(repo, id.hex(), obj_fmt, size) && obj_fmt == fmt) typed.push_back(id);
+        }
+        if (!typed.empty()) found.swap(typed);
+    }
+    if (found.empty()) throw std::runtime_error("Not a valid object name " + name);
+    if (found.size() > 1) {
+        std::string msg = "short SHA " + name + " is ambiguous; candidates:";
+        for (const ObjectId& id : found) msg += "\n  " + id.hex();
+        throw AmbiguousObjectName(msg);
+    }
+    return found[0].hex();
+}
+
 // Improved object_find: resolve refs and HEAD
 std::string object_find(const GitRepository& repo, const std::string& name, const std::string& fmt, bool follow) {
+    // gitdir / "" is gitdir itself, which would look like a ref
+    if (name.empty()) throw std::runtime_error("Empty object name");
     if (name == "HEAD") {
         std::ifstream head_file(repo.gitdir / "HEAD");
         if (!head_file) throw std::runtime_error("No HEAD");
@@ -234,60 +794,845 @@ std::string object_find(const GitRepository& repo, const std::string& name, cons
         }
     }
 
-    // Assume full SHA for now (short SHA support can be added later)
-    // TODO: Validate if object exists and matches fmt
-    return name;
+    if (name.size() < MIN_ABBREV || name.size() >= 40 ||
+        !std::all_of(name.begin(), name.end(), [](unsigned char c) { return std::isxdigit(c); })) {
+        return name;
+    }
+    return object_resolve_abbrev(repo, name, fmt);
 }
 
-// New: Recursive write_tree
-std::string write_tree(const GitRepository& repo, const fs::path& dir) {
-    std::set<std::string> ignore = {"gitlite", "test.sh", "CMakeLists.txt", "Makefile", "cmake_install.cmake", "CMakeCache.txt", "compile_commands.json", "include", "src", "CMakeFiles", "repomix-output.xml"};
+// Per-directory state for write_tree. A directory's tree object is written
+// as soon as the last of its children reports its SHA, so trees are built
+// bottom-up while blob hashing is still running elsewhere in the pool.
+struct TreeBuildNode {
+    TreeBuildNode* parent = nullptr;
+    size_t parent_slot = 0;
+    std::string rel;                   // Path relative to the worktree, "" for the root
     std::vector<GitTreeLeaf> entries;
+    uint32_t subdirs = 0;
+    std::atomic<size_t> pending{0};
+    std::atomic<bool> clean{true};     // Every child unchanged since the cached tree
+    std::atomic<int32_t> files{0};     // Files anywhere below this directory
+    std::string sha;
+};
+
+struct TreeBuildContext {
+    GitRepository* repo;
+    ThreadPool* pool;
+    const GitIndex* old_index;  // Stat cache from the last run, null if unused
+    GitIndex new_index;         // Guarded by mu
+    std::vector<std::unique_ptr<TreeBuildNode>> nodes;  // Owned here, guarded by mu
+    std::mutex mu;
+    // Paths changed since old_index was written, null to look at everything
+    const FsMonitorResult* monitor = nullptr;
+
+    TreeBuildNode* new_node(TreeBuildNode* parent, size_t slot, const std::string& rel) {
+        auto node = std::make_unique<TreeBuildNode>();
+        node->parent = parent;
+        node->parent_slot = slot;
+        node->rel = rel;
+        std::lock_guard<std::mutex> lk(mu);
+        nodes.push_back(std::move(node));
+        return nodes.back().get();
+    }
+};
+
+static void write_tree_complete(TreeBuildContext& ctx, TreeBuildNode* node, size_t slot,
+                                const std::string& sha, bool clean, int32_t files);
+
+// All children known: reuse the cached tree if nothing below changed,
+// otherwise sort and write the tree, then report upwards
+static void write_tree_finalize(TreeBuildContext& ctx, TreeBuildNode* node) {
+    const CacheTreeEntry* cached = nullptr;
+    if (ctx.old_index) {
+        auto it = ctx.old_index->trees.find(node->rel);
+        if (it != ctx.old_index->trees.end() && it->second.entry_count >= 0) cached = &it->second;
+    }
+    std::string sha;
+    if (cached && node->clean && cached->entry_count == node->files && cached->subtree_count == node->subdirs) {
+        sha = cached->sha;
+    } else {
+        // Sort entries in Git's tree order (a directory sorts as "name/")
+        std::sort(node->entries.begin(), node->entries.end(), [](const GitTreeLeaf& a, const GitTreeLeaf& b) {
+            return tree_order(a, b) < 0;
+        });
+        GitTree tree_obj;
+        tree_obj.items = std::move(node->entries);
+        sha = object_write(&tree_obj, ctx.repo);
+    }
+    if (ctx.old_index) {
+        std::lock_guard<std::mutex> lk(ctx.mu);
+        ctx.new_index.trees[node->rel] = {node->files, node->subdirs, sha};
+    }
+    if (node->parent) {
+        write_tree_complete(ctx, node->parent, node->parent_slot, sha, cached && cached->sha == sha, node->files);
+    } else {
+        node->sha = sha;
+    }
+}
+
+static void write_tree_complete(TreeBuildContext& ctx, TreeBuildNode* node, size_t slot,
+                                const std::string& sha, bool clean, int32_t files) {
+    node->entries[slot].sha = sha;
+    if (!clean) node->clean = false;
+    node->files += files;
+    if (node->pending.fetch_sub(1) == 1) write_tree_finalize(ctx, node);
+}
+
+// Hash one file, reusing the indexed SHA when its stat data is unchanged
+// Files at most this big are read whole and hashed BLOB_BATCH at a time, so
+// the multi-buffer SHA-1 backend can run them side by side
+static constexpr uint64_t SMALL_BLOB = 16 * 1024;
+static constexpr size_t BLOB_BATCH = 8;
+
+struct PendingBlob {
+    size_t slot;
+    fs::path path;
+    std::string rel;
+    struct stat st;
+    const IndexEntry* cached;
+};
+
+static void write_tree_blob_done(TreeBuildContext& ctx, TreeBuildNode* node, const PendingBlob& blob,
+                                 const std::string& sha) {
+    if (ctx.old_index) {
+        std::lock_guard<std::mutex> lk(ctx.mu);
+        ctx.new_index.entries.push_back(IndexEntry::from_stat(blob.rel, blob.st, sha));
+    }
+    write_tree_complete(ctx, node, blob.slot, sha, blob.cached && blob.cached->sha == sha, 1);
+}
+
+static void write_tree_hash_batch(TreeBuildContext& ctx, TreeBuildNode* node, const std::vector<PendingBlob>& batch) {
+    std::vector<std::string> objects(batch.size());
+    std::vector<size_t> header_len(batch.size());
+    std::vector<Sha1Message> messages(batch.size());
+    for (size_t i = 0; i < batch.size(); ++i) {
+        std::ifstream in(batch[i].path, std::ios::binary);
+        if (!in) throw std::runtime_error("Failed to open file: " + batch[i].path.string());
+        std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        objects[i] = "blob " + std::to_string(content.size()) + '\0';
+        header_len[i] = objects[i].size();
+        objects[i] += content;
+        messages[i] = {objects[i].data(), objects[i].size()};
+    }
+    std::vector<ObjectId> ids(batch.size());
+    sha1_many(messages.data(), messages.size(), ids.data());
+    for (size_t i = 0; i < batch.size(); ++i) {
+        LooseObjectWriter writer("blob", objects[i].size() - header_len[i], ctx.repo, &ids[i]);
+        writer.update(objects[i].data() + header_len[i], objects[i].size() - header_len[i]);
+        write_tree_blob_done(ctx, node, batch[i], writer.finish());
+    }
+}
+
+// Reuse the index entry when the file's stat data is unchanged. Otherwise
+// small files join `batch` (flushed by the caller) and large ones are
+// streamed on their own task.
+// `unchanged` means the fsmonitor vouches for the file and `st` was never filled in.
+static void write_tree_file(TreeBuildContext& ctx, TreeBuildNode* node, size_t slot, const fs::path& path,
+                            const std::string& rel, const struct stat& st, bool unchanged,
+                            std::vector<PendingBlob>& batch) {
+    const IndexEntry* cached = ctx.old_index ? ctx.old_index->find(rel) : nullptr;
+    if (cached && (unchanged || (cached->stat_matches(st) && !ctx.old_index->is_racy(*cached)))) {
+        {
+            std::lock_guard<std::mutex> lk(ctx.mu);
+            ctx.new_index.entries.push_back(*cached);
+        }
+        write_tree_complete(ctx, node, slot, cached->sha, true, 1);
+        return;
+    }
+    PendingBlob blob{slot, path, rel, st, cached};
+    if (static_cast<uint64_t>(st.st_size) <= SMALL_BLOB) {
+        batch.push_back(std::move(blob));
+        if (batch.size() == BLOB_BATCH) {
+            ctx.pool->submit([&ctx, node, b = std::move(batch)] { write_tree_hash_batch(ctx, node, b); });
+            batch.clear();
+        }
+        return;
+    }
+    ctx.pool->submit([&ctx, node, blob = std::move(blob)] {
+        write_tree_blob_done(ctx, node, blob, object_hash_file(blob.path, "blob", ctx.repo));
+    });
+}
+
+// Index entries for everything below directory `rel` (sorted by path)
+static std::pair<size_t, size_t> index_range(const GitIndex& index, const std::string& rel) {
+    std::string prefix = rel + "/";
+    auto by_path = [](const IndexEntry& e, const std::string& p) { return e.path < p; };
+    auto first = std::lower_bound(index.entries.begin(), index.entries.end(), prefix, by_path);
+    auto last = first;
+    while (last != index.entries.end() && last->path.compare(0, prefix.size(), prefix) == 0) ++last;
+    return {size_t(first - index.entries.begin()), size_t(last - index.entries.begin())};
+}
+
+// A directory the fsmonitor saw no changes in: take its tree, and the
+// index entries and cached trees below it, from the old index unread.
+// False if there's no valid cached tree to take.
+static bool write_tree_reuse_dir(TreeBuildContext& ctx, TreeBuildNode* node, size_t slot, const std::string& rel) {
+    auto it = ctx.old_index->trees.find(rel);
+    if (it == ctx.old_index->trees.end() || it->second.entry_count < 0) return false;
+    auto [first, last] = index_range(*ctx.old_index, rel);
+    if (last - first != size_t(it->second.entry_count)) return false;
+    {
+        std::lock_guard<std::mutex> lk(ctx.mu);
+        ctx.new_index.entries.insert(ctx.new_index.entries.end(), ctx.old_index->entries.begin() + first,
+                                     ctx.old_index->entries.begin() + last);
+        ctx.new_index.trees.insert(*it);
+        std::string prefix = rel + "/";
+        for (auto t = ctx.old_index->trees.lower_bound(prefix);
+             t != ctx.old_index->trees.end() && t->first.compare(0, prefix.size(), prefix) == 0; ++t) {
+            ctx.new_index.trees.insert(*t);
+        }
+    }
+    fsmonitor_count_skipped(true);
+    write_tree_complete(ctx, node, slot, it->second.sha, true, it->second.entry_count);
+    return true;
+}
+
+static void write_tree_scan(TreeBuildContext& ctx, TreeBuildNode* node, const fs::path& dir,
+                            const std::shared_ptr<const IgnoreScope>& ignore) {
+    std::vector<fs::path> paths;
+    std::vector<struct stat> stats;
+    std::vector<char> unchanged;  // Per entry: the fsmonitor saw no change, so it wasn't stat()ed
     for (const auto& entry : fs::directory_iterator(dir)) {
         std::string filename = entry.path().filename().string();
-        if (filename[0] == '.') continue;
-        if (ignore.count(filename)) continue;  // Ignore build files and subdirs
-        if (entry.is_directory()) {
-            std::string sub_tree_sha = write_tree(repo, entry.path());
-            entries.push_back({040000, filename, sub_tree_sha});
-        } else if (entry.is_regular_file()) {
-            std::ifstream fd(entry.path(), std::ios::binary);
-            if (!fd) throw std::runtime_error("Failed to open file: " + entry.path().string());
-            std::string blob_sha = object_hash(fd, "blob", const_cast<GitRepository*>(&repo));
-            entries.push_back({0100644, filename, blob_sha});
-        }
-    }
-
-    // Sort entries by path
-    std::sort(entries.begin(), entries.end(), [](const GitTreeLeaf& a, const GitTreeLeaf& b) {
-        return a.path < b.path;
-    });
+        std::string rel = node->rel.empty() ? filename : node->rel + "/" + filename;
+        // The type comes from readdir; symlinks are stat()ed to find out
+        // what they point to
+        std::error_code ec;
+        fs::file_type type = entry.symlink_status(ec).type();
+        struct stat st {};
+        bool have_stat = false;
+        if (type != fs::file_type::directory && type != fs::file_type::regular) {
+            if (::stat(entry.path().c_str(), &st) != 0) continue;  // Vanished meanwhile
+            have_stat = true;
+        }
+        bool is_dir = have_stat ? S_ISDIR(st.st_mode) : type == fs::file_type::directory;
+        if (ignore->ignored(rel, filename, is_dir)) continue;  // Not opened or hashed
+        bool same = false;
+        if (ctx.monitor && !have_stat) {
+            // Symlinks are always looked at, as the daemon doesn't watch
+            // what they point to
+            if (is_dir) {
+                same = !ctx.monitor->dir_changed(rel);
+                st.st_mode = S_IFDIR;
+            } else {
+                same = !ctx.monitor->changed(rel) && ctx.old_index->find(rel);
+                st.st_mode = S_IFREG;
+            }
+        }
+        if (!same && !have_stat && ::stat(entry.path().c_str(), &st) != 0) continue;
+        if (S_ISDIR(st.st_mode)) {
+            node->entries.push_back({040000, filename, ""});
+            ++node->subdirs;
+        } else if (S_ISREG(st.st_mode)) {
+            node->entries.push_back({0100644, filename, ""});
+        } else {
+            continue;
+        }
+        paths.push_back(entry.path());
+        stats.push_back(st);
+        unchanged.push_back(same);
+    }
 
-    GitTree tree_obj;
-    tree_obj.items = entries;
-    return object_write(&tree_obj, const_cast<GitRepository*>(&repo));
+    // Entries are fixed from here on; tasks fill in their own slot only
+    node->pending = node->entries.size();
+    if (node->entries.empty()) {
+        write_tree_finalize(ctx, node);
+        return;
+    }
+    std::vector<PendingBlob> batch;
+    for (size_t slot = 0; slot < paths.size(); ++slot) {
+        const GitTreeLeaf& leaf = node->entries[slot];
+        std::string rel = node->rel.empty() ? leaf.path : node->rel + "/" + leaf.path;
+        if (leaf.mode == 040000) {
+            if (unchanged[slot] && write_tree_reuse_dir(ctx, node, slot, rel)) continue;
+            TreeBuildNode* child = ctx.new_node(node, slot, rel);
+            ctx.pool->submit([&ctx, child, path = paths[slot], ignore] {
+                write_tree_scan(ctx, child, path, ignore->child(path, child->rel));
+            });
+        } else {
+            if (unchanged[slot]) fsmonitor_count_skipped(false);
+            write_tree_file(ctx, node, slot, paths[slot], rel, stats[slot], unchanged[slot], batch);
+        }
+    }
+    if (!batch.empty()) {
+        ctx.pool->submit([&ctx, node, b = std::move(batch)] { write_tree_hash_batch(ctx, node, b); });
+    }
 }
 
-// New: Recursive read_tree for checkout
+// Snapshot a directory as a tree object. Blobs are hashed and compressed on a
+// work-stealing pool of `jobs` threads (0 = one per core, 1 = serial). The
+// resulting SHA does not depend on the thread count.
+//
+// When snapshotting the whole worktree, .git/index acts as a stat cache:
+// files whose stat data is unchanged reuse their recorded blob SHA, and
+// directories with nothing changed below them reuse their cached tree SHA.
+std::string write_tree(const GitRepository& repo, const fs::path& dir, unsigned jobs) {
+    if (jobs == 0) jobs = ThreadPool::default_threads();
+    bool use_index = fs::equivalent(dir, repo.worktree);
+    GitIndex old_index = use_index ? GitIndex::read(repo) : GitIndex();
+    // Asked before the scan, so anything changing during it is in the next answer
+    std::unique_ptr<FsMonitorResult> monitor = use_index ? fsmonitor_query(repo, old_index.fsmonitor_token) : nullptr;
+
+    ObjectWriteBatch batch(repo);
+    ThreadPool pool(jobs);
+    TreeBuildContext ctx{const_cast<GitRepository*>(&repo), &pool, use_index ? &old_index : nullptr, {}, {}, {}};
+    if (monitor && !monitor->everything) ctx.monitor = monitor.get();
+    TreeBuildNode* root = ctx.new_node(nullptr, 0, "");
+    pool.submit([&ctx, root, dir, &repo] { write_tree_scan(ctx, root, dir, IgnoreScope::root(repo, dir)); });
+    pool.wait();
+    batch.commit();
+
+    if (use_index) {
+        if (monitor) ctx.new_index.fsmonitor_token = monitor->token;
+        ctx.new_index.sort();
+        ctx.new_index.write(repo);  // Best effort: a concurrent writer holding the lock wins
+    }
+    return root->sha;
+}
+
+// status: the worktree against the index the last write-tree left. One
+// task per directory on the pool, stat()ing entries by the same rules as
+// write-tree; files whose stat data moved are rehashed, so a touch alone
+// isn't a change.
+struct StatusContext {
+    const GitRepository& repo;
+    ThreadPool& pool;
+    const GitIndex& index;
+    const FsMonitorResult* monitor;    // Null to look at everything
+    std::vector<char> seen;            // Per index entry; each is set by one task only
+    std::mutex mu;
+    std::vector<std::pair<std::string, char>> changes;  // Guarded by mu
+};
+
+static void status_change(StatusContext& ctx, const std::string& path, char status) {
+    std::lock_guard<std::mutex> lk(ctx.mu);
+    ctx.changes.push_back({path, status});
+}
+
+static void status_file(StatusContext& ctx, const std::string& path, const struct stat& st) {
+    const IndexEntry* cached = ctx.index.find(path);
+    if (!cached) {
+        status_change(ctx, path, 'A');
+        return;
+    }
+    ctx.seen[cached - ctx.index.entries.data()] = 1;
+    if (cached->stat_matches(st) && !ctx.index.is_racy(*cached)) return;
+    if (object_hash_file(ctx.repo.worktree / path, "blob") != cached->sha) status_change(ctx, path, 'M');
+}
+
+static void status_scan(StatusContext& ctx, const std::string& rel, std::shared_ptr<const IgnoreScope> ignore) {
+    fs::path dir = rel.empty() ? ctx.repo.worktree : ctx.repo.worktree / rel;
+    if (!ignore) ignore = IgnoreScope::root(ctx.repo, dir);
+    int dfd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd < 0) return;  // Vanished meanwhile
+    DIR* d = fdopendir(dfd);
+    if (!d) {
+        ::close(dfd);
+        return;
+    }
+    while (struct dirent* e = readdir(d)) {
+        std::string name = e->d_name;
+        if (name == "." || name == "..") continue;
+        std::string path = rel.empty() ? name : rel + "/" + name;
+        struct stat st;
+        bool have_stat = false;
+        if (e->d_type != DT_DIR && e->d_type != DT_REG) {
+            // Symlinks and unknown types: what's really there decides
+            if (::fstatat(dfd, e->d_name, &st, 0) != 0) continue;
+            have_stat = true;
+        }
+        if (ignore->ignored(path, name, have_stat ? S_ISDIR(st.st_mode) : e->d_type == DT_DIR)) continue;
+        if (ctx.monitor && !have_stat) {
+            // Trust the daemon for anything it saw no change in; symlinks
+            // and unknown types are always looked at
+            if (e->d_type == DT_DIR && !ctx.monitor->dir_changed(path)) {
+                auto [first, last] = index_range(ctx.index, path);
+                std::fill(ctx.seen.begin() + first, ctx.seen.begin() + last, 1);
+                fsmonitor_count_skipped(true);
+                continue;
+            }
+            const IndexEntry* cached = e->d_type == DT_REG && !ctx.monitor->changed(path) ? ctx.index.find(path) : nullptr;
+            if (cached) {
+                ctx.seen[cached - ctx.index.entries.data()] = 1;
+                fsmonitor_count_skipped(false);
+                continue;
+            }
+        }
+        if (!have_stat && ::fstatat(dfd, e->d_name, &st, 0) != 0) continue;
+        if (S_ISDIR(st.st_mode)) {
+            ctx.pool.submit([&ctx, path, ignore, full = dir / name] {
+                status_scan(ctx, path, ignore->child(full, path));
+            });
+        } else if (S_ISREG(st.st_mode)) {
+            status_file(ctx, path, st);
+        }
+    }
+    closedir(d);
+}
+
+// Sorted (path, status) pairs: 'A' new, 'M' modified, 'D' deleted
+static std::vector<std::pair<std::string, char>> worktree_status(const GitRepository& repo, unsigned jobs) {
+    GitIndex index = GitIndex::read(repo);
+    std::unique_ptr<FsMonitorResult> monitor = fsmonitor_query(repo, index.fsmonitor_token);
+    ThreadPool pool(jobs);
+    StatusContext ctx{repo, pool, index, monitor && !monitor->everything ? monitor.get() : nullptr,
+                      std::vector<char>(index.entries.size()), {}, {}};
+    pool.submit([&ctx] { status_scan(ctx, "", nullptr); });
+    pool.wait();
+    for (size_t i = 0; i < index.entries.size(); ++i) {
+        if (!ctx.seen[i]) ctx.changes.push_back({index.entries[i].path, 'D'});
+    }
+    std::sort(ctx.changes.begin(), ctx.changes.end());
+    return std::move(ctx.changes);
+}
+
+// Write one blob to the worktree
+static void checkout_blob(const GitRepository& repo, const std::string& sha, const fs::path& path) {
+    int fd = -1;
+    auto write_all = [&](const char* data, size_t len) {
+        while (len > 0) {
+            ssize_t n = ::write(fd, data, len);
+            io_count_write();
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) throw std::runtime_error("Failed to write file: " + path.string());
+            data += n;
+            len -= static_cast<size_t>(n);
+        }
+    };
+    try {
+        object_read_stream(
+            repo, sha,
+            [&](const std::string& fmt, uint64_t) {
+                if (fmt != "blob") throw std::runtime_error("Not a blob object");
+                fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+                io_count_open();
+                if (fd < 0) throw std::runtime_error("Failed to write file: " + path.string());
+            },
+            write_all);
+        int rc = ::close(fd);
+        fd = -1;
+        if (rc != 0) throw std::runtime_error("Failed to write file: " + path.string());
+    } catch (...) {
+        // Don't leave a truncated or unverified file behind
+        if (fd >= 0) {
+            ::close(fd);
+            std::error_code ec;
+            fs::remove(path, ec);
+        }
+        throw;
+    }
+}
+
+struct CheckoutContext {
+    const GitRepository& repo;
+    ThreadPool& pool;
+    std::atomic<uint64_t> written{0};
+    std::atomic<uint64_t> deleted{0};
+};
+
+// A loose object file up to this size is read whole by the io_uring
+// checkout; bigger ones, and packed objects, stream through checkout_blob
+static constexpr uint32_t URING_READ_CAP = 16 * 1024;
+// Blobs per pool task, one ring's worth
+static constexpr size_t URING_BATCH = 128;
+
+struct CheckoutJob {
+    std::string sha;
+    fs::path path;
+};
+
+// io_uring checkout of a ring's worth of blobs: one batch reads every
+// loose object file, they are inflated and checked here, and a second
+// batch writes every worktree file. Nothing is written for a blob that
+// fails to inflate or doesn't match its SHA-1.
+static void checkout_batch(const GitRepository& repo, const std::vector<CheckoutJob>& jobs) {
+    static thread_local std::unique_ptr<IoRing> ring = IoRing::create(URING_BATCH);
+    if (!ring) {
+        for (const auto& job : jobs) checkout_blob(repo, job.sha, job.path);
+        return;
+    }
+    ArenaScope scratch;
+    std::vector<const CheckoutJob*> loose;
+    std::vector<std::string> object_paths;
+    std::vector<IoRing::Read> reads;
+    loose.reserve(jobs.size());
+    object_paths.reserve(jobs.size());
+    reads.reserve(jobs.size());
+    for (const auto& job : jobs) {
+        if (pack_has_object(repo, job.sha)) {
+            checkout_blob(repo, job.sha, job.path);
+            continue;
+        }
+        loose.push_back(&job);
+        object_paths.push_back(loose_object_path(repo, job.sha));
+        reads.push_back({object_paths.back().c_str(), scratch.alloc(URING_READ_CAP), URING_READ_CAP});
+    }
+    ring->read_files(reads.data(), reads.size());
+
+    std::vector<std::string> payloads;
+    std::vector<IoRing::Write> writes;
+    std::vector<const CheckoutJob*> written;
+    payloads.reserve(loose.size());
+    writes.reserve(loose.size());
+    written.reserve(loose.size());
+    for (size_t i = 0; i < loose.size(); ++i) {
+        const CheckoutJob& job = *loose[i];
+        // Missing (repacked meanwhile) or too big to have come in whole
+        if (reads[i].result < 0 || reads[i].result == URING_READ_CAP) {
+            checkout_blob(repo, job.sha, job.path);
+            continue;
+        }
+        auto [fmt, data] = inflate_loose(reads[i].buf, static_cast<uint64_t>(reads[i].result));
+        if (fmt != "blob") throw std::runtime_error("Not a blob object");
+        Sha1 hash;
+        std::string header = fmt + ' ' + std::to_string(data.size()) + '\0';
+        hash.update(header.data(), header.size());
+        hash.update(data.data(), data.size());
+        if (hash.finish() != ObjectId::from_hex(job.sha)) {
+            throw std::runtime_error("Object " + job.sha + " does not match its SHA-1");
+        }
+        payloads.push_back(std::move(data));
+        writes.push_back({job.path.c_str(), payloads.back().data(), static_cast<uint32_t>(payloads.back().size())});
+        written.push_back(&job);
+    }
+    ring->write_files(writes.data(), writes.size());
+    for (size_t i = 0; i < writes.size(); ++i) {
+        if (writes[i].result == 0) continue;
+        // Don't leave a truncated file behind
+        std::error_code ec;
+        fs::remove(written[i]->path, ec);
+        throw std::runtime_error("Failed to write file: " + written[i]->path.string() + ": " +
+                                 std::strerror(static_cast<int>(-writes[i].result)));
+    }
+}
+
+// Remove what a deleted entry left at `path`, if it's still of the old
+// type. When a path changes between file and directory the addition can be
+// reported before the deletion, and by then the new entry is in place.
+static void checkout_remove(CheckoutContext& ctx, const fs::path& path, bool was_dir) {
+    std::error_code ec;
+    auto st = fs::symlink_status(path, ec);
+    if (!fs::exists(st) || fs::is_directory(st) != was_dir) return;
+    auto n = fs::remove_all(path, ec);
+    if (ec) throw std::runtime_error("Failed to remove " + path.string() + ": " + ec.message());
+    ctx.deleted += n;
+}
+
+// Clear whatever of the other type is in the way of a new entry
+static void checkout_make_room(CheckoutContext& ctx, const fs::path& path, bool is_dir) {
+    std::error_code ec;
+    auto st = fs::symlink_status(path, ec);
+    if (fs::exists(st) && fs::is_directory(st) != is_dir) checkout_remove(ctx, path, !is_dir);
+}
+
+// One file checkout_tree may write or remove: old_sha is what HEAD's tree
+// has at the path and new_sha what the target tree has ("" for neither)
+struct CheckoutFile {
+    std::string rel;
+    std::string old_sha;
+    std::string new_sha;
+    bool restore = false;  // Same in both trees, only rewritten if the worktree lost it
+    char action = 0;       // 'w' write, 'r' remove, '!' would lose local changes, 0 nothing to do
+};
+
+// The blob a worktree file holds: the indexed SHA while its stat data
+// vouches for it, as in status, otherwise the file is hashed
+static std::string worktree_sha(const GitIndex& index, const fs::path& path, const std::string& rel,
+                                const struct stat& st) {
+    const IndexEntry* cached = index.find(rel);
+    if (cached && cached->stat_matches(st) && !index.is_racy(*cached)) return cached->sha;
+    return object_hash_file(path, "blob");
+}
+
+// Decide what to do with one file. A file that still holds what HEAD had
+// there (or, for an unchanged path, anything at all) is replaced; any other
+// content would be lost, so that takes `force`.
+static void checkout_inspect(const GitIndex& index, const fs::path& base_path, CheckoutFile& file, bool force) {
+    fs::path path = base_path / file.rel;
+    char change = file.new_sha.empty() ? 'r' : 'w';
+    struct stat st;
+    if (::lstat(path.c_str(), &st) != 0) {
+        file.action = change == 'w' ? 'w' : 0;
+    } else if (!S_ISREG(st.st_mode)) {
+        // Changed paths clear what's in their way (see checkout_make_room);
+        // something put where an unchanged file was is left alone
+        file.action = change == 'r' ? 0 : file.restore && !force ? '!' : 'w';
+    } else {
+        std::string sha = worktree_sha(index, path, file.rel, st);
+        if (sha == file.new_sha) file.action = 0;
+        else if (file.restore || sha == file.old_sha || force) file.action = change;
+        else file.action = '!';
+    }
+}
+
+// Finds the files of the new tree that the diff didn't report but the
+// worktree has lost or changed since. A file whose index entry has its SHA
+// and unchanged stat data is taken as it is, as in status. A folder whose
+// cached tree in the index is the one being checked out is settled from its
+// index entries alone, so only folders on the way to changed paths (or
+// without a cached tree) have their tree read.
+struct CheckoutScan {
+    const GitRepository& repo;
+    const GitIndex& index;
+    const TreeFilter* filter;
+    const std::set<std::string>& changed;
+    std::vector<CheckoutFile>& files;
+    // The tree of every folder read, for the index once the checkout is done
+    std::map<std::string, CacheTreeEntry> trees;
+
+    void check(const std::string& rel, const std::string& sha) {
+        if (changed.count(rel) || (filter && !filter->includes(rel, false))) return;
+        const IndexEntry* cached = index.find(rel);
+        struct stat st;
+        if (cached && cached->sha == sha && ::lstat((repo.worktree / rel).c_str(), &st) == 0 &&
+            cached->stat_matches(st) && !index.is_racy(*cached)) {
+            return;
+        }
+        files.push_back({rel, sha, sha, true});
+    }
+
+    // Files below `dir`, or -1 if its tree can't be cached (it has submodules)
+    int32_t scan(const std::string& dir, const std::string& tree_sha) {
+        auto it = index.trees.find(dir);
+        if (it != index.trees.end() && it->second.entry_count >= 0 && it->second.sha == tree_sha) {
+            auto [first, last] = dir.empty() ? std::make_pair(size_t(0), index.entries.size()) : index_range(index, dir);
+            if (last - first == size_t(it->second.entry_count)) {
+                for (size_t i = first; i < last; ++i) check(index.entries[i].path, index.entries[i].sha);
+                return it->second.entry_count;
+            }
+        }
+        std::shared_ptr<const GitTree> tree = object_cache_tree(repo, tree_sha);
+        int32_t count = 0;
+        uint32_t subdirs = 0;
+        for (const auto& leaf : tree->items) {
+            std::string rel = dir.empty() ? leaf.path : dir + "/" + leaf.path;
+            if (leaf.mode == 040000) {
+                ++subdirs;
+                int32_t below = filter && filter->prunes(rel) ? 0 : scan(rel, leaf.sha);
+                count = count < 0 || below < 0 ? -1 : count + below;
+            } else if (leaf.mode == 0160000) {
+                count = -1;
+            } else {
+                if (count >= 0) ++count;
+                check(rel, leaf.sha);
+            }
+        }
+        if (count >= 0) trees[dir] = {count, subdirs, tree_sha};
+        return count;
+    }
+};
+
+// Record what checkout left in the worktree, so the next status, write-tree
+// or checkout can trust the stat data instead of hashing every file again.
+// `trees` are folders now known to hold their tree exactly.
+static void checkout_update_index(const GitRepository& repo, GitIndex& index, const std::vector<CheckoutFile>& files,
+                                  const std::vector<std::string>& removed_dirs,
+                                  const std::map<std::string, CacheTreeEntry>& trees) {
+    std::map<std::string, IndexEntry> fresh;
+    std::set<std::string> gone, moved;  // moved: content differs from the indexed SHA
+    for (const auto& file : files) {
+        if (file.new_sha.empty()) {
+            if (index.find(file.rel)) gone.insert(file.rel);
+            continue;
+        }
+        struct stat st;
+        if (::lstat((repo.worktree / file.rel).c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        const IndexEntry* cached = index.find(file.rel);
+        if (cached && cached->sha == file.new_sha && cached->stat_matches(st)) continue;
+        if (!cached || cached->sha != file.new_sha) moved.insert(file.rel);
+        fresh[file.rel] = IndexEntry::from_stat(file.rel, st, file.new_sha);
+    }
+    auto removed = [&](const std::string& path) {
+        if (gone.count(path) || fresh.count(path)) return true;
+        for (const auto& dir : removed_dirs) {
+            if (path.size() > dir.size() && path.compare(0, dir.size(), dir) == 0 && path[dir.size()] == '/') {
+                gone.insert(path);
+                return true;
+            }
+        }
+        return false;
+    };
+    size_t before = index.entries.size();
+    index.entries.erase(std::remove_if(index.entries.begin(), index.entries.end(),
+                                       [&](const IndexEntry& e) { return removed(e.path); }),
+                        index.entries.end());
+    bool dirty = !fresh.empty() || index.entries.size() != before;
+    // Cached trees above anything whose content changed no longer hold
+    auto invalidate = [&](std::string dir) {
+        while (true) {
+            size_t slash = dir.rfind('/');
+            dir = slash == std::string::npos ? "" : dir.substr(0, slash);
+            auto it = index.trees.find(dir);
+            if (it != index.trees.end()) it->second.entry_count = -1;
+            if (dir.empty()) break;
+        }
+    };
+    for (const auto& path : gone) invalidate(path);
+    for (const auto& path : moved) invalidate(path);
+    for (auto& [path, entry] : fresh) index.entries.push_back(std::move(entry));
+    for (const auto& [dir, tree] : trees) {
+        auto it = index.trees.find(dir);
+        if (it != index.trees.end() && it->second.entry_count == tree.entry_count && it->second.sha == tree.sha) {
+            continue;
+        }
+        index.trees[dir] = tree;
+        dirty = true;
+    }
+    if (!dirty) return;
+    index.sort();
+    index.write(repo);  // Only a cache: if another process holds the lock, it's simply not updated
+}
+
+// Files per pool task when checking the worktree
+static constexpr size_t INSPECT_BATCH = 256;
+
+CheckoutStats checkout_tree(const GitRepository& repo, const std::string& old_tree, const std::string& new_tree,
+                            const fs::path& base_path, unsigned jobs, const TreeFilter* old_filter,
+                            const TreeFilter* new_filter, bool force) {
+    if (jobs == 0) jobs = ThreadPool::default_threads();
+    ThreadPool pool(jobs);
+    CheckoutContext ctx{repo, pool};
+    bool in_worktree = base_path == repo.worktree;
+    GitIndex index = in_worktree ? GitIndex::read(repo) : GitIndex{};
+
+    // Changed entries, in diff order with the file each one is about;
+    // unchanged subtrees aren't read. Deleted subtrees are walked too, so
+    // the files in them can be checked for local changes.
+    std::vector<std::pair<TreeChange, size_t>> changes;
+    std::vector<CheckoutFile> files;
+    std::set<std::string> changed;
+    TreeDiffStats diff = tree_diff(repo, old_tree, new_tree, [&](const TreeChange& change) {
+        size_t slot = SIZE_MAX;
+        if (!change.is_tree()) {
+            slot = files.size();
+            files.push_back({change.path, change.old_sha, change.new_sha});
+            changed.insert(change.path);
+        }
+        changes.push_back({change, slot});
+        return change.is_tree();
+    }, old_filter, new_filter);
+    // Then the files it didn't report, in case the worktree lost or changed
+    // them since HEAD was checked out
+    CheckoutScan scan{repo, index, new_filter, changed, files, {}};
+    if (!old_tree.empty()) scan.scan("", new_tree);
+
+    for (size_t first = 0; first < files.size(); first += INSPECT_BATCH) {
+        pool.submit([&, first] {
+            size_t last = std::min(files.size(), first + INSPECT_BATCH);
+            for (size_t i = first; i < last; ++i) checkout_inspect(index, base_path, files[i], force);
+        });
+    }
+    pool.wait();
+    std::string lost;
+    for (const auto& file : files) {
+        if (file.action == '!') lost += "\n  " + file.rel;
+    }
+    if (!lost.empty()) {
+        throw std::runtime_error("Checkout would overwrite local changes to these files (--force discards them):" +
+                                 lost);
+    }
+
+    // With io_uring, blobs go to the pool a ring's worth at a time
+    bool batched = io_backend() == IoBackend::URING;
+    std::vector<CheckoutJob> batch;
+    auto flush = [&] {
+        if (batch.empty()) return;
+        pool.submit([&ctx, jobs = std::move(batch)] {
+            checkout_batch(ctx.repo, jobs);
+            ctx.written += jobs.size();
+        });
+        batch.clear();
+    };
+    auto write = [&](const std::string& sha, fs::path path) {
+        if (batched) {
+            batch.push_back({sha, std::move(path)});
+            if (batch.size() == URING_BATCH) flush();
+            return;
+        }
+        pool.submit([&ctx, sha, path = std::move(path)] {
+            checkout_blob(ctx.repo, sha, path);
+            ++ctx.written;
+        });
+    };
+    std::vector<std::string> removed_dirs;
+    for (const auto& [change, slot] : changes) {
+        fs::path path = base_path / change.path;
+        if (change.status == 'D') {
+            if (change.is_tree()) {
+                checkout_remove(ctx, path, true);
+                removed_dirs.push_back(change.path);
+            } else if (files[slot].action == 'r') {
+                checkout_remove(ctx, path, false);
+            }
+            continue;
+        }
+        if (change.is_tree()) {
+            checkout_make_room(ctx, path, true);
+            // A folder that's only partly checked out appears with its first file
+            if (!new_filter || new_filter->includes(change.path, true)) fs::create_directories(path);
+            continue;
+        }
+        if (files[slot].action != 'w') continue;
+        checkout_make_room(ctx, path, false);
+        if (new_filter) fs::create_directories(path.parent_path());
+        write(change.new_sha, std::move(path));
+    }
+    for (const auto& file : files) {
+        if (!file.restore || file.action != 'w') continue;
+        fs::path path = base_path / file.rel;
+        checkout_make_room(ctx, path, false);
+        fs::create_directories(path.parent_path());
+        write(file.new_sha, std::move(path));
+    }
+    flush();
+    pool.wait();
+    // With a filter, folders are only partly checked out
+    if (new_filter) scan.trees.clear();
+    if (in_worktree) checkout_update_index(repo, index, files, removed_dirs, scan.trees);
+    return {ctx.written, ctx.deleted, diff.unchanged, diff.trees_pruned, diff.files_excluded, diff.bytes_excluded};
+}
+
+// Full checkout of a tree into base_path
 void read_tree(const GitRepository& repo, const std::string& tree_sha, const fs::path& base_path) {
-    auto [fmt, tree_data] = read_object_fmt_and_data(repo, tree_sha);
-    if (fmt != "tree") throw std::runtime_error("Not a tree object");
-    GitTree tree = GitTree::parse(tree_data);
+    checkout_tree(repo, "", tree_sha, base_path);
+}
+
+// SHA of the commit HEAD points at, or "" if there is none yet (unborn branch)
+std::string head_commit(const GitRepository& repo) {
+    std::ifstream head_file(repo.gitdir / "HEAD");
+    std::string line;
+    if (!head_file || !std::getline(head_file, line)) return "";
+    if (line.rfind("ref: ", 0) == 0) {
+        std::ifstream ref_file(repo.gitdir / line.substr(5));
+        if (!ref_file || !std::getline(ref_file, line)) return "";
+    }
+    return line;
+}
 
-    for (const auto& leaf : tree.items) {
-        fs::path path = base_path / leaf.path;
-        if (leaf.mode == 040000) {  // Directory (tree)
-            fs::create_directories(path);
-            read_tree(repo, leaf.sha, path);
-        } else {  // File (blob)
-            auto [blob_fmt, blob_data] = read_object_fmt_and_data(repo, leaf.sha);
-            if (blob_fmt != "blob") throw std::runtime_error("Not a blob object");
-            std::ofstream file(path, std::ios::binary);
-            if (!file) throw std::runtime_error("Failed to write file: " + path.string());
-            file << blob_data;
-            file.close();
+std::vector<std::string> ref_tips(const GitRepository& repo) {
+    std::vector<std::string> tips;
+    std::string head = head_commit(repo);
+    if (!head.empty()) tips.push_back(head);
+    fs::path refs = repo.gitdir / "refs";
+    if (fs::is_directory(refs)) {
+        for (const auto& entry : fs::recursive_directory_iterator(refs)) {
+            if (!entry.is_regular_file()) continue;
+            std::ifstream ref_file(entry.path());
+            std::string sha;
+            if (std::getline(ref_file, sha) && sha.size() == 40) tips.push_back(sha);
         }
     }
+    return tips;
+}
+
+// Tree SHA recorded in a commit
+std::string commit_tree_sha(const GitRepository& repo, const std::string& commit_sha) {
+    auto commit = object_cache_commit(repo, commit_sha);
+    for (const auto& kv : commit->kvlm) {
+        if (kv.first == "tree") return kv.second;
+    }
+    throw std::runtime_error("No tree in commit");
 }
 
 // Command: init
@@ -307,36 +1652,207 @@ void cmd_hash_object(const std::vector<std::string>& args) {
     std::cout << sha << std::endl;
 }
 
+// Output for cat-file --batch: collected in one buffer and written out when
+// it gets big or when the caller has nothing more queued for us
+class BatchOutput {
+public:
+    ~BatchOutput() { flush(); }
+    std::string& buffer() { return buf_; }
+    void maybe_flush() {
+        if (buf_.size() >= 64 * 1024) flush();
+    }
+    void flush() {
+        const char* p = buf_.data();
+        size_t left = buf_.size();
+        while (left > 0) {
+            ssize_t n = ::write(STDOUT_FILENO, p, left);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) throw std::runtime_error("Failed to write output");
+            p += n;
+            left -= static_cast<size_t>(n);
+        }
+        buf_.clear();
+    }
+
+private:
+    std::string buf_;
+};
+
+// `cat-file --batch` / `--batch-check`: one object name per stdin line, one
+// "<sha> <type> <size>" line back (plus the content and a newline with
+// --batch). The repository, pack maps, inflate state and object cache stay
+// live across lines, so a caller can keep one process open for a whole job.
+static void cat_file_batch(bool contents) {
+    // Bigger objects are streamed through the output buffer, not cached
+    constexpr uint64_t BATCH_CACHED_MAX = 1 << 20;
+    GitRepository repo = GitRepository::find();
+    BatchOutput out;
+    char in[64 * 1024];
+    size_t start = 0, end = 0;
+    std::string line;
+    for (;;) {
+        const char* nl = static_cast<const char*>(std::memchr(in + start, '\n', end - start));
+        if (!nl) {
+            line.append(in + start, end - start);
+            start = end = 0;
+            // About to block: whoever is on the other end may be waiting for
+            // the answers so far before sending more
+            out.flush();
+            ssize_t n = ::read(STDIN_FILENO, in, sizeof(in));
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) throw std::runtime_error("Failed to read input");
+            if (n == 0) {
+                if (line.empty()) break;
+                in[0] = '\n';
+                n = 1;
+            }
+            end = static_cast<size_t>(n);
+            continue;
+        }
+        line.append(in + start, nl - (in + start));
+        start = nl - in + 1;
+
+        std::string sha, fmt;
+        uint64_t size = 0;
+        ObjectId id;
+        bool found = false, ambiguous = false;
+        // A blank line names nothing; don't let it reach object_find
+        bool blank = std::all_of(line.begin(), line.end(), [](unsigned char c) { return std::isspace(c); });
+        try {
+            if (!blank) {
+                sha = object_find(repo, line);
+                found = ObjectId::parse_hex(sha, id) && object_read_header(repo, sha, fmt, size);
+            }
+        } catch (const AmbiguousObjectName&) {
+            ambiguous = true;
+        } catch (const std::exception&) {
+            found = false;
+        }
+        std::string& buf = out.buffer();
+        if (!found) {
+            buf += line;
+            buf += ambiguous ? " ambiguous\n" : " missing\n";
+        } else {
+            buf += sha;
+            buf += ' ';
+            buf += fmt;
+            buf += ' ';
+            buf += std::to_string(size);
+            buf += '\n';
+            if (contents && size <= BATCH_CACHED_MAX) {
+                auto object = object_cache_read(repo, sha);
+                buf += object->data;
+                buf += '\n';
+            } else if (contents) {
+                object_read_stream(repo, sha, [](const std::string&, uint64_t) {}, [&](const char* data, size_t len) {
+                    buf.append(data, len);
+                    out.maybe_flush();
+                });
+                buf += '\n';
+            }
+        }
+        line.clear();
+        out.maybe_flush();
+    }
+}
+
 // Command: cat-file
 void cmd_cat_file(const std::vector<std::string>& args) {
-    if (args.size() < 2) throw std::runtime_error("Usage: cat-file <type> <object>");
+    if (args.size() == 1 && (args[0] == "--batch" || args[0] == "--batch-check")) {
+        cat_file_batch(args[0] == "--batch");
+        return;
+    }
+    if (args.size() < 2) throw std::runtime_error("Usage: cat-file (<type> <object> | --batch | --batch-check)");
     std::string type = args[0];
     std::string obj_name = args[1];
     GitRepository repo = GitRepository::find();
     std::string sha = object_find(repo, obj_name, type);
-    auto [actual_type, data] = read_object_fmt_and_data(repo, sha);
-    if (actual_type != type) throw std::runtime_error("Object type mismatch: expected " + type + ", got " + actual_type);
-    std::cout << data;
+    object_read_stream(
+        repo, sha,
+        [&](const std::string& actual_type, uint64_t) {
+            if (actual_type != type) {
+                throw std::runtime_error("Object type mismatch: expected " + type + ", got " + actual_type);
+            }
+        },
+        [](const char* data, size_t len) { std::cout.write(data, static_cast<std::streamsize>(len)); });
 }
 
 // New Command: write-tree
 void cmd_write_tree(const std::vector<std::string>& args) {
+    unsigned jobs = 0;
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == "-j" && i + 1 < args.size()) {
+            jobs = static_cast<unsigned>(std::stoul(args[++i]));
+        } else if (args[i].rfind("-j", 0) == 0 && args[i].size() > 2) {
+            jobs = static_cast<unsigned>(std::stoul(args[i].substr(2)));
+        } else {
+            throw std::runtime_error("Usage: write-tree [-j <threads>]");
+        }
+    }
+    if (jobs == 0) jobs = ThreadPool::default_threads();
     GitRepository repo = GitRepository::find();
-    std::string tree_sha = write_tree(repo, repo.worktree);
+    std::string tree_sha = write_tree(repo, repo.worktree, jobs);
     std::cout << tree_sha << std::endl;
 }
 
+// New Command: status
+void cmd_status(const std::vector<std::string>& args) {
+    unsigned jobs = 0;
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == "-j" && i + 1 < args.size()) {
+            jobs = static_cast<unsigned>(std::stoul(args[++i]));
+        } else if (args[i].rfind("-j", 0) == 0 && args[i].size() > 2) {
+            jobs = static_cast<unsigned>(std::stoul(args[i].substr(2)));
+        } else {
+            throw std::runtime_error("Usage: status [-j <threads>]");
+        }
+    }
+    if (jobs == 0) jobs = ThreadPool::default_threads();
+    GitRepository repo = GitRepository::find();
+    std::string out;
+    for (const auto& [path, status] : worktree_status(repo, jobs)) {
+        out += status;
+        out += '\t';
+        out += path;
+        out += '\n';
+    }
+    std::cout << out << std::flush;
+}
+
+// New Command: fsmonitor
+void cmd_fsmonitor(const std::vector<std::string>& args) {
+    const std::string usage = "Usage: fsmonitor (start | stop | status | run)";
+    if (args.size() != 1) throw std::runtime_error(usage);
+    GitRepository repo = GitRepository::find();
+    if (args[0] == "start") {
+        fsmonitor_start(repo);
+        std::cout << "fsmonitor watching " << repo.worktree.lexically_normal().string() << std::endl;
+        if (!fsmonitor_enabled(repo)) {
+            std::cerr << "Note: set core.fsmonitor=true for status and write-tree to use it" << std::endl;
+        }
+    } else if (args[0] == "stop") {
+        if (!fsmonitor_stop(repo)) throw std::runtime_error("fsmonitor is not running");
+        std::cout << "fsmonitor stopped" << std::endl;
+    } else if (args[0] == "status") {
+        std::cout << (fsmonitor_running(repo) ? "fsmonitor is running" : "fsmonitor is not running") << std::endl;
+    } else if (args[0] == "run") {
+        fsmonitor_run(repo);
+    } else {
+        throw std::runtime_error(usage);
+    }
+}
+
 // New Command: commit-tree
 void cmd_commit_tree(const std::vector<std::string>& args) {
-    if (args.size() < 3) throw std::runtime_error("Usage: commit-tree <tree_sha> [-p <parent>] -m <message>");
+    if (args.size() < 3) throw std::runtime_error("Usage: commit-tree <tree_sha> [-p <parent>]... -m <message>");
 
     std::string tree_sha = args[0];
-    std::string parent_sha;
+    std::vector<std::string> parents;
     std::string message;
     size_t i = 1;
-    if (args[i] == "-p") {
-        if (args.size() < 5) throw std::runtime_error("Missing parent or message");
-        parent_sha = args[i + 1];
+    while (i < args.size() && args[i] == "-p") {
+        if (i + 1 >= args.size()) throw std::runtime_error("Missing parent");
+        parents.push_back(args[i + 1]);
         i += 2;
     }
     if (i >= args.size() || args[i] != "-m") throw std::runtime_error("Missing -m");
@@ -346,7 +1862,7 @@ void cmd_commit_tree(const std::vector<std::string>& args) {
 
     GitCommit commit;
     commit.kvlm.push_back({"tree", tree_sha});
-    if (!parent_sha.empty()) {
+    for (const auto& parent_sha : parents) {
         commit.kvlm.push_back({"parent", parent_sha});
     }
     std::time_t now = std::time(nullptr);
@@ -367,15 +1883,32 @@ void cmd_ls_tree(const std::vector<std::string>& args) {
     std::string name = args[0];
     GitRepository repo = GitRepository::find();
     std::string sha = object_find(repo, name, "tree", true);
-    auto [fmt, data] = read_object_fmt_and_data(repo, sha);
-    if (fmt != "tree") throw std::runtime_error("Not a tree object");
+    auto object = object_cache_read(repo, sha);
+    if (object->fmt != "tree") throw std::runtime_error("Not a tree object");
+    const std::string& data = object->data;
     try {
-        GitTree tree = GitTree::parse(data);
-        for (const auto& leaf : tree.items) {
-            std::ostringstream mode_ss;
-            mode_ss << std::oct << leaf.mode;
-            std::cout << mode_ss.str() << " " << leaf.path << "\t" << leaf.sha << std::endl;
+        // Formatted straight from the inflated buffer, flushed once
+        std::string out;
+        out.reserve(data.size() * 2);
+        char hex[40];
+        for (const auto& entry : TreeView(data)) {
+            char mode[12];
+            char* end = mode + sizeof(mode);
+            char* p = end;
+            uint32_t m = entry.mode;
+            do {
+                *--p = static_cast<char>('0' + (m & 7));
+                m >>= 3;
+            } while (m);
+            out.append(p, end);
+            out += ' ';
+            out += entry.path;
+            out += '\t';
+            entry.id().hex(hex);
+            out.append(hex, sizeof(hex));
+            out += '\n';
         }
+        std::cout << out << std::flush;
     } catch (const std::exception& e) {
         std::cerr << "Error parsing tree: " << e.what() << std::endl;
         std::cerr << "Tree data length: " << data.length() << std::endl;
@@ -389,18 +1922,75 @@ void cmd_ls_tree(const std::vector<std::string>& args) {
     }
 }
 
+// A tree SHA from a tree or commit name
+static std::string tree_ish(const GitRepository& repo, const std::string& name) {
+    std::string sha = object_find(repo, name, "", true);
+    std::string fmt;
+    uint64_t size;
+    if (!object_read_header(repo, sha, fmt, size)) throw std::runtime_error("Not a valid object name " + name);
+    if (fmt == "commit") return commit_tree_sha(repo, sha);
+    if (fmt != "tree") throw std::runtime_error(name + " is a " + fmt + ", not a tree or commit");
+    return sha;
+}
+
+// New Command: diff-tree
+void cmd_diff_tree(const std::vector<std::string>& args) {
+    bool recursive = false;
+    bool name_status = false;
+    std::vector<std::string> names;
+    for (const auto& arg : args) {
+        if (arg == "-r") recursive = true;
+        else if (arg == "--name-status") name_status = true;
+        else names.push_back(arg);
+    }
+    if (names.size() != 2) throw std::runtime_error("Usage: diff-tree [-r] [--name-status] <tree-ish> <tree-ish>");
+    GitRepository repo = GitRepository::find();
+    std::string old_tree = tree_ish(repo, names[0]);
+    std::string new_tree = tree_ish(repo, names[1]);
+
+    static const std::string zero_sha(40, '0');
+    std::string out;
+    tree_diff(repo, old_tree, new_tree, [&](const TreeChange& change) {
+        // With -r, subtrees are walked into rather than listed
+        if (recursive && change.is_tree()) return true;
+        if (!name_status) {
+            char modes[16];
+            std::snprintf(modes, sizeof(modes), ":%06o %06o ", change.old_mode, change.new_mode);
+            out += modes;
+            out += change.old_sha.empty() ? zero_sha : change.old_sha;
+            out += ' ';
+            out += change.new_sha.empty() ? zero_sha : change.new_sha;
+            out += ' ';
+        }
+        out += change.status;
+        out += '\t';
+        out += change.path;
+        out += '\n';
+        return false;
+    });
+    std::cout << out << std::flush;
+}
+
 // New Command: log
 void cmd_log(const std::vector<std::string>& args) {
+    bool topo_order = false;
+    std::vector<std::string> names;
+    for (const auto& arg : args) {
+        if (arg == "--topo-order") topo_order = true;
+        else names.push_back(arg);
+    }
+    if (names.empty()) names.push_back("HEAD");
     GitRepository repo = GitRepository::find();
-    std::string sha = args.empty() ? "HEAD" : args[0];
-    sha = object_find(repo, sha, "commit", true);
+    std::vector<std::string> tips;
+    for (const auto& name : names) tips.push_back(object_find(repo, name, "commit", true));
 
-    while (!sha.empty()) {
-        auto [fmt, data] = read_object_fmt_and_data(repo, sha);
-        if (fmt != "commit") throw std::runtime_error("Not a commit object");
-        GitCommit commit = GitCommit::parse(data);
+    // The walk itself comes from the commit-graph when there is one; only
+    // the commits being printed are inflated
+    CommitSource source(repo);
+    for (const auto& sha : rev_list(source, tips, topo_order)) {
+        const GitCommit& commit = *object_cache_commit(repo, sha);
 
-        std::cout << "commit " << sha << std::endl;
+        std::cout << "commit " << sha << "\n";
 
         std::string author;
         for (const auto& kv : commit.kvlm) {
@@ -410,7 +2000,7 @@ void cmd_log(const std::vector<std::string>& args) {
             }
         }
         if (!author.empty()) {
-            std::cout << "Author: " << author << std::endl;
+            std::cout << "Author: " << author << "\n";
         }
 
         std::string message;
@@ -420,42 +2010,422 @@ void cmd_log(const std::vector<std::string>& args) {
                 break;
             }
         }
-        std::cout << std::endl << message << std::endl;
+        std::cout << "\n" << message << "\n";
+    }
+    std::cout << std::flush;
+}
 
-        std::string parent;
-        for (const auto& kv : commit.kvlm) {
-            if (kv.first == "parent") {
-                parent = kv.second;
-                break;
-            }
+// New Command: commit-graph
+// Writes objects/info/commit-graph for everything reachable from HEAD, the
+// refs under refs/ and any commits named on the command line.
+void cmd_commit_graph(const std::vector<std::string>& args) {
+    if (args.empty() || args[0] != "write") throw std::runtime_error("Usage: commit-graph write [<commit>...]");
+    GitRepository repo = GitRepository::find();
+    std::vector<std::string> tips = ref_tips(repo);
+    for (size_t i = 1; i < args.size(); ++i) tips.push_back(object_find(repo, args[i], "commit", true));
+    uint32_t count = commit_graph_write(repo, tips);
+    std::cout << "Wrote commit-graph with " << count << " commits" << std::endl;
+}
+
+// New Command: rev-list
+// With --objects, the trees and blobs reachable from the commits follow
+// them. --use-bitmap-index answers from a pack's bitmaps instead of walking
+// (objects then come in pack order, without paths, as in Git).
+void cmd_rev_list(const std::vector<std::string>& args) {
+    bool topo_order = false, objects = false, use_bitmap = false, count = false;
+    std::vector<std::string> names;
+    for (const auto& arg : args) {
+        if (arg == "--topo-order") topo_order = true;
+        else if (arg == "--objects") objects = true;
+        else if (arg == "--use-bitmap-index") use_bitmap = true;
+        else if (arg == "--count") count = true;
+        else names.push_back(arg);
+    }
+    if (names.empty()) {
+        throw std::runtime_error("Usage: rev-list [--topo-order] [--objects] [--use-bitmap-index] [--count] <commit>...");
+    }
+    GitRepository repo = GitRepository::find();
+    std::vector<std::string> tips;
+    for (const auto& name : names) tips.push_back(object_find(repo, name, "commit", true));
+
+    Reachable reachable;
+    if (use_bitmap && bitmap_reachable(repo, tips, reachable)) {
+        ObjectCounts counts = reachable.counts();
+        if (count) {
+            std::cout << (objects ? counts.total() : counts.commits) << std::endl;
+            return;
         }
-        sha = parent;
+        char hex[41] = {};
+        reachable.for_each([&](const ObjectId& id, int type) {
+            if (!objects && type != PACK_COMMIT) return;
+            id.hex(hex);
+            std::cout << hex << "\n";
+        });
+    } else if (objects) {
+        ObjectCounts counts = walk_objects(repo, tips, [&](const std::string& sha, int type, const std::string& path) {
+            if (count) return;
+            if (type == PACK_COMMIT) std::cout << sha << "\n";
+            else std::cout << sha << " " << path << "\n";
+        });
+        if (count) std::cout << counts.total() << "\n";
+    } else {
+        CommitSource source(repo);
+        std::vector<std::string> commits = rev_list(source, tips, topo_order);
+        if (count) std::cout << commits.size() << "\n";
+        else for (const auto& sha : commits) std::cout << sha << "\n";
     }
+    std::cout << std::flush;
+}
+
+// New Command: count-objects
+// Objects reachable from the given commits (default HEAD) by type. Comes
+// from the pack bitmaps when there are any, else from a full walk.
+void cmd_count_objects(const std::vector<std::string>& args) {
+    auto start = std::chrono::steady_clock::now();
+    GitRepository repo = GitRepository::find();
+    std::vector<std::string> tips;
+    for (const auto& name : args) tips.push_back(object_find(repo, name, "commit", true));
+    if (tips.empty()) tips.push_back(object_find(repo, "HEAD", "commit", true));
+
+    ObjectCounts counts;
+    Reachable reachable;
+    bool bitmaps = bitmap_reachable(repo, tips, reachable);
+    if (bitmaps) counts = reachable.counts();
+    else counts = walk_objects(repo, tips, [](const std::string&, int, const std::string&) {});
+    std::cout << "commits: " << counts.commits << "\n"
+              << "trees: " << counts.trees << "\n"
+              << "blobs: " << counts.blobs << "\n"
+              << "tags: " << counts.tags << "\n"
+              << "total: " << counts.total() << std::endl;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cerr << "Counted " << counts.total() << " objects " << (bitmaps ? "from bitmaps" : "by walking") << " in "
+              << std::fixed << std::setprecision(3) << elapsed.count() << "s" << std::endl;
 }
+
+// New Command: merge-base
+void cmd_merge_base(const std::vector<std::string>& args) {
+    bool all = false;
+    std::vector<std::string> names;
+    for (const auto& arg : args) {
+        if (arg == "--all") all = true;
+        else names.push_back(arg);
+    }
+    if (names.size() != 2) throw std::runtime_error("Usage: merge-base [--all] <commit> <commit>");
+    GitRepository repo = GitRepository::find();
+    CommitSource source(repo);
+    auto bases = merge_bases(source, object_find(repo, names[0], "commit", true),
+                             object_find(repo, names[1], "commit", true));
+    if (bases.empty()) throw std::runtime_error("No common ancestor");
+    if (!all) bases.resize(1);
+    for (const auto& sha : bases) std::cout << sha << std::endl;
+}
+
 // New Command: checkout
+// Entries that differ between the HEAD tree and the target tree are written
+// or deleted, as are files that went missing or were changed in the
+// worktree; blob writes run on a pool of -j threads. Local changes to files
+// the checkout replaces or deletes make it stop before touching anything,
+// unless --force. The patterns
+// in .git/info/sparse-checkout (replaced with --sparse, dropped with
+// --no-sparse) limit what's checked out, and folders they leave out are
+// never read. With pathspecs only those paths are written from the commit,
+// over whatever is there, and HEAD stays where it is.
 void cmd_checkout(const std::vector<std::string>& args) {
-    if (args.empty()) throw std::runtime_error("Usage: checkout <commit_sha>");
-    std::string name = args[0];
+    const std::string usage =
+        "Usage: checkout [-j <threads>] [--force] [--sparse <pattern-file> | --no-sparse] <commit_sha> "
+        "[-- <pathspec>...]";
+    unsigned jobs = 0;
+    std::string name, sparse_file;
+    bool no_sparse = false, have_pathspecs = false, force = false;
+    std::vector<std::string> pathspecs;
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == "--") {
+            pathspecs.assign(args.begin() + i + 1, args.end());
+            have_pathspecs = true;
+            break;
+        } else if (args[i] == "-j" && i + 1 < args.size()) {
+            jobs = static_cast<unsigned>(std::stoul(args[++i]));
+        } else if (args[i].rfind("-j", 0) == 0 && args[i].size() > 2) {
+            jobs = static_cast<unsigned>(std::stoul(args[i].substr(2)));
+        } else if (args[i] == "--sparse" && i + 1 < args.size()) {
+            sparse_file = args[++i];
+        } else if (args[i] == "--no-sparse") {
+            no_sparse = true;
+        } else if (args[i] == "--force" || args[i] == "-f") {
+            force = true;
+        } else if (name.empty()) {
+            name = args[i];
+        } else {
+            throw std::runtime_error(usage);
+        }
+    }
+    if (name.empty() || (have_pathspecs && pathspecs.empty())) throw std::runtime_error(usage);
+    if ((!sparse_file.empty() || no_sparse) && (have_pathspecs || (no_sparse && !sparse_file.empty()))) {
+        throw std::runtime_error(usage);
+    }
+    auto start = std::chrono::steady_clock::now();
     GitRepository repo = GitRepository::find();
     std::string commit_sha = object_find(repo, name, "commit", true);
-    auto [fmt, commit_data] = read_object_fmt_and_data(repo, commit_sha);
-    if (fmt != "commit") throw std::runtime_error("Not a commit object");
-    GitCommit commit = GitCommit::parse(commit_data);
-
-    std::string tree_sha;
-    for (const auto& kv : commit.kvlm) {
-        if (kv.first == "tree") {
-            tree_sha = kv.second;
-            break;
+    std::string tree_sha = commit_tree_sha(repo, commit_sha);
+
+    // Diff against what HEAD has checked out, if anything, under the
+    // patterns it was checked out with
+    std::string old_tree;
+    std::string head = head_commit(repo);
+    if (!head.empty()) old_tree = commit_tree_sha(repo, head);
+    std::unique_ptr<SparseFilter> old_filter = SparseFilter::load(repo);
+    std::unique_ptr<SparseFilter> replacement;
+    const SparseFilter* new_filter = no_sparse ? nullptr : old_filter.get();
+    if (!sparse_file.empty()) {
+        std::ifstream file(sparse_file);
+        if (!file) throw std::runtime_error("Cannot read " + sparse_file);
+        std::ostringstream text;
+        text << file.rdbuf();
+        if (!old_filter || text.str() != old_filter->text()) {
+            replacement = SparseFilter::from_patterns(text.str());
+            new_filter = replacement.get();
         }
+    } else if (have_pathspecs) {
+        // Everything the pathspecs cover is written, changed since HEAD or not
+        old_tree.clear();
+        force = true;
+        replacement = SparseFilter::from_pathspecs(old_filter.get(), pathspecs);
+        new_filter = replacement.get();
     }
-    if (tree_sha.empty()) throw std::runtime_error("No tree in commit");
 
     // Checkout tree to worktree
-    read_tree(repo, tree_sha, repo.worktree);
+    CheckoutStats stats = checkout_tree(repo, old_tree, tree_sha, repo.worktree, jobs, old_filter.get(), new_filter, force);
 
-    // Update HEAD to this commit (detached)
-    std::ofstream head_file(repo.gitdir / "HEAD");
-    head_file << commit_sha;
-    head_file.close();
-}
\ No newline at end of file
+    if (!have_pathspecs) {
+        if (new_filter != old_filter.get()) sparse_save(repo, new_filter);
+        // Update HEAD to this commit (detached)
+        std::ofstream head_file(repo.gitdir / "HEAD");
+        head_file << commit_sha;
+        head_file.close();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cerr << "Checked out " << commit_sha.substr(0, 7) << ": " << stats.written << " written, "
+              << stats.deleted << " deleted, " << stats.skipped << " unchanged entries skipped in "
+              << std::fixed << std::setprecision(3) << elapsed.count() << "s" << std::endl;
+    if (new_filter) {
+        std::cerr << "Left out compared with a full checkout: " << stats.trees_pruned << " folders (never read), "
+                  << stats.files_excluded << " files (" << stats.bytes_excluded << " bytes)" << std::endl;
+    }
+}
+
+// New Command: repack
+// Moves loose objects (and with -a, existing packs) into a new pack. With -d
+// the packed loose objects (and replaced packs) are deleted, but only after
+// every object in the new pack has been read back and re-hashed. With -b
+// (which needs -a) a reachability bitmap is written next to the new pack.
+void cmd_repack(const std::vector<std::string>& args) {
+    const std::string usage =
+        "Usage: repack [-a] [-d] [-b | --write-bitmap-index] [--window=<n>] [--depth=<n>] [--ref-delta]";
+    bool all = false, remove = false, write_bitmap = false;
+    PackOptions opts;
+    for (const auto& arg : args) {
+        if (arg.rfind("--window=", 0) == 0) {
+            opts.window = static_cast<unsigned>(std::stoul(arg.substr(9)));
+        } else if (arg.rfind("--depth=", 0) == 0) {
+            opts.depth = static_cast<unsigned>(std::stoul(arg.substr(8)));
+            if (opts.depth == 0) opts.window = 0;
+        } else if (arg == "--ref-delta") {
+            opts.ofs_delta = false;
+        } else if (arg == "--write-bitmap-index") {
+            write_bitmap = true;
+        } else if (arg.size() >= 2 && arg[0] == '-' && arg[1] != '-') {
+            for (size_t i = 1; i < arg.size(); ++i) {
+                if (arg[i] == 'a') all = true;
+                else if (arg[i] == 'd') remove = true;
+                else if (arg[i] == 'b') write_bitmap = true;
+                else throw std::runtime_error(usage);
+            }
+        } else {
+            throw std::runtime_error(usage);
+        }
+    }
+    // A bitmap needs every reachable object in the one pack
+    if (write_bitmap && !all) throw std::runtime_error("--write-bitmap-index needs -a");
+    GitRepository repo = GitRepository::find();
+    auto old_packs = pack_list(repo, true);
+    std::vector<std::string> loose = loose_objects(repo);
+
+    std::set<std::string> seen;
+    std::vector<std::string> to_pack;
+    for (const auto& sha : loose) {
+        if (!all && pack_has_object(repo, sha)) continue;
+        if (seen.insert(sha).second) to_pack.push_back(sha);
+    }
+    if (all) {
+        for (const auto& pack : old_packs) {
+            for (uint32_t i = 0; i < pack->count(); ++i) {
+                std::string sha = sha_to_hex(pack->sha_at(i));
+                if (seen.insert(sha).second) to_pack.push_back(sha);
+            }
+        }
+    }
+    PackWriter writer(repo);
+    PackStats stats = pack_objects(repo, to_pack, writer, opts);
+
+    fs::path pack_path;
+    if (writer.count() == 0) {
+        std::cout << "Nothing new to pack" << std::endl;
+    } else {
+        pack_path = writer.finish();
+        fs::path idx_path = pack_path;
+        idx_path.replace_extension(".idx");
+
+        // Verify before anything is deleted
+        PackFile pack(idx_path);
+        for (uint32_t i = 0; i < pack.count(); ++i) {
+            auto [fmt, data] = pack.read(pack.offset_at(i));
+            GitBlob obj;
+            obj.fmt = fmt;
+            obj.blobdata = std::move(data);
+            std::string expected = sha_to_hex(pack.sha_at(i));
+            if (object_write(&obj) != expected) {
+                throw std::runtime_error("Pack verification failed for " + expected + "; nothing was deleted");
+            }
+        }
+        std::cout << "Packed " << pack.count() << " objects (" << stats.deltas << " deltas) into "
+                  << pack_path.filename().string() << std::endl;
+        if (write_bitmap) {
+            uint32_t selected = bitmap_write(repo, std::make_shared<PackFile>(idx_path), ref_tips(repo));
+            std::cout << "Wrote bitmaps for " << selected << " commits" << std::endl;
+        }
+    }
+
+    auto packs = pack_list(repo, true);
+    if (remove) {
+        if (all && writer.count() > 0) {
+            for (const auto& old : old_packs) {
+                if (old->pack_path() == pack_path) continue;  // Same objects, same name
+                fs::remove(old->idx_path());
+                fs::remove(old->pack_path());
+                fs::path bitmap = old->pack_path();
+                fs::remove(bitmap.replace_extension(".bitmap"));
+            }
+            packs = pack_list(repo, true);
+        }
+        size_t removed = 0;
+        for (const auto& sha : loose) {
+            if (!pack_has_object(repo, sha)) continue;
+            fs::path path = repo.gitdir / "objects" / sha.substr(0, 2) / sha.substr(2);
+            if (fs::remove(path)) ++removed;
+            std::error_code ec;
+            fs::remove(path.parent_path(), ec);  // Only succeeds once the fanout dir is empty
+        }
+        std::cout << "Removed " << removed << " loose objects" << std::endl;
+    }
+}
+
+// New Command: fast-import
+// Reads a `git fast-import` stream on stdin and writes everything it
+// describes into one new pack.
+void cmd_fast_import(const std::vector<std::string>& args) {
+    FastImportOptions options;
+    for (const auto& arg : args) {
+        if (arg.rfind("--import-marks=", 0) == 0) options.import_marks = arg.substr(15);
+        else if (arg.rfind("--export-marks=", 0) == 0) options.export_marks = arg.substr(15);
+        else throw std::runtime_error("Usage: fast-import [--import-marks=<file>] [--export-marks=<file>]");
+    }
+    GitRepository repo = GitRepository::find();
+    std::ios::sync_with_stdio(false);
+    FastImportStats stats = fast_import(repo, std::cin, std::cout, options);
+    double secs = std::max(stats.seconds, 1e-9);
+    std::cerr << "Imported " << stats.objects() << " objects (" << stats.blobs << " blobs, " << stats.trees
+              << " trees, " << stats.commits << " commits, " << stats.tags << " tags; " << stats.duplicates
+              << " duplicates skipped) in " << std::fixed << std::setprecision(3) << stats.seconds << "s: "
+              << std::setprecision(0) << stats.objects() / secs << " objects/s, " << std::setprecision(1)
+              << stats.bytes / 1e6 / secs << " MB/s" << std::endl;
+    if (!stats.pack.empty()) {
+        std::cerr << "Wrote " << stats.pack << " (" << std::setprecision(1) << stats.pack_bytes / 1048576.0
+                  << " MiB)" << std::endl;
+    }
+}
+
+// New Command: fsck
+void cmd_fsck(const std::vector<std::string>& args) {
+    const std::string usage = "Usage: fsck [-j <threads>] [--connectivity]";
+    FsckOptions options;
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == "--connectivity") {
+            options.connectivity = true;
+        } else if (args[i] == "-j" && i + 1 < args.size()) {
+            options.jobs = static_cast<unsigned>(std::stoul(args[++i]));
+        } else if (args[i].rfind("-j", 0) == 0 && args[i].size() > 2) {
+            options.jobs = static_cast<unsigned>(std::stoul(args[i].substr(2)));
+        } else {
+            throw std::runtime_error(usage);
+        }
+    }
+    GitRepository repo = GitRepository::find();
+    FsckStats stats = fsck(repo, options, std::cout);
+    uint64_t objects = stats.loose + stats.packed;
+    std::cerr << "Checked " << objects << " objects (" << stats.loose << " loose, " << stats.packed << " packed, "
+              << std::fixed << std::setprecision(1) << stats.bytes / 1048576.0 << " MiB) in " << std::setprecision(3)
+              << stats.seconds
+              << "s with " << (options.jobs ? options.jobs : ThreadPool::default_threads()) << " threads: "
+              << std::setprecision(0) << objects / std::max(stats.seconds, 1e-9) << " objects/s" << std::endl;
+    uint64_t problems = stats.errors + stats.missing;
+    if (problems > 0) {
+        throw std::runtime_error("fsck found " + std::to_string(problems) + (problems == 1 ? " problem" : " problems"));
+    }
+}
+
+// New Command: archive
+// A tar (or tar.gz) of a tree or commit on stdout, straight from the object
+// store. A commit's time is every entry's mtime; a bare tree gets the
+// current time, as in Git.
+void cmd_archive(const std::vector<std::string>& args) {
+    const std::string usage =
+        "Usage: archive [--format=tar|tar.gz] [--prefix=<prefix>] [-j <threads>] [-<0-9>] <tree-ish>";
+    ArchiveOptions options;
+    std::string name;
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+        if (arg.rfind("--format=", 0) == 0) {
+            std::string format = arg.substr(9);
+            if (format == "tar") options.format = ArchiveFormat::TAR;
+            else if (format == "tar.gz" || format == "tgz") options.format = ArchiveFormat::TAR_GZ;
+            else throw std::runtime_error("Unknown archive format: " + format);
+        } else if (arg.rfind("--prefix=", 0) == 0) {
+            options.prefix = arg.substr(9);
+        } else if (arg == "-j" && i + 1 < args.size()) {
+            options.jobs = static_cast<unsigned>(std::stoul(args[++i]));
+        } else if (arg.rfind("-j", 0) == 0 && arg.size() > 2) {
+            options.jobs = static_cast<unsigned>(std::stoul(arg.substr(2)));
+        } else if (arg.size() == 2 && arg[0] == '-' && std::isdigit(static_cast<unsigned char>(arg[1]))) {
+            options.level = arg[1] - '0';
+        } else if (name.empty() && arg[0] != '-') {
+            name = arg;
+        } else {
+            throw std::runtime_error(usage);
+        }
+    }
+    if (name.empty()) throw std::runtime_error(usage);
+    GitRepository repo = GitRepository::find();
+    std::string sha = object_find(repo, name, "", true);
+    std::string fmt;
+    uint64_t size;
+    if (!object_read_header(repo, sha, fmt, size)) throw std::runtime_error("Not a valid object name " + name);
+    std::string tree_sha = sha;
+    if (fmt == "commit") {
+        auto commit = object_cache_read(repo, sha);
+        options.commit = sha;
+        options.mtime = CommitView(commit->data).commit_time();
+        tree_sha = commit_tree_sha(repo, sha);
+    } else if (fmt == "tree") {
+        options.mtime = static_cast<uint64_t>(std::time(nullptr));
+    } else {
+        throw std::runtime_error(name + " is a " + fmt + ", not a tree or commit");
+    }
+
+    ArchiveStats stats = archive_tree(repo, tree_sha, options, STDOUT_FILENO);
+    double secs = std::max(stats.seconds, 1e-9);
+    std::cerr << "Archived " << stats.files << " files in " << stats.dirs << " folders (" << std::fixed
+              << std::setprecision(1) << stats.bytes / 1048576.0 << " MiB, " << stats.written / 1048576.0
+              << " MiB written) in " << std::setprecision(3) << stats.seconds << "s: " << std::setprecision(1)
+              << stats.bytes / 1e6 / secs << " MB/s" << std::endl;
+}
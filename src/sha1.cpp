@@ -0,0 +1,330 @@
+#include "sha1.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <openssl/evp.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GITLITE_SHA1_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+static const uint32_t SHA1_INIT[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+
+static uint32_t load_be32(const unsigned char* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+static void store_be32(unsigned char* p, uint32_t v) {
+    p[0] = static_cast<unsigned char>(v >> 24);
+    p[1] = static_cast<unsigned char>(v >> 16);
+    p[2] = static_cast<unsigned char>(v >> 8);
+    p[3] = static_cast<unsigned char>(v);
+}
+
+// Final 1 or 2 blocks of a message: the bytes after the last full block,
+// 0x80, zeros, and the length in bits. Returns the number of blocks.
+static size_t sha1_tail(const unsigned char* rest, size_t rest_len, uint64_t total, unsigned char* out) {
+    size_t blocks = rest_len + 9 <= 64 ? 1 : 2;
+    std::memset(out, 0, 64 * blocks);
+    std::memcpy(out, rest, rest_len);
+    out[rest_len] = 0x80;
+    uint64_t bits = total * 8;
+    for (int i = 0; i < 8; ++i) out[64 * blocks - 1 - i] = static_cast<unsigned char>(bits >> (8 * i));
+    return blocks;
+}
+
+#ifdef GITLITE_SHA1_X86
+
+namespace {
+
+struct CpuFeatures {
+    bool shani = false;
+    bool avx2 = false;
+    CpuFeatures() {
+        unsigned eax, ebx, ecx, edx;
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return;
+        bool ssse3 = ecx & (1u << 9);
+        bool sse41 = ecx & (1u << 19);
+        bool osxsave = ecx & (1u << 27);
+        bool avx = ecx & (1u << 28);
+        bool ymm = false;
+        if (osxsave) {
+            uint32_t lo, hi;
+            __asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+            ymm = (lo & 6) == 6;  // OS saves SSE and AVX state
+        }
+        if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return;
+        shani = (ebx & (1u << 29)) && ssse3 && sse41;
+        avx2 = (ebx & (1u << 5)) && avx && ymm;
+    }
+};
+
+const CpuFeatures& cpu() {
+    static const CpuFeatures features;
+    return features;
+}
+
+}  // namespace
+
+// One group of four rounds. Message words rotate through W[0..3] and the
+// E value alternates between E[0] and E[1]; which schedule steps run at
+// group i is fixed, so with constant i the conditions fold away.
+#define SHA1_GROUP(i)                                                                  \
+    do {                                                                               \
+        if ((i) < 4) W[(i) % 4] = _mm_shuffle_epi8(_mm_loadu_si128(                        \
+                                  reinterpret_cast<const __m128i*>(blocks + 16 * (i))), MASK); \
+        if ((i) == 0) E[0] = _mm_add_epi32(E[0], W[0]);                                \
+        else E[(i) % 2] = _mm_sha1nexte_epu32(E[(i) % 2], W[(i) % 4]);                 \
+        E[((i) + 1) % 2] = ABCD;                                                       \
+        if ((i) >= 3 && (i) <= 18) W[((i) + 1) % 4] = _mm_sha1msg2_epu32(W[((i) + 1) % 4], W[(i) % 4]); \
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E[(i) % 2], (i) / 5);                         \
+        if ((i) >= 1 && (i) <= 16) W[((i) + 3) % 4] = _mm_sha1msg1_epu32(W[((i) + 3) % 4], W[(i) % 4]); \
+        if ((i) >= 2 && (i) <= 17) W[((i) + 2) % 4] = _mm_xor_si128(W[((i) + 2) % 4], W[(i) % 4]); \
+    } while (0)
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha1_compress_shani(uint32_t* state, const unsigned char* blocks, size_t count) {
+    const __m128i MASK = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i ABCD = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0x1b);
+    __m128i E0 = _mm_set_epi32(static_cast<int>(state[4]), 0, 0, 0);
+    for (; count > 0; --count, blocks += 64) {
+        __m128i ABCD_SAVE = ABCD;
+        __m128i E0_SAVE = E0;
+        __m128i W[4];
+        __m128i E[2] = {E0, E0};
+        SHA1_GROUP(0); SHA1_GROUP(1); SHA1_GROUP(2); SHA1_GROUP(3); SHA1_GROUP(4);
+        SHA1_GROUP(5); SHA1_GROUP(6); SHA1_GROUP(7); SHA1_GROUP(8); SHA1_GROUP(9);
+        SHA1_GROUP(10); SHA1_GROUP(11); SHA1_GROUP(12); SHA1_GROUP(13); SHA1_GROUP(14);
+        SHA1_GROUP(15); SHA1_GROUP(16); SHA1_GROUP(17); SHA1_GROUP(18); SHA1_GROUP(19);
+        E0 = _mm_sha1nexte_epu32(E[0], E0_SAVE);
+        ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_shuffle_epi32(ABCD, 0x1b));
+    state[4] = static_cast<uint32_t>(_mm_extract_epi32(E0, 3));
+}
+
+#undef SHA1_GROUP
+
+// Eight messages side by side, one per 32-bit lane. Lanes whose message
+// has run out of blocks keep their state while the others finish.
+struct Sha1Lane {
+    const unsigned char* data;
+    size_t full_blocks;
+    size_t blocks;
+    unsigned char tail[128];
+};
+
+__attribute__((target("avx2")))
+static inline __m256i rol(__m256i x, int n) {
+    return _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - n));
+}
+
+__attribute__((target("avx2")))
+static void sha1_x8_avx2(Sha1Lane* lanes, size_t nlanes, ObjectId* out) {
+    static const unsigned char zero_block[64] = {};
+    __m256i state[5];
+    for (int i = 0; i < 5; ++i) state[i] = _mm256_set1_epi32(static_cast<int>(SHA1_INIT[i]));
+    size_t max_blocks = 0;
+    for (size_t l = 0; l < nlanes; ++l) max_blocks = std::max(max_blocks, lanes[l].blocks);
+
+    alignas(32) uint32_t words[16][8];
+    alignas(32) int32_t active[8];
+    for (size_t b = 0; b < max_blocks; ++b) {
+        for (size_t l = 0; l < 8; ++l) {
+            const unsigned char* block = zero_block;
+            if (l < nlanes && b < lanes[l].blocks) {
+                block = b < lanes[l].full_blocks ? lanes[l].data + 64 * b
+                                                 : lanes[l].tail + 64 * (b - lanes[l].full_blocks);
+            }
+            active[l] = l < nlanes && b < lanes[l].blocks ? -1 : 0;
+            for (int j = 0; j < 16; ++j) words[j][l] = load_be32(block + 4 * j);
+        }
+        __m256i W[16];
+        for (int j = 0; j < 16; ++j) W[j] = _mm256_load_si256(reinterpret_cast<const __m256i*>(words[j]));
+        __m256i a = state[0], bb = state[1], c = state[2], d = state[3], e = state[4];
+        for (int t = 0; t < 80; ++t) {
+            if (t >= 16) {
+                W[t % 16] = rol(_mm256_xor_si256(_mm256_xor_si256(W[(t - 3) % 16], W[(t - 8) % 16]),
+                                                 _mm256_xor_si256(W[(t - 14) % 16], W[t % 16])), 1);
+            }
+            __m256i f, k;
+            if (t < 20) {
+                f = _mm256_xor_si256(d, _mm256_and_si256(bb, _mm256_xor_si256(c, d)));
+                k = _mm256_set1_epi32(0x5a827999);
+            } else if (t < 40) {
+                f = _mm256_xor_si256(_mm256_xor_si256(bb, c), d);
+                k = _mm256_set1_epi32(0x6ed9eba1);
+            } else if (t < 60) {
+                f = _mm256_or_si256(_mm256_and_si256(bb, c), _mm256_and_si256(d, _mm256_or_si256(bb, c)));
+                k = _mm256_set1_epi32(static_cast<int>(0x8f1bbcdc));
+            } else {
+                f = _mm256_xor_si256(_mm256_xor_si256(bb, c), d);
+                k = _mm256_set1_epi32(static_cast<int>(0xca62c1d6));
+            }
+            __m256i temp = _mm256_add_epi32(_mm256_add_epi32(rol(a, 5), f),
+                                            _mm256_add_epi32(_mm256_add_epi32(e, k), W[t % 16]));
+            e = d;
+            d = c;
+            c = rol(bb, 30);
+            bb = a;
+            a = temp;
+        }
+        __m256i mask = _mm256_load_si256(reinterpret_cast<const __m256i*>(active));
+        __m256i sums[5] = {a, bb, c, d, e};
+        for (int i = 0; i < 5; ++i) {
+            state[i] = _mm256_blendv_epi8(state[i], _mm256_add_epi32(state[i], sums[i]), mask);
+        }
+    }
+
+    alignas(32) uint32_t result[5][8];
+    for (int i = 0; i < 5; ++i) _mm256_store_si256(reinterpret_cast<__m256i*>(result[i]), state[i]);
+    for (size_t l = 0; l < nlanes; ++l) {
+        for (int i = 0; i < 5; ++i) store_be32(out[l].bytes.data() + 4 * i, result[i][l]);
+    }
+}
+
+#endif  // GITLITE_SHA1_X86
+
+bool sha1_backend_available(Sha1Backend backend) {
+    switch (backend) {
+        case Sha1Backend::OPENSSL: return true;
+#ifdef GITLITE_SHA1_X86
+        case Sha1Backend::SHANI: return cpu().shani;
+        case Sha1Backend::AVX2: return cpu().avx2;
+#else
+        default: return false;
+#endif
+    }
+    return false;
+}
+
+const char* sha1_backend_name(Sha1Backend backend) {
+    switch (backend) {
+        case Sha1Backend::OPENSSL: return "openssl";
+        case Sha1Backend::SHANI: return "shani";
+        case Sha1Backend::AVX2: return "avx2";
+    }
+    return "unknown";
+}
+
+static Sha1Backend pick_backend() {
+    if (const char* env = std::getenv("GITLITE_SHA1")) {
+        for (Sha1Backend b : {Sha1Backend::OPENSSL, Sha1Backend::SHANI, Sha1Backend::AVX2}) {
+            if (std::string(env) != sha1_backend_name(b)) continue;
+            if (sha1_backend_available(b)) return b;
+            std::cerr << "warning: SHA-1 backend '" << env << "' not available, using openssl" << std::endl;
+            return Sha1Backend::OPENSSL;
+        }
+        std::cerr << "warning: unknown SHA-1 backend '" << env << "', using the default" << std::endl;
+    }
+    // SHA-NI hashes one stream about as fast as AVX2 hashes eight, and it
+    // needs no batching, so it wins whenever it's there
+    if (sha1_backend_available(Sha1Backend::SHANI)) return Sha1Backend::SHANI;
+    if (sha1_backend_available(Sha1Backend::AVX2)) return Sha1Backend::AVX2;
+    return Sha1Backend::OPENSSL;
+}
+
+Sha1Backend sha1_backend() {
+    static const Sha1Backend backend = pick_backend();
+    return backend;
+}
+
+Sha1::Sha1(Sha1Backend backend) {
+#ifdef GITLITE_SHA1_X86
+    // Single streams have no AVX2 path; they use SHA-NI when the CPU has it
+    if (backend != Sha1Backend::OPENSSL && cpu().shani) compress_ = sha1_compress_shani;
+#else
+    (void)backend;
+#endif
+    if (compress_) {
+        std::memcpy(state_, SHA1_INIT, sizeof(state_));
+    } else {
+        evp_ = EVP_MD_CTX_new();
+        if (!evp_ || EVP_DigestInit_ex(evp_, EVP_sha1(), nullptr) != 1) throw std::runtime_error("SHA-1 init error");
+    }
+}
+
+Sha1::~Sha1() {
+    if (evp_) EVP_MD_CTX_free(evp_);
+}
+
+void Sha1::update(const void* data, size_t len) {
+    if (evp_) {
+        EVP_DigestUpdate(evp_, data, len);
+        return;
+    }
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    total_ += len;
+    if (buf_len_ > 0) {
+        size_t take = std::min(len, 64 - buf_len_);
+        std::memcpy(buf_ + buf_len_, p, take);
+        buf_len_ += take;
+        p += take;
+        len -= take;
+        if (buf_len_ < 64) return;
+        compress_(state_, buf_, 1);
+        buf_len_ = 0;
+    }
+    if (len >= 64) {
+        compress_(state_, p, len / 64);
+        p += len / 64 * 64;
+        len %= 64;
+    }
+    std::memcpy(buf_, p, len);
+    buf_len_ = len;
+}
+
+ObjectId Sha1::finish() {
+    ObjectId id;
+    if (evp_) {
+        unsigned int len = 0;
+        EVP_DigestFinal_ex(evp_, id.bytes.data(), &len);
+        return id;
+    }
+    unsigned char tail[128];
+    size_t blocks = sha1_tail(buf_, buf_len_, total_, tail);
+    compress_(state_, tail, blocks);
+    for (int i = 0; i < 5; ++i) store_be32(id.bytes.data() + 4 * i, state_[i]);
+    return id;
+}
+
+ObjectId sha1(const void* data, size_t len, Sha1Backend backend) {
+    Sha1 ctx(backend);
+    ctx.update(data, len);
+    return ctx.finish();
+}
+
+void sha1_many(const Sha1Message* messages, size_t count, ObjectId* out, Sha1Backend backend) {
+#ifdef GITLITE_SHA1_X86
+    if (backend == Sha1Backend::AVX2 && cpu().avx2 && count > 1) {
+        // Similar lengths share a batch so few lanes sit idle
+        std::vector<size_t> order(count);
+        std::iota(order.begin(), order.end(), size_t(0));
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return messages[a].len < messages[b].len; });
+        Sha1Lane lanes[8];
+        ObjectId ids[8];
+        for (size_t i = 0; i < count; i += 8) {
+            size_t n = std::min<size_t>(8, count - i);
+            for (size_t l = 0; l < n; ++l) {
+                const Sha1Message& m = messages[order[i + l]];
+                const unsigned char* data = static_cast<const unsigned char*>(m.data);
+                lanes[l].data = data;
+                lanes[l].full_blocks = m.len / 64;
+                lanes[l].blocks = lanes[l].full_blocks +
+                                  sha1_tail(data + m.len / 64 * 64, m.len % 64, m.len, lanes[l].tail);
+            }
+            sha1_x8_avx2(lanes, n, ids);
+            for (size_t l = 0; l < n; ++l) out[order[i + l]] = ids[l];
+        }
+        return;
+    }
+#endif
+    for (size_t i = 0; i < count; ++i) out[i] = sha1(messages[i].data, messages[i].len, backend);
+}
@@ -0,0 +1,99 @@
+#include "sparse.h"
+#include <fnmatch.h>
+#include <fstream>
+#include <sstream>
+
+static fs::path sparse_path(const GitRepository& repo) {
+    return repo.gitdir / "info" / "sparse-checkout";
+}
+
+std::unique_ptr<SparseFilter> SparseFilter::load(const GitRepository& repo) {
+    std::ifstream file(sparse_path(repo));
+    if (!file) return nullptr;
+    std::ostringstream text;
+    text << file.rdbuf();
+    return from_patterns(text.str());
+}
+
+std::unique_ptr<SparseFilter> SparseFilter::from_patterns(std::string text) {
+    std::unique_ptr<SparseFilter> filter(new SparseFilter);
+    filter->has_patterns_ = true;
+    filter->text_ = std::move(text);
+    filter->rules_ = IgnoreRules(filter->text_, "");
+    return filter;
+}
+
+std::unique_ptr<SparseFilter> SparseFilter::from_pathspecs(const SparseFilter* base,
+                                                           std::vector<std::string> pathspecs) {
+    std::unique_ptr<SparseFilter> filter(base ? from_patterns(base->text_).release() : new SparseFilter);
+    for (auto& spec : pathspecs) {
+        while (spec.size() > 1 && spec.back() == '/') spec.pop_back();
+        if (spec.rfind("./", 0) == 0) spec.erase(0, 2);
+        if (spec.empty() || spec == "." || spec == "/") return filter;  // The whole tree
+    }
+    filter->pathspecs_ = std::move(pathspecs);
+    return filter;
+}
+
+// Inside `dir` (or `dir` itself)
+static bool path_within(const std::string& path, const std::string& dir) {
+    return path.compare(0, dir.size(), dir) == 0 && (path.size() == dir.size() || path[dir.size()] == '/');
+}
+
+bool SparseFilter::pattern_includes(std::string_view path, bool is_dir) const {
+    for (;;) {
+        size_t slash = path.rfind('/');
+        std::string_view name = slash == std::string_view::npos ? path : path.substr(slash + 1);
+        IgnoreRules::Result result = rules_.match(path, name, is_dir);
+        if (result != IgnoreRules::NONE) return result == IgnoreRules::IGNORED;
+        if (slash == std::string_view::npos) return false;
+        path = path.substr(0, slash);
+        is_dir = true;
+    }
+}
+
+bool SparseFilter::pathspec_includes(const std::string& path) const {
+    if (pathspecs_.empty()) return true;
+    for (const auto& spec : pathspecs_) {
+        if (path_within(path, spec)) return true;
+        if (has_glob(spec) && fnmatch(spec.c_str(), path.c_str(), 0) == 0) return true;
+    }
+    return false;
+}
+
+bool SparseFilter::pathspec_prunes(const std::string& path) const {
+    if (pathspecs_.empty()) return false;
+    for (const auto& spec : pathspecs_) {
+        // Only the part before the first wildcard has to line up
+        std::string literal = spec.substr(0, spec.find_first_of("*?[\\"));
+        if (literal.size() < spec.size()) {
+            size_t n = std::min(literal.size(), path.size() + 1);
+            if ((path + "/").compare(0, n, literal, 0, n) == 0) return false;
+        } else if (path_within(path, spec) || path_within(spec, path)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SparseFilter::includes(const std::string& path, bool is_dir) const {
+    if (!pathspec_includes(path)) return false;
+    return !has_patterns_ || pattern_includes(path, is_dir);
+}
+
+bool SparseFilter::prunes(const std::string& path) const {
+    if (pathspec_prunes(path)) return true;
+    return has_patterns_ && !pattern_includes(path, true) && !rules_.may_match_below(path);
+}
+
+void sparse_save(const GitRepository& repo, const SparseFilter* filter) {
+    fs::path path = sparse_path(repo);
+    if (!filter) {
+        fs::remove(path);
+        return;
+    }
+    fs::create_directories(path.parent_path());
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file << filter->text();
+    if (!file.flush()) throw std::runtime_error("Failed to write " + path.string());
+}
@@ -0,0 +1,124 @@
+#include "thread_pool.h"
+
+// Identifies the pool and queue of the current worker thread (if any)
+static thread_local ThreadPool* tls_pool = nullptr;
+static thread_local size_t tls_index = 0;
+
+ThreadPool::ThreadPool(unsigned threads) {
+    if (threads <= 1) return;  // Inline mode
+    for (unsigned i = 0; i < threads; ++i) {
+        queues_.push_back(std::make_unique<Queue>());
+    }
+    for (unsigned i = 0; i < threads; ++i) {
+        workers_.emplace_back([this, i] { run(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        stop_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& t : workers_) t.join();
+}
+
+unsigned ThreadPool::default_threads() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    pending_.fetch_add(1);
+    if (workers_.empty()) {
+        execute(task);
+        finish_one();
+        return;
+    }
+    // Workers keep their own spawned tasks local; outsiders spread round-robin
+    size_t target = (tls_pool == this) ? tls_index : next_.fetch_add(1) % queues_.size();
+    {
+        std::lock_guard<std::mutex> lk(queues_[target]->mu);
+        queues_[target]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        ++queued_;
+    }
+    work_cv_.notify_one();
+}
+
+void ThreadPool::wait() {
+    {
+        std::unique_lock<std::mutex> lk(mu_);
+        done_cv_.wait(lk, [this] { return pending_.load() == 0; });
+    }
+    if (error_) {
+        std::exception_ptr e = error_;
+        error_ = nullptr;
+        failed_ = false;
+        std::rethrow_exception(e);
+    }
+}
+
+bool ThreadPool::try_pop(size_t self, std::function<void()>& task) {
+    // Own queue first, newest task
+    {
+        Queue& q = *queues_[self];
+        std::lock_guard<std::mutex> lk(q.mu);
+        if (!q.tasks.empty()) {
+            task = std::move(q.tasks.back());
+            q.tasks.pop_back();
+            return true;
+        }
+    }
+    // Steal the oldest task from a victim
+    for (size_t i = 1; i < queues_.size(); ++i) {
+        Queue& q = *queues_[(self + i) % queues_.size()];
+        std::lock_guard<std::mutex> lk(q.mu);
+        if (!q.tasks.empty()) {
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run(size_t self) {
+    tls_pool = this;
+    tls_index = self;
+    for (;;) {
+        std::function<void()> task;
+        if (try_pop(self, task)) {
+            {
+                std::lock_guard<std::mutex> lk(mu_);
+                --queued_;
+            }
+            execute(task);
+            finish_one();
+            continue;
+        }
+        std::unique_lock<std::mutex> lk(mu_);
+        work_cv_.wait(lk, [this] { return stop_ || queued_ > 0; });
+        if (stop_ && queued_ == 0) return;
+    }
+}
+
+void ThreadPool::execute(std::function<void()>& task) {
+    if (failed_.load()) return;  // Skip remaining work after a failure
+    try {
+        task();
+    } catch (...) {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (!error_) error_ = std::current_exception();
+        failed_ = true;
+    }
+}
+
+void ThreadPool::finish_one() {
+    if (pending_.fetch_sub(1) == 1) {
+        std::lock_guard<std::mutex> lk(mu_);
+        done_cv_.notify_all();
+    }
+}
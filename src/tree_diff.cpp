@@ -0,0 +1,118 @@
+#include "tree_diff.h"
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include "object_cache.h"
+
+static constexpr uint32_t TREE_MODE = 040000;
+
+static uint64_t total_trees_read = 0;
+static uint64_t total_unchanged = 0;
+
+namespace {
+
+struct TreeDiffWalk {
+    const GitRepository& repo;
+    const TreeChangeFn& fn;
+    const TreeFilter* old_filter;
+    const TreeFilter* new_filter;
+    TreeDiffStats stats;
+
+    static bool kept(const TreeFilter* filter, const std::string& path, const GitTreeLeaf& leaf) {
+        if (!filter) return true;
+        return leaf.mode == TREE_MODE ? !filter->prunes(path) : filter->includes(path, false);
+    }
+
+    // Counted against a full checkout of the new side
+    void count_excluded(const GitTreeLeaf& leaf) {
+        if (leaf.mode == TREE_MODE) {
+            ++stats.trees_pruned;
+            return;
+        }
+        ++stats.files_excluded;
+        std::string fmt;
+        uint64_t size = 0;
+        if (leaf.mode != 0160000 && object_read_header(repo, leaf.sha, fmt, size)) stats.bytes_excluded += size;
+    }
+
+    // Entries of a tree in Git order; trees written by other tools should
+    // already be, so the sort is normally a no-op
+    std::vector<const GitTreeLeaf*> entries(const std::string& sha, std::shared_ptr<const GitTree>& keep) {
+        std::vector<const GitTreeLeaf*> out;
+        if (sha.empty()) return out;
+        keep = object_cache_tree(repo, sha);
+        ++stats.trees_read;
+        out.reserve(keep->items.size());
+        for (const auto& leaf : keep->items) out.push_back(&leaf);
+        auto less = [](const GitTreeLeaf* a, const GitTreeLeaf* b) { return tree_order(*a, *b) < 0; };
+        if (!std::is_sorted(out.begin(), out.end(), less)) std::sort(out.begin(), out.end(), less);
+        return out;
+    }
+
+    void report(char status, const std::string& path, const GitTreeLeaf* o, const GitTreeLeaf* n) {
+        TreeChange change{status, path, o ? o->mode : 0, n ? n->mode : 0, o ? o->sha : "", n ? n->sha : ""};
+        if (fn(change) && change.is_tree()) {
+            walk(o && o->mode == TREE_MODE ? o->sha : "", n && n->mode == TREE_MODE ? n->sha : "", path + "/");
+        }
+    }
+
+    void walk(const std::string& old_tree, const std::string& new_tree, const std::string& prefix) {
+        std::shared_ptr<const GitTree> old_obj, new_obj;
+        auto olds = entries(old_tree, old_obj);
+        auto news = entries(new_tree, new_obj);
+        size_t i = 0, j = 0;
+        while (i < olds.size() || j < news.size()) {
+            const GitTreeLeaf* o = i < olds.size() ? olds[i] : nullptr;
+            const GitTreeLeaf* n = j < news.size() ? news[j] : nullptr;
+            if (o && n) {
+                int cmp = tree_order(*o, *n);
+                if (cmp < 0) n = nullptr;
+                else if (cmp > 0) o = nullptr;
+            }
+            if (o) ++i;
+            if (n) ++j;
+            bool same = o && n && o->mode == n->mode && o->sha == n->sha;
+            if (same && old_filter == new_filter) {
+                ++stats.unchanged;
+                continue;
+            }
+            if (old_filter || new_filter) {
+                std::string path = prefix + (o ? o->path : n->path);
+                if (o && !kept(old_filter, path, *o)) o = nullptr;
+                if (n && !kept(new_filter, path, *n)) {
+                    if (!same) count_excluded(*n);
+                    n = nullptr;
+                }
+                if (same && o && n && o->mode != TREE_MODE) {
+                    ++stats.unchanged;
+                    continue;
+                }
+            }
+
+            if (o && n) {
+                report('M', prefix + n->path, o, n);
+            } else if (n) {
+                report('A', prefix + n->path, nullptr, n);
+            } else if (o) {
+                report('D', prefix + o->path, o, nullptr);
+            }
+        }
+    }
+};
+
+}  // namespace
+
+TreeDiffStats tree_diff(const GitRepository& repo, const std::string& old_tree, const std::string& new_tree,
+                        const TreeChangeFn& fn, const TreeFilter* old_filter, const TreeFilter* new_filter) {
+    TreeDiffWalk walk{repo, fn, old_filter, new_filter, {}};
+    if (old_tree != new_tree || old_filter != new_filter) walk.walk(old_tree, new_tree, "");
+    total_trees_read += walk.stats.trees_read;
+    total_unchanged += walk.stats.unchanged;
+    return walk.stats;
+}
+
+void tree_diff_print_stats(std::ostream& out) {
+    if (total_trees_read == 0) return;
+    out << "tree diff: " << total_trees_read << " trees read, " << total_unchanged << " unchanged entries skipped"
+        << std::endl;
+}
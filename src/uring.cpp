@@ -0,0 +1,233 @@
+#include "uring.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static std::atomic<uint64_t> stat_batches{0};
+static std::atomic<uint64_t> stat_ops{0};
+static std::atomic<uint64_t> stat_enters{0};
+
+static int sys_io_uring_setup(unsigned entries, io_uring_params* p) {
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+// Steps of a file's chain, kept in the low bits of user_data
+enum : uint64_t { STEP_OPEN = 0, STEP_IO = 1, STEP_CLOSE = 2 };
+
+std::unique_ptr<IoRing> IoRing::create(unsigned slots) {
+    if (slots == 0) return nullptr;
+    std::unique_ptr<IoRing> ring(new IoRing);
+    io_uring_params p{};
+    ring->fd_ = sys_io_uring_setup(slots * 3, &p);
+    if (ring->fd_ < 0) return nullptr;
+    ring->slots_ = slots;
+
+    ring->sq_map_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_map_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) ring->sq_map_size_ = ring->cq_map_size_ = std::max(ring->sq_map_size_, ring->cq_map_size_);
+    void* sq = ::mmap(nullptr, ring->sq_map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd_,
+                      IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) return nullptr;
+    ring->sq_map_ = sq;
+    void* cq = sq;
+    if (!single) {
+        cq = ::mmap(nullptr, ring->cq_map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd_,
+                    IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) return nullptr;
+        ring->cq_map_ = cq;
+    }
+    ring->sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = ::mmap(nullptr, ring->sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd_,
+                        IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) return nullptr;
+    ring->sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    auto at = [](void* base, uint32_t off) { return reinterpret_cast<unsigned*>(static_cast<char*>(base) + off); };
+    ring->sq_tail_ = at(sq, p.sq_off.tail);
+    ring->sq_mask_ = at(sq, p.sq_off.ring_mask);
+    ring->sq_array_ = at(sq, p.sq_off.array);
+    ring->cq_head_ = at(cq, p.cq_off.head);
+    ring->cq_tail_ = at(cq, p.cq_off.tail);
+    ring->cq_mask_ = at(cq, p.cq_off.ring_mask);
+    ring->cqes_ = reinterpret_cast<io_uring_cqe*>(static_cast<char*>(cq) + p.cq_off.cqes);
+
+    // Every opcode a chain uses must be there
+    size_t probe_size = sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op);
+    std::unique_ptr<char[]> probe_buf(new char[probe_size]());
+    auto* probe = reinterpret_cast<io_uring_probe*>(probe_buf.get());
+    if (sys_io_uring_register(ring->fd_, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) < 0) return nullptr;
+    for (unsigned op : {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE}) {
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) return nullptr;
+    }
+
+    // Empty slots that the chains open files into
+    std::vector<int> empty(slots, -1);
+    if (sys_io_uring_register(ring->fd_, IORING_REGISTER_FILES, empty.data(), slots) < 0) return nullptr;
+    ring->opened_.resize(slots);
+    ring->transferred_.resize(slots);
+    ring->closed_.resize(slots);
+
+    // Opening into a slot and closing one by index came after the opcodes
+    // themselves, and the probe doesn't tell; try it for real
+    unsigned char byte;
+    Read check{"/dev/null", &byte, 1};
+    ring->read_files(&check, 1);
+    if (check.result != 0) return nullptr;
+    ring->counted_ = true;
+    return ring;
+}
+
+IoRing::~IoRing() {
+    if (sqes_) ::munmap(sqes_, sqes_size_);
+    if (cq_map_) ::munmap(cq_map_, cq_map_size_);
+    if (sq_map_) ::munmap(sq_map_, sq_map_size_);
+    if (fd_ >= 0) ::close(fd_);
+}
+
+void IoRing::queue_chain(unsigned i, const char* path, int flags, uint8_t op, const void* buf, uint32_t len) {
+    // Hard links so a short read (the usual end of a file) doesn't cancel
+    // the close after it
+    auto next = [&](uint8_t opcode, uint64_t step) {
+        unsigned tail = *sq_tail_ + queued_++;
+        unsigned idx = tail & *sq_mask_;
+        io_uring_sqe* sqe = &sqes_[idx];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = opcode;
+        sqe->user_data = (static_cast<uint64_t>(i) << 2) | step;
+        sq_array_[idx] = idx;
+        return sqe;
+    };
+    io_uring_sqe* open = next(IORING_OP_OPENAT, STEP_OPEN);
+    open->fd = AT_FDCWD;
+    open->addr = reinterpret_cast<uint64_t>(path);
+    open->len = 0666;
+    // No O_CLOEXEC: the kernel refuses it for a direct (slot-only) open,
+    // and such a file never gets a descriptor to leak anyway
+    open->open_flags = static_cast<uint32_t>(flags);
+    open->file_index = i + 1;
+    open->flags = IOSQE_IO_HARDLINK;
+
+    io_uring_sqe* io = next(op, STEP_IO);
+    io->fd = static_cast<int32_t>(i);
+    io->addr = reinterpret_cast<uint64_t>(buf);
+    io->len = len;
+    io->off = 0;
+    io->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+
+    io_uring_sqe* close = next(IORING_OP_CLOSE, STEP_CLOSE);
+    close->file_index = i + 1;
+}
+
+void IoRing::run(size_t files) {
+    unsigned ops = queued_;
+    __atomic_store_n(sq_tail_, *sq_tail_ + queued_, __ATOMIC_RELEASE);
+    queued_ = 0;
+    if (counted_) {
+        stat_batches.fetch_add(1, std::memory_order_relaxed);
+        stat_ops.fetch_add(ops, std::memory_order_relaxed);
+    }
+
+    unsigned to_submit = ops, reaped = 0;
+    while (reaped < ops) {
+        int rc = sys_io_uring_enter(fd_, to_submit, ops - reaped, IORING_ENTER_GETEVENTS);
+        if (counted_) stat_enters.fetch_add(1, std::memory_order_relaxed);
+        if (rc < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+            throw std::runtime_error(std::string("io_uring_enter: ") + std::strerror(errno));
+        }
+        to_submit -= std::min<unsigned>(to_submit, static_cast<unsigned>(rc));
+        unsigned head = *cq_head_;
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head, ++reaped) {
+            const io_uring_cqe& cqe = cqes_[head & *cq_mask_];
+            size_t file = cqe.user_data >> 2;
+            if (file >= files) continue;
+            switch (cqe.user_data & 3) {
+                case STEP_OPEN: opened_[file] = cqe.res; break;
+                case STEP_IO: transferred_[file] = cqe.res; break;
+                default: closed_[file] = cqe.res; break;
+            }
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+}
+
+void IoRing::read_files(Read* files, size_t n) {
+    for (size_t start = 0; start < n; start += slots_) {
+        size_t count = std::min<size_t>(n - start, slots_);
+        for (size_t i = 0; i < count; ++i) {
+            Read& f = files[start + i];
+            queue_chain(static_cast<unsigned>(i), f.path, O_RDONLY, IORING_OP_READ, f.buf, f.cap);
+        }
+        run(count);
+        for (size_t i = 0; i < count; ++i) {
+            files[start + i].result = opened_[i] < 0 ? opened_[i] : transferred_[i];
+        }
+    }
+}
+
+void IoRing::write_files(Write* files, size_t n) {
+    for (size_t start = 0; start < n; start += slots_) {
+        size_t count = std::min<size_t>(n - start, slots_);
+        for (size_t i = 0; i < count; ++i) {
+            Write& f = files[start + i];
+            queue_chain(static_cast<unsigned>(i), f.path, O_WRONLY | O_CREAT | O_TRUNC, IORING_OP_WRITE, f.data,
+                        f.len);
+        }
+        run(count);
+        for (size_t i = 0; i < count; ++i) {
+            Write& f = files[start + i];
+            if (opened_[i] < 0) f.result = opened_[i];
+            else if (transferred_[i] < 0) f.result = transferred_[i];
+            else if (static_cast<uint32_t>(transferred_[i]) != f.len) f.result = -EIO;
+            else f.result = closed_[i] < 0 ? closed_[i] : 0;
+        }
+    }
+}
+
+const char* io_backend_name(IoBackend backend) {
+    return backend == IoBackend::URING ? "uring" : "sync";
+}
+
+static IoBackend pick_backend() {
+    const char* env = std::getenv("GITLITE_IO");
+    if (env && std::string(env) == "sync") return IoBackend::SYNC;
+    if (env && std::string(env) != "uring") {
+        std::cerr << "warning: unknown I/O backend '" << env << "', using the default" << std::endl;
+    }
+    if (IoRing::create(1)) return IoBackend::URING;
+    if (env && std::string(env) == "uring") {
+        std::cerr << "warning: I/O backend 'uring' not available, using sync" << std::endl;
+    }
+    return IoBackend::SYNC;
+}
+
+IoBackend io_backend() {
+    static const IoBackend backend = pick_backend();
+    return backend;
+}
+
+void uring_print_stats(std::ostream& out) {
+    if (stat_batches == 0) return;
+    out << "uring: " << stat_batches << " batches, " << stat_ops << " operations, " << stat_enters
+        << " io_uring_enter calls" << std::endl;
+}
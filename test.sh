@@ -56,6 +56,61 @@ if [ "$ls_tree_output" != "$expected_ls_tree" ]; then
 fi
 echo "write-tree and ls-tree: OK"
 
+# Test parallel write-tree gives the same tree as the serial path
+mkdir -p sub/deeper
+echo "nested" > sub/deeper/nested.txt
+echo "side" > sub/side.txt
+serial_sha=$(../build/gitlite write-tree -j 1)
+parallel_sha=$(../build/gitlite write-tree -j 4)
+if [ "$serial_sha" != "$parallel_sha" ]; then
+    echo "Error: parallel write-tree mismatch ($serial_sha vs $parallel_sha)"
+    exit 1
+fi
+echo "write-tree -j: OK"
+
+# Test Git tree order: directory "a" sorts as "a/", after "a-b" and "a.txt"
+# (the SHA is what git write-tree gives for the same files)
+mkdir order_repo && cd order_repo
+../../build/gitlite init > /dev/null
+mkdir a && echo x > a/f && echo y > a.txt && echo z > a-b
+order_sha=$(../../build/gitlite write-tree)
+if [ "$order_sha" != "4994ff8bf162716de6f7c5747c17b0791c411bc7" ] || ! ../../build/gitlite fsck > /dev/null 2>&1; then
+    echo "Error: write-tree doesn't use Git's tree order: $order_sha"
+    exit 1
+fi
+cd .. && rm -rf order_repo
+echo "write-tree order: OK"
+
+# Test every SHA-1 backend gives the same tree (unavailable ones fall back)
+mv .git/index .git/index.bak
+for backend in openssl shani avx2; do
+    backend_sha=$(GITLITE_SHA1=$backend ../build/gitlite write-tree 2>/dev/null)
+    rm -f .git/index
+    if [ "$backend_sha" != "$serial_sha" ]; then
+        echo "Error: SHA-1 backend $backend gave $backend_sha, expected $serial_sha"
+        exit 1
+    fi
+done
+mv .git/index.bak .git/index
+echo "sha1 backends: OK"
+
+# Test the index stat cache picks up changes and matches an uncached run
+if [ ! -f ".git/index" ]; then
+    echo "Error: write-tree did not write .git/index"
+    exit 1
+fi
+echo "changed" > sub/side.txt
+cached_sha=$(../build/gitlite write-tree)
+mv .git/index .git/index.bak
+uncached_sha=$(../build/gitlite write-tree)
+mv .git/index.bak .git/index
+if [ "$cached_sha" != "$uncached_sha" ] || [ "$cached_sha" == "$parallel_sha" ]; then
+    echo "Error: index stat cache returned a stale tree"
+    exit 1
+fi
+rm -rf sub
+echo "write-tree index: OK"
+
 # Test commit-tree (first commit)
 commit_sha1=$(../build/gitlite commit-tree $tree_sha -m "Initial commit")
 echo "Commit SHA1: $commit_sha1"
@@ -76,6 +131,22 @@ if ! echo "$log_output2" | grep -q "Second commit" || ! echo "$log_output2" | gr
 fi
 echo "commit-tree and log (chain): OK"
 
+# Test object cache counters
+stats_output=$(GITLITE_STATS=1 ../build/gitlite log $commit_sha2 2>&1 >/dev/null)
+if ! echo "$stats_output" | grep -q "object cache: .* misses"; then
+    echo "Error: GITLITE_STATS did not report object cache counters"
+    exit 1
+fi
+echo "object cache stats: OK"
+
+# Test I/O counters: a log over loose commits opens each one with no zlib setup after the first
+io_stats=$(GITLITE_STATS=1 ../build/gitlite log $commit_sha2 2>&1 >/dev/null | grep "^io:")
+if ! echo "$io_stats" | grep -q "allocations" || ! echo "$io_stats" | grep -q " 1 zlib inits"; then
+    echo "Error: GITLITE_STATS did not report I/O counters: $io_stats"
+    exit 1
+fi
+echo "io stats: OK"
+
 # Test checkout (remove files, checkout back)
 rm test.txt hello.txt
 ../build/gitlite checkout $commit_sha2
@@ -90,6 +161,101 @@ if [ "$head_content" != "$commit_sha2" ]; then
 fi
 echo "checkout: OK"
 
+# Test incremental checkout only touches what differs between the commits
+echo "extra" > extra.txt
+extra_tree=$(../build/gitlite write-tree)
+commit_sha3=$(../build/gitlite commit-tree $extra_tree -p $commit_sha2 -m "Add extra")
+../build/gitlite checkout $commit_sha3 2>/dev/null
+checkout_output=$(../build/gitlite checkout $commit_sha2 2>&1)
+if [ -f "extra.txt" ] || ! echo "$checkout_output" | grep -q "0 written, 1 deleted, 2 unchanged"; then
+    echo "Error: incremental checkout failed: $checkout_output"
+    exit 1
+fi
+echo "incremental checkout: OK"
+
+# Test checkout puts back what the worktree lost, and won't throw away local
+# changes to a file it replaces unless forced
+rm test.txt
+echo "edited" > hello.txt
+../build/gitlite checkout $commit_sha2 2>/dev/null
+if [ ! -f "test.txt" ] || [ "$(cat hello.txt)" = "edited" ]; then
+    echo "Error: checkout of HEAD did not restore deleted and edited files"
+    exit 1
+fi
+echo "local" > extra.txt
+if ../build/gitlite checkout $commit_sha3 2>/dev/null || [ "$(cat extra.txt)" != "local" ]; then
+    echo "Error: checkout overwrote an untracked file"
+    exit 1
+fi
+../build/gitlite checkout --force $commit_sha3 2>/dev/null
+echo "mine" > extra.txt
+if ../build/gitlite checkout $commit_sha2 2>/dev/null || [ "$(cat extra.txt)" != "mine" ] || \
+   [ "$(cat .git/HEAD)" != "$commit_sha3" ]; then
+    echo "Error: checkout deleted a locally changed file"
+    exit 1
+fi
+../build/gitlite checkout --force $commit_sha2 2>/dev/null
+if [ -f "extra.txt" ] || [ "$(cat .git/HEAD)" != "$commit_sha2" ]; then
+    echo "Error: checkout --force did not discard local changes"
+    exit 1
+fi
+echo "checkout local changes: OK"
+
+# Test repack: objects are readable from the pack once loose files are gone
+repack_output=$(../build/gitlite repack -d)
+if ! echo "$repack_output" | grep -q "Packed"; then
+    echo "Error: repack failed: $repack_output"
+    exit 1
+fi
+if [ -n "$(find .git/objects -path .git/objects/pack -prune -o -type f -print)" ]; then
+    echo "Error: repack -d left loose objects behind"
+    exit 1
+fi
+cat_output=$(../build/gitlite cat-file blob $blob_sha)
+if [ "$cat_output" != "test" ]; then
+    echo "Error: cat-file failed for packed blob"
+    exit 1
+fi
+echo "repack: OK"
+
+# Test delta compression between two versions of a file
+seq 1 2000 > numbers.txt
+v1_sha=$(../build/gitlite hash-object numbers.txt)
+echo "one more line" >> numbers.txt
+v2_sha=$(../build/gitlite hash-object numbers.txt)
+repack_output=$(../build/gitlite repack -a -d)
+if ! echo "$repack_output" | grep -q "([1-9][0-9]* deltas)"; then
+    echo "Error: repack did not deltify similar blobs: $repack_output"
+    exit 1
+fi
+if [ "$(../build/gitlite cat-file blob $v2_sha)" != "$(cat numbers.txt)" ] || \
+   [ "$(../build/gitlite cat-file blob $v1_sha)" != "$(seq 1 2000)" ]; then
+    echo "Error: cat-file failed for deltified blob"
+    exit 1
+fi
+rm numbers.txt
+echo "repack deltas: OK"
+
+# Test corrupt pack entry headers: a size past 64 bits or past what the
+# compressed bytes could hold is rejected instead of being allocated
+mkdir bad_pack_repo && cd bad_pack_repo
+../../build/gitlite init > /dev/null
+echo "hello" > a
+bad_sha=$(../../build/gitlite hash-object a)
+../../build/gitlite repack -d > /dev/null
+bad_pack=$(ls .git/objects/pack/*.pack)
+cp $bad_pack .git/good.pack && chmod u+w $bad_pack
+{ head -c 12 .git/good.pack; printf '\xb6\xff\xff\xff\xff\xff\xff\xff\xff\xff\x01'; tail -c +14 .git/good.pack; } > $bad_pack
+bad_overflow=$(../../build/gitlite cat-file blob $bad_sha 2>&1)
+{ head -c 12 .git/good.pack; printf '\xb6\x80\x80\x80\x80\x01'; tail -c +14 .git/good.pack; } > $bad_pack
+bad_huge=$(../../build/gitlite cat-file blob $bad_sha 2>&1)
+if ! echo "$bad_overflow" | grep -q "Pack entry size too large" || ! echo "$bad_huge" | grep -q "Corrupt packed object"; then
+    echo "Error: corrupt pack entry sizes were not rejected: $bad_overflow / $bad_huge"
+    exit 1
+fi
+cd .. && rm -rf bad_pack_repo
+echo "corrupt pack headers: OK"
+
 # Test log from HEAD
 log_from_head=$(../build/gitlite log)
 if [ "$log_from_head" != "$log_output2" ]; then
@@ -98,6 +264,392 @@ if [ "$log_from_head" != "$log_output2" ]; then
 fi
 echo "log from HEAD: OK"
 
+# Test commit-graph: walks agree with and without the graph, across a merge
+side_sha=$(../build/gitlite commit-tree $extra_tree -p $commit_sha1 -m "Side")
+merge_sha=$(../build/gitlite commit-tree $extra_tree -p $commit_sha3 -p $side_sha -m "Merge")
+revs_before=$(../build/gitlite rev-list --topo-order $merge_sha)
+if [ "$(echo "$revs_before" | wc -l)" -ne 5 ] || [ "$(echo "$revs_before" | tail -1)" != "$commit_sha1" ] || \
+   [ "$(../build/gitlite merge-base $commit_sha3 $side_sha)" != "$commit_sha1" ]; then
+    echo "Error: rev-list/merge-base failed without commit-graph"
+    exit 1
+fi
+../build/gitlite commit-graph write $merge_sha > /dev/null
+graph_stats=$(GITLITE_STATS=1 ../build/gitlite rev-list --topo-order $merge_sha 2>&1 >/dev/null)
+if [ "$(../build/gitlite rev-list --topo-order $merge_sha)" != "$revs_before" ] || \
+   ! echo "$graph_stats" | grep -q "commit graph: 5 from graph, 0 object reads" || \
+   [ "$(../build/gitlite merge-base $commit_sha3 $side_sha)" != "$commit_sha1" ]; then
+    echo "Error: commit-graph walk failed: $graph_stats"
+    exit 1
+fi
+echo "commit-graph: OK"
+
+# Test commit-graph write with refs to an annotated tag and to a tree: the
+# tag is peeled to its commit and the tree is skipped
+mkdir tag_repo && cd tag_repo
+../../build/gitlite init > /dev/null
+printf 'commit refs/heads/main\nmark :1\ncommitter A <a@b> 1700000000 +0000\ndata 2\nm\n\n' > .git/tag_stream
+printf 'tag v1\nfrom :1\ntagger A <a@b> 1700000000 +0000\ndata 4\ntag\n' >> .git/tag_stream
+../../build/gitlite fast-import < .git/tag_stream 2> /dev/null
+rm .git/refs/heads/main
+echo "4b825dc642cb6eb9a060e54bf8d69288fbee4904" > .git/refs/heads/tree_ref
+if [ "$(../../build/gitlite commit-graph write 2>&1)" != "Wrote commit-graph with 1 commits" ]; then
+    echo "Error: commit-graph write didn't peel the tag or skip the tree"
+    exit 1
+fi
+cd .. && rm -rf tag_repo
+echo "commit-graph tag refs: OK"
+
+# Test the compression policy: random data is stored uncompressed, -c overrides the level
+head -c 8192 /dev/urandom > random.bin
+compress_stats=$(GITLITE_STATS=1 ../build/gitlite hash-object random.bin 2>&1 >/dev/null)
+if ! echo "$compress_stats" | grep -q "compression: 1 objects, 1 stored uncompressed"; then
+    echo "Error: incompressible blob was not detected: $compress_stats"
+    exit 1
+fi
+seq 1 5000 > numbers.txt
+fast_sha=$(../build/gitlite -c compression.level=fast hash-object numbers.txt)
+fast_size=$(wc -c < .git/objects/${fast_sha:0:2}/${fast_sha:2})
+rm -f .git/objects/${fast_sha:0:2}/${fast_sha:2}
+none_sha=$(../build/gitlite -c compression.level=none hash-object numbers.txt)
+none_size=$(wc -c < .git/objects/${none_sha:0:2}/${none_sha:2})
+if [ "$fast_sha" != "$none_sha" ] || [ "$fast_size" -ge "$none_size" ] || \
+   [ "$(../build/gitlite cat-file blob $none_sha)" != "$(seq 1 5000)" ]; then
+    echo "Error: compression level override failed ($fast_size vs $none_size bytes)"
+    exit 1
+fi
+rm random.bin numbers.txt
+echo "compression policy: OK"
+
+# Test cat-file --batch-check / --batch: packed deltas, loose objects and missing names in one process
+v2_size=$({ seq 1 2000; echo "one more line"; } | wc -c)
+batch_check=$(printf '%s\n' $v2_sha $none_sha $merge_sha 0123456789012345678901234567890123456789 | ../build/gitlite cat-file --batch-check)
+expected_check="$v2_sha blob $v2_size
+$none_sha blob $(seq 1 5000 | wc -c)
+$merge_sha commit $(../build/gitlite cat-file commit $merge_sha | wc -c)
+0123456789012345678901234567890123456789 missing"
+batch_bytes=$(printf '%s\n%s\n' $v2_sha $none_sha | ../build/gitlite cat-file --batch | wc -c)
+if [ "$batch_check" != "$expected_check" ] || \
+   [ "$batch_bytes" != "$(( $(echo "$batch_check" | head -2 | wc -c) + v2_size + $(seq 1 5000 | wc -c) + 2 ))" ]; then
+    echo "Error: cat-file --batch failed: $batch_check"
+    exit 1
+fi
+echo "cat-file --batch: OK"
+
+# Test streaming reads: a multi-chunk blob round-trips, a swapped object file is caught by its SHA
+seq 1 200000 > big.txt
+big_sha=$(../build/gitlite hash-object big.txt)
+if ! ../build/gitlite cat-file blob $big_sha | cmp -s - big.txt; then
+    echo "Error: streamed cat-file differs from the original"
+    exit 1
+fi
+chmod u+w .git/objects/${big_sha:0:2}/${big_sha:2} 2>/dev/null
+cp .git/objects/${none_sha:0:2}/${none_sha:2} .git/objects/${big_sha:0:2}/${big_sha:2}
+if ../build/gitlite cat-file blob $big_sha 2>&1 >/dev/null | grep -q "does not match its SHA-1"; then
+    echo "streaming object reads: OK"
+else
+    echo "Error: streamed read did not verify the object's SHA-1"
+    exit 1
+fi
+rm -f big.txt .git/objects/${big_sha:0:2}/${big_sha:2}
+
+# Test concurrent writers: 8 processes storing the same new objects at once, all fsync modes
+mkdir stress
+for i in $(seq 1 40); do echo "stress $i" > stress/s$i.txt; done
+for mode in none object batch; do
+    rm -rf .git/objects/tmp_obj_*
+    pids=""
+    for w in $(seq 1 8); do
+        (for f in stress/*.txt; do ../build/gitlite -c core.fsyncObjects=$mode hash-object $f; done > stress/out$w) &
+        pids="$pids $!"
+    done
+    wait $pids
+    for w in $(seq 2 8); do
+        if ! cmp -s stress/out1 stress/out$w; then
+            echo "Error: concurrent writers disagree on object IDs ($mode)"
+            exit 1
+        fi
+    done
+    if ../build/gitlite cat-file --batch < stress/out1 | grep -q "missing" || ls .git/objects | grep -q tmp_obj; then
+        echo "Error: concurrent writers left missing objects or temp files ($mode)"
+        exit 1
+    fi
+    for sha in $(cat stress/out1); do rm -f .git/objects/${sha:0:2}/${sha:2}; done
+done
+rewrite_stats=$(GITLITE_STATS=1 ../build/gitlite hash-object stress/s1.txt 2>&1 >/dev/null; \
+                GITLITE_STATS=1 ../build/gitlite hash-object stress/s1.txt 2>&1 >/dev/null)
+if ! echo "$rewrite_stats" | tail -1 | grep -q " 1 existing objects not rewritten"; then
+    echo "Error: existing object was rewritten: $rewrite_stats"
+    exit 1
+fi
+rm -rf stress
+echo "concurrent object writes: OK"
+
+# Test abbreviated SHAs: these two blobs both start with 1201
+echo "abbrev 97" > abbrev1.txt
+echo "abbrev 278" > abbrev2.txt
+abbrev_sha=$(../build/gitlite hash-object abbrev1.txt)
+../build/gitlite hash-object abbrev2.txt > /dev/null
+if ! ../build/gitlite cat-file blob 1201 2>&1 | grep -q "ambiguous" || \
+   [ "$(../build/gitlite cat-file blob ${abbrev_sha:0:7})" != "abbrev 97" ] || \
+   [ "$(echo ${abbrev_sha:0:7} | ../build/gitlite cat-file --batch-check)" != "$abbrev_sha blob 10" ] || \
+   [ "$(printf '1201\n\n  \n' | ../build/gitlite cat-file --batch-check)" != "$(printf '1201 ambiguous\n missing\n   missing')" ]; then
+    echo "Error: abbreviated SHA lookup failed"
+    exit 1
+fi
+rm -f abbrev1.txt abbrev2.txt
+echo "abbreviated SHAs: OK"
+
+# Test diff-tree: only changed paths are listed, unchanged subtrees are never read
+mkdir -p dt/same dt/changed
+echo one > dt/same/f.txt
+echo two > dt/changed/f.txt
+dt_before=$(../build/gitlite write-tree)
+echo three > dt/changed/f.txt
+echo four > dt/new.txt
+dt_after=$(../build/gitlite write-tree)
+dt_out=$(GITLITE_STATS=1 ../build/gitlite diff-tree -r --name-status $dt_before $dt_after 2>dt_stats)
+if [ "$dt_out" != "$(printf 'M\tdt/changed/f.txt\nA\tdt/new.txt')" ] || \
+   ! grep -q "tree diff: 6 trees read" dt_stats || \
+   [ "$(../build/gitlite diff-tree $dt_before $dt_after | cut -f2)" != "dt" ]; then
+    echo "Error: diff-tree failed: $dt_out"
+    exit 1
+fi
+rm -rf dt dt_stats
+echo "diff-tree: OK"
+
+# Test status, then the same answers through the fsmonitor daemon
+../build/gitlite write-tree > /dev/null
+echo "status change" >> test.txt
+mkdir -p fsm/sub
+echo "fsm" > fsm/sub/new.txt
+status_plain=$(../build/gitlite status)
+../build/gitlite -c core.fsmonitor=true fsmonitor start > /dev/null
+../build/gitlite -c core.fsmonitor=true write-tree > /dev/null  # Full scan, saves the first token
+echo "after token" >> fsm/sub/new.txt
+rm test.txt
+status_fsm=$(GITLITE_STATS=1 ../build/gitlite -c core.fsmonitor=true status 2>.git/fsm_stats)
+../build/gitlite fsmonitor stop > /dev/null
+if [ "$status_plain" != "$(printf 'A\tfsm/sub/new.txt\nM\ttest.txt')" ] || \
+   [ "$status_fsm" != "$(printf 'M\tfsm/sub/new.txt\nD\ttest.txt')" ] || \
+   [ "$status_fsm" != "$(../build/gitlite status)" ] || \
+   ! grep -q "fsmonitor: 2 changed paths, 0 directories and 1 files not visited" .git/fsm_stats; then
+    echo "Error: status failed: $status_plain / $status_fsm"
+    exit 1
+fi
+rm -rf fsm .git/fsm_stats
+echo "status and fsmonitor: OK"
+
+# Test .gitignore: nested files, negation, dir-only and anchored patterns, a
+# line of nothing but spaces; ignored directories are pruned, not read
+ign_before=$(../build/gitlite write-tree)
+mkdir -p ign/out/deep ign/sub/keep ign/logs
+printf '*.tmp\n   \n!keep.tmp\nout/\n/logs/*.log\n' > ign/.gitignore
+echo "*.dat" > ign/sub/.gitignore
+for f in a.tmp keep.tmp out/deep/x out/y sub/z.dat sub/keep/w.dat sub/v.txt logs/today.log logs/notes; do
+    echo "$f" > ign/$f
+done
+ign_tree=$(GITLITE_STATS=1 ../build/gitlite write-tree 2>.git/ign_stats)
+ign_files=$(../build/gitlite diff-tree -r $ign_before $ign_tree | cut -f2 | tr '\n' ' ')
+if [ "$ign_files" != "ign/keep.tmp ign/logs/notes ign/sub/v.txt " ] || \
+   ! grep -q "ignore: 1 directories pruned" .git/ign_stats || \
+   [ -n "$(../build/gitlite status | grep ign/)" ]; then
+    echo "Error: .gitignore rules not applied: $ign_files"
+    exit 1
+fi
+rm -rf ign .git/ign_stats
+echo "gitignore: OK"
+
+# Test fsck: the repository so far is clean; then a blob is cut short and
+# one a tree points to is deleted
+if ! ../build/gitlite fsck --connectivity > /dev/null 2>.git/fsck_stats || \
+   ! grep -q "objects/s" .git/fsck_stats; then
+    echo "Error: fsck failed on a clean repository: $(cat .git/fsck_stats)"
+    exit 1
+fi
+echo "fsck truncated" > fsck1.txt
+echo "fsck missing" > fsck2.txt
+../build/gitlite write-tree > /dev/null
+fsck1=$(../build/gitlite hash-object fsck1.txt)
+fsck2=$(../build/gitlite hash-object fsck2.txt)
+fsck1_path=.git/objects/${fsck1:0:2}/${fsck1:2}
+head -c 12 $fsck1_path > fsck_cut && mv -f fsck_cut $fsck1_path
+rm -f .git/objects/${fsck2:0:2}/${fsck2:2}
+fsck_out=$(../build/gitlite fsck --connectivity -j 2 2>/dev/null)
+if [ $? -eq 0 ] || ! echo "$fsck_out" | grep -q "^error in object $fsck1 (loose): truncated" || \
+   ! echo "$fsck_out" | grep -q "^missing blob $fsck2"; then
+    echo "Error: fsck missed damage: $fsck_out"
+    exit 1
+fi
+rm -f fsck1.txt fsck2.txt $fsck1_path .git/fsck_stats
+../build/gitlite write-tree > /dev/null
+echo "fsck: OK"
+
+# Test bitmaps: rev-list --objects agrees with and without them, and a
+# commit on top of the bitmapped pack is walked while the rest comes from
+# the bitmap
+bm_head=$(../build/gitlite rev-list HEAD | head -1)
+bm_walk=$(../build/gitlite rev-list --objects $bm_head | cut -c1-40 | sort)
+if ! ../build/gitlite repack -a -d -b | grep -q "Wrote bitmaps" || ! ls .git/objects/pack/*.bitmap > /dev/null; then
+    echo "Error: repack -b wrote no bitmap"
+    exit 1
+fi
+bm_fast=$(GITLITE_STATS=1 ../build/gitlite rev-list --objects --use-bitmap-index $bm_head 2>.git/bm_stats | sort)
+if [ "$bm_fast" != "$bm_walk" ] || ! grep -q "bitmap: 1 bitmaps used, 0 commits walked" .git/bm_stats; then
+    echo "Error: bitmap answer differs from the walk: $(cat .git/bm_stats)"
+    exit 1
+fi
+echo "bitmap tail" > bm.txt
+bm_tree=$(../build/gitlite write-tree)
+bm_top=$(../build/gitlite commit-tree $bm_tree -p $bm_head -m "bitmap tail")
+bm_total=$(GITLITE_STATS=1 ../build/gitlite count-objects $bm_top 2>.git/bm_stats | grep "^total:")
+if [ "$bm_total" != "total: $(../build/gitlite rev-list --objects $bm_top | wc -l)" ] || \
+   ! grep -q "bitmaps used, 1 commits walked" .git/bm_stats; then
+    echo "Error: count-objects with an uncovered commit: $bm_total, $(cat .git/bm_stats)"
+    exit 1
+fi
+rm -f bm.txt .git/bm_stats
+echo "bitmap: OK"
+
+# Test fast-import: marks, inline data, deletes and a duplicate blob go
+# into one pack without any loose objects
+fi_loose=$(find .git/objects -type f -path '*/objects/??/*' | wc -l)
+printf 'blob\nmark :1\ndata 9\nfast one\nblob\nmark :2\ndata 9\nfast one\n' > .git/fi_stream
+printf 'commit refs/heads/imported\nmark :3\ncommitter A <a@b> 1000000000 +0000\ndata 4\none\n' >> .git/fi_stream
+printf 'M 100644 :1 a.txt\nM 100644 inline dir/b.txt\ndata 7\ninline\n\n' >> .git/fi_stream
+printf 'commit refs/heads/imported\ncommitter A <a@b> 1000000001 +0000\ndata 4\ntwo\n' >> .git/fi_stream
+printf 'D a.txt\nM 100644 :2 dir/c.txt\n\n' >> .git/fi_stream
+if ! ../build/gitlite fast-import --export-marks=.git/fi_marks < .git/fi_stream 2>&1 | grep -q "1 duplicates skipped"; then
+    echo "Error: fast-import didn't skip the duplicate blob"
+    exit 1
+fi
+fi_blob=$(printf 'blob 9\0fast one\n' | sha1sum | cut -c1-40)
+fi_paths=$(../build/gitlite rev-list --objects $(cat .git/refs/heads/imported) | cut -c42- | grep . | sort -u | tr '\n' ' ')
+if [ "$fi_paths" != "dir dir/b.txt dir/c.txt " ] || ! grep -q "^:1 $fi_blob$" .git/fi_marks || \
+   [ "$(find .git/objects -type f -path '*/objects/??/*' | wc -l)" != "$fi_loose" ]; then
+    echo "Error: fast-import result is wrong: $fi_paths"
+    exit 1
+fi
+rm -f .git/fi_stream .git/fi_marks .git/refs/heads/imported
+echo "fast-import: OK"
+
+# Test fast-import tags record their target's real type
+mkdir fi_tag_repo && cd fi_tag_repo
+../../build/gitlite init > /dev/null
+printf 'blob\nmark :1\ndata 2\nx\n\ntag blob_tag\nfrom :1\ntagger A <a@b> 1000000000 +0000\ndata 4\ntag\n' |
+    ../../build/gitlite fast-import 2> /dev/null
+if ! ../../build/gitlite cat-file tag $(cat .git/refs/tags/blob_tag) | grep -q "^type blob$" || \
+   ! ../../build/gitlite fsck > /dev/null 2>&1; then
+    echo "Error: fast-import wrote a bad tag for a blob"
+    exit 1
+fi
+cd .. && rm -rf fi_tag_repo
+echo "fast-import tag types: OK"
+
+# Test a fast-import copy of a new directory: both paths get the written tree
+mkdir fi_copy_repo && cd fi_copy_repo
+../../build/gitlite init > /dev/null
+printf 'blob\nmark :1\ndata 2\nx\n\ncommit refs/heads/main\ncommitter A <a@b> 1000000000 +0000\ndata 2\nc\n' > .git/fi_stream
+printf 'M 100644 :1 a/x\nC a b\n\n' >> .git/fi_stream
+../../build/gitlite fast-import < .git/fi_stream 2> /dev/null
+fi_root=$(../../build/gitlite cat-file commit $(cat .git/refs/heads/main) | head -1 | cut -c6-)
+fi_copy=$(../../build/gitlite ls-tree $fi_root | tr '\t\n' '  ')
+fi_dir=ab69b4abf3bb84d4e268bd42d84e4a9a5e242bd3  # The tree holding x, as Git writes it
+if [ "$fi_copy" != "40000 a $fi_dir 40000 b $fi_dir " ] || \
+   ! ../../build/gitlite fsck --connectivity > /dev/null 2>&1; then
+    echo "Error: fast-import copy of a directory is wrong: $fi_copy"
+    exit 1
+fi
+cd .. && rm -rf fi_copy_repo
+echo "fast-import directory copy: OK"
+
+# Test sparse checkout: folders the patterns leave out are never read, the
+# patterns stay for the next checkout, and a pathspec only writes its paths
+mkdir sparse_repo && cd sparse_repo
+../../build/gitlite init > /dev/null
+mkdir -p app/lib docs
+echo a > app/a.c && echo b > app/lib/b.c && echo d > docs/d.md
+sp_one=$(../../build/gitlite commit-tree $(../../build/gitlite write-tree) -m "one")
+echo c > app/c.c
+sp_two=$(../../build/gitlite commit-tree $(../../build/gitlite write-tree) -p $sp_one -m "two")
+rm -rf app docs
+printf '/*\n!/*/\n/app/\n' > .git/sp_patterns
+../../build/gitlite checkout --sparse .git/sp_patterns $sp_one 2> .git/sp_log
+if [ -e docs ] || [ ! -f app/lib/b.c ] || ! grep -q "1 folders (never read)" .git/sp_log; then
+    echo "Error: sparse checkout wrote the wrong files: $(cat .git/sp_log)"
+    exit 1
+fi
+../../build/gitlite checkout $sp_two 2> /dev/null
+if [ -e docs ] || [ ! -f app/c.c ]; then
+    echo "Error: the sparse patterns didn't stay in effect"
+    exit 1
+fi
+echo changed > app/lib/b.c
+../../build/gitlite checkout $sp_one -- app/lib docs 2> /dev/null
+if [ "$(cat app/lib/b.c)" != "b" ] || [ -e docs ] || [ ! -f app/c.c ] || [ "$(cat .git/HEAD)" != "$sp_two" ]; then
+    echo "Error: pathspec checkout is wrong"
+    exit 1
+fi
+cd .. && rm -rf sparse_repo
+echo "sparse checkout: OK"
+
+# Test the I/O backends: a checkout through io_uring (when the kernel has it)
+# and one through plain syscalls leave the same files, and a blob too big for
+# one batched read still comes out whole
+mkdir io_repo && cd io_repo
+../../build/gitlite init > /dev/null
+mkdir -p d1 d2
+for i in $(seq 1 200); do echo "io $i" > d1/f$i.txt; echo "other $i" > d2/f$i.txt; done
+head -c 100000 /dev/urandom > big.bin
+io_tree=$(../../build/gitlite write-tree)
+io_commit=$(../../build/gitlite commit-tree $io_tree -m "io")
+for backend in uring sync; do
+    rm -rf d1 d2 big.bin .git/index
+    echo "ref: refs/heads/none" > .git/HEAD
+    GITLITE_IO=$backend ../../build/gitlite checkout $io_commit 2> /dev/null
+    if [ "$(../../build/gitlite write-tree)" != "$io_tree" ] || [ "$(cat d2/f7.txt)" != "other 7" ]; then
+        echo "Error: checkout through the $backend backend is wrong"
+        exit 1
+    fi
+done
+cd .. && rm -rf io_repo
+echo "I/O backends: OK"
+
+# Test archive: the tar holds the commit's files under the prefix with their
+# modes, and tar.gz is the same tar whatever the number of threads
+mkdir archive_repo && cd archive_repo
+../../build/gitlite init > /dev/null
+{
+    printf 'commit refs/heads/main\ncommitter A <a@b> 1700000000 +0000\ndata 2\nm\n'
+    printf 'M 100755 inline bin/run.sh\ndata 10\n#!/bin/sh\n'
+    printf 'M 120000 inline link\ndata 10\nbin/run.sh\n'
+    printf 'M 100644 inline docs/readme.txt\ndata 6\nhello\n\n'
+} | ../../build/gitlite fast-import 2> /dev/null
+ar_commit=$(cat .git/refs/heads/main)
+../../build/gitlite archive --prefix=proj/ $ar_commit > .git/ar.tar 2> /dev/null
+mkdir .git/ar_out && tar xf .git/ar.tar -C .git/ar_out
+if [ "$(cat .git/ar_out/proj/docs/readme.txt)" != "hello" ] || [ ! -x .git/ar_out/proj/bin/run.sh ] || \
+   [ "$(readlink .git/ar_out/proj/link)" != "bin/run.sh" ]; then
+    echo "Error: archive wrote the wrong files: $(tar tvf .git/ar.tar)"
+    exit 1
+fi
+for jobs in 1 4; do
+    ../../build/gitlite archive --format=tar.gz -j$jobs --prefix=proj/ $ar_commit 2> /dev/null > .git/ar.tgz
+    if ! gzip -dc .git/ar.tgz | cmp -s - .git/ar.tar; then
+        echo "Error: archive --format=tar.gz -j$jobs doesn't unpack to the tar"
+        exit 1
+    fi
+done
+# An mtime past the 11 octal digits of a ustar header goes in a pax record
+printf 'commit refs/heads/late\ncommitter A <a@b> 10000000000 +0000\ndata 2\nm\nM 100644 inline f\ndata 2\nx\n\n' | \
+    ../../build/gitlite fast-import 2> /dev/null
+../../build/gitlite archive $(cat .git/refs/heads/late) > .git/late.tar 2> /dev/null
+if ! TZ=UTC tar --full-time -tvf .git/late.tar | grep -q "2286-11-20 17:46:40 f"; then
+    echo "Error: archive lost an mtime past the ustar range: $(tar tvf .git/late.tar)"
+    exit 1
+fi
+cd .. && rm -rf archive_repo
+echo "archive: OK"
+
 # Clean up
 cd ..
 rm -rf temp_test_dir